@@ -970,12 +970,11 @@ static void apm_event_handler(void)
  * Check whether we're the only running process to
  * decide if we should just power down.
  *
- * Do this by checking the runqueue: if we're the
- * only one, then the current process run_list will
- * have both prev and next pointing to the same
- * entry (the true idle process)
+ * Do this by counting the runnable processes: the
+ * idle threads are not on the run-queues, so if we're
+ * the only one the count is one.
  */
-#define system_idle() (current->run_list.next == current->run_list.prev)
+#define system_idle() (nr_running() == 1)
 
 static void apm_mainloop(void)
 {
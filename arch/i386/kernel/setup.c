@@ -522,6 +522,12 @@ static inline void parse_mem_cmdline (char ** cmdline_p)
 				add_memory_region(start_at, mem_size, E820_RAM);
 			}
 		}
+		/*
+		 * "numa=fake=N" splits memory into N nodes, it has
+		 * to be known before paging_init().
+		 */
+		if (c == ' ' && !memcmp(from, "numa=", 5))
+			numa_setup(from+5);
 		c = *(from++);
 		if (!c)
 			break;
@@ -1181,14 +1181,16 @@ static void __init do_boot_cpu(int i)
 	if (!idle)
 		panic("No idle process for CPU %d", i);
 
+	/* it is queued on our run-queue, so dequeue it first */
+	del_from_runqueue(idle);
+	unhash_process(idle);
+
 	idle->processor = i;
 	__cpu_logical_map[cpucount] = i;
 	cpu_number_map[i] = cpucount;
 	idle->has_cpu = 1; /* we schedule the first task manually */
 	idle->thread.eip = (unsigned long) start_secondary;
 
-	del_from_runqueue(idle);
-	unhash_process(idle);
 	init_tasks[cpucount] = idle;
 
 	/* start_eip had better be page-aligned! */
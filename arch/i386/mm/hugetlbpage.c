@@ -0,0 +1,421 @@
+/*
+ *  linux/arch/i386/mm/hugetlbpage.c
+ *
+ *  Huge pages for shared memory segments and anonymous mappings,
+ *  each mapped by a single PSE pmd.
+ *
+ *  The pool is filled from the buddy allocator, at boot ("hugepages=")
+ *  or through /proc/sys/vm/nr_hugepages. Pool pages have all their
+ *  struct pages marked reserved, so that the rest of the VM leaves
+ *  them alone; the count of the first struct page is the reference
+ *  count of the whole huge page, with one reference for every pmd
+ *  mapping it and one for every shm segment holding it.
+ */
+
+#include <linux/config.h>
+#include <linux/sched.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/slab.h>
+#include <linux/highmem.h>
+#include <linux/sysctl.h>
+#include <linux/hugetlb.h>
+#include <linux/init.h>
+
+#include <asm/processor.h>
+#include <asm/pgtable.h>
+#include <asm/pgalloc.h>
+
+#define HPAGE_NR_PAGES	(HPAGE_SIZE >> PAGE_SHIFT)
+
+static LIST_HEAD(htlbpage_freelist);
+static spinlock_t htlbpage_lock = SPIN_LOCK_UNLOCKED;
+
+int htlbpage_max;		/* pool size, as set by sysctl */
+static int htlbpage_total;	/* pool size */
+static int htlbpage_free;	/* pages on the freelist */
+
+/*
+ * Take a page from the pool, with a reference for the caller.
+ */
+struct page * alloc_hugetlb_page(void)
+{
+	struct page * page;
+	int i;
+
+	spin_lock(&htlbpage_lock);
+	if (list_empty(&htlbpage_freelist)) {
+		spin_unlock(&htlbpage_lock);
+		return NULL;
+	}
+	page = list_entry(htlbpage_freelist.next, struct page, list);
+	list_del(&page->list);
+	htlbpage_free--;
+	spin_unlock(&htlbpage_lock);
+
+	set_page_count(page, 1);
+	for (i = 0; i < HPAGE_NR_PAGES; i++)
+		clear_highpage(page + i);
+	return page;
+}
+
+/*
+ * Drop a reference, and put the page back into the pool with the last.
+ */
+void free_hugetlb_page(struct page * page)
+{
+	if (!put_page_testzero(page))
+		return;
+	spin_lock(&htlbpage_lock);
+	list_add(&page->list, &htlbpage_freelist);
+	htlbpage_free++;
+	spin_unlock(&htlbpage_lock);
+}
+
+static pmd_t * huge_pmd_offset(struct mm_struct * mm, unsigned long address)
+{
+	pgd_t * pgd = pgd_offset(mm, address);
+
+	if (pgd_none(*pgd))
+		return NULL;
+	return pmd_offset(pgd, address);
+}
+
+int pmd_huge(pmd_t pmd)
+{
+	return pmd_val(pmd) & _PAGE_PSE;
+}
+
+struct page * follow_huge_pmd(struct mm_struct * mm, unsigned long address,
+	pmd_t * pmd)
+{
+	struct page * page = mem_map + (pmd_val(*pmd) >> PAGE_SHIFT);
+
+	return page + ((address & ~HPAGE_MASK) >> PAGE_SHIFT);
+}
+
+/*
+ * Find the small page at 'address' of a huge page mapping, or NULL
+ * if nothing is mapped there.
+ */
+struct page * follow_huge_addr(struct mm_struct * mm, unsigned long address)
+{
+	pmd_t * pmd = huge_pmd_offset(mm, address);
+
+	if (!pmd || !pmd_huge(*pmd))
+		return NULL;
+	return follow_huge_pmd(mm, address, pmd);
+}
+
+/*
+ * Map 'page' at 'address', taking a reference for the mapping. Any
+ * page table left over from earlier small page mappings is empty by
+ * now, and is freed.
+ */
+static int set_huge_pmd(struct mm_struct * mm, struct vm_area_struct * vma,
+	unsigned long address, struct page * page)
+{
+	pgd_t * pgd;
+	pmd_t * pmd;
+	pte_t entry;
+
+	pgd = pgd_offset(mm, address);
+	pmd = pmd_alloc(pgd, address);
+	if (!pmd)
+		return -ENOMEM;
+
+	entry = pte_mkyoung(pte_mkdirty(mk_pte(page, vma->vm_page_prot)));
+	get_page(page);
+
+	spin_lock(&mm->page_table_lock);
+	if (!pmd_none(*pmd) && !pmd_huge(*pmd)) {
+		pte_free((pte_t *) pmd_page(*pmd));
+		pmd_clear(pmd);
+	}
+	if (!pmd_none(*pmd))
+		BUG();
+	pmd_val(*pmd) = pte_val(entry) | _PAGE_PSE;
+	mm->rss += HPAGE_NR_PAGES;
+	spin_unlock(&mm->page_table_lock);
+	return 0;
+}
+
+/*
+ * Map the whole of a new shm attach: 'pages' is the segment's array
+ * of huge pages.
+ */
+int hugetlb_prefault(struct vm_area_struct * vma, struct page ** pages)
+{
+	struct mm_struct * mm = vma->vm_mm;
+	unsigned long address, idx;
+	int error;
+
+	idx = vma->vm_pgoff >> (HPAGE_SHIFT - PAGE_SHIFT);
+	for (address = vma->vm_start; address < vma->vm_end; address += HPAGE_SIZE) {
+		error = set_huge_pmd(mm, vma, address, pages[idx++]);
+		if (error)
+			return error;
+	}
+	flush_tlb_range(mm, vma->vm_start, vma->vm_end);
+	return 0;
+}
+
+/*
+ * fork(): the child shares the parent's huge pages. Huge vmas are
+ * always VM_SHARED, so this is what the mapping asked for.
+ */
+int copy_hugetlb_page_range(struct mm_struct * dst, struct mm_struct * src,
+	struct vm_area_struct * vma)
+{
+	unsigned long address;
+	pmd_t * src_pmd, * dst_pmd;
+
+	for (address = vma->vm_start; address < vma->vm_end; address += HPAGE_SIZE) {
+		src_pmd = huge_pmd_offset(src, address);
+		if (!src_pmd || pmd_none(*src_pmd))
+			continue;
+		dst_pmd = pmd_alloc(pgd_offset(dst, address), address);
+		if (!dst_pmd)
+			return -ENOMEM;
+		get_page(mem_map + (pmd_val(*src_pmd) >> PAGE_SHIFT));
+		*dst_pmd = *src_pmd;
+		dst->rss += HPAGE_NR_PAGES;
+	}
+	return 0;
+}
+
+/*
+ * The huge page counterpart of zap_page_range(). Callers flush the
+ * caches and TLB, and have checked that the range is huge page aligned.
+ */
+void unmap_hugepage_range(struct vm_area_struct * vma, unsigned long start,
+	unsigned long end)
+{
+	struct mm_struct * mm = vma->vm_mm;
+	unsigned long address;
+	pmd_t * pmd;
+
+	spin_lock(&mm->page_table_lock);
+	for (address = start; address < end; address += HPAGE_SIZE) {
+		pmd = huge_pmd_offset(mm, address);
+		if (!pmd || pmd_none(*pmd))
+			continue;
+		if (!pmd_huge(*pmd))
+			BUG();
+		free_hugetlb_page(mem_map + (pmd_val(*pmd) >> PAGE_SHIFT));
+		pmd_clear(pmd);
+		mm->rss -= HPAGE_NR_PAGES;
+	}
+	spin_unlock(&mm->page_table_lock);
+}
+
+/*
+ * get_unmapped_area(), for huge page aligned areas.
+ */
+unsigned long hugetlb_get_unmapped_area(unsigned long addr, unsigned long len)
+{
+	struct vm_area_struct * vmm;
+
+	if (len > TASK_SIZE)
+		return 0;
+	if (!addr)
+		addr = TASK_UNMAPPED_BASE;
+	addr = (addr + ~HPAGE_MASK) & HPAGE_MASK;
+
+	for (vmm = find_vma(current->mm, addr); ; vmm = vmm->vm_next) {
+		if (TASK_SIZE - len < addr)
+			return 0;
+		if (!vmm || addr + len <= vmm->vm_start)
+			return addr;
+		addr = (vmm->vm_end + ~HPAGE_MASK) & HPAGE_MASK;
+	}
+}
+
+/*
+ * mmap(MAP_SHARED|MAP_ANONYMOUS|MAP_HUGETLB): called by do_mmap() with
+ * the mmap semaphore held. The length is rounded up to whole huge pages,
+ * which are all allocated and mapped here; the area is never merged
+ * with its neighbours. There is no COW for huge pages, so private
+ * mappings are refused: a child would share them after fork().
+ */
+unsigned long hugetlb_mmap(unsigned long addr, unsigned long len,
+	unsigned long prot, unsigned long flags)
+{
+	struct mm_struct * mm = current->mm;
+	struct vm_area_struct * vma;
+	struct page * page;
+	unsigned long address;
+	int error;
+
+	if ((flags & MAP_TYPE) != MAP_SHARED)
+		return -EINVAL;
+
+	len = (len + ~HPAGE_MASK) & HPAGE_MASK;
+	if (!len || len > TASK_SIZE || addr > TASK_SIZE - len)
+		return -EINVAL;
+	if (mm->map_count > MAX_MAP_COUNT)
+		return -ENOMEM;
+	if ((len >> HPAGE_SHIFT) > htlbpage_free)
+		return -ENOMEM;
+
+	if (flags & MAP_FIXED) {
+		if (addr & ~HPAGE_MASK)
+			return -EINVAL;
+	} else {
+		addr = hugetlb_get_unmapped_area(addr, len);
+		if (!addr)
+			return -ENOMEM;
+	}
+
+	vma = kmem_cache_alloc(vm_area_cachep, SLAB_KERNEL);
+	if (!vma)
+		return -ENOMEM;
+
+	vma->vm_mm = mm;
+	vma->vm_start = addr;
+	vma->vm_end = addr + len;
+	vma->vm_flags = VM_HUGETLB | VM_SHARED | VM_MAYSHARE |
+			VM_MAYREAD | VM_MAYWRITE | VM_MAYEXEC;
+	if (prot & PROT_READ)
+		vma->vm_flags |= VM_READ;
+	if (prot & PROT_WRITE)
+		vma->vm_flags |= VM_WRITE;
+	if (prot & PROT_EXEC)
+		vma->vm_flags |= VM_EXEC;
+	vma->vm_page_prot = protection_map[vma->vm_flags & 0x0f];
+	vma->vm_ops = NULL;
+	vma->vm_pgoff = 0;
+	vma->vm_file = NULL;
+	vma->vm_private_data = NULL;
+
+	error = -ENOMEM;
+	if (do_munmap(addr, len))
+		goto free_vma;
+	if ((mm->total_vm << PAGE_SHIFT) + len
+	    > current->rlim[RLIMIT_AS].rlim_cur)
+		goto free_vma;
+
+	vmlist_modify_lock(mm);
+	insert_vm_struct(mm, vma);
+	vmlist_modify_unlock(mm);
+	mm->total_vm += len >> PAGE_SHIFT;
+
+	for (address = addr; address < addr + len; address += HPAGE_SIZE) {
+		page = alloc_hugetlb_page();
+		if (!page)
+			goto unmap;
+		error = set_huge_pmd(mm, vma, address, page);
+		free_hugetlb_page(page);
+		if (error)
+			goto unmap;
+	}
+	flush_tlb_range(mm, addr, addr + len);
+	return addr;
+
+unmap:
+	do_munmap(addr, len);
+	return -ENOMEM;
+
+free_vma:
+	kmem_cache_free(vm_area_cachep, vma);
+	return error;
+}
+
+/*
+ * Grow or shrink the pool towards 'count' pages. Only free pages can
+ * be given back; growing stops when the buddy allocator has no more
+ * blocks of the right order.
+ */
+static int set_hugetlb_mem_size(int count)
+{
+	struct page * page;
+	int i;
+
+	if (!cpu_has_pse)
+		return 0;
+
+	while (htlbpage_total < count) {
+		page = alloc_pages(GFP_HIGHUSER, HUGETLB_PAGE_ORDER);
+		if (!page)
+			break;
+		if ((page - mem_map) & (HPAGE_NR_PAGES - 1)) {
+			/* can't happen with huge page aligned zones */
+			printk(KERN_ERR "hugetlb: misaligned page %08lx\n",
+				(page - mem_map) << PAGE_SHIFT);
+			__free_pages(page, HUGETLB_PAGE_ORDER);
+			break;
+		}
+		for (i = 0; i < HPAGE_NR_PAGES; i++)
+			SetPageReserved(page + i);
+		set_page_count(page, 0);
+		spin_lock(&htlbpage_lock);
+		list_add(&page->list, &htlbpage_freelist);
+		htlbpage_free++;
+		htlbpage_total++;
+		spin_unlock(&htlbpage_lock);
+	}
+
+	for (;;) {
+		spin_lock(&htlbpage_lock);
+		if (htlbpage_total <= count || list_empty(&htlbpage_freelist)) {
+			spin_unlock(&htlbpage_lock);
+			break;
+		}
+		page = list_entry(htlbpage_freelist.next, struct page, list);
+		list_del(&page->list);
+		htlbpage_free--;
+		htlbpage_total--;
+		spin_unlock(&htlbpage_lock);
+
+		for (i = 0; i < HPAGE_NR_PAGES; i++)
+			ClearPageReserved(page + i);
+		set_page_count(page, 1);
+		__free_pages(page, HUGETLB_PAGE_ORDER);
+	}
+	return htlbpage_total;
+}
+
+int hugetlb_sysctl_handler(ctl_table * table, int write, struct file * filp,
+	void * buffer, size_t * lenp)
+{
+	int error;
+
+	error = proc_dointvec(table, write, filp, buffer, lenp);
+	if (!error && write)
+		htlbpage_max = set_hugetlb_mem_size(htlbpage_max);
+	return error;
+}
+
+int hugetlb_report_meminfo(char * buf)
+{
+	return sprintf(buf,
+		"HugePages_Total: %5d\n"
+		"HugePages_Free:  %5d\n"
+		"Hugepagesize:    %5lu kB\n",
+		htlbpage_total, htlbpage_free, HPAGE_SIZE >> 10);
+}
+
+static int __init hugetlb_setup(char * str)
+{
+	htlbpage_max = simple_strtoul(str, NULL, 0);
+	return 1;
+}
+
+__setup("hugepages=", hugetlb_setup);
+
+static int __init hugetlb_init(void)
+{
+	if (!htlbpage_max)
+		return 0;
+	if (!cpu_has_pse) {
+		printk("hugetlb: CPU has no PSE, huge pages disabled.\n");
+		htlbpage_max = 0;
+		return 0;
+	}
+	htlbpage_max = set_hugetlb_mem_size(htlbpage_max);
+	printk("hugetlb: %d huge pages of %luk.\n", htlbpage_max,
+		HPAGE_SIZE >> 10);
+	return 0;
+}
+
+__initcall(hugetlb_init);
@@ -225,12 +225,13 @@ void __init smp_boot_cpus(void)
 			p = init_task.prev_task;
 			init_tasks[cpucount] = p;
 
-			p->processor = i;
-			p->has_cpu = 1; /* we schedule the first task manually */
-
+			/* dequeue it before it changes run-queues */
 			del_from_runqueue(p);
 			unhash_process(p);
 
+			p->processor = i;
+			p->has_cpu = 1; /* we schedule the first task manually */
+
 			callin_flag = 0;
 			for (no = 0; no < linux_num_cpus; no++)
 				if (linux_cpus[no].mid == i)
@@ -672,8 +672,7 @@ int timod_getmsg(unsigned int fd, char *ctl_buf, int ctl_maxlen, s32 *ctl_len,
 		if (!entry)
 			return -ENOMEM;
 		SOLD("got one");
-		wait_table.nr = 0;
-		wait_table.entry = entry;
+		poll_initwait(&wait_table, entry);
 		wait = &wait_table;
 		for(;;) {
 			SOLD("loop");
@@ -1048,6 +1048,10 @@ static boolean DAC960_RegisterBlockDevice(DAC960_Controller_T *Controller)
   */
   blk_dev[MajorNumber].request_fn =
     RequestFunctions[Controller->ControllerNumber];
+  /*
+    The controller sorts its own commands, so queue in arrival order.
+  */
+  blk_dev[MajorNumber].elevator = elevator_noop;
   /*
     Initialize the Disk Partitions array, Partition Sizes array, Block Sizes
     array, Max Sectors per Request array, and Max Segments per Request array.
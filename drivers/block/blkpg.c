@@ -281,6 +281,15 @@ int blk_ioctl(kdev_t dev, unsigned int cmd, unsigned long arg)
 
 		case BLKPG:
 			return blkpg_ioctl(dev, (struct blkpg_ioctl_arg *) arg);
+
+		case BLKELVGET:
+			return blkelvget_ioctl(blk_dev + MAJOR(dev),
+					       (blkelv_ioctl_arg_t *) arg);
+		case BLKELVSET:
+			if (!capable(CAP_SYS_ADMIN))
+				return -EACCES;
+			return blkelvset_ioctl(blk_dev + MAJOR(dev),
+					       (blkelv_ioctl_arg_t *) arg);
 			
 		default:
 			return -EINVAL;
@@ -481,6 +481,8 @@ void __init cpqarray_init(void)
 		/* ida_gendisk[i].nr_real is handled by getgeometry */
 	
 		blk_dev[MAJOR_NR+i].request_fn = request_fns[i];
+		/* the controller does its own sorting */
+		blk_dev[MAJOR_NR+i].elevator = elevator_noop;
 		blksize_size[MAJOR_NR+i] = ida_blocksizes + (i*256);
 		hardsect_size[MAJOR_NR+i] = ida_hardsizes + (i*256);
 		read_ahead[MAJOR_NR+i] = READ_AHEAD;
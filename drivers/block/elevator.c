@@ -0,0 +1,139 @@
+/*
+ *  linux/drivers/block/elevator.c
+ *
+ *  Request queue ordering policies, split out of add_request().
+ *
+ *  The deadline elevator is the old one-way elevator of ll_rw_blk.c
+ *  with two changes: reads are queued ahead of writes, and a request
+ *  that has waited longer than its expiry time is never passed again,
+ *  so a stream of nearby requests can no longer starve it.
+ *
+ *  The noop elevator queues in arrival order, for controllers which
+ *  do their own sorting (DAC960, Compaq Smart Array).
+ */
+
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/init.h>
+#include <linux/blk.h>
+#include <linux/elevator.h>
+
+#include <asm/uaccess.h>
+
+#include <linux/module.h>
+
+static void elevator_noop_add(elevator_t * e, struct request * head,
+			      struct request * req)
+{
+	while (head->next)
+		head = head->next;
+	req->next = NULL;
+	head->next = req;
+}
+
+static void elevator_deadline_add(elevator_t * e, struct request * head,
+				  struct request * req)
+{
+	struct request * tmp, * start;
+	int rw = req->cmd;
+
+	/*
+	 * Find where the sorted part of the queue we may enter begins:
+	 * behind the last request that has expired and, for a write,
+	 * behind the last read.
+	 */
+	start = head;
+	for (tmp = head; tmp->next; tmp = tmp->next) {
+		if (time_after_eq(jiffies, tmp->next->deadline) ||
+		    (rw == WRITE && tmp->next->cmd == READ))
+			start = tmp->next;
+	}
+
+	for (tmp = start; tmp->next; tmp = tmp->next) {
+		const int after_current = IN_ORDER(tmp,req);
+		const int before_next = IN_ORDER(req,tmp->next);
+
+		/* reads stay ahead of the writes */
+		if (rw == READ && tmp->next->cmd != READ)
+			break;
+		if (!IN_ORDER(tmp,tmp->next)) {
+			if (after_current || before_next)
+				break;
+		} else {
+			if (after_current && before_next)
+				break;
+		}
+	}
+	req->next = tmp->next;
+	tmp->next = req;
+}
+
+elevator_t elevator_noop = {
+	ELEVATOR_NOOP, "noop", elevator_noop_add, 0, 0
+};
+
+elevator_t elevator_deadline = {
+	ELEVATOR_DEADLINE, "deadline", elevator_deadline_add, HZ / 2, 5 * HZ
+};
+
+elevator_t * elevator_default = &elevator_deadline;
+
+static int __init elevator_setup(char *str)
+{
+	if (!strcmp(str, "noop"))
+		elevator_default = &elevator_noop;
+	else if (!strcmp(str, "deadline"))
+		elevator_default = &elevator_deadline;
+	return 1;
+}
+
+__setup("elevator=", elevator_setup);
+
+int blkelvget_ioctl(struct blk_dev_struct * q, blkelv_ioctl_arg_t * arg)
+{
+	blkelv_ioctl_arg_t output;
+
+	output.elevator = q->elevator.id;
+	output.read_expire = q->elevator.read_expire * 1000 / HZ;
+	output.write_expire = q->elevator.write_expire * 1000 / HZ;
+	if (copy_to_user(arg, &output, sizeof(output)))
+		return -EFAULT;
+	return 0;
+}
+
+int blkelvset_ioctl(struct blk_dev_struct * q, const blkelv_ioctl_arg_t * arg)
+{
+	blkelv_ioctl_arg_t input;
+	elevator_t e;
+	unsigned long flags;
+
+	if (copy_from_user(&input, arg, sizeof(input)))
+		return -EFAULT;
+	/* at most an hour, which also keeps the conversion in range */
+	if (input.read_expire < 0 || input.read_expire > 3600000 ||
+	    input.write_expire < 0 || input.write_expire > 3600000)
+		return -EINVAL;
+	switch (input.elevator) {
+		case ELEVATOR_NOOP:
+			e = elevator_noop;
+			break;
+		case ELEVATOR_DEADLINE:
+			e = elevator_deadline;
+			break;
+		default:
+			return -EINVAL;
+	}
+	if (input.read_expire)
+		e.read_expire = (input.read_expire * (unsigned long) HZ + 999) / 1000;
+	if (input.write_expire)
+		e.write_expire = (input.write_expire * (unsigned long) HZ + 999) / 1000;
+
+	spin_lock_irqsave(q->queue_lock, flags);
+	q->elevator = e;
+	spin_unlock_irqrestore(q->queue_lock, flags);
+	return 0;
+}
+
+EXPORT_SYMBOL(elevator_noop);
+EXPORT_SYMBOL(elevator_deadline);
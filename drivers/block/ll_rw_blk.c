@@ -18,6 +18,7 @@
 #include <linux/mm.h>
 #include <linux/init.h>
 #include <linux/smp_lock.h>
+#include <linux/malloc.h>
 
 #include <asm/system.h>
 #include <asm/io.h>
@@ -36,9 +37,15 @@ extern int mac_floppy_init(void);
 
 /*
  * The request-struct contains all necessary data
- * to load a nr of sectors into memory
+ * to load a nr of sectors into memory. Each queue
+ * has its own NR_REQUEST of them (see blk_alloc_requests),
+ * so a busy disk can't take the requests of another.
+ *
+ * Queues which couldn't get a pool of their own share
+ * this one, as all of them used to.
  */
-static struct request all_requests[NR_REQUEST];
+static struct request reserve_requests[NR_REQUEST];
+static struct blk_queue_stats reserve_stats;
 
 /*
  * The "disk" task queue is used to start the actual requests
@@ -57,6 +64,9 @@ DECLARE_TASK_QUEUE(tq_disk);
  *
  * there is a fair chance that things will work just OK if these functions
  * are called with no global kernel lock held ...
+ *
+ * The code here only ever takes the queue_lock of a queue, which all
+ * drivers still point at this one.
  */
 spinlock_t io_request_lock = SPIN_LOCK_UNLOCKED;
 
@@ -161,7 +171,7 @@ void unplug_device(void * data)
 	int queue_new_request=0;
 	unsigned long flags;
 
-	spin_lock_irqsave(&io_request_lock,flags);
+	spin_lock_irqsave(dev->queue_lock,flags);
 	if (dev->current_request == &dev->plug) {
 		struct request * next = dev->plug.next;
 		dev->current_request = next;
@@ -173,7 +183,7 @@ void unplug_device(void * data)
 	if (queue_new_request)
 		(dev->request_fn)();
 
-	spin_unlock_irqrestore(&io_request_lock,flags);
+	spin_unlock_irqrestore(dev->queue_lock,flags);
 }
 
 /*
@@ -193,41 +203,94 @@ static inline void plug_device(struct blk_dev_struct * dev)
 }
 
 /*
- * look for a free request in the first N entries.
- * NOTE: interrupts must be disabled on the way in (on SMP the request queue
- * spinlock has to be aquired), and will still be disabled on the way out.
+ * Give a queue its pool of requests, and the stats that go with it.
+ * register_blkdev() does this for the driver's major. Returns 0 if
+ * there is no memory, or blk_dev_init() hasn't run yet.
+ */
+int blk_alloc_requests(int major, int gfp_mask)
+{
+	struct blk_dev_struct * q = blk_dev + major;
+	struct request * req;
+	unsigned long flags;
+
+	if (q->requests)
+		return 1;
+	if (!q->queue_lock)
+		return 0;
+	req = kmalloc(NR_REQUEST * sizeof(struct request) +
+		      sizeof(struct blk_queue_stats), gfp_mask);
+	if (!req)
+		return 0;
+	memset(req, 0, NR_REQUEST * sizeof(struct request) +
+	       sizeof(struct blk_queue_stats));
+	spin_lock_irqsave(q->queue_lock,flags);
+	if (q->requests) {
+		/* we slept, and someone else won */
+		spin_unlock_irqrestore(q->queue_lock,flags);
+		kfree(req);
+		return 1;
+	}
+	q->stats = (struct blk_queue_stats *) (req + NR_REQUEST);
+	q->requests = req;
+	req += NR_REQUEST;
+	while (--req >= q->requests)
+		req->rq_status = RQ_INACTIVE;
+	spin_unlock_irqrestore(q->queue_lock,flags);
+	return 1;
+}
+
+/*
+ * The first request of a queue which has no pool: its major wasn't
+ * registered, or there was no memory then. Try again, but don't wait
+ * for memory on what may well be the writeout path: fall back on the
+ * shared pool instead.
  */
-static inline struct request * get_request(int n, kdev_t dev)
+static void blk_get_requests(int major)
+{
+	struct blk_dev_struct * q = blk_dev + major;
+	unsigned long flags;
+
+	if (blk_alloc_requests(major, GFP_ATOMIC))
+		return;
+	spin_lock_irqsave(q->queue_lock,flags);
+	if (!q->requests) {
+		q->stats = &reserve_stats;
+		q->requests = reserve_requests;
+	}
+	spin_unlock_irqrestore(q->queue_lock,flags);
+}
+
+/*
+ * look for a free request in the first N entries of the queue's pool.
+ * NOTE: interrupts must be disabled on the way in (on SMP the queue
+ * lock has to be aquired), and will still be disabled on the way out.
+ */
+static inline struct request * get_request(struct blk_dev_struct * q,
+					   int n, kdev_t dev)
 {
-	static struct request *prev_found = NULL, *prev_limit = NULL;
 	register struct request *req, *limit;
 
 	if (n <= 0)
 		panic("get_request(%d): impossible!\n", n);
 
-	limit = all_requests + n;
-	if (limit != prev_limit) {
-		prev_limit = limit;
-		prev_found = all_requests;
-	}
-	req = prev_found;
-	for (;;) {
-		req = ((req > all_requests) ? req : limit) - 1;
-		if (req->rq_status == RQ_INACTIVE)
-			break;
-		if (req == prev_found)
-			return NULL;
+	limit = q->requests + n;
+	for (req = q->requests; req < limit; req++) {
+		if (req->rq_status == RQ_INACTIVE) {
+			req->rq_status = RQ_ACTIVE;
+			req->rq_dev = dev;
+			return req;
+		}
 	}
-	prev_found = req;
-	req->rq_status = RQ_ACTIVE;
-	req->rq_dev = dev;
-	return req;
+	return NULL;
 }
 
 /*
  * wait until a free request in the first N entries is available.
+ * Drivers free requests without knowing about the pools, so everybody
+ * waits on wait_for_request and checks its own queue.
  */
-static struct request * __get_request_wait(int n, kdev_t dev)
+static struct request * __get_request_wait(struct blk_dev_struct * q,
+					   int n, kdev_t dev)
 {
 	register struct request *req;
 	DECLARE_WAITQUEUE(wait, current);
@@ -236,9 +299,9 @@ static struct request * __get_request_wait(int n, kdev_t dev)
 	add_wait_queue(&wait_for_request, &wait);
 	for (;;) {
 		current->state = TASK_UNINTERRUPTIBLE;
-		spin_lock_irqsave(&io_request_lock,flags);
-		req = get_request(n, dev);
-		spin_unlock_irqrestore(&io_request_lock,flags);
+		spin_lock_irqsave(q->queue_lock,flags);
+		req = get_request(q, n, dev);
+		spin_unlock_irqrestore(q->queue_lock,flags);
 		if (req)
 			break;
 		run_task_queue(&tq_disk);
@@ -249,17 +312,18 @@ static struct request * __get_request_wait(int n, kdev_t dev)
 	return req;
 }
 
-static inline struct request * get_request_wait(int n, kdev_t dev)
+static inline struct request * get_request_wait(struct blk_dev_struct * q,
+						int n, kdev_t dev)
 {
 	register struct request *req;
 	unsigned long flags;
 
-	spin_lock_irqsave(&io_request_lock,flags);
-	req = get_request(n, dev);
-	spin_unlock_irqrestore(&io_request_lock,flags);
+	spin_lock_irqsave(q->queue_lock,flags);
+	req = get_request(q, n, dev);
+	spin_unlock_irqrestore(q->queue_lock,flags);
 	if (req)
 		return req;
-	return __get_request_wait(n, dev);
+	return __get_request_wait(q, n, dev);
 }
 
 /* RO fail safe mechanism */
@@ -325,9 +389,32 @@ static inline void drive_stat_acct(struct request *req,
 		printk(KERN_ERR "drive_stat_acct: cmd not R/W?\n");
 }
 
+/*
+ * Account a finished request in the latency stats of its queue. Has to
+ * be called with the queue lock held, before the request is freed or,
+ * for drivers which free it when they start on it, with their copy.
+ */
+void req_finished_io(struct request * req)
+{
+	struct blk_queue_stats * stats = blk_dev[MAJOR(req->rq_dev)].stats;
+	unsigned long ms;
+	int rw = req->cmd, i;
+
+	if (!stats || (rw != READ && rw != WRITE) || !req->start_time)
+		return;
+	ms = (jiffies - req->start_time) * 1000 / HZ;
+	stats->completed[rw]++;
+	stats->total_ms[rw] += ms;
+	if (ms > stats->max_ms[rw])
+		stats->max_ms[rw] = ms;
+	for (i = 0; i < BLK_LAT_HIST - 1 && ms >= (1UL << i); i++)
+		;
+	stats->hist[rw][i]++;
+}
+
 /*
  * add-request adds a request to the linked list.
- * It disables interrupts (aquires the request spinlock) so that it can muck
+ * It disables interrupts (aquires the queue lock) so that it can muck
  * with the request-lists in peace. Thus it should be called with no spinlocks
  * held.
  *
@@ -348,7 +435,10 @@ void add_request(struct blk_dev_struct * dev, struct request * req)
 	/*
 	 * We use the goto to reduce locking complexity
 	 */
-	spin_lock_irqsave(&io_request_lock,flags);
+	spin_lock_irqsave(dev->queue_lock,flags);
+	req->start_time = jiffies;
+	req->deadline = jiffies + (req->cmd == READ ?
+		dev->elevator.read_expire : dev->elevator.write_expire);
 	current_request = get_queue(req->rq_dev);
 
 	if (!(tmp = *current_request)) {
@@ -357,20 +447,7 @@ void add_request(struct blk_dev_struct * dev, struct request * req)
 			queue_new_request = 1;
 		goto out;
 	}
-	for ( ; tmp->next ; tmp = tmp->next) {
-		const int after_current = IN_ORDER(tmp,req);
-		const int before_next = IN_ORDER(req,tmp->next);
-
-		if (!IN_ORDER(tmp,tmp->next)) {
-			if (after_current || before_next)
-				break;
-		} else {
-			if (after_current && before_next)
-				break;
-		}
-	}
-	req->next = tmp->next;
-	tmp->next = req;
+	dev->elevator.add_request(&dev->elevator, tmp, req);
 
 /* for SCSI devices, call request_fn unconditionally */
 	if (scsi_blk_major(major))
@@ -383,11 +460,11 @@ void add_request(struct blk_dev_struct * dev, struct request * req)
 out:
 	if (queue_new_request)
 		(dev->request_fn)();
-	spin_unlock_irqrestore(&io_request_lock,flags);
+	spin_unlock_irqrestore(dev->queue_lock,flags);
 }
 
 /*
- * Has to be called with the request spinlock aquired
+ * Has to be called with the queue lock aquired
  */
 static inline void attempt_merge (struct request *req,
 				int max_sectors,
@@ -411,17 +488,42 @@ static inline void attempt_merge (struct request *req,
 	req->bhtail = next->bhtail;
 	req->nr_sectors += next->nr_sectors;
 	req->nr_segments = total_segments;
+	/* the merged request is as old as the older half */
+	if (time_before(next->start_time, req->start_time))
+		req->start_time = next->start_time;
+	if (time_before(next->deadline, req->deadline))
+		req->deadline = next->deadline;
 	next->rq_status = RQ_INACTIVE;
 	req->next = next->next;
 	wake_up (&wait_for_request);
 }
 
-void make_request(int major,int rw, struct buffer_head * bh)
+/*
+ * Complete every buffer of a chain that could not be queued.
+ */
+static void end_io_chain(struct buffer_head * bh)
 {
+	struct buffer_head * next;
+
+	while (bh) {
+		next = bh->b_reqnext;
+		bh->b_reqnext = NULL;
+		bh->b_end_io(bh, test_bit(BH_Uptodate, &bh->b_state));
+		bh = next;
+	}
+}
+
+/*
+ * First half of make_request: lock the buffer and work out what to do
+ * with it. Returns READ or WRITE, or -1 if the buffer has been dealt
+ * with already. The buffer may be replaced by a bounce buffer, so use
+ * *bhp afterwards, and the sector it was mapped to before.
+ */
+static int check_request_bh(int major, int rw, struct buffer_head ** bhp,
+			    int * rw_ahead)
+{
+	struct buffer_head * bh = *bhp;
 	unsigned int sector, count;
-	struct request * req;
-	int rw_ahead, max_req, max_sectors, max_segments;
-	unsigned long flags;
 
 	count = bh->b_size >> 9;
 	sector = bh->b_rsector;
@@ -432,7 +534,7 @@ void make_request(int major,int rw, struct buffer_head * bh)
 
 	/* Only one thread can actually submit the I/O. */
 	if (test_and_set_bit(BH_Lock, &bh->b_state))
-		return;
+		return -1;
 
 	if (blk_size[major]) {
 		unsigned long maxsector = (blk_size[major][MINOR(bh->b_rdev)] << 1) + 1;
@@ -452,16 +554,15 @@ void make_request(int major,int rw, struct buffer_head * bh)
 		}
 	}
 
-	rw_ahead = 0;	/* normal case; gets changed below for READA */
+	*rw_ahead = 0;	/* normal case; gets changed below for READA */
 	switch (rw) {
 		case READA:
-			rw_ahead = 1;
+			*rw_ahead = 1;
 			rw = READ;	/* drop into READ */
 		case READ:
 			if (buffer_uptodate(bh)) /* Hmmph! Already have it */
 				goto end_io;
 			kstat.pgpgin++;
-			max_req = NR_REQUEST;	/* reads take precedence */
 			break;
 		case WRITERAW:
 			rw = WRITE;
@@ -471,14 +572,7 @@ void make_request(int major,int rw, struct buffer_head * bh)
 				goto end_io;	/* Hmmph! Nothing to write */
 			refile_buffer(bh);
 		do_write:
-			/*
-			 * We don't allow the write-requests to fill up the
-			 * queue completely:  we want some room for reads,
-			 * as they take precedence. The last third of the
-			 * requests are only for reads.
-			 */
 			kstat.pgpgout++;
-			max_req = (NR_REQUEST * 2) / 3;
 			break;
 		default:
 			printk(KERN_ERR "make_request: bad block dev cmd,"
@@ -499,14 +593,48 @@ void make_request(int major,int rw, struct buffer_head * bh)
 	 * high memory - keep the original buffer otherwise.
 	 */
 #if CONFIG_HIGHMEM
-	bh = create_bounce(rw, bh);
+	*bhp = create_bounce(rw, bh);
 #endif
+	return rw;
+
+end_io:
+	bh->b_end_io(bh, test_bit(BH_Uptodate, &bh->b_state));
+	return -1;
+}
+
+/*
+ * Second half of make_request: queue a chain of locked buffers, linked
+ * through b_reqnext, which lie back to back on the disk from "sector"
+ * on. The chain is merged into, or becomes, a single request, so the
+ * caller must keep it within max_sectors and max_segments.
+ */
+static void __make_request(int major, int rw, int rw_ahead,
+			   struct buffer_head * bh, struct buffer_head * bhtail,
+			   unsigned int sector, unsigned int count,
+			   int nr_segments)
+{
+	struct request * req;
+	struct blk_dev_struct * q = blk_dev + major;
+	int max_req, max_sectors, max_segments, total_segments;
+	unsigned long flags;
 
-/* look for a free request. */
-       /* Loop uses two requests, 1 for loop and 1 for the real device.
-        * Cut max_req in half to avoid running out and deadlocking. */
-	 if ((major == LOOP_MAJOR) || (major == NBD_MAJOR))
-	     max_req >>= 1;
+	/*
+	 * We don't allow the write-requests to fill up the
+	 * queue completely:  we want some room for reads,
+	 * as they take precedence. The last third of the
+	 * requests are only for reads.
+	 */
+	max_req = NR_REQUEST;
+	if (rw == WRITE)
+		max_req = (NR_REQUEST * 2) / 3;
+
+	/*
+	 * Loop uses two requests, 1 for loop and 1 for the real device,
+	 * which come from different pools unless both are on the shared
+	 * one.
+	 */
+	if (!q->requests)
+		blk_get_requests(major);
 
 	/*
 	 * Try to coalesce the new request with old requests
@@ -518,13 +646,13 @@ void make_request(int major,int rw, struct buffer_head * bh)
 	 * Now we acquire the request spinlock, we have to be mega careful
 	 * not to schedule or do something nonatomic
 	 */
-	spin_lock_irqsave(&io_request_lock,flags);
+	spin_lock_irqsave(q->queue_lock,flags);
 	req = *get_queue(bh->b_rdev);
 	if (!req) {
 		/* MD and loop can't handle plugging without deadlocking */
 		if (major != MD_MAJOR && major != LOOP_MAJOR && 
 		    major != DDV_MAJOR && major != NBD_MAJOR)
-			plug_device(blk_dev + major); /* is atomic */
+			plug_device(q); /* is atomic */
 	} else switch (major) {
 	     case IDE0_MAJOR:	/* same as HD_MAJOR */
 	     case IDE1_MAJOR:
@@ -548,7 +676,7 @@ void make_request(int major,int rw, struct buffer_head * bh)
 		 * All other drivers need to jump over the first entry, as that
 		 * entry may be busy being processed and we thus can't change it.
 		 */
-		if (req == blk_dev[major].current_request)
+		if (req == q->current_request)
 	        	req = req->next;
 		if (!req)
 			break;
@@ -590,54 +718,55 @@ void make_request(int major,int rw, struct buffer_head * bh)
 				continue;
 			if (req->rq_dev != bh->b_rdev)
 				continue;
+			total_segments = req->nr_segments + nr_segments;
 			/* Can we add it to the end of this request? */
 			if (req->sector + req->nr_sectors == sector) {
 				if (req->bhtail->b_data + req->bhtail->b_size
-				    != bh->b_data) {
-					if (req->nr_segments < max_segments)
-						req->nr_segments++;
-					else continue;
-				}
+				    == bh->b_data)
+					total_segments--;
+				if (total_segments > max_segments)
+					continue;
 				req->bhtail->b_reqnext = bh;
-				req->bhtail = bh;
+				req->bhtail = bhtail;
 			    	req->nr_sectors += count;
+				req->nr_segments = total_segments;
 				drive_stat_acct(req, count, 0);
 				/* Can we now merge this req with the next? */
 				attempt_merge(req, max_sectors, max_segments);
 			/* or to the beginning? */
 			} else if (req->sector - count == sector) {
-				if (bh->b_data + bh->b_size
-				    != req->bh->b_data) {
-					if (req->nr_segments < max_segments)
-						req->nr_segments++;
-					else continue;
-				}
-			    	bh->b_reqnext = req->bh;
+				if (bhtail->b_data + bhtail->b_size
+				    == req->bh->b_data)
+					total_segments--;
+				if (total_segments > max_segments)
+					continue;
+			    	bhtail->b_reqnext = req->bh;
 			    	req->bh = bh;
 			    	req->buffer = bh->b_data;
-			    	req->current_nr_sectors = count;
+			    	req->current_nr_sectors = bh->b_size >> 9;
 			    	req->sector = sector;
 			    	req->nr_sectors += count;
+				req->nr_segments = total_segments;
 				drive_stat_acct(req, count, 0);
 			} else
 				continue;
 
-			spin_unlock_irqrestore(&io_request_lock,flags);
+			spin_unlock_irqrestore(q->queue_lock,flags);
 		    	return;
 
 		} while ((req = req->next) != NULL);
 	}
 
 /* find an unused request. */
-	req = get_request(max_req, bh->b_rdev);
+	req = get_request(q, max_req, bh->b_rdev);
 
-	spin_unlock_irqrestore(&io_request_lock,flags);
+	spin_unlock_irqrestore(q->queue_lock,flags);
 
 /* if no request available: if rw_ahead, forget it; otherwise try again blocking.. */
 	if (!req) {
 		if (rw_ahead)
 			goto end_io;
-		req = __get_request_wait(max_req, bh->b_rdev);
+		req = __get_request_wait(q, max_req, bh->b_rdev);
 	}
 
 /* fill up the request-info, and add it to the queue */
@@ -645,30 +774,50 @@ void make_request(int major,int rw, struct buffer_head * bh)
 	req->errors = 0;
 	req->sector = sector;
 	req->nr_sectors = count;
-	req->nr_segments = 1;
-	req->current_nr_sectors = count;
+	req->nr_segments = nr_segments;
+	req->current_nr_sectors = bh->b_size >> 9;
 	req->buffer = bh->b_data;
 	req->sem = NULL;
 	req->bh = bh;
-	req->bhtail = bh;
+	req->bhtail = bhtail;
 	req->next = NULL;
-	add_request(major+blk_dev,req);
+	add_request(q,req);
 	return;
 
 end_io:
-	bh->b_end_io(bh, test_bit(BH_Uptodate, &bh->b_state));
+	end_io_chain(bh);
+}
+
+void make_request(int major,int rw, struct buffer_head * bh)
+{
+	unsigned int sector = bh->b_rsector;
+	int rw_ahead;
+
+	rw = check_request_bh(major, rw, &bh, &rw_ahead);
+	if (rw < 0)
+		return;
+	__make_request(major, rw, rw_ahead, bh, bh, sector,
+		       bh->b_size >> 9, 1);
 }
 
 /* This function can be used to request a number of buffers from a block
    device. Currently the only restriction is that all buffers must belong to
-   the same device */
+   the same device.
+
+   Buffers that follow each other on the disk are chained up here and
+   queued as one unit, which takes the queue lock and looks for a merge
+   once per run instead of once per buffer. This is what makes large
+   raw (kiobuf), swap and readahead I/O cheap. */
 
 void ll_rw_block(int rw, int nr, struct buffer_head * bh[])
 {
 	unsigned int major;
 	int correct_size;
 	struct blk_dev_struct * dev;
-	int i;
+	struct buffer_head * head, * tail, * tmp;
+	unsigned int sector, head_sector, count;
+	int i, this_rw, head_rw, rw_ahead;
+	int segments, max_sectors, max_segments;
 
 	dev = NULL;
 	if ((major = MAJOR(bh[0]->b_dev)) < MAX_BLKDEV)
@@ -718,16 +867,64 @@ void ll_rw_block(int rw, int nr, struct buffer_head * bh[])
 		goto sorry;
 	}
 
+	head = tail = NULL;
+	head_sector = count = 0;
+	head_rw = segments = max_sectors = max_segments = rw_ahead = 0;
 	for (i = 0; i < nr; i++) {
 		set_bit(BH_Req, &bh[i]->b_state);
+		if (rw == WRITE && buffer_dirty(bh[i]))
+			mark_buffer_writeback(bh[i]);
 #ifdef CONFIG_BLK_DEV_MD
 		if (MAJOR(bh[i]->b_dev) == MD_MAJOR) {
 			md_make_request(MINOR (bh[i]->b_dev), rw, bh[i]);
 			continue;
 		}
 #endif
-		make_request(MAJOR(bh[i]->b_rdev), rw, bh[i]);
+		/*
+		 * Don't hold on to locked buffers while a bounce
+		 * buffer is allocated: queue what we have first.
+		 */
+		if (head && PageHighMem(bh[i]->b_page)) {
+			__make_request(MAJOR(head->b_rdev), head_rw, rw_ahead,
+				       head, tail, head_sector, count,
+				       segments);
+			head = NULL;
+		}
+		tmp = bh[i];
+		sector = tmp->b_rsector;
+		this_rw = check_request_bh(MAJOR(tmp->b_rdev), rw, &tmp,
+					   &rw_ahead);
+		if (this_rw < 0)
+			continue;
+		if (head) {
+			int seg = tail->b_data + tail->b_size != tmp->b_data;
+
+			if (tmp->b_rdev == head->b_rdev &&
+			    head_sector + count == sector &&
+			    count + (tmp->b_size >> 9) <= max_sectors &&
+			    segments + seg <= max_segments) {
+				tail->b_reqnext = tmp;
+				tail = tmp;
+				count += tmp->b_size >> 9;
+				segments += seg;
+				continue;
+			}
+			__make_request(MAJOR(head->b_rdev), head_rw, rw_ahead,
+				       head, tail, head_sector, count,
+				       segments);
+		}
+		head = tail = tmp;
+		tmp->b_reqnext = NULL;
+		head_rw = this_rw;
+		head_sector = sector;
+		count = tmp->b_size >> 9;
+		segments = 1;
+		max_sectors = get_max_sectors(tmp->b_rdev);
+		max_segments = get_max_segments(tmp->b_rdev);
 	}
+	if (head)
+		__make_request(MAJOR(head->b_rdev), head_rw, rw_ahead,
+			       head, tail, head_sector, count, segments);
 	return;
 
       sorry:
@@ -789,16 +986,64 @@ end_that_request_first( struct request *req, int uptodate, char *name )
 void
 end_that_request_last( struct request *req ) 
 {
+	req_finished_io(req);
 	if (req->sem != NULL)
 		up(req->sem);
 	req->rq_status = RQ_INACTIVE;
 	wake_up(&wait_for_request);
 }
 
-int __init blk_dev_init(void)
+/*
+ * /proc/blkqueues: elevator, pool usage and completion latencies of
+ * every queue which has issued a request.
+ */
+int get_blkqueue_list(char * page)
 {
+	struct blk_dev_struct * q;
 	struct request * req;
+	int len = 0, busy, rw, i;
+	unsigned long flags;
+
+	for (q = blk_dev; q < blk_dev + MAX_BLKDEV; q++) {
+		if (!q->requests)
+			continue;
+		if (len > PAGE_SIZE - 512)
+			break;
+		busy = 0;
+		spin_lock_irqsave(q->queue_lock, flags);
+		for (req = q->requests; req < q->requests + NR_REQUEST; req++)
+			if (req->rq_status != RQ_INACTIVE &&
+			    MAJOR(req->rq_dev) == q - blk_dev)
+				busy++;
+		spin_unlock_irqrestore(q->queue_lock, flags);
+		len += sprintf(page + len,
+			       "%-20s elevator %s requests %d/%d%s expire %lu/%lu ms\n",
+			       bdevname(MKDEV(q - blk_dev, 0)), q->elevator.name,
+			       busy, NR_REQUEST,
+			       q->requests == reserve_requests ? " shared" : "",
+			       q->elevator.read_expire * 1000 / HZ,
+			       q->elevator.write_expire * 1000 / HZ);
+		for (rw = READ; rw <= WRITE; rw++) {
+			unsigned long done = q->stats->completed[rw];
+
+			len += sprintf(page + len,
+				       "  %s %lu avg %lu max %lu ms, <2^i ms:",
+				       rw == READ ? "read " : "write", done,
+				       done ? q->stats->total_ms[rw] / done : 0,
+				       q->stats->max_ms[rw]);
+			for (i = 0; i < BLK_LAT_HIST; i++)
+				len += sprintf(page + len, " %lu",
+					       q->stats->hist[rw][i]);
+			page[len++] = '\n';
+		}
+	}
+	return len;
+}
+
+int __init blk_dev_init(void)
+{
 	struct blk_dev_struct *dev;
+	struct request *req;
 
 	for (dev = blk_dev + MAX_BLKDEV; dev-- != blk_dev;) {
 		dev->request_fn      = NULL;
@@ -810,13 +1055,16 @@ int __init blk_dev_init(void)
 		dev->plug_tq.sync    = 0;
 		dev->plug_tq.routine = &unplug_device;
 		dev->plug_tq.data    = dev;
+		dev->queue_lock      = &io_request_lock;
+		dev->requests        = NULL;
+		dev->stats           = NULL;
+		dev->elevator        = *elevator_default;
 	}
 
-	req = all_requests + NR_REQUEST;
-	while (--req >= all_requests) {
+	req = reserve_requests + NR_REQUEST;
+	while (--req >= reserve_requests)
 		req->rq_status = RQ_INACTIVE;
-		req->next = NULL;
-	}
+
 	memset(ro_bits,0,sizeof(ro_bits));
 	memset(max_readahead, 0, sizeof(max_readahead));
 	memset(max_sectors, 0, sizeof(max_sectors));
@@ -924,3 +1172,4 @@ int __init blk_dev_init(void)
 EXPORT_SYMBOL(io_request_lock);
 EXPORT_SYMBOL(end_that_request_first);
 EXPORT_SYMBOL(end_that_request_last);
+EXPORT_SYMBOL(req_finished_io);
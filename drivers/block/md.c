@@ -60,6 +60,7 @@
 
 #include <linux/blk.h>
 #include <linux/blkpg.h>
+#include <linux/xor.h>
 #include <asm/uaccess.h>
 #include <asm/bitops.h>
 #include <asm/atomic.h>
@@ -657,6 +658,9 @@ static int md_ioctl (struct inode *inode, struct file *file,
 	  return blk_ioctl(inode->i_rdev, cmd, arg);
     
     default:
+    /* anything else is for the personality running this array */
+    if (md_dev[minor].pers && md_dev[minor].pers->ioctl)
+      return md_dev[minor].pers->ioctl (inode, file, cmd, arg);
     return -EINVAL;
   }
 
@@ -890,6 +894,12 @@ static int md_status_read_proc(char *page, char **start, off_t off,
 	else
 		sz+=sprintf (page+sz, "%d sectors\n", read_ahead[MD_MAJOR]);
 
+	sz+=sprintf (page+sz, "xor : %s", xor_active_template->name);
+	if (xor_active_template->speed)
+		sz+=sprintf (page+sz, " %d KB/sec",
+				xor_active_template->speed);
+	sz+=sprintf (page+sz, "\n");
+
 	for (i=0; i<MAX_MD_DEV; i++) {
 		if (sz < off) {
 			begin += sz;
@@ -1300,6 +1310,8 @@ int __init md_init (void)
     printk("md: bug: md_sync_thread == NULL\n");
 #endif /* SUPPORT_RECONSTRUCTION */
 
+  calibrate_xor_block ();
+
 #ifdef CONFIG_MD_LINEAR
   linear_init ();
 #endif
@@ -50,8 +50,9 @@ static int __raid1_map (struct md_dev *mddev, kdev_t *rdev,
 	int i, n = raid_conf->raid_disks;
 
 	/*
-	 * Later we do read balancing on the read side 
-	 * now we use the first available disk.
+	 * Only used to redirect failed reads, so any disk other than
+	 * the one that failed will do: raid1_read_balance() spreads
+	 * the normal reads.
 	 */
 
 	PRINTK(("raid1_map().\n"));
@@ -73,6 +74,70 @@ static int raid1_map (struct md_dev *mddev, kdev_t *rdev,
 	return 0;
 }
 
+static inline int raid1_read_usable (struct mirror_info *mirror)
+{
+	return mirror->operational && !mirror->write_only;
+}
+
+/*
+ * Pick the mirror a read goes to. A sequential stream stays on one
+ * mirror for sect_limit sectors, so the disk's own read-ahead works
+ * for it, and then moves on round the ring to spread the bandwidth.
+ * Any other read goes to the mirror whose head was left nearest.
+ */
+static int raid1_read_balance (struct raid1_data *raid_conf,
+			       unsigned long sector, int sectors)
+{
+	int disk = raid_conf->last_used, i, best = -1;
+	unsigned long dist, best_dist = ~0UL;
+	struct mirror_info *mirror;
+
+	if (sector == raid_conf->next_sect &&
+	    raid1_read_usable(raid_conf->mirrors + disk)) {
+		raid_conf->sect_count += sectors;
+		if (raid_conf->sect_count < raid_conf->mirrors[disk].sect_limit)
+			goto out;
+		/*
+		 * Do not switch to write-only disks ... resyncing
+		 * is in progress
+		 */
+		for (i = 0; i < raid_conf->raid_disks; i++) {
+			disk = raid_conf->mirrors[disk].next;
+			if (raid1_read_usable(raid_conf->mirrors + disk))
+				break;
+		}
+		if (i == raid_conf->raid_disks)
+			disk = raid_conf->last_used;
+		PRINTK(("read-balancing: switching %d -> %d (%d sectors)\n", raid_conf->last_used, disk, raid_conf->sect_count));
+		raid_conf->sect_count = 0;
+		goto out;
+	}
+
+	for (i = 0, mirror = raid_conf->mirrors; i < raid_conf->raid_disks;
+	     i++, mirror++) {
+		if (!raid1_read_usable(mirror))
+			continue;
+		if (sector > mirror->head_position)
+			dist = sector - mirror->head_position;
+		else
+			dist = mirror->head_position - sector;
+		if (dist < best_dist) {
+			best = i;
+			best_dist = dist;
+		}
+	}
+	if (best >= 0)
+		disk = best;
+	raid_conf->sect_count = 0;
+out:
+	raid_conf->last_used = disk;
+	raid_conf->next_sect = sector + sectors;
+	mirror = raid_conf->mirrors + disk;
+	mirror->head_position = sector + sectors;
+	mirror->reads++;
+	return disk;
+}
+
 void raid1_reschedule_retry (struct buffer_head *bh)
 {
 	struct raid1_bh * r1_bh = (struct raid1_bh *)(bh->b_dev_id);
@@ -203,7 +268,7 @@ raid1_make_request (struct md_dev *mddev, int rw, struct buffer_head * bh)
 	struct raid1_data *raid_conf = (struct raid1_data *) mddev->private;
 	struct buffer_head *mirror_bh[MD_SB_DISKS], *bh_req;
 	struct raid1_bh * r1_bh;
-	int n = raid_conf->raid_disks, i, sum_bhs = 0, switch_disks = 0, sectors;
+	int n = raid_conf->raid_disks, i, sum_bhs = 0;
 	struct mirror_info *mirror;
 
 	PRINTK(("raid1_make_request().\n"));
@@ -235,29 +300,11 @@ raid1_make_request (struct md_dev *mddev, int rw, struct buffer_head * bh)
 	r1_bh->cmd = rw;
 
 	if (rw==READ || rw==READA) {
-		int last_used = raid_conf->last_used;
 		PRINTK(("raid1_make_request(), read branch.\n"));
-		mirror = raid_conf->mirrors + last_used;
+		mirror = raid_conf->mirrors +
+			raid1_read_balance(raid_conf, bh->b_rsector,
+					   bh->b_size >> 9);
 		bh->b_rdev = mirror->dev;
-		sectors = bh->b_size >> 9;
-		if (bh->b_blocknr * sectors == raid_conf->next_sect) {
-			raid_conf->sect_count += sectors;
-			if (raid_conf->sect_count >= mirror->sect_limit)
-				switch_disks = 1;
-		} else
-			switch_disks = 1;
-		raid_conf->next_sect = (bh->b_blocknr + 1) * sectors;
-		if (switch_disks) {
-			PRINTK(("read-balancing: switching %d -> %d (%d sectors)\n", last_used, mirror->next, raid_conf->sect_count));
-			raid_conf->sect_count = 0;
-			last_used = raid_conf->last_used = mirror->next;
-			/*
-			 * Do not switch to write-only disks ... resyncing
-			 * is in progress
-			 */
-			while (raid_conf->mirrors[last_used].write_only)
-				raid_conf->last_used = raid_conf->mirrors[last_used].next;
-		}
 		PRINTK (("raid1 read queue: %d %d\n", MAJOR (bh->b_rdev), MINOR (bh->b_rdev)));
 		bh_req = &r1_bh->bh_req;
 		memcpy(bh_req, bh, sizeof(*bh));
@@ -316,6 +363,9 @@ raid1_make_request (struct md_dev *mddev, int rw, struct buffer_head * bh)
 		mirror_bh [i]->b_end_io     = raid1_end_request;
 		mirror_bh [i]->b_dev_id     = r1_bh;
 
+		/* every mirror's head ends up behind the write */
+		raid_conf->mirrors [i].head_position =
+			bh->b_rsector + (bh->b_size >> 9);
 		r1_bh->mirror_bh[i] = mirror_bh[i];
 		sum_bhs++;
 	}
@@ -349,6 +399,9 @@ static int raid1_status (char *page, int minor, struct md_dev *mddev)
 	sz += sprintf (page+sz, " [%d/%d] [", raid_conf->raid_disks, raid_conf->working_disks);
 	for (i = 0; i < raid_conf->raid_disks; i++)
 		sz += sprintf (page+sz, "%s", raid_conf->mirrors [i].operational ? "U" : "_");
+	sz += sprintf (page+sz, "] reads [");
+	for (i = 0; i < raid_conf->raid_disks; i++)
+		sz += sprintf (page+sz, "%s%lu", i ? " " : "", raid_conf->mirrors [i].reads);
 	sz += sprintf (page+sz, "]");
 	return sz;
 }
@@ -17,11 +17,13 @@
 #include <linux/module.h>
 #include <linux/locks.h>
 #include <linux/malloc.h>
+#include <linux/interrupt.h>
 #include <linux/md.h>
 #include <linux/raid5.h>
+#include <linux/xor.h>
 #include <asm/bitops.h>
 #include <asm/atomic.h>
-#include <asm/md.h>
+#include <asm/uaccess.h>
 
 static struct md_personality raid5_personality;
 
@@ -29,6 +31,9 @@ static struct md_personality raid5_personality;
  * Stripe cache
  */
 #define NR_STRIPES		128
+#define MIN_NR_STRIPES		16
+#define MAX_NR_STRIPES		1024
+#define WRITE_DELAY		(HZ / 50)	/* wait for the rest of a partial write stripe */
 #define HASH_PAGES		1
 #define HASH_PAGES_ORDER	0
 #define NR_HASH			(HASH_PAGES * PAGE_SIZE / sizeof(struct stripe_head *))
@@ -397,25 +402,34 @@ static struct stripe_head *find_stripe(struct raid5_data *raid_conf, unsigned lo
 	return NULL;
 }
 
+static struct stripe_head *alloc_stripe(struct raid5_data *raid_conf, int priority)
+{
+	struct stripe_head *sh;
+
+	if ((sh = kmalloc(sizeof(struct stripe_head), priority)) == NULL)
+		return NULL;
+	memset(sh, 0, sizeof(*sh));
+	if (grow_buffers(sh, 2 * raid_conf->raid_disks, PAGE_SIZE, priority)) {
+		shrink_buffers(sh, 2 * raid_conf->raid_disks);
+		kfree(sh);
+		return NULL;
+	}
+	if (grow_bh(sh, raid_conf->raid_disks, priority)) {
+		shrink_buffers(sh, 2 * raid_conf->raid_disks);
+		shrink_bh(sh, raid_conf->raid_disks);
+		kfree(sh);
+		return NULL;
+	}
+	return sh;
+}
+
 static int grow_stripes(struct raid5_data *raid_conf, int num, int priority)
 {
 	struct stripe_head *sh;
 
 	while (num--) {
-		if ((sh = kmalloc(sizeof(struct stripe_head), priority)) == NULL)
-			return 1;
-		memset(sh, 0, sizeof(*sh));
-		if (grow_buffers(sh, 2 * raid_conf->raid_disks, PAGE_SIZE, priority)) {
-			shrink_buffers(sh, 2 * raid_conf->raid_disks);
-			kfree(sh);
-			return 1;
-		}
-		if (grow_bh(sh, raid_conf->raid_disks, priority)) {
-			shrink_buffers(sh, 2 * raid_conf->raid_disks);
-			shrink_bh(sh, raid_conf->raid_disks);
-			kfree(sh);
+		if ((sh = alloc_stripe(raid_conf, priority)) == NULL)
 			return 1;
-		}
 		put_free_stripe(raid_conf, sh);
 		raid_conf->nr_stripes++;
 	}
@@ -744,36 +758,11 @@ static unsigned long compute_blocknr(struct stripe_head *sh, int i)
 	return blocknr;
 }
 
-#ifdef HAVE_ARCH_XORBLOCK
-static void xor_block(struct buffer_head *dest, struct buffer_head *source)
-{
-	__xor_block((char *) dest->b_data, (char *) source->b_data, dest->b_size);
-}
-#else
-static void xor_block(struct buffer_head *dest, struct buffer_head *source)
-{
-	long lines = dest->b_size / (sizeof (long)) / 8, i;
-	long *destp = (long *) dest->b_data, *sourcep = (long *) source->b_data;
-
-	for (i = lines; i > 0; i--) {
-		*(destp + 0) ^= *(sourcep + 0);
-		*(destp + 1) ^= *(sourcep + 1);
-		*(destp + 2) ^= *(sourcep + 2);
-		*(destp + 3) ^= *(sourcep + 3);
-		*(destp + 4) ^= *(sourcep + 4);
-		*(destp + 5) ^= *(sourcep + 5);
-		*(destp + 6) ^= *(sourcep + 6);
-		*(destp + 7) ^= *(sourcep + 7);
-		destp += 8;
-		sourcep += 8;
-	}
-}
-#endif
-
 static void compute_block(struct stripe_head *sh, int dd_idx)
 {
 	struct raid5_data *raid_conf = sh->raid_conf;
-	int i, disks = raid_conf->raid_disks;
+	int i, count, disks = raid_conf->raid_disks;
+	struct buffer_head *bh_ptr[MAX_XOR_BLOCKS];
 
 	PRINTK(("compute_block, stripe %lu, idx %d\n", sh->sector, dd_idx));
 
@@ -782,22 +771,31 @@ static void compute_block(struct stripe_head *sh, int dd_idx)
 	raid5_build_block(sh, sh->bh_old[dd_idx], dd_idx);
 
 	memset(sh->bh_old[dd_idx]->b_data, 0, sh->size);
+	bh_ptr[0] = sh->bh_old[dd_idx];
+	count = 1;
 	for (i = 0; i < disks; i++) {
 		if (i == dd_idx)
 			continue;
 		if (sh->bh_old[i]) {
-			xor_block(sh->bh_old[dd_idx], sh->bh_old[i]);
+			bh_ptr[count++] = sh->bh_old[i];
+			if (count == MAX_XOR_BLOCKS) {
+				xor_block(count, bh_ptr);
+				count = 1;
+			}
 			continue;
 		} else
 			printk("compute_block() %d, stripe %lu, %d not present\n", dd_idx, sh->sector, i);
 	}
+	if (count != 1)
+		xor_block(count, bh_ptr);
 	raid5_mark_buffer_uptodate(sh->bh_old[dd_idx], 1);
 }
 
 static void compute_parity(struct stripe_head *sh, int method)
 {
 	struct raid5_data *raid_conf = sh->raid_conf;
-	int i, pd_idx = sh->pd_idx, disks = raid_conf->raid_disks;
+	int i, count, pd_idx = sh->pd_idx, disks = raid_conf->raid_disks;
+	struct buffer_head *bh_ptr[MAX_XOR_BLOCKS];
 
 	PRINTK(("compute_parity, stripe %lu, method %d\n", sh->sector, method));
 	for (i = 0; i < disks; i++) {
@@ -813,18 +811,20 @@ static void compute_parity(struct stripe_head *sh, int method)
 		sh->bh_copy[pd_idx] = raid5_kmalloc_buffer(sh, sh->size);
 	raid5_build_block(sh, sh->bh_copy[pd_idx], sh->pd_idx);
 
+	bh_ptr[0] = sh->bh_copy[pd_idx];
+	count = 1;
 	if (method == RECONSTRUCT_WRITE) {
 		memset(sh->bh_copy[pd_idx]->b_data, 0, sh->size);
 		for (i = 0; i < disks; i++) {
 			if (i == sh->pd_idx)
 				continue;
-			if (sh->bh_new[i]) {
-				xor_block(sh->bh_copy[pd_idx], sh->bh_copy[i]);
-				continue;
-			}
-			if (sh->bh_old[i]) {
-				xor_block(sh->bh_copy[pd_idx], sh->bh_old[i]);
-				continue;
+			if (sh->bh_new[i])
+				bh_ptr[count++] = sh->bh_copy[i];
+			else if (sh->bh_old[i])
+				bh_ptr[count++] = sh->bh_old[i];
+			if (count == MAX_XOR_BLOCKS) {
+				xor_block(count, bh_ptr);
+				count = 1;
 			}
 		}
 	} else if (method == READ_MODIFY_WRITE) {
@@ -833,12 +833,18 @@ static void compute_parity(struct stripe_head *sh, int method)
 			if (i == sh->pd_idx)
 				continue;
 			if (sh->bh_new[i] && sh->bh_old[i]) {
-				xor_block(sh->bh_copy[pd_idx], sh->bh_copy[i]);
-				xor_block(sh->bh_copy[pd_idx], sh->bh_old[i]);
-				continue;
+				bh_ptr[count++] = sh->bh_copy[i];
+				bh_ptr[count++] = sh->bh_old[i];
+			}
+			/* two at a time, so flush before there's no room */
+			if (count >= MAX_XOR_BLOCKS - 1) {
+				xor_block(count, bh_ptr);
+				count = 1;
 			}
 		}
 	}
+	if (count != 1)
+		xor_block(count, bh_ptr);
 	raid5_mark_buffer_uptodate(sh->bh_copy[pd_idx], 1);
 }
 
@@ -862,6 +868,7 @@ static void add_stripe_bh (struct stripe_head *sh, struct buffer_head *bh, int d
 	if (sh->phase == PHASE_COMPLETE && sh->cmd == STRIPE_NONE) {
 		sh->phase = PHASE_BEGIN;
 		sh->cmd = (rw == READ) ? STRIPE_READ : STRIPE_WRITE;
+		sh->begin = jiffies;
 		raid_conf->nr_pending_stripes++;
 		atomic_inc(&raid_conf->nr_handle);
 	}
@@ -1070,6 +1077,12 @@ static void handle_stripe(struct stripe_head *sh)
 		PRINTK(("handle_stripe(), sector %lu, nr_write %d, method1 %d, method2 %d\n", sh->sector, nr_write, method1, method2));
 
 		if (!method1 || !method2) {
+			if (nr_write == disks - 1)
+				raid_conf->full_stripe_writes++;
+			else if (method1 <= method2)
+				raid_conf->rcw_writes++;
+			else
+				raid_conf->rmw_writes++;
 			lock_stripe(sh);
 			sh->nr_pending++;
 			sh->phase = PHASE_WRITE;
@@ -1248,6 +1261,74 @@ static void unplug_devices(struct stripe_head *sh)
 #endif
 }
 
+static void raid5_delay_timeout (unsigned long data)
+{
+	struct raid5_data *raid_conf = (struct raid5_data *) data;
+
+	md_wakeup_thread(raid_conf->thread);
+}
+
+/*
+ * A write stripe that doesn't cover all data blocks has to read old
+ * data or parity before it can be written. Sequential writers usually
+ * fill in the rest within a few jiffies, so a fresh partial write
+ * stripe is left alone for up to WRITE_DELAY -- unless the cache is
+ * running short of stripes or somebody is already waiting for one.
+ * The delay timer makes sure we come back for it.
+ */
+static int raid5_delay_stripe (struct raid5_data *raid_conf, struct stripe_head *sh)
+{
+	int disks = raid_conf->raid_disks, i, nr = 0;
+
+	if (sh->cmd != STRIPE_WRITE || sh->phase != PHASE_BEGIN)
+		return 0;
+	if (stripe_error(sh) || raid_conf->failed_disks || raid_conf->resync_parity)
+		return 0;
+	if (!time_before(jiffies, sh->begin + WRITE_DELAY))
+		return 0;
+	if (raid_conf->nr_pending_stripes >= raid_conf->max_nr_stripes / 2)
+		return 0;
+	if (waitqueue_active(&raid_conf->wait_for_stripe))
+		return 0;
+	for (i = 0; i < disks; i++) {
+		if (i == sh->pd_idx)
+			continue;
+		if (sh->bh_new[i] || sh->bh_old[i])
+			nr++;
+	}
+	if (nr == disks - 1)
+		return 0;
+
+	if (!timer_pending(&raid_conf->delay_timer)) {
+		raid_conf->delay_timer.expires = sh->begin + WRITE_DELAY;
+		add_timer(&raid_conf->delay_timer);
+	}
+	return 1;
+}
+
+/*
+ * Carry out a SET_STRIPE_CACHE request, see raid5_resize_stripes().
+ */
+static void raid5_do_resize (struct raid5_data *raid_conf)
+{
+	struct stripe_head *sh;
+	int nr = raid_conf->resize_nr;
+
+	while ((sh = raid_conf->resize_list) != NULL) {
+		raid_conf->resize_list = sh->free_next;
+		put_free_stripe(raid_conf, sh);
+		raid_conf->nr_stripes++;
+	}
+	if (nr < raid_conf->nr_stripes) {
+		shrink_stripe_cache(raid_conf, raid_conf->nr_stripes - nr);
+		shrink_stripes(raid_conf, raid_conf->nr_stripes - nr);
+	}
+	raid_conf->max_nr_stripes = raid_conf->nr_stripes;
+	raid_conf->resize_nr = 0;
+	wake_up(&raid_conf->wait_for_stripe);
+	wake_up(&raid_conf->wait_for_resize);
+}
+
 /*
  * This is our raid5 kernel thread.
  *
@@ -1269,6 +1350,8 @@ static void raid5d (void *data)
 		mddev->sb_dirty = 0;
 		md_update_sb((int) (mddev - md_dev));
 	}
+	if (raid_conf->resize_nr)
+		raid5_do_resize(raid_conf);
 	for (i = 0; i < NR_HASH; i++) {
 repeat:
 		sh = raid_conf->stripe_hashtbl[i];
@@ -1279,6 +1362,8 @@ repeat:
 				continue;
 			if (sh->nr_pending)
 				continue;
+			if (raid5_delay_stripe(raid_conf, sh))
+				continue;
 			if (sh->sector == raid_conf->next_sector) {
 				raid_conf->sector_count += (sh->size >> 9);
 				if (raid_conf->sector_count >= 128)
@@ -1346,8 +1431,19 @@ static int __check_consistency (struct md_dev *mddev, int row)
 		nr++;
 	}
 	if (nr == raid_conf->raid_disks) {
-		for (i = 1; i < nr; i++)
-			xor_block(&tmp, bh[i]);
+		struct buffer_head *bh_ptr[MAX_XOR_BLOCKS];
+		int count = 1;
+
+		bh_ptr[0] = &tmp;
+		for (i = 1; i < nr; i++) {
+			bh_ptr[count++] = bh[i];
+			if (count == MAX_XOR_BLOCKS) {
+				xor_block(count, bh_ptr);
+				count = 1;
+			}
+		}
+		if (count != 1)
+			xor_block(count, bh_ptr);
 		if (memcmp(tmp.b_data, bh[0]->b_data, 4096))
 			rc = 1;
 	}
@@ -1465,6 +1561,11 @@ static int raid5_run (int minor, struct md_dev *mddev)
 	raid_conf->level = sb->level;
 	raid_conf->algorithm = sb->parity_algorithm;
 	raid_conf->max_nr_stripes = NR_STRIPES;
+	init_timer(&raid_conf->delay_timer);
+	raid_conf->delay_timer.function = raid5_delay_timeout;
+	raid_conf->delay_timer.data = (unsigned long) raid_conf;
+	init_MUTEX(&raid_conf->resize_sem);
+	init_waitqueue_head(&raid_conf->wait_for_resize);
 
 	if (raid_conf->working_disks != sb->raid_disks && sb->state != (1 << MD_SB_CLEAN)) {
 		printk(KERN_ALERT "raid5: raid set %s not clean and not all disks are operational -- run ckraid\n", kdevname(MKDEV(MD_MAJOR, minor)));
@@ -1557,9 +1658,17 @@ static int raid5_stop (int minor, struct md_dev *mddev)
 {
 	struct raid5_data *raid_conf = (struct raid5_data *) mddev->private;
 
+	down(&raid_conf->resize_sem);
 	shrink_stripe_cache(raid_conf, raid_conf->max_nr_stripes);
 	shrink_stripes(raid_conf, raid_conf->max_nr_stripes);
 	md_unregister_thread(raid_conf->thread);
+	/*
+	 * raid5d can't re-arm the delay timer any more; make sure the
+	 * handler isn't still running on another CPU before raid_conf
+	 * goes away.
+	 */
+	del_timer(&raid_conf->delay_timer);
+	synchronize_bh();
 #if SUPPORT_RECONSTRUCTION
 	md_unregister_thread(raid_conf->resync_thread);
 #endif /* SUPPORT_RECONSTRUCTION */
@@ -1581,9 +1690,68 @@ static int raid5_status (char *page, int minor, struct md_dev *mddev)
 	for (i = 0; i < raid_conf->raid_disks; i++)
 		sz += sprintf (page+sz, "%s", raid_conf->disks[i].operational ? "U" : "_");
 	sz += sprintf (page+sz, "]");
+	sz += sprintf (page+sz, " %d stripes, writes: %lu full %lu rcw %lu rmw",
+		raid_conf->nr_stripes, raid_conf->full_stripe_writes,
+		raid_conf->rcw_writes, raid_conf->rmw_writes);
 	return sz;
 }
 
+/*
+ * Resize the stripe cache. Only raid5d changes the set of stripes, so
+ * that none of them can go away while it or a request is using one:
+ * we allocate the new stripes here, where we may sleep, and wait for
+ * raid5d to take them in or to give back the surplus. Shrinking can
+ * only give back stripes that are idle, so the cache may end up larger
+ * than asked for; max_nr_stripes always follows what we actually have.
+ */
+static int raid5_resize_stripes (struct raid5_data *raid_conf, int nr)
+{
+	struct stripe_head *sh, *list = NULL;
+	int err = 0, more;
+
+	if (nr < MIN_NR_STRIPES || nr > MAX_NR_STRIPES)
+		return -EINVAL;
+
+	down(&raid_conf->resize_sem);
+	for (more = nr - raid_conf->nr_stripes; more > 0; more--) {
+		if ((sh = alloc_stripe(raid_conf, GFP_KERNEL)) == NULL) {
+			err = -ENOMEM;
+			break;
+		}
+		sh->free_next = list;
+		list = sh;
+	}
+	raid_conf->resize_list = list;
+	raid_conf->resize_nr = nr;
+	md_wakeup_thread(raid_conf->thread);
+	wait_event(raid_conf->wait_for_resize, !raid_conf->resize_nr);
+
+	printk(KERN_INFO "raid5: %s stripe cache now %d stripes\n",
+		kdevname(MKDEV(MD_MAJOR, (int) (raid_conf->mddev - md_dev))),
+		raid_conf->nr_stripes);
+	up(&raid_conf->resize_sem);
+	return err;
+}
+
+static int raid5_ioctl (struct inode *inode, struct file *file,
+			unsigned int cmd, unsigned long arg)
+{
+	int minor = MINOR(inode->i_rdev);
+	struct raid5_data *raid_conf;
+
+	if (minor >= MAX_MD_DEV || md_dev[minor].pers != &raid5_personality)
+		return -EINVAL;
+	raid_conf = (struct raid5_data *) md_dev[minor].private;
+
+	switch (cmd) {
+	case GET_STRIPE_CACHE:
+		return put_user(raid_conf->max_nr_stripes, (int *) arg);
+	case SET_STRIPE_CACHE:
+		return raid5_resize_stripes(raid_conf, (int) arg);
+	}
+	return -EINVAL;
+}
+
 static int raid5_mark_spare(struct md_dev *mddev, md_descriptor_t *spare, int state)
 {
 	int i = 0, failed_disk = -1;
@@ -1651,7 +1819,7 @@ static struct md_personality raid5_personality=
 	raid5_run,
 	raid5_stop,
 	raid5_status,
-	NULL,			/* no ioctls */
+	raid5_ioctl,
 	0,
 	raid5_error,
 	/* raid5_hot_add_disk, */ NULL,
@@ -0,0 +1,364 @@
+/*
+ * linux/drivers/block/xor.c
+ *
+ * Parity computation for RAID4/5.
+ *
+ * xor_block() XORs up to four source buffers into a destination in a
+ * single pass, so that a stripe of N disks re-reads the destination
+ * N/4 times instead of N. There are two plain C versions, and the
+ * architecture may add its own in <asm/xor.h>. calibrate_xor_block()
+ * times all of them on the running CPU when md starts up and keeps the
+ * fastest. /proc/mdstat reports the one in use.
+ */
+
+#include <linux/config.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/string.h>
+#include <linux/mm.h>
+#include <linux/xor.h>
+#include <asm/md.h>
+#ifdef HAVE_ARCH_XOR_TEMPLATES
+#include <asm/xor.h>
+#endif
+
+/*
+ * The obvious loop: eight longs at a time, straight through memory.
+ */
+static void
+xor_8regs_2(unsigned long bytes, unsigned long *p1, unsigned long *p2)
+{
+	long lines = bytes / (sizeof (long)) / 8;
+
+	do {
+		p1[0] ^= p2[0];
+		p1[1] ^= p2[1];
+		p1[2] ^= p2[2];
+		p1[3] ^= p2[3];
+		p1[4] ^= p2[4];
+		p1[5] ^= p2[5];
+		p1[6] ^= p2[6];
+		p1[7] ^= p2[7];
+		p1 += 8;
+		p2 += 8;
+	} while (--lines > 0);
+}
+
+static void
+xor_8regs_3(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+	    unsigned long *p3)
+{
+	long lines = bytes / (sizeof (long)) / 8;
+
+	do {
+		p1[0] ^= p2[0] ^ p3[0];
+		p1[1] ^= p2[1] ^ p3[1];
+		p1[2] ^= p2[2] ^ p3[2];
+		p1[3] ^= p2[3] ^ p3[3];
+		p1[4] ^= p2[4] ^ p3[4];
+		p1[5] ^= p2[5] ^ p3[5];
+		p1[6] ^= p2[6] ^ p3[6];
+		p1[7] ^= p2[7] ^ p3[7];
+		p1 += 8;
+		p2 += 8;
+		p3 += 8;
+	} while (--lines > 0);
+}
+
+static void
+xor_8regs_4(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+	    unsigned long *p3, unsigned long *p4)
+{
+	long lines = bytes / (sizeof (long)) / 8;
+
+	do {
+		p1[0] ^= p2[0] ^ p3[0] ^ p4[0];
+		p1[1] ^= p2[1] ^ p3[1] ^ p4[1];
+		p1[2] ^= p2[2] ^ p3[2] ^ p4[2];
+		p1[3] ^= p2[3] ^ p3[3] ^ p4[3];
+		p1[4] ^= p2[4] ^ p3[4] ^ p4[4];
+		p1[5] ^= p2[5] ^ p3[5] ^ p4[5];
+		p1[6] ^= p2[6] ^ p3[6] ^ p4[6];
+		p1[7] ^= p2[7] ^ p3[7] ^ p4[7];
+		p1 += 8;
+		p2 += 8;
+		p3 += 8;
+		p4 += 8;
+	} while (--lines > 0);
+}
+
+static void
+xor_8regs_5(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+	    unsigned long *p3, unsigned long *p4, unsigned long *p5)
+{
+	long lines = bytes / (sizeof (long)) / 8;
+
+	do {
+		p1[0] ^= p2[0] ^ p3[0] ^ p4[0] ^ p5[0];
+		p1[1] ^= p2[1] ^ p3[1] ^ p4[1] ^ p5[1];
+		p1[2] ^= p2[2] ^ p3[2] ^ p4[2] ^ p5[2];
+		p1[3] ^= p2[3] ^ p3[3] ^ p4[3] ^ p5[3];
+		p1[4] ^= p2[4] ^ p3[4] ^ p4[4] ^ p5[4];
+		p1[5] ^= p2[5] ^ p3[5] ^ p4[5] ^ p5[5];
+		p1[6] ^= p2[6] ^ p3[6] ^ p4[6] ^ p5[6];
+		p1[7] ^= p2[7] ^ p3[7] ^ p4[7] ^ p5[7];
+		p1 += 8;
+		p2 += 8;
+		p3 += 8;
+		p4 += 8;
+		p5 += 8;
+	} while (--lines > 0);
+}
+
+static struct xor_block_template xor_block_8regs = {
+	NULL, "8regs", 0,
+	xor_8regs_2, xor_8regs_3, xor_8regs_4, xor_8regs_5
+};
+
+/*
+ * The same with all loads issued before the first store, which
+ * schedules better on CPUs with plenty of registers.
+ */
+#define XOR_32REGS_LOAD(p)				\
+	d0 = (p)[0]; d1 = (p)[1]; d2 = (p)[2]; d3 = (p)[3];	\
+	d4 = (p)[4]; d5 = (p)[5]; d6 = (p)[6]; d7 = (p)[7]
+
+#define XOR_32REGS_XOR(p)				\
+	d0 ^= (p)[0]; d1 ^= (p)[1]; d2 ^= (p)[2]; d3 ^= (p)[3];	\
+	d4 ^= (p)[4]; d5 ^= (p)[5]; d6 ^= (p)[6]; d7 ^= (p)[7]
+
+#define XOR_32REGS_STORE(p)				\
+	(p)[0] = d0; (p)[1] = d1; (p)[2] = d2; (p)[3] = d3;	\
+	(p)[4] = d4; (p)[5] = d5; (p)[6] = d6; (p)[7] = d7
+
+static void
+xor_32regs_2(unsigned long bytes, unsigned long *p1, unsigned long *p2)
+{
+	long lines = bytes / (sizeof (long)) / 8;
+	register unsigned long d0, d1, d2, d3, d4, d5, d6, d7;
+
+	do {
+		XOR_32REGS_LOAD(p1);
+		XOR_32REGS_XOR(p2);
+		XOR_32REGS_STORE(p1);
+		p1 += 8;
+		p2 += 8;
+	} while (--lines > 0);
+}
+
+static void
+xor_32regs_3(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+	     unsigned long *p3)
+{
+	long lines = bytes / (sizeof (long)) / 8;
+	register unsigned long d0, d1, d2, d3, d4, d5, d6, d7;
+
+	do {
+		XOR_32REGS_LOAD(p1);
+		XOR_32REGS_XOR(p2);
+		XOR_32REGS_XOR(p3);
+		XOR_32REGS_STORE(p1);
+		p1 += 8;
+		p2 += 8;
+		p3 += 8;
+	} while (--lines > 0);
+}
+
+static void
+xor_32regs_4(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+	     unsigned long *p3, unsigned long *p4)
+{
+	long lines = bytes / (sizeof (long)) / 8;
+	register unsigned long d0, d1, d2, d3, d4, d5, d6, d7;
+
+	do {
+		XOR_32REGS_LOAD(p1);
+		XOR_32REGS_XOR(p2);
+		XOR_32REGS_XOR(p3);
+		XOR_32REGS_XOR(p4);
+		XOR_32REGS_STORE(p1);
+		p1 += 8;
+		p2 += 8;
+		p3 += 8;
+		p4 += 8;
+	} while (--lines > 0);
+}
+
+static void
+xor_32regs_5(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+	     unsigned long *p3, unsigned long *p4, unsigned long *p5)
+{
+	long lines = bytes / (sizeof (long)) / 8;
+	register unsigned long d0, d1, d2, d3, d4, d5, d6, d7;
+
+	do {
+		XOR_32REGS_LOAD(p1);
+		XOR_32REGS_XOR(p2);
+		XOR_32REGS_XOR(p3);
+		XOR_32REGS_XOR(p4);
+		XOR_32REGS_XOR(p5);
+		XOR_32REGS_STORE(p1);
+		p1 += 8;
+		p2 += 8;
+		p3 += 8;
+		p4 += 8;
+		p5 += 8;
+	} while (--lines > 0);
+}
+
+static struct xor_block_template xor_block_32regs = {
+	NULL, "32regs", 0,
+	xor_32regs_2, xor_32regs_3, xor_32regs_4, xor_32regs_5
+};
+
+#ifdef HAVE_ARCH_XORBLOCK
+/*
+ * An architecture's two-operand __xor_block() from <asm/md.h>,
+ * applied once per source.
+ */
+static void
+xor_arch_2(unsigned long bytes, unsigned long *p1, unsigned long *p2)
+{
+	__xor_block((char *) p1, (char *) p2, bytes);
+}
+
+static void
+xor_arch_3(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+	   unsigned long *p3)
+{
+	__xor_block((char *) p1, (char *) p2, bytes);
+	__xor_block((char *) p1, (char *) p3, bytes);
+}
+
+static void
+xor_arch_4(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+	   unsigned long *p3, unsigned long *p4)
+{
+	xor_arch_3(bytes, p1, p2, p3);
+	__xor_block((char *) p1, (char *) p4, bytes);
+}
+
+static void
+xor_arch_5(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+	   unsigned long *p3, unsigned long *p4, unsigned long *p5)
+{
+	xor_arch_4(bytes, p1, p2, p3, p4);
+	__xor_block((char *) p1, (char *) p5, bytes);
+}
+
+static struct xor_block_template xor_block_arch = {
+	NULL, "arch", 0,
+	xor_arch_2, xor_arch_3, xor_arch_4, xor_arch_5
+};
+#endif
+
+/* the plain 8regs version until we have measured something better */
+struct xor_block_template *xor_active_template = &xor_block_8regs;
+
+/*
+ * count is the number of buffers, the destination bh_ptr[0] included,
+ * at most MAX_XOR_BLOCKS. All of them are bh_ptr[0]->b_size bytes,
+ * a multiple of 64.
+ */
+void xor_block(unsigned int count, struct buffer_head **bh_ptr)
+{
+	struct xor_block_template *t = xor_active_template;
+	unsigned long bytes = bh_ptr[0]->b_size;
+	unsigned long *p0, *p1, *p2, *p3, *p4;
+
+	p0 = (unsigned long *) bh_ptr[0]->b_data;
+	p1 = (unsigned long *) bh_ptr[1]->b_data;
+	if (count == 2) {
+		t->do_2(bytes, p0, p1);
+		return;
+	}
+	p2 = (unsigned long *) bh_ptr[2]->b_data;
+	if (count == 3) {
+		t->do_3(bytes, p0, p1, p2);
+		return;
+	}
+	p3 = (unsigned long *) bh_ptr[3]->b_data;
+	if (count == 4) {
+		t->do_4(bytes, p0, p1, p2, p3);
+		return;
+	}
+	p4 = (unsigned long *) bh_ptr[4]->b_data;
+	t->do_5(bytes, p0, p1, p2, p3, p4);
+}
+
+/*
+ * Calibration: XOR four pages into a fifth for a whole jiffy, take the
+ * best of five runs and keep the fastest template. This needs the
+ * timer interrupt, which md_init() has by the time it calls us.
+ */
+#define XOR_BENCH_RUNS	5
+
+static struct xor_block_template *xor_templates;
+static unsigned long xor_bench_pages;
+
+static void __init xor_speed(struct xor_block_template *t)
+{
+	unsigned long *b[MAX_XOR_BLOCKS], now;
+	int i, count, max = 0;
+
+	t->next = xor_templates;
+	xor_templates = t;
+
+	for (i = 0; i < MAX_XOR_BLOCKS; i++)
+		b[i] = (unsigned long *) (xor_bench_pages + i * PAGE_SIZE);
+
+	for (i = 0; i < XOR_BENCH_RUNS; i++) {
+		now = jiffies;
+		count = 0;
+		while (jiffies == now) {
+			mb();
+			t->do_5(PAGE_SIZE, b[0], b[1], b[2], b[3], b[4]);
+			mb();
+			count++;
+		}
+		if (count > max)
+			max = count;
+	}
+
+	/* KB of source data per second */
+	t->speed = max * HZ * (MAX_XOR_BLOCKS - 1) * (PAGE_SIZE >> 10);
+	printk(KERN_INFO "   %-10s: %6d.%d MB/sec\n", t->name,
+	       t->speed >> 10, ((t->speed & 1023) * 10) >> 10);
+}
+
+void __init calibrate_xor_block(void)
+{
+	struct xor_block_template *t, *fastest;
+
+	xor_bench_pages = __get_free_pages(GFP_KERNEL, 3);
+	if (!xor_bench_pages) {
+		printk(KERN_WARNING "xor: no memory to calibrate, "
+		       "using %s\n", xor_active_template->name);
+		return;
+	}
+	memset((void *) xor_bench_pages, 0, MAX_XOR_BLOCKS * PAGE_SIZE);
+
+	printk(KERN_INFO "raid5: measuring checksumming speed\n");
+	xor_speed(&xor_block_8regs);
+	xor_speed(&xor_block_32regs);
+#ifdef HAVE_ARCH_XORBLOCK
+	xor_speed(&xor_block_arch);
+#endif
+#ifdef XOR_ARCH_TEMPLATES
+	XOR_ARCH_TEMPLATES;
+#endif
+	free_pages(xor_bench_pages, 3);
+
+	fastest = xor_templates;
+	for (t = fastest->next; t; t = t->next)
+		if (t->speed > fastest->speed)
+			fastest = t;
+	xor_active_template = fastest;
+	printk(KERN_INFO "raid5: using function: %s (%d.%d MB/sec)\n",
+	       fastest->name, fastest->speed >> 10,
+	       ((fastest->speed & 1023) * 10) >> 10);
+}
+
+EXPORT_SYMBOL(xor_block);
@@ -681,6 +681,7 @@ static Scsi_Cmnd *end_scsi_request(Scsi_Cmnd * SCpnt, int uptodate, int sectors)
 		up(req->sem);
 	}
 	add_blkdev_randomness(MAJOR(req->rq_dev));
+	req_finished_io(req);
 
 	if (SCpnt->host->block) {
 		struct Scsi_Host *next;
@@ -80,6 +80,44 @@ static spinlock_t lru_list_lock = SPIN_LOCK_UNLOCKED;
 static int nr_buffers_type[NR_LIST] = {0,};
 static unsigned long size_buffers_type[NR_LIST] = {0,};
 
+/*
+ * Dirty buffers don't live on lru_list[BUF_DIRTY] but on one list per
+ * request queue, that is per major, each written back by its own
+ * kflushd thread. A slow disk full of dirty buffers then only holds
+ * up the tasks writing to it. The lists and counts are protected by
+ * lru_list_lock, like the global ones.
+ */
+struct wb_queue {
+	struct buffer_head * dirty_list;
+	int nr_dirty;			/* buffers on dirty_list */
+	unsigned long size_dirty;	/* bytes on dirty_list */
+	atomic_t size_writeback;	/* bytes of writes in flight */
+	unsigned long written;		/* sectors written back, ever */
+	unsigned long throttled;	/* writers made to wait for us */
+	int started;			/* flusher thread started? */
+	struct task_struct * tsk;	/* ... and running */
+	wait_queue_head_t flush_done;	/* woken after each flush pass */
+};
+
+static struct wb_queue wb_queues[MAX_BLKDEV];
+static int nr_wb_active = 0;		/* queues with dirty buffers */
+
+#define wb_queue(dev)	(wb_queues + MAJOR(dev))
+
+static inline struct buffer_head ** lru_list_head(kdev_t dev, int blist)
+{
+	if (blist == BUF_DIRTY)
+		return &wb_queue(dev)->dirty_list;
+	return &lru_list[blist];
+}
+
+static inline int lru_list_count(kdev_t dev, int blist)
+{
+	if (blist == BUF_DIRTY)
+		return wb_queue(dev)->nr_dirty;
+	return nr_buffers_type[blist];
+}
+
 static struct buffer_head * unused_list = NULL;
 static int nr_unused_buffer_heads = 0;
 static spinlock_t unused_list_lock = SPIN_LOCK_UNLOCKED;
@@ -172,6 +210,11 @@ static int sync_buffers(kdev_t dev, int wait)
 {
 	int i, retry, pass = 0, err = 0;
 	struct buffer_head * bh, *next;
+	struct wb_queue * wq, * first, * last;
+
+	/* dev == 0 means all devices, and all the dirty lists */
+	first = dev ? wb_queue(dev) : wb_queues;
+	last = dev ? first : wb_queues + MAX_BLKDEV - 1;
 
 	/* One pass for no-wait, three for wait:
 	 * 0) write out all dirty, unlocked buffers;
@@ -184,55 +227,58 @@ static int sync_buffers(kdev_t dev, int wait)
 		/* We search all lists as a failsafe mechanism, not because we expect
 		 * there to be dirty buffers on any of the other lists.
 		 */
+		wq = first;
 repeat:
 		spin_lock(&lru_list_lock);
-		bh = lru_list[BUF_DIRTY];
-		if (!bh)
-			goto repeat2;
+		for (; wq <= last; wq++) {
+			bh = wq->dirty_list;
+			if (!bh)
+				continue;
 
-		for (i = nr_buffers_type[BUF_DIRTY]*2 ; i-- > 0 ; bh = next) {
-			next = bh->b_next_free;
+			for (i = wq->nr_dirty*2 ; i-- > 0 ; bh = next) {
+				next = bh->b_next_free;
 
-			if (!lru_list[BUF_DIRTY])
-				break;
-			if (dev && bh->b_dev != dev)
-				continue;
-			if (buffer_locked(bh)) {
-				/* Buffer is locked; skip it unless wait is
-				 * requested AND pass > 0.
+				if (!wq->dirty_list)
+					break;
+				if (dev && bh->b_dev != dev)
+					continue;
+				if (buffer_locked(bh)) {
+					/* Buffer is locked; skip it unless wait is
+					 * requested AND pass > 0.
+					 */
+					if (!wait || !pass) {
+						retry = 1;
+						continue;
+					}
+					atomic_inc(&bh->b_count);
+					spin_unlock(&lru_list_lock);
+					wait_on_buffer (bh);
+					atomic_dec(&bh->b_count);
+					goto repeat;
+				}
+
+				/* If an unlocked buffer is not uptodate, there has
+				 * been an IO error. Skip it.
 				 */
-				if (!wait || !pass) {
-					retry = 1;
+				if (wait && buffer_req(bh) && !buffer_locked(bh) &&
+				    !buffer_dirty(bh) && !buffer_uptodate(bh)) {
+					err = -EIO;
 					continue;
 				}
+
+				/* Don't write clean buffers.  Don't write ANY buffers
+				 * on the third pass.
+				 */
+				if (!buffer_dirty(bh) || pass >= 2)
+					continue;
+
 				atomic_inc(&bh->b_count);
 				spin_unlock(&lru_list_lock);
-				wait_on_buffer (bh);
+				ll_rw_block(WRITE, 1, &bh);
 				atomic_dec(&bh->b_count);
+				retry = 1;
 				goto repeat;
 			}
-
-			/* If an unlocked buffer is not uptodate, there has
-			 * been an IO error. Skip it.
-			 */
-			if (wait && buffer_req(bh) && !buffer_locked(bh) &&
-			    !buffer_dirty(bh) && !buffer_uptodate(bh)) {
-				err = -EIO;
-				continue;
-			}
-
-			/* Don't write clean buffers.  Don't write ANY buffers
-			 * on the third pass.
-			 */
-			if (!buffer_dirty(bh) || pass >= 2)
-				continue;
-
-			atomic_inc(&bh->b_count);
-			spin_unlock(&lru_list_lock);
-			ll_rw_block(WRITE, 1, &bh);
-			atomic_dec(&bh->b_count);
-			retry = 1;
-			goto repeat;
 		}
 
     repeat2:
@@ -421,10 +467,10 @@ void invalidate_buffers(kdev_t dev)
 		struct buffer_head * bh;
 		int i;
 	retry:
-		bh = lru_list[nlist];
+		bh = *lru_list_head(dev, nlist);
 		if (!bh)
 			continue;
-		for (i = nr_buffers_type[nlist]*2 ; --i > 0 ; bh = bh->b_next_free) {
+		for (i = lru_list_count(dev, nlist)*2 ; --i > 0 ; bh = bh->b_next_free) {
 			if (bh->b_dev != dev)
 				continue;
 			if (buffer_locked(bh)) {
@@ -472,7 +518,7 @@ static __inline__ void __hash_unlink(struct buffer_head *bh)
 
 static void __insert_into_lru_list(struct buffer_head * bh, int blist)
 {
-	struct buffer_head **bhp = &lru_list[blist];
+	struct buffer_head **bhp = lru_list_head(bh->b_dev, blist);
 
 	if(!*bhp) {
 		*bhp = bh;
@@ -484,20 +530,36 @@ static void __insert_into_lru_list(struct buffer_head * bh, int blist)
 	(*bhp)->b_prev_free = bh;
 	nr_buffers_type[blist]++;
 	size_buffers_type[blist] += bh->b_size;
+	if (blist == BUF_DIRTY) {
+		struct wb_queue * wq = wb_queue(bh->b_dev);
+
+		if (!wq->nr_dirty++)
+			nr_wb_active++;
+		wq->size_dirty += bh->b_size;
+	}
 }
 
 static void __remove_from_lru_list(struct buffer_head * bh, int blist)
 {
 	if (bh->b_prev_free || bh->b_next_free) {
+		struct buffer_head **bhp = lru_list_head(bh->b_dev, blist);
+
 		bh->b_prev_free->b_next_free = bh->b_next_free;
 		bh->b_next_free->b_prev_free = bh->b_prev_free;
-		if (lru_list[blist] == bh)
-			lru_list[blist] = bh->b_next_free;
-		if (lru_list[blist] == bh)
-			lru_list[blist] = NULL;
+		if (*bhp == bh)
+			*bhp = bh->b_next_free;
+		if (*bhp == bh)
+			*bhp = NULL;
 		bh->b_next_free = bh->b_prev_free = NULL;
 		nr_buffers_type[blist]--;
 		size_buffers_type[blist] -= bh->b_size;
+		if (blist == BUF_DIRTY) {
+			struct wb_queue * wq = wb_queue(bh->b_dev);
+
+			if (!--wq->nr_dirty)
+				nr_wb_active--;
+			wq->size_dirty -= bh->b_size;
+		}
 	}
 }
 
@@ -632,8 +694,8 @@ void set_blocksize(kdev_t dev, int size)
 	for(nlist = 0; nlist < NR_LIST; nlist++) {
 	repeat:
 		spin_lock(&lru_list_lock);
-		bh = lru_list[nlist];
-		for (i = nr_buffers_type[nlist]*2 ; --i > 0 ; bh = bhnext) {
+		bh = *lru_list_head(dev, nlist);
+		for (i = lru_list_count(dev, nlist)*2 ; --i > 0 ; bh = bhnext) {
 			if(!bh)
 				break;
 
@@ -826,33 +888,77 @@ static int balance_dirty_state(kdev_t dev)
 
 	if (dirty > soft_dirty_limit)
 	{
-		if (dirty > hard_dirty_limit)
-			return 1;
+		if (dirty > hard_dirty_limit) {
+			int active = nr_wb_active;
+
+			/*
+			 * Over the limit, only the queues holding more than
+			 * their share of the dirty buffers have to wait:
+			 * writers to the others carry on.
+			 */
+			if (dev == NODEV || active <= 1)
+				return 1;
+			if ((wb_queue(dev)->size_dirty >> PAGE_SHIFT) >
+			    hard_dirty_limit / active)
+				return 1;
+		}
 		return 0;
 	}
 	return -1;
 }
 
+static void wakeup_flusher(struct task_struct *, wait_queue_head_t *, int);
+
 /*
  * if a new dirty buffer is created we need to balance bdflush.
  *
- * in the future we might want to make bdflush aware of different
- * pressures on different devices - thus the (currently unused)
- * 'dev' parameter.
+ * Only the flusher of the queue 'dev' is on is kicked, and only
+ * writers to a queue with too much dirty data wait for it. Queues
+ * which don't have their own flusher yet are left to kflushd, which
+ * starts one.
  */
 void balance_dirty(kdev_t dev)
 {
 	int state = balance_dirty_state(dev);
+	struct wb_queue * wq = wb_queue(dev);
 
 	if (state < 0)
 		return;
-	wakeup_bdflush(state);
+	if (!wq->tsk) {
+		wakeup_bdflush(state);
+		return;
+	}
+	if (state)
+		wq->throttled++;
+	wakeup_flusher(wq->tsk, &wq->flush_done, state);
+}
+
+/*
+ * Called by ll_rw_block() for each dirty buffer it's about to write,
+ * and, through unlock_buffer(), once the write has completed.
+ */
+void mark_buffer_writeback(struct buffer_head * bh)
+{
+	struct wb_queue * wq = wb_queue(bh->b_dev);
+
+	if (!test_and_set_bit(BH_Writeback, &bh->b_state)) {
+		atomic_add(bh->b_size, &wq->size_writeback);
+		wq->written += bh->b_size >> 9;
+	}
+}
+
+void end_buffer_writeback(struct buffer_head * bh)
+{
+	if (test_and_clear_bit(BH_Writeback, &bh->b_state))
+		atomic_sub(bh->b_size, &wb_queue(bh->b_dev)->size_writeback);
 }
 
 static inline void __mark_dirty(struct buffer_head *bh, int flag)
 {
 	bh->b_flushtime = jiffies + (flag ? bdf_prm.b_un.age_super : bdf_prm.b_un.age_buffer);
 	clear_bit(BH_New, &bh->b_state);
+	if (bh->b_page)
+		page_cache_tag_dirty(bh->b_page);
 	refile_buffer(bh);
 }
 
@@ -2213,6 +2319,13 @@ void show_buffers(void)
 	if (!spin_trylock(&lru_list_lock))
 		return;
 	for(nlist = 0; nlist < NR_LIST; nlist++) {
+		if (nlist == BUF_DIRTY) {
+			/* spread over the per-queue lists */
+			printk("%8s: %d buffers, %lukB, on %d queues\n",
+			       buf_types[nlist], nr_buffers_type[nlist],
+			       size_buffers_type[nlist] >> 10, nr_wb_active);
+			continue;
+		}
 		found = locked = dirty = used = lastused = protected = 0;
 		bh = lru_list[nlist];
 		if(!bh) continue;
@@ -2238,6 +2351,33 @@ void show_buffers(void)
 #endif
 }
 
+/*
+ * /proc/writeback: dirty and in-flight data per request queue, for the
+ * queues which have ever had dirty buffers.
+ */
+int get_writeback_list(char * page)
+{
+	struct wb_queue * wq;
+	int len;
+
+	len = sprintf(page, "%-20s %10s %12s %12s %9s %5s\n", "device",
+		      "dirty_kB", "writeback_kB", "written_kB", "throttled",
+		      "pid");
+	for (wq = wb_queues; wq < wb_queues + MAX_BLKDEV; wq++) {
+		if (!wq->nr_dirty && !wq->written)
+			continue;
+		if (len > PAGE_SIZE - 80)
+			break;
+		len += sprintf(page + len, "%-20s %10lu %12d %12lu %9lu %5d\n",
+			       bdevname(MKDEV(wq - wb_queues, 0)),
+			       wq->size_dirty >> 10,
+			       atomic_read(&wq->size_writeback) >> 10,
+			       wq->written >> 1, wq->throttled,
+			       wq->tsk ? wq->tsk->pid : 0);
+	}
+	return len;
+}
+
 /* ===================== Init ======================= */
 
 /*
@@ -2296,6 +2436,8 @@ void __init buffer_init(unsigned long mempages)
 	/* Setup lru lists. */
 	for(i = 0; i < NR_LIST; i++)
 		lru_list[i] = NULL;
+	for(i = 0; i < MAX_BLKDEV; i++)
+		init_waitqueue_head(&wb_queues[i].flush_done);
 
 	bh_cachep = kmem_cache_create("buffer_head",
 				      sizeof(struct buffer_head),
@@ -2315,16 +2457,21 @@ void __init buffer_init(unsigned long mempages)
 static DECLARE_WAIT_QUEUE_HEAD(bdflush_done);
 struct task_struct *bdflush_tsk = 0;
 
-void wakeup_bdflush(int block)
+/*
+ * Kick a flusher thread and, if 'block' is set, wait until it has
+ * completed a pass.
+ */
+static void wakeup_flusher(struct task_struct * tsk, wait_queue_head_t * done,
+	int block)
 {
 	DECLARE_WAITQUEUE(wait, current);
 
-	if (current == bdflush_tsk)
+	if (current == tsk)
 		return;
 
 	if (!block)
 	{
-		wake_up_process(bdflush_tsk);
+		wake_up_process(tsk);
 		return;
 	}
 
@@ -2333,32 +2480,41 @@ void wakeup_bdflush(int block)
 	   this wakeup event from kflushd to avoid deadlocking in SMP
 	   (we are not holding any lock anymore in these two paths). */
 	__set_current_state(TASK_UNINTERRUPTIBLE);
-	add_wait_queue(&bdflush_done, &wait);
+	add_wait_queue(done, &wait);
 
-	wake_up_process(bdflush_tsk);
+	wake_up_process(tsk);
 	schedule();
 
-	remove_wait_queue(&bdflush_done, &wait);
+	remove_wait_queue(done, &wait);
 	__set_current_state(TASK_RUNNING);
 }
 
+void wakeup_bdflush(int block)
+{
+	wakeup_flusher(bdflush_tsk, &bdflush_done, block);
+}
+
 /* This is the _only_ function that deals with flushing async writes
    to disk.
-   NOTENOTENOTENOTE: we _only_ need to browse the DIRTY lru list
-   as all dirty buffers lives _only_ in the DIRTY lru list.
+   NOTENOTENOTENOTE: we _only_ need to browse the DIRTY lru lists
+   as all dirty buffers lives _only_ in the DIRTY lru lists.
    As we never browse the LOCKED and CLEAN lru lists they are infact
-   completly useless. */
-static void flush_dirty_buffers(int check_flushtime)
+   completly useless.
+
+   Writes out at most 'max' buffers of one queue and returns how many
+   it wrote. */
+static int flush_queue_buffers(struct wb_queue * wq, int check_flushtime,
+	int max)
 {
 	struct buffer_head * bh, *next;
 	int flushed = 0, i;
 
  restart:
 	spin_lock(&lru_list_lock);
-	bh = lru_list[BUF_DIRTY];
+	bh = wq->dirty_list;
 	if (!bh)
 		goto out_unlock;
-	for (i = nr_buffers_type[BUF_DIRTY]; i-- > 0; bh = next)
+	for (i = wq->nr_dirty; i-- > 0; bh = next)
 	{
 		next = bh->b_next_free;
 
@@ -2381,7 +2537,7 @@ static void flush_dirty_buffers(int check_flushtime)
 		}
 		else
 		{
-			if (++flushed > bdf_prm.b_un.ndirty)
+			if (flushed >= max)
 				goto out_unlock;
 		}
 
@@ -2390,6 +2546,7 @@ static void flush_dirty_buffers(int check_flushtime)
 		spin_unlock(&lru_list_lock);
 		ll_rw_block(WRITE, 1, &bh);
 		atomic_dec(&bh->b_count);
+		flushed++;
 
 		if (current->need_resched)
 			schedule();
@@ -2397,6 +2554,105 @@ static void flush_dirty_buffers(int check_flushtime)
 	}
  out_unlock:
 	spin_unlock(&lru_list_lock);
+	return flushed;
+}
+
+/*
+ * Flush the queues which have no flusher thread of their own, at most
+ * bdf_prm.b_un.ndirty buffers in all unless going by flush time.
+ */
+static int flush_dirty_buffers(int check_flushtime)
+{
+	struct wb_queue * wq;
+	int flushed = 0;
+
+	for (wq = wb_queues; wq < wb_queues + MAX_BLKDEV; wq++) {
+		if (wq->tsk || !wq->nr_dirty)
+			continue;
+		flushed += flush_queue_buffers(wq, check_flushtime,
+			bdf_prm.b_un.ndirty - flushed);
+		if (!check_flushtime && flushed >= bdf_prm.b_un.ndirty)
+			break;
+	}
+	return flushed;
+}
+
+/*
+ * The per-queue flusher: writes back its queue's buffers as they age,
+ * and in ndirty batches while there are too many dirty buffers.
+ */
+static int bdflush_queue(void * data)
+{
+	struct wb_queue * wq = data;
+	kdev_t dev = MKDEV(wq - wb_queues, 0);
+	int interval;
+
+	current->session = 1;
+	current->pgrp = 1;
+	sprintf(current->comm, "kflushd/%d", MAJOR(dev));
+
+	spin_lock_irq(&current->sigmask_lock);
+	flush_signals(current);
+	sigfillset(&current->blocked);
+	recalc_sigpending(current);
+	spin_unlock_irq(&current->sigmask_lock);
+
+	wq->tsk = current;
+
+	for (;;) {
+		int flushed = 0;
+
+		interval = bdf_prm.b_un.interval;
+		if (balance_dirty_state(dev) >= 0) {
+			flushed = flush_queue_buffers(wq, 0, bdf_prm.b_un.ndirty);
+			if (!flushed)
+				run_task_queue(&tq_disk);
+		} else if (interval && (flushed = flush_queue_buffers(wq, 1, 0)))
+			run_task_queue(&tq_disk);
+
+		/* as in bdflush() below */
+		__set_current_state(TASK_INTERRUPTIBLE);
+		wake_up(&wq->flush_done);
+		/*
+		 * The dirty total is global, so it can stay over the limit
+		 * while everything on this queue is locked or belongs to
+		 * someone else. Only skip the sleep if this pass got
+		 * something written.
+		 */
+		if (!flushed || balance_dirty_state(dev) < 0 || !wq->nr_dirty)
+			schedule_timeout(interval ? interval : 5*HZ);
+		__set_current_state(TASK_RUNNING);
+	}
+	return 0;
+}
+
+/*
+ * Start flushers for the queues which got dirty buffers and have none
+ * yet, and kick the running ones if there's too much dirty data. Returns
+ * the queue with the most dirty buffers among those having a flusher.
+ */
+static struct wb_queue * start_queue_flushers(int state)
+{
+	struct wb_queue * wq, * busiest = NULL;
+
+	for (wq = wb_queues; wq < wb_queues + MAX_BLKDEV; wq++) {
+		if (!wq->nr_dirty)
+			continue;
+		if (!wq->started) {
+			wq->started = 1;
+			if (kernel_thread(bdflush_queue, wq,
+			    CLONE_FS | CLONE_FILES | CLONE_SIGHAND) < 0)
+				wq->started = 0;
+			continue;
+		}
+		if (!wq->tsk)
+			continue;
+		if (state >= 0)
+			wake_up_process(wq->tsk);
+		if (!busiest || wq->size_dirty > busiest->size_dirty)
+			busiest = wq;
+	}
+	return busiest;
 }
 
 /* 
@@ -2414,6 +2670,7 @@ static int sync_old_buffers(void)
 	sync_inodes(0);
 	unlock_kernel();
 
+	/* queues with a flusher of their own age their buffers themselves */
 	flush_dirty_buffers(1);
 	/* must really sync all the active I/O request to disk here */
 	run_task_queue(&tq_disk);
@@ -2499,9 +2756,22 @@ int bdflush(void * unused)
 	spin_unlock_irq(&current->sigmask_lock);
 
 	for (;;) {
+		struct wb_queue * busiest;
+		int state;
+
 		CHECK_EMERGENCY_SYNC
 
-		flush_dirty_buffers(0);
+		state = balance_dirty_state(NODEV);
+		busiest = start_queue_flushers(state);
+
+		/*
+		 * Once every dirty queue has a flusher of its own we
+		 * have nothing left to write: wait for the busiest
+		 * one instead, so that wakeup_bdflush(1) still means
+		 * waiting for some writeback to happen.
+		 */
+		if (!flush_dirty_buffers(0) && busiest && state >= 0)
+			wakeup_flusher(busiest->tsk, &busiest->flush_done, 1);
 
 		/* If wakeup_bdflush will wakeup us
 		   after our bdflush_done wakeup, then
@@ -42,12 +42,18 @@ kmem_cache_t *dentry_cache;
  * This hash-function tries to avoid losing too many bits of hash
  * information, yet avoid using a prime hash-size or similar.
  */
-#define D_HASHBITS     14
-#define D_HASHSIZE     (1UL << D_HASHBITS)
-#define D_HASHMASK     (D_HASHSIZE-1)
+static unsigned int d_hash_mask;
+static unsigned int d_hash_shift;
+static struct list_head *dentry_hashtable;
 
-static struct list_head dentry_hashtable[D_HASHSIZE];
+/*
+ * Unused dentries are kept on an LRU list per super block, so that
+ * a big tree walk on one filesystem only pushes out its own entries
+ * before the others are shrunk in proportion. Dentries without a
+ * super block go on dentry_unused.
+ */
 static LIST_HEAD(dentry_unused);
+static int nr_dentry_unused;
 
 struct {
 	int nr_dentry;
@@ -57,15 +63,97 @@ struct {
 	int dummy[2];
 } dentry_stat = {0, 0, 45, 0,};
 
-static inline void d_free(struct dentry *dentry)
+static inline struct list_head * d_unused_list(struct dentry * dentry)
+{
+	if (dentry->d_sb)
+		return &dentry->d_sb->s_dentry_lru;
+	return &dentry_unused;
+}
+
+static inline void d_lru_add(struct dentry * dentry)
+{
+	list_add(&dentry->d_lru, d_unused_list(dentry));
+	if (dentry->d_sb)
+		dentry->d_sb->s_nr_dentry_unused++;
+	else
+		nr_dentry_unused++;
+	dentry_stat.nr_unused++;
+}
+
+static inline void d_lru_del(struct dentry * dentry)
+{
+	list_del(&dentry->d_lru);
+	if (dentry->d_sb)
+		dentry->d_sb->s_nr_dentry_unused--;
+	else
+		nr_dentry_unused--;
+	dentry_stat.nr_unused--;
+}
+
+/*
+ * Bumped whenever a dentry leaves a hash chain, by d_drop() or
+ * d_move(): it may then be freed, or be put on another chain, under
+ * the feet of a __d_lookup() walking without the big kernel lock. All
+ * writers hold the big kernel lock.
+ */
+seqcount_t dentry_hash_seq = SEQCNT_ZERO;
+
+static inline void __d_free(struct dentry *dentry)
 {
-	if (dentry->d_op && dentry->d_op->d_release)
-		dentry->d_op->d_release(dentry);
 	if (dname_external(dentry)) 
 		kfree(dentry->d_name.name);
 	kmem_cache_free(dentry_cache, dentry); 
 }
 
+#ifdef __SMP__
+/*
+ * __d_lookup() may be walking over a dentry on another CPU while it
+ * gets unhashed and freed here, so its memory is only given back once
+ * all CPUs have gone through a quiescent state. Freed dentries are
+ * collected on dentry_free_next (through d_lru, which is unused by
+ * then), and moved as a batch to dentry_free_wait when that is empty.
+ */
+static LIST_HEAD(dentry_free_next);
+static LIST_HEAD(dentry_free_wait);
+static unsigned long dentry_free_snap[NR_CPUS];
+
+static void d_free_deferred(void)
+{
+	struct list_head *tmp;
+
+	if (!list_empty(&dentry_free_wait) &&
+	    quiescent_passed(dentry_free_snap)) {
+		while ((tmp = dentry_free_wait.next) != &dentry_free_wait) {
+			list_del(tmp);
+			__d_free(list_entry(tmp, struct dentry, d_lru));
+		}
+	}
+	if (list_empty(&dentry_free_wait) && !list_empty(&dentry_free_next)) {
+		list_splice(&dentry_free_next, &dentry_free_wait);
+		INIT_LIST_HEAD(&dentry_free_next);
+		quiescent_snapshot(dentry_free_snap);
+	}
+}
+
+static inline void d_free(struct dentry *dentry)
+{
+	if (dentry->d_op && dentry->d_op->d_release)
+		dentry->d_op->d_release(dentry);
+	list_add(&dentry->d_lru, &dentry_free_next);
+	d_free_deferred();
+}
+#else
+/* no other CPU to walk the hash chains while we're here */
+#define d_free_deferred()	do { } while (0)
+
+static inline void d_free(struct dentry *dentry)
+{
+	if (dentry->d_op && dentry->d_op->d_release)
+		dentry->d_op->d_release(dentry);
+	__d_free(dentry);
+}
+#endif
+
 /*
  * Release the dentry's inode, using the fileystem
  * d_iput() operation if defined.
@@ -125,10 +213,8 @@ repeat:
 			goto out;
 	}
 
-	if (!list_empty(&dentry->d_lru)) {
-		dentry_stat.nr_unused--;
-		list_del(&dentry->d_lru);
-	}
+	if (!list_empty(&dentry->d_lru))
+		d_lru_del(dentry);
 	if (list_empty(&dentry->d_hash)) {
 		struct dentry * parent;
 
@@ -141,8 +227,7 @@ repeat:
 		dentry = parent;
 		goto repeat;
 	}
-	list_add(&dentry->d_lru, &dentry_unused);
-	dentry_stat.nr_unused++;
+	d_lru_add(dentry);
 	/*
 	 * Update the timestamp
 	 */
@@ -209,7 +294,7 @@ static inline void prune_one_dentry(struct dentry * dentry)
 {
 	struct dentry * parent;
 
-	list_del(&dentry->d_hash);
+	d_drop(dentry);
 	list_del(&dentry->d_child);
 	dentry_iput(dentry);
 	parent = dentry->d_parent;
@@ -219,23 +304,20 @@ static inline void prune_one_dentry(struct dentry * dentry)
 }
 
 /*
- * Shrink the dcache. This is done when we need
- * more memory, or simply when we need to unmount
- * something (at which point we need to unuse
- * all dentries).
+ * Throw away up to count unused dentries from one LRU list, oldest
+ * first; a count of zero empties it.
  */
-void prune_dcache(int count)
+static void prune_dcache_list(struct list_head * lru, int count)
 {
 	for (;;) {
 		struct dentry *dentry;
-		struct list_head *tmp = dentry_unused.prev;
+		struct list_head *tmp = lru->prev;
 
-		if (tmp == &dentry_unused)
+		if (tmp == lru)
 			break;
-		dentry_stat.nr_unused--;
-		list_del(tmp);
-		INIT_LIST_HEAD(tmp);
 		dentry = list_entry(tmp, struct dentry, d_lru);
+		d_lru_del(dentry);
+		INIT_LIST_HEAD(tmp);
 		if (!dentry->d_count) {
 			prune_one_dentry(dentry);
 			if (!--count)
@@ -244,53 +326,70 @@ void prune_dcache(int count)
 	}
 }
 
+/*
+ * Shrink the dcache. This is done when we need
+ * more memory, or simply when we need to unmount
+ * something (at which point we need to unuse
+ * all dentries).
+ *
+ * Each super block gives up its share of count, in
+ * proportion to the number of unused dentries it has.
+ */
+void prune_dcache(int count)
+{
+	struct super_block *sb;
+	int total = dentry_stat.nr_unused;
+	int ratio, share;
+
+	if (!total)
+		return;
+	if (count <= 0 || count >= total) {
+		count = 0;
+		ratio = 1;
+	} else
+		ratio = total / count;
+
+	for (sb = sb_entry(super_blocks.next);
+	     sb != sb_entry(&super_blocks);
+	     sb = sb_entry(sb->s_list.next)) {
+		if (!sb->s_nr_dentry_unused)
+			continue;
+		share = 0;
+		if (count)
+			share = (sb->s_nr_dentry_unused + ratio - 1) / ratio;
+		prune_dcache_list(&sb->s_dentry_lru, share);
+	}
+	if (nr_dentry_unused) {
+		share = 0;
+		if (count)
+			share = (nr_dentry_unused + ratio - 1) / ratio;
+		prune_dcache_list(&dentry_unused, share);
+	}
+}
+
 /*
  * Shrink the dcache for the specified super block.
  * This allows us to unmount a device without disturbing
  * the dcache for the other devices.
  *
- * This implementation makes just two traversals of the
- * unused list.  On the first pass we move the selected
- * dentries to the most recent end, and on the second
- * pass we free them.  The second pass must restart after
- * each dput(), but since the target dentries are all at
- * the end, it's really just a single traversal.
+ * The unused list is per super block, so this is a single
+ * traversal of it. It must restart after each dput(), which
+ * may put the parent back on the list.
  */
 void shrink_dcache_sb(struct super_block * sb)
 {
 	struct list_head *tmp, *next;
 	struct dentry *dentry;
 
-	/*
-	 * Pass one ... move the dentries for the specified
-	 * superblock to the most recent end of the unused list.
-	 */
-	next = dentry_unused.next;
-	while (next != &dentry_unused) {
-		tmp = next;
-		next = tmp->next;
-		dentry = list_entry(tmp, struct dentry, d_lru);
-		if (dentry->d_sb != sb)
-			continue;
-		list_del(tmp);
-		list_add(tmp, &dentry_unused);
-	}
-
-	/*
-	 * Pass two ... free the dentries for this superblock.
-	 */
 repeat:
-	next = dentry_unused.next;
-	while (next != &dentry_unused) {
+	next = sb->s_dentry_lru.next;
+	while (next != &sb->s_dentry_lru) {
 		tmp = next;
 		next = tmp->next;
 		dentry = list_entry(tmp, struct dentry, d_lru);
-		if (dentry->d_sb != sb)
-			continue;
 		if (dentry->d_count)
 			continue;
-		dentry_stat.nr_unused--;
-		list_del(tmp);
+		d_lru_del(dentry);
 		INIT_LIST_HEAD(tmp);
 		prune_one_dentry(dentry);
 		goto repeat;
@@ -358,7 +457,7 @@ resume:
 		next = tmp->next;
 		if (!dentry->d_count) {
 			list_del(&dentry->d_lru);
-			list_add(&dentry->d_lru, dentry_unused.prev);
+			list_add(&dentry->d_lru, d_unused_list(dentry)->prev);
 			found++;
 		}
 		/*
@@ -396,7 +495,7 @@ void shrink_dcache_parent(struct dentry * parent)
 	int found;
 
 	while ((found = select_parent(parent)) != 0)
-		prune_dcache(found);
+		prune_dcache_list(d_unused_list(parent), found);
 }
 
 /*
@@ -418,6 +517,7 @@ int shrink_dcache_memory(int priority, unsigned int gfp_mask)
 		if (priority)
 			count = dentry_stat.nr_unused / priority;
 		prune_dcache(count);
+		d_free_deferred();
 		unlock_kernel();
 		/* FIXME: kmem_cache_shrink here should tell us
 		   the number of pages freed, and it should
@@ -477,6 +577,7 @@ struct dentry * d_alloc(struct dentry * parent, const struct qstr *name)
 	dentry->d_name.hash = name->hash;
 	dentry->d_op = NULL;
 	dentry->d_fsdata = NULL;
+	seqcount_init(&dentry->d_seq);
 	return dentry;
 }
 
@@ -515,41 +616,137 @@ struct dentry * d_alloc_root(struct inode * root_inode)
 static inline struct list_head * d_hash(struct dentry * parent, unsigned long hash)
 {
 	hash += (unsigned long) parent;
-	hash = hash ^ (hash >> D_HASHBITS) ^ (hash >> D_HASHBITS*2);
-	return dentry_hashtable + (hash & D_HASHMASK);
+	hash = hash ^ (hash >> d_hash_shift) ^ (hash >> d_hash_shift*2);
+	return dentry_hashtable + (hash & d_hash_mask);
 }
 
-struct dentry * d_lookup(struct dentry * parent, struct qstr * name)
+/*
+ * Add to a hash chain so that a concurrent __d_lookup() never sees
+ * the entry before its own links are set up.
+ */
+static inline void d_hash_add(struct list_head * new, struct list_head * head)
+{
+	new->next = head->next;
+	new->prev = head;
+	wmb();
+	head->next->prev = new;
+	head->next = new;
+}
+
+/*
+ * Look up a name in the hash chains without relying on any lock for
+ * the walk: entries are added with d_hash_add(), only freed after a
+ * quiescent state, and every link followed is checked against
+ * dentry_hash_seq, so that the walk never strays off the chain it
+ * started on. d_move() also bumps the d_seq of the dentries it renames.
+ *
+ * No reference is taken on the returned dentry, and the caller gets
+ * the dentry_hash_seq the result is valid for in *seqp.
+ */
+static struct dentry * __d_lookup(struct dentry * parent, struct qstr * name,
+	unsigned int * seqp)
 {
 	unsigned int len = name->len;
 	unsigned int hash = name->hash;
 	const unsigned char *str = name->name;
 	struct list_head *head = d_hash(parent,hash);
-	struct list_head *tmp = head->next;
+	struct list_head *tmp;
+	unsigned int seq;
 
+repeat:
+	seq = read_seqcount_begin(&dentry_hash_seq);
+	tmp = head->next;
 	for (;;) {
-		struct dentry * dentry = list_entry(tmp, struct dentry, d_hash);
+		struct dentry * dentry;
+		unsigned int dseq;
+		int miss;
+
+		/* a chain changed: tmp may not be on ours any more */
+		if (read_seqcount_retry(&dentry_hash_seq, seq))
+			goto repeat;
 		if (tmp == head)
 			break;
+		dentry = list_entry(tmp, struct dentry, d_hash);
 		tmp = tmp->next;
 		if (dentry->d_name.hash != hash)
 			continue;
+
+		dseq = read_seqcount_begin(&dentry->d_seq);
 		if (dentry->d_parent != parent)
-			continue;
-		if (parent->d_op && parent->d_op->d_compare) {
-			if (parent->d_op->d_compare(parent, &dentry->d_name, name))
-				continue;
-		} else {
-			if (dentry->d_name.len != len)
-				continue;
-			if (memcmp(dentry->d_name.name, str, len))
-				continue;
+			miss = 1;
+		else if (parent->d_op && parent->d_op->d_compare)
+			miss = parent->d_op->d_compare(parent, &dentry->d_name, name);
+		else
+			miss = dentry->d_name.len != len ||
+			       memcmp(dentry->d_name.name, str, len);
+		/* renamed while we were comparing: start over */
+		if (read_seqcount_retry(&dentry->d_seq, dseq))
+			goto repeat;
+		if (!miss) {
+			*seqp = seq;
+			return dentry;
 		}
-		return dget(dentry);
 	}
+	*seqp = seq;
 	return NULL;
 }
 
+static inline void d_lookup_stat(struct dentry * parent, struct dentry * dentry)
+{
+	struct super_block * sb = parent->d_sb;
+
+	if (sb) {
+		if (!dentry)
+			sb->s_dcache_stat.misses++;
+		else if (!dentry->d_inode)
+			sb->s_dcache_stat.negative++;
+		else
+			sb->s_dcache_stat.hits++;
+	}
+}
+
+struct dentry * d_lookup(struct dentry * parent, struct qstr * name)
+{
+	struct dentry * dentry;
+	unsigned int seq;
+
+	dentry = __d_lookup(parent, name, &seq);
+	d_lookup_stat(parent, dentry);
+	return dget(dentry);
+}
+
+/*
+ * d_lookup() for the path walk, called with the big kernel lock held
+ * once: the lock is dropped for the hash walk, and only taken again to
+ * get a reference on what was found. The dentry can't have been freed
+ * in between, as this CPU doesn't schedule; and if no dentry has left
+ * a hash chain since the walk, it is still hashed under the same name
+ * and parent. Otherwise, and for names with their own d_compare(),
+ * which may rely on the big kernel lock, this is a plain d_lookup().
+ */
+struct dentry * d_fast_lookup(struct dentry * parent, struct qstr * name)
+{
+#ifdef __SMP__
+	struct dentry * dentry;
+	unsigned int seq;
+
+	if (current->lock_depth != 0 ||
+	    (parent->d_op && parent->d_op->d_compare))
+		return d_lookup(parent, name);
+
+	unlock_kernel();
+	dentry = __d_lookup(parent, name, &seq);
+	lock_kernel();
+
+	if (dentry && read_seqcount_retry(&dentry_hash_seq, seq))
+		return d_lookup(parent, name);
+	d_lookup_stat(parent, dentry);
+	return dget(dentry);
+#else
+	return d_lookup(parent, name);
+#endif
+}
+
 /*
  * An insecure source has sent us a dentry, here we verify it.
  *
@@ -627,7 +824,7 @@ void d_rehash(struct dentry * entry)
 {
 	struct dentry * parent = entry->d_parent;
 
-	list_add(&entry->d_hash, d_hash(parent, entry->d_name.hash));
+	d_hash_add(&entry->d_hash, d_hash(parent, entry->d_name.hash));
 }
 
 #define do_switch(x,y) do { \
@@ -680,9 +877,13 @@ void d_move(struct dentry * dentry, struct dentry * target)
 	if (!dentry->d_inode)
 		printk(KERN_WARNING "VFS: moving negative dcache entry\n");
 
+	write_seqcount_begin(&dentry_hash_seq);
+	write_seqcount_begin(&dentry->d_seq);
+	write_seqcount_begin(&target->d_seq);
+
 	/* Move the dentry to the target hash queue */
 	list_del(&dentry->d_hash);
-	list_add(&dentry->d_hash, &target->d_hash);
+	d_hash_add(&dentry->d_hash, &target->d_hash);
 
 	/* Unhash the target: dput() will then get rid of it */
 	list_del(&target->d_hash);
@@ -697,6 +898,10 @@ void d_move(struct dentry * dentry, struct dentry * target)
 	do_switch(dentry->d_name.len, target->d_name.len);
 	do_switch(dentry->d_name.hash, target->d_name.hash);
 
+	write_seqcount_end(&target->d_seq);
+	write_seqcount_end(&dentry->d_seq);
+	write_seqcount_end(&dentry_hash_seq);
+
 	/* And add them back to the (new) parent lists */
 	list_add(&target->d_child, &target->d_parent->d_subdirs);
 	list_add(&dentry->d_child, &dentry->d_parent->d_subdirs);
@@ -851,10 +1056,40 @@ out:
 	return ino;
 }
 
-void __init dcache_init(void)
+/*
+ * /proc/dcache: unused dentries and d_lookup() results
+ * for each mounted filesystem.
+ */
+int get_dcache_stats(char * page)
+{
+	struct super_block * sb;
+	int len;
+
+	len = sprintf(page, "%-20s %-10s %8s %10s %10s %10s\n", "device",
+		      "type", "unused", "hits", "negative", "misses");
+	for (sb = sb_entry(super_blocks.next);
+	     sb != sb_entry(&super_blocks);
+	     sb = sb_entry(sb->s_list.next)) {
+		if (!sb->s_dev || !sb->s_type)
+			continue;
+		if (len > PAGE_SIZE - 80)
+			break;
+		len += sprintf(page + len, "%-20s %-10s %8d %10lu %10lu %10lu\n",
+			       kdevname(sb->s_dev), sb->s_type->name,
+			       sb->s_nr_dentry_unused,
+			       sb->s_dcache_stat.hits,
+			       sb->s_dcache_stat.negative,
+			       sb->s_dcache_stat.misses);
+	}
+	return len;
+}
+
+void __init dcache_init(unsigned long mempages)
 {
+	struct list_head *d;
+	unsigned int nr_hash;
+	int order;
 	int i;
-	struct list_head *d = dentry_hashtable;
 
 	/* 
 	 * A constructor could be added for stable state like the lists,
@@ -872,7 +1107,39 @@ void __init dcache_init(void)
 	if (!dentry_cache)
 		panic("Cannot create dentry cache");
 
-	i = D_HASHSIZE;
+	/* one hash chain per 8kB of memory to start with */
+	mempages >>= (13 - PAGE_SHIFT);
+	mempages *= sizeof(struct list_head);
+	for (order = 0; ((1UL << order) << PAGE_SHIFT) < mempages; order++)
+		;
+	/* the page allocator can't give us anything bigger */
+	if (order >= MAX_ORDER)
+		order = MAX_ORDER - 1;
+
+	do {
+		unsigned long tmp;
+
+		nr_hash = (1UL << order) * PAGE_SIZE /
+			sizeof(struct list_head);
+		d_hash_mask = (nr_hash - 1);
+
+		tmp = nr_hash;
+		d_hash_shift = 0;
+		while ((tmp >>= 1UL) != 0UL)
+			d_hash_shift++;
+
+		dentry_hashtable = (struct list_head *)
+			__get_free_pages(GFP_ATOMIC, order);
+	} while (dentry_hashtable == NULL && --order >= 0);
+
+	printk("Dentry-cache hash table entries: %d (order: %d, %ld bytes)\n",
+	       nr_hash, order, (PAGE_SIZE << order));
+
+	if (!dentry_hashtable)
+		panic("Failed to allocate dcache hash table\n");
+
+	d = dentry_hashtable;
+	i = nr_hash;
 	do {
 		INIT_LIST_HEAD(d);
 		d++;
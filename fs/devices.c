@@ -11,6 +11,8 @@
 
 #include <linux/config.h>
 #include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/mm.h>
 #include <linux/major.h>
 #include <linux/string.h>
 #include <linux/sched.h>
@@ -146,6 +148,7 @@ int register_blkdev(unsigned int major, const char * name, struct file_operation
 			if (blkdevs[major].fops == NULL) {
 				blkdevs[major].name = name;
 				blkdevs[major].fops = fops;
+				blk_alloc_requests(major, GFP_KERNEL);
 				return major;
 			}
 		}
@@ -157,6 +160,7 @@ int register_blkdev(unsigned int major, const char * name, struct file_operation
 		return -EBUSY;
 	blkdevs[major].name = name;
 	blkdevs[major].fops = fops;
+	blk_alloc_requests(major, GFP_KERNEL);
 	return 0;
 }
 
@@ -0,0 +1,690 @@
+/*
+ *  linux/fs/eventpoll.c
+ *
+ *  epoll: scalable readiness notification.
+ *
+ *  select() and poll() build a poll table, call every file's ->poll
+ *  and queue a wait entry on every wait queue on each call. An epoll
+ *  set instead keeps one item per watched descriptor, with its wait
+ *  queue entries registered once, at EPOLL_CTL_ADD time. The entries
+ *  call ep_poll_callback() when their wait queue is woken, which puts
+ *  the item on the set's ready list; epoll_wait() only looks at that
+ *  list, and re-polls just those files to get the actual events.
+ *
+ *  Locking:
+ *    epsem        serializes adding and removing items, which is what
+ *                 touches file->f_ep_links. Taken first.
+ *    ep->sem      keeps items from going away while epoll_wait()
+ *                 works on them without ep->lock.
+ *    ep->lock     protects the ready list. Taken from wakeups, that
+ *                 is with the watched wait queue's lock held and
+ *                 possibly from interrupts.
+ */
+
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/malloc.h>
+#include <linux/smp_lock.h>
+#include <linux/init.h>
+#include <linux/eventpoll.h>
+
+#include <asm/uaccess.h>
+#include <asm/semaphore.h>
+
+#define EP_MIN_HASH_BITS	4
+#define EP_MAX_HASH_BITS	12
+
+#define EP_MAX_EVENTS		(INT_MAX / sizeof(struct epoll_event))
+
+struct eventpoll {
+	spinlock_t lock;
+	struct semaphore sem;
+
+	/* tasks sleeping in epoll_wait() */
+	wait_queue_head_t wq;
+
+	/* poll()/select() on the epoll file itself */
+	wait_queue_head_t poll_wait;
+
+	/* items whose wait queues have been woken */
+	struct list_head rdllist;
+
+	/* all items, hashed by file and descriptor */
+	struct list_head * hash;
+	unsigned int hashbits;
+};
+
+/* One per watched descriptor. */
+struct epitem {
+	struct list_head hlink;		/* ep->hash chain */
+	struct list_head rdllink;	/* ep->rdllist, or empty */
+	struct list_head fllink;	/* file->f_ep_links */
+	struct list_head pwqlist;	/* our eppoll_entries */
+	int nwait;			/* entries on pwqlist, -1 on failure */
+	struct eventpoll * ep;
+	struct file * file;
+	int fd;
+	struct epoll_event event;
+};
+
+/* One per wait queue the watched file's ->poll registered us on. */
+struct eppoll_entry {
+	struct list_head llink;
+	struct epitem * base;
+	wait_queue_t wait;
+	wait_queue_head_t * whead;
+};
+
+/* The poll table handed to ->poll at EPOLL_CTL_ADD time. */
+struct ep_pqueue {
+	poll_table pt;
+	struct epitem * epi;
+};
+
+static DECLARE_MUTEX(epsem);
+
+static kmem_cache_t * epi_cachep;
+static kmem_cache_t * pwq_cachep;
+
+static int ep_eventpoll_release(struct inode *, struct file *);
+static unsigned int ep_eventpoll_poll(struct file *, poll_table *);
+
+static struct file_operations eventpoll_fops = {
+	NULL,			/* lseek */
+	NULL,			/* read */
+	NULL,			/* write */
+	NULL,			/* readdir */
+	ep_eventpoll_poll,	/* poll */
+	NULL,			/* ioctl */
+	NULL,			/* mmap */
+	NULL,			/* open */
+	NULL,			/* flush */
+	ep_eventpoll_release,	/* release */
+};
+
+static struct inode_operations eventpoll_inode_operations = {
+	&eventpoll_fops,
+};
+
+static inline int is_file_epoll(struct file * file)
+{
+	return file->f_op == &eventpoll_fops;
+}
+
+static inline struct list_head * ep_hash_entry(struct eventpoll * ep,
+	struct file * file, int fd)
+{
+	unsigned long h = ((unsigned long) file / L1_CACHE_BYTES) ^ fd;
+
+	h ^= h >> ep->hashbits;
+	return ep->hash + (h & ((1 << ep->hashbits) - 1));
+}
+
+static struct epitem * ep_find(struct eventpoll * ep, struct file * file, int fd)
+{
+	struct list_head * head = ep_hash_entry(ep, file, fd), * tmp;
+
+	for (tmp = head->next; tmp != head; tmp = tmp->next) {
+		struct epitem * epi = list_entry(tmp, struct epitem, hlink);
+
+		if (epi->file == file && epi->fd == fd)
+			return epi;
+	}
+	return NULL;
+}
+
+/*
+ * Queue 'epi' as ready, and wake up whoever waits on the set.
+ * Called with ep->lock held; returns whether poll_wait needs a wakeup,
+ * which the caller does after dropping the lock.
+ */
+static inline int ep_make_ready(struct eventpoll * ep, struct epitem * epi)
+{
+	if (list_empty(&epi->rdllink))
+		list_add_tail(&epi->rdllink, &ep->rdllist);
+	if (waitqueue_active(&ep->wq))
+		wake_up(&ep->wq);
+	return waitqueue_active(&ep->poll_wait);
+}
+
+/*
+ * Wait queue callback: one of the wait queues of a watched file has
+ * been woken up.
+ */
+static void ep_poll_callback(wait_queue_t * wait, unsigned int mode)
+{
+	struct eppoll_entry * pwq = list_entry(wait, struct eppoll_entry, wait);
+	struct epitem * epi = pwq->base;
+	struct eventpoll * ep = epi->ep;
+	unsigned long flags;
+	int pwake;
+
+	spin_lock_irqsave(&ep->lock, flags);
+	pwake = ep_make_ready(ep, epi);
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	if (pwake)
+		wake_up(&ep->poll_wait);
+}
+
+/*
+ * poll_wait() from the watched file's ->poll at EPOLL_CTL_ADD time.
+ */
+static void ep_ptable_queue_proc(struct file * file, wait_queue_head_t * whead,
+	poll_table * pt)
+{
+	struct epitem * epi = ((struct ep_pqueue *) pt)->epi;
+	struct eppoll_entry * pwq;
+
+	if (epi->nwait < 0)
+		return;
+	pwq = kmem_cache_alloc(pwq_cachep, SLAB_KERNEL);
+	if (!pwq) {
+		epi->nwait = -1;
+		return;
+	}
+	init_waitqueue_func_entry(&pwq->wait, ep_poll_callback);
+	pwq->whead = whead;
+	pwq->base = epi;
+	add_wait_queue(whead, &pwq->wait);
+	list_add_tail(&pwq->llink, &epi->pwqlist);
+	epi->nwait++;
+}
+
+static void ep_unregister_pollwait(struct epitem * epi)
+{
+	struct eppoll_entry * pwq;
+
+	while (!list_empty(&epi->pwqlist)) {
+		pwq = list_entry(epi->pwqlist.next, struct eppoll_entry, llink);
+		list_del(&pwq->llink);
+		remove_wait_queue(pwq->whead, &pwq->wait);
+		kmem_cache_free(pwq_cachep, pwq);
+	}
+	epi->nwait = 0;
+}
+
+static int ep_insert(struct eventpoll * ep, struct epoll_event * event,
+	struct file * tfile, int fd)
+{
+	struct epitem * epi;
+	struct ep_pqueue epq;
+	unsigned int revents;
+	unsigned long flags;
+	int pwake = 0;
+
+	epi = kmem_cache_alloc(epi_cachep, SLAB_KERNEL);
+	if (!epi)
+		return -ENOMEM;
+	INIT_LIST_HEAD(&epi->rdllink);
+	INIT_LIST_HEAD(&epi->pwqlist);
+	epi->nwait = 0;
+	epi->ep = ep;
+	epi->file = tfile;
+	epi->fd = fd;
+	epi->event = *event;
+
+	/* Register on the file's wait queues, and see if it is ready now */
+	poll_initwait(&epq.pt, NULL);
+	epq.pt.qproc = ep_ptable_queue_proc;
+	epq.epi = epi;
+	lock_kernel();
+	revents = tfile->f_op->poll(tfile, &epq.pt);
+	unlock_kernel();
+
+	if (epi->nwait < 0) {
+		ep_unregister_pollwait(epi);
+		spin_lock_irqsave(&ep->lock, flags);
+		if (!list_empty(&epi->rdllink))
+			list_del(&epi->rdllink);
+		spin_unlock_irqrestore(&ep->lock, flags);
+		kmem_cache_free(epi_cachep, epi);
+		return -ENOMEM;
+	}
+
+	list_add_tail(&epi->fllink, &tfile->f_ep_links);
+	list_add(&epi->hlink, ep_hash_entry(ep, tfile, fd));
+
+	spin_lock_irqsave(&ep->lock, flags);
+	if (revents & event->events)
+		pwake = ep_make_ready(ep, epi);
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	if (pwake)
+		wake_up(&ep->poll_wait);
+	return 0;
+}
+
+static int ep_modify(struct eventpoll * ep, struct epitem * epi,
+	struct epoll_event * event)
+{
+	unsigned int revents;
+	unsigned long flags;
+	int pwake = 0;
+
+	epi->event = *event;
+
+	lock_kernel();
+	revents = epi->file->f_op->poll(epi->file, NULL);
+	unlock_kernel();
+
+	spin_lock_irqsave(&ep->lock, flags);
+	if (revents & event->events)
+		pwake = ep_make_ready(ep, epi);
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	if (pwake)
+		wake_up(&ep->poll_wait);
+	return 0;
+}
+
+/*
+ * Called with epsem and ep->sem held.
+ */
+static void ep_remove(struct eventpoll * ep, struct epitem * epi)
+{
+	unsigned long flags;
+
+	/* no more callbacks once we're off the wait queues */
+	ep_unregister_pollwait(epi);
+
+	list_del(&epi->fllink);
+	list_del(&epi->hlink);
+
+	spin_lock_irqsave(&ep->lock, flags);
+	if (!list_empty(&epi->rdllink))
+		list_del(&epi->rdllink);
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	kmem_cache_free(epi_cachep, epi);
+}
+
+/*
+ * Copy out up to 'maxevents' ready events. Level-triggered items that
+ * are still ready go back on the ready list, to be reported again by
+ * the next epoll_wait().
+ */
+static int ep_events_transfer(struct eventpoll * ep,
+	struct epoll_event * events, int maxevents)
+{
+	struct list_head txlist;
+	struct epitem * epi;
+	struct epoll_event ev;
+	unsigned int revents;
+	unsigned long flags;
+	int eventcnt = 0;
+
+	INIT_LIST_HEAD(&txlist);
+
+	down(&ep->sem);
+	spin_lock_irqsave(&ep->lock, flags);
+	list_splice(&ep->rdllist, &txlist);
+	INIT_LIST_HEAD(&ep->rdllist);
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	lock_kernel();
+	while (eventcnt < maxevents) {
+		spin_lock_irqsave(&ep->lock, flags);
+		if (list_empty(&txlist)) {
+			spin_unlock_irqrestore(&ep->lock, flags);
+			break;
+		}
+		epi = list_entry(txlist.next, struct epitem, rdllink);
+		list_del(&epi->rdllink);
+		INIT_LIST_HEAD(&epi->rdllink);
+		spin_unlock_irqrestore(&ep->lock, flags);
+
+		revents = epi->file->f_op->poll(epi->file, NULL);
+		revents &= epi->event.events;
+		if (!revents)
+			continue;
+
+		ev.events = revents;
+		ev.data = epi->event.data;
+		if (__copy_to_user(&events[eventcnt], &ev, sizeof(ev))) {
+			spin_lock_irqsave(&ep->lock, flags);
+			if (list_empty(&epi->rdllink))
+				list_add(&epi->rdllink, &txlist);
+			spin_unlock_irqrestore(&ep->lock, flags);
+			eventcnt = -EFAULT;
+			break;
+		}
+		eventcnt++;
+
+		if (!(epi->event.events & EPOLLET)) {
+			spin_lock_irqsave(&ep->lock, flags);
+			if (list_empty(&epi->rdllink))
+				list_add_tail(&epi->rdllink, &ep->rdllist);
+			spin_unlock_irqrestore(&ep->lock, flags);
+		}
+	}
+	unlock_kernel();
+
+	/* Whatever didn't fit is left for the next call */
+	spin_lock_irqsave(&ep->lock, flags);
+	list_splice(&txlist, &ep->rdllist);
+	spin_unlock_irqrestore(&ep->lock, flags);
+	up(&ep->sem);
+
+	return eventcnt;
+}
+
+static int ep_poll(struct eventpoll * ep, struct epoll_event * events,
+	int maxevents, long timeout)
+{
+	wait_queue_t wait;
+	unsigned long flags;
+	int res, eavail;
+
+retry:
+	res = 0;
+	spin_lock_irqsave(&ep->lock, flags);
+	if (list_empty(&ep->rdllist)) {
+		init_waitqueue_entry(&wait, current);
+		add_wait_queue(&ep->wq, &wait);
+		for (;;) {
+			set_current_state(TASK_INTERRUPTIBLE);
+			if (!list_empty(&ep->rdllist) || !timeout)
+				break;
+			if (signal_pending(current)) {
+				res = -EINTR;
+				break;
+			}
+			spin_unlock_irqrestore(&ep->lock, flags);
+			timeout = schedule_timeout(timeout);
+			spin_lock_irqsave(&ep->lock, flags);
+		}
+		remove_wait_queue(&ep->wq, &wait);
+		current->state = TASK_RUNNING;
+	}
+	eavail = !list_empty(&ep->rdllist);
+	spin_unlock_irqrestore(&ep->lock, flags);
+
+	/*
+	 * Items on the ready list may turn out not to be ready after all:
+	 * go back to sleep if none were, and there's time left.
+	 */
+	if (!res && eavail &&
+	    !(res = ep_events_transfer(ep, events, maxevents)) && timeout)
+		goto retry;
+	return res;
+}
+
+static unsigned int ep_eventpoll_poll(struct file * file, poll_table * wait)
+{
+	struct eventpoll * ep = file->private_data;
+
+	poll_wait(file, &ep->poll_wait, wait);
+	if (!list_empty(&ep->rdllist))
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static struct eventpoll * ep_alloc(int size)
+{
+	struct eventpoll * ep;
+	unsigned int i, hashbits;
+
+	for (hashbits = EP_MIN_HASH_BITS; hashbits < EP_MAX_HASH_BITS; hashbits++)
+		if ((1 << hashbits) >= size)
+			break;
+
+	ep = kmalloc(sizeof(struct eventpoll), GFP_KERNEL);
+	if (!ep)
+		return NULL;
+	ep->hash = kmalloc(sizeof(struct list_head) << hashbits, GFP_KERNEL);
+	if (!ep->hash) {
+		kfree(ep);
+		return NULL;
+	}
+	for (i = 0; i < (1 << hashbits); i++)
+		INIT_LIST_HEAD(&ep->hash[i]);
+	ep->hashbits = hashbits;
+	ep->lock = SPIN_LOCK_UNLOCKED;
+	init_MUTEX(&ep->sem);
+	init_waitqueue_head(&ep->wq);
+	init_waitqueue_head(&ep->poll_wait);
+	INIT_LIST_HEAD(&ep->rdllist);
+	return ep;
+}
+
+static void ep_free(struct eventpoll * ep)
+{
+	unsigned int i;
+
+	down(&epsem);
+	for (i = 0; i < (1 << ep->hashbits); i++) {
+		while (!list_empty(&ep->hash[i]))
+			ep_remove(ep, list_entry(ep->hash[i].next,
+				struct epitem, hlink));
+	}
+	up(&epsem);
+
+	kfree(ep->hash);
+	kfree(ep);
+}
+
+static int ep_eventpoll_release(struct inode * inode, struct file * file)
+{
+	if (file->private_data)
+		ep_free(file->private_data);
+	return 0;
+}
+
+/*
+ * The last reference to a watched file is gone: drop it from all the
+ * sets watching it.
+ */
+void eventpoll_release_file(struct file * file)
+{
+	struct epitem * epi;
+	struct eventpoll * ep;
+
+	down(&epsem);
+	while (!list_empty(&file->f_ep_links)) {
+		epi = list_entry(file->f_ep_links.next, struct epitem, fllink);
+		ep = epi->ep;
+		down(&ep->sem);
+		ep_remove(ep, epi);
+		up(&ep->sem);
+	}
+	up(&epsem);
+}
+
+static struct inode * ep_get_inode(void)
+{
+	struct inode * inode = get_empty_inode();
+
+	if (!inode)
+		return NULL;
+	inode->i_op = &eventpoll_inode_operations;
+	/* never goes on the dirty list, as for pipes */
+	inode->i_state = I_DIRTY;
+	inode->i_mode = S_IRUSR | S_IWUSR;
+	inode->i_uid = current->fsuid;
+	inode->i_gid = current->fsgid;
+	inode->i_atime = inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	inode->i_blksize = PAGE_SIZE;
+	return inode;
+}
+
+/*
+ * Create an epoll set. 'size' is a hint of how many descriptors will
+ * be watched, used to size the lookup hash.
+ */
+asmlinkage long sys_epoll_create(int size)
+{
+	struct eventpoll * ep;
+	struct inode * inode;
+	struct file * file;
+	int error, fd;
+
+	error = -EINVAL;
+	if (size <= 0)
+		goto out;
+
+	error = -ENFILE;
+	file = get_empty_filp();
+	if (!file)
+		goto out;
+
+	inode = ep_get_inode();
+	if (!inode)
+		goto out_filp;
+
+	error = get_unused_fd();
+	if (error < 0)
+		goto out_inode;
+	fd = error;
+
+	error = -ENOMEM;
+	ep = ep_alloc(size);
+	if (!ep)
+		goto out_fd;
+
+	file->f_dentry = d_alloc_root(inode);
+	if (!file->f_dentry)
+		goto out_ep;
+	file->f_pos = 0;
+	file->f_flags = O_RDONLY;
+	file->f_op = &eventpoll_fops;
+	file->f_mode = FMODE_READ;
+	file->private_data = ep;
+
+	fd_install(fd, file);
+	return fd;
+
+out_ep:
+	kfree(ep->hash);
+	kfree(ep);
+out_fd:
+	put_unused_fd(fd);
+out_inode:
+	iput(inode);
+out_filp:
+	put_filp(file);
+out:
+	return error;
+}
+
+asmlinkage long sys_epoll_ctl(int epfd, int op, int fd, struct epoll_event * event)
+{
+	struct file * file, * tfile;
+	struct eventpoll * ep;
+	struct epitem * epi;
+	struct epoll_event epds;
+	int error;
+
+	error = -EFAULT;
+	if (op != EPOLL_CTL_DEL && copy_from_user(&epds, event, sizeof(epds)))
+		goto out;
+
+	error = -EBADF;
+	file = fget(epfd);
+	if (!file)
+		goto out;
+	tfile = fget(fd);
+	if (!tfile)
+		goto out_fput;
+
+	error = -EPERM;
+	if (!tfile->f_op || !tfile->f_op->poll)
+		goto out_tfput;
+
+	/* epoll sets can't be nested: the wakeups would recurse */
+	error = -EINVAL;
+	if (!is_file_epoll(file) || is_file_epoll(tfile))
+		goto out_tfput;
+	ep = file->private_data;
+
+	down(&epsem);
+	down(&ep->sem);
+	epi = ep_find(ep, tfile, fd);
+	switch (op) {
+	case EPOLL_CTL_ADD:
+		error = -EEXIST;
+		if (!epi) {
+			epds.events |= POLLERR | POLLHUP;
+			error = ep_insert(ep, &epds, tfile, fd);
+		}
+		break;
+	case EPOLL_CTL_DEL:
+		error = -ENOENT;
+		if (epi) {
+			ep_remove(ep, epi);
+			error = 0;
+		}
+		break;
+	case EPOLL_CTL_MOD:
+		error = -ENOENT;
+		if (epi) {
+			epds.events |= POLLERR | POLLHUP;
+			error = ep_modify(ep, epi, &epds);
+		}
+		break;
+	default:
+		error = -EINVAL;
+	}
+	up(&ep->sem);
+	up(&epsem);
+
+out_tfput:
+	fput(tfile);
+out_fput:
+	fput(file);
+out:
+	return error;
+}
+
+/*
+ * Wait up to 'timeout' milliseconds (forever if negative) for events
+ * on the set, and return at most 'maxevents' of them.
+ */
+asmlinkage long sys_epoll_wait(int epfd, struct epoll_event * events,
+	int maxevents, int timeout)
+{
+	struct file * file;
+	long jtimeout;
+	int error;
+
+	if (maxevents <= 0 || maxevents > EP_MAX_EVENTS)
+		return -EINVAL;
+	if (verify_area(VERIFY_WRITE, events, maxevents * sizeof(struct epoll_event)))
+		return -EFAULT;
+
+	error = -EBADF;
+	file = fget(epfd);
+	if (!file)
+		goto out;
+	error = -EINVAL;
+	if (!is_file_epoll(file))
+		goto out_fput;
+
+	if (timeout < 0 || (unsigned long) timeout >=
+	    (MAX_SCHEDULE_TIMEOUT - 999) / HZ)
+		jtimeout = MAX_SCHEDULE_TIMEOUT;
+	else
+		jtimeout = ((unsigned long) timeout * HZ + 999) / 1000;
+	error = ep_poll(file->private_data, events, maxevents, jtimeout);
+
+out_fput:
+	fput(file);
+out:
+	return error;
+}
+
+static int __init eventpoll_init(void)
+{
+	epi_cachep = kmem_cache_create("eventpoll_epi",
+		sizeof(struct epitem), 0, SLAB_HWCACHE_ALIGN, NULL, NULL);
+	pwq_cachep = kmem_cache_create("eventpoll_pwq",
+		sizeof(struct eppoll_entry), 0, 0, NULL, NULL);
+	if (!epi_cachep || !pwq_cachep)
+		panic("Cannot create eventpoll SLAB caches");
+	return 0;
+}
+
+__initcall(eventpoll_init);
@@ -14,7 +14,10 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/locks.h>
+#include <linux/malloc.h>
 #include <linux/quotaops.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
 
 
 /*
@@ -70,181 +73,191 @@ struct ext2_group_desc * ext2_get_group_desc(struct super_block * sb,
 }
 
 /*
- * Read the bitmap for a given block_group, reading into the specified 
- * slot in the superblock's bitmap cache.
- *
- * Return >=0 on success or a -ve error code.
+ * Set up the group table at mount time, or bring its free counts up to
+ * date when a read-only filesystem goes read-write (e2fsck may have
+ * changed the descriptors). Bitmaps are loaded as they are needed.
  */
-
-static int read_block_bitmap (struct super_block * sb,
-			       unsigned int block_group,
-			       unsigned long bitmap_nr)
+int ext2_load_group_info (struct super_block * sb)
 {
+	struct ext2_group_info * gi = sb->u.ext2_sb.s_group_info;
+	struct ext2_super_block * es = sb->u.ext2_sb.s_es;
 	struct ext2_group_desc * gdp;
-	struct buffer_head * bh = NULL;
-	int retval = -EIO;
-	
-	gdp = ext2_get_group_desc (sb, block_group, NULL);
-	if (!gdp)
-		goto error_out;
-	retval = 0;
-	bh = bread (sb->s_dev, le32_to_cpu(gdp->bg_block_bitmap), sb->s_blocksize);
-	if (!bh) {
-		ext2_error (sb, "read_block_bitmap",
-			    "Cannot read block bitmap - "
-			    "block_group = %d, block_bitmap = %lu",
-			    block_group, (unsigned long) gdp->bg_block_bitmap);
-		retval = -EIO;
+	unsigned long i, groups = sb->u.ext2_sb.s_groups_count;
+	unsigned long free_blocks = 0, free_inodes = 0;
+
+	if (!gi) {
+		gi = vmalloc (groups * sizeof (struct ext2_group_info));
+		if (!gi)
+			return -ENOMEM;
+		sb->u.ext2_sb.s_alloc_stats =
+			kmalloc (sizeof (struct ext2_alloc_stats), GFP_KERNEL);
+		if (!sb->u.ext2_sb.s_alloc_stats) {
+			vfree (gi);
+			return -ENOMEM;
+		}
+		memset (gi, 0, groups * sizeof (struct ext2_group_info));
+		memset (sb->u.ext2_sb.s_alloc_stats, 0,
+			sizeof (struct ext2_alloc_stats));
+		for (i = 0; i < groups; i++)
+			init_MUTEX (&gi[i].gi_lock);
+		sb->u.ext2_sb.s_group_info = gi;
+	}
+	for (i = 0; i < groups; i++) {
+		gdp = ext2_get_group_desc (sb, i, NULL);
+		if (!gdp)
+			return -EIO;
+		gi[i].gi_free_blocks = le16_to_cpu(gdp->bg_free_blocks_count);
+		gi[i].gi_free_inodes = le16_to_cpu(gdp->bg_free_inodes_count);
+		gi[i].gi_used_dirs = le16_to_cpu(gdp->bg_used_dirs_count);
+		free_blocks += gi[i].gi_free_blocks;
+		free_inodes += gi[i].gi_free_inodes;
 	}
 	/*
-	 * On IO error, just leave a zero in the superblock's block pointer for
-	 * this group.  The IO will be retried next time.
+	 * The totals in the superblock are only summed from the groups
+	 * when it is written, and may be stale after a crash.
 	 */
-error_out:
-	sb->u.ext2_sb.s_block_bitmap_number[bitmap_nr] = block_group;
-	sb->u.ext2_sb.s_block_bitmap[bitmap_nr] = bh;
-	return retval;
+	es->s_free_blocks_count = cpu_to_le32(free_blocks);
+	es->s_free_inodes_count = cpu_to_le32(free_inodes);
+	return 0;
 }
 
-/*
- * load_block_bitmap loads the block bitmap for a blocks group
- *
- * It maintains a cache for the last bitmaps loaded.  This cache is managed
- * with a LRU algorithm.
- *
- * Notes:
- * 1/ There is one cache per mounted file system.
- * 2/ If the file system contains less than EXT2_MAX_GROUP_LOADED groups,
- *    this function reads the bitmap without maintaining a LRU cache.
- * 
- * Return the slot used to store the bitmap, or a -ve error code.
- */
-static int load__block_bitmap (struct super_block * sb,
-			       unsigned int block_group)
+void ext2_release_group_info (struct super_block * sb)
 {
-	int i, j, retval = 0;
-	unsigned long block_bitmap_number;
-	struct buffer_head * block_bitmap;
-
-	if (block_group >= sb->u.ext2_sb.s_groups_count)
-		ext2_panic (sb, "load_block_bitmap",
-			    "block_group >= groups_count - "
-			    "block_group = %d, groups_count = %lu",
-			    block_group, sb->u.ext2_sb.s_groups_count);
+	struct ext2_group_info * gi = sb->u.ext2_sb.s_group_info;
+	unsigned long i;
 
-	if (sb->u.ext2_sb.s_groups_count <= EXT2_MAX_GROUP_LOADED) {
-		if (sb->u.ext2_sb.s_block_bitmap[block_group]) {
-			if (sb->u.ext2_sb.s_block_bitmap_number[block_group] ==
-			    block_group)
-				return block_group;
-			ext2_error (sb, "load_block_bitmap",
-				    "block_group != block_bitmap_number");
-		}
-		retval = read_block_bitmap (sb, block_group, block_group);
-		if (retval < 0)
-			return retval;
-		return block_group;
+	if (!gi)
+		return;
+	for (i = 0; i < sb->u.ext2_sb.s_groups_count; i++) {
+		if (gi[i].gi_block_bitmap)
+			brelse (gi[i].gi_block_bitmap);
+		if (gi[i].gi_inode_bitmap)
+			brelse (gi[i].gi_inode_bitmap);
 	}
+	vfree (gi);
+	kfree (sb->u.ext2_sb.s_alloc_stats);
+	sb->u.ext2_sb.s_group_info = NULL;
+	sb->u.ext2_sb.s_alloc_stats = NULL;
+}
+
+/*
+ * Account for one call of an allocator, which started at 'start'.
+ */
+void ext2_alloc_latency (struct ext2_alloc_latency * al,
+			 struct timeval * start, int failed)
+{
+	struct timeval now;
+	unsigned long usecs;
+	int i;
 
-	for (i = 0; i < sb->u.ext2_sb.s_loaded_block_bitmaps &&
-		    sb->u.ext2_sb.s_block_bitmap_number[i] != block_group; i++)
+	do_gettimeofday(&now);
+	usecs = (now.tv_sec - start->tv_sec) * 1000000 +
+		now.tv_usec - start->tv_usec;
+	if ((long) usecs < 0)
+		usecs = 0;
+	al->calls++;
+	if (failed)
+		al->failed++;
+	al->usecs += usecs;
+	if (usecs > al->max_usecs)
+		al->max_usecs = usecs;
+	for (i = 0; i < EXT2_ALLOC_HIST - 1 && (usecs >> (i + 1)); i++)
 		;
-	if (i < sb->u.ext2_sb.s_loaded_block_bitmaps &&
-  	    sb->u.ext2_sb.s_block_bitmap_number[i] == block_group) {
-		block_bitmap_number = sb->u.ext2_sb.s_block_bitmap_number[i];
-		block_bitmap = sb->u.ext2_sb.s_block_bitmap[i];
-		for (j = i; j > 0; j--) {
-			sb->u.ext2_sb.s_block_bitmap_number[j] =
-				sb->u.ext2_sb.s_block_bitmap_number[j - 1];
-			sb->u.ext2_sb.s_block_bitmap[j] =
-				sb->u.ext2_sb.s_block_bitmap[j - 1];
-		}
-		sb->u.ext2_sb.s_block_bitmap_number[0] = block_bitmap_number;
-		sb->u.ext2_sb.s_block_bitmap[0] = block_bitmap;
+	al->hist[i]++;
+}
 
-		/*
-		 * There's still one special case here --- if block_bitmap == 0
-		 * then our last attempt to read the bitmap failed and we have
-		 * just ended up caching that failure.  Try again to read it.
-		 */
-		if (!block_bitmap)
-			retval = read_block_bitmap (sb, block_group, 0);
-	} else {
-		if (sb->u.ext2_sb.s_loaded_block_bitmaps < EXT2_MAX_GROUP_LOADED)
-			sb->u.ext2_sb.s_loaded_block_bitmaps++;
-		else
-			brelse (sb->u.ext2_sb.s_block_bitmap[EXT2_MAX_GROUP_LOADED - 1]);
-		for (j = sb->u.ext2_sb.s_loaded_block_bitmaps - 1; j > 0;  j--) {
-			sb->u.ext2_sb.s_block_bitmap_number[j] =
-				sb->u.ext2_sb.s_block_bitmap_number[j - 1];
-			sb->u.ext2_sb.s_block_bitmap[j] =
-				sb->u.ext2_sb.s_block_bitmap[j - 1];
+/*
+ * Memory is short: let go of the bitmaps of the groups which haven't
+ * been used since the last call, going through 1/priority of the group
+ * table. Groups being worked on are skipped. The bitmaps only leave the
+ * group table; the buffer cache frees them once it needs the memory.
+ */
+void ext2_shrink_bitmaps (struct super_block * sb, int priority)
+{
+	struct ext2_group_info * gi;
+	unsigned long groups = sb->u.ext2_sb.s_groups_count;
+	unsigned long i = sb->u.ext2_sb.s_shrink_group;
+	unsigned long count = groups;
+
+	if (!sb->u.ext2_sb.s_group_info)
+		return;
+	if (priority)
+		count /= priority;
+	while (count--) {
+		if (i >= groups)
+			i = 0;
+		gi = sb->u.ext2_sb.s_group_info + i++;
+		if (!gi->gi_block_bitmap && !gi->gi_inode_bitmap)
+			continue;
+		if (down_trylock (&gi->gi_lock))
+			continue;
+		if (gi->gi_referenced)
+			gi->gi_referenced = 0;
+		else {
+			if (gi->gi_block_bitmap) {
+				brelse (gi->gi_block_bitmap);
+				gi->gi_block_bitmap = NULL;
+				sb->u.ext2_sb.s_alloc_stats->bitmaps_cached--;
+			}
+			if (gi->gi_inode_bitmap) {
+				brelse (gi->gi_inode_bitmap);
+				gi->gi_inode_bitmap = NULL;
+				sb->u.ext2_sb.s_alloc_stats->bitmaps_cached--;
+			}
 		}
-		retval = read_block_bitmap (sb, block_group, 0);
+		up (&gi->gi_lock);
 	}
-	return retval;
+	sb->u.ext2_sb.s_shrink_group = i;
 }
 
 /*
- * Load the block bitmap for a given block group.  First of all do a couple
- * of fast lookups for common cases and then pass the request onto the guts
- * of the bitmap loader.
+ * Return the block bitmap of a group, reading it if it isn't in the
+ * group table yet. The caller holds the group's gi_lock. Bitmaps stay
+ * there, which saves rereading them over and over on filesystems with
+ * many groups, until unmount or until ext2_shrink_bitmaps() finds them
+ * idle.
  *
- * Return the slot number of the group in the superblock bitmap cache's on
- * success, or a -ve error code.
- *
- * There is still one inconsistancy here --- if the number of groups in this
- * filesystems is <= EXT2_MAX_GROUP_LOADED, then we have no way of 
- * differentiating between a group for which we have never performed a bitmap
- * IO request, and a group for which the last bitmap read request failed.
+ * On an I/O error, NULL is returned and the read is retried next time.
  */
-static inline int load_block_bitmap (struct super_block * sb,
-				     unsigned int block_group)
+static struct buffer_head * load_block_bitmap (struct super_block * sb,
+					       unsigned int block_group)
 {
-	int slot;
-	
-	/*
-	 * Do the lookup for the slot.  First of all, check if we're asking
-	 * for the same slot as last time, and did we succeed that last time?
-	 */
-	if (sb->u.ext2_sb.s_loaded_block_bitmaps > 0 &&
-	    sb->u.ext2_sb.s_block_bitmap_number[0] == block_group &&
-	    sb->u.ext2_sb.s_block_bitmap[block_group]) {
-		return 0;
+	struct ext2_group_info * gi;
+	struct ext2_group_desc * gdp;
+	struct buffer_head * bh;
+
+	if (block_group >= sb->u.ext2_sb.s_groups_count)
+		ext2_panic (sb, "load_block_bitmap",
+			    "block_group >= groups_count - "
+			    "block_group = %d, groups_count = %lu",
+			    block_group, sb->u.ext2_sb.s_groups_count);
+
+	gi = sb->u.ext2_sb.s_group_info + block_group;
+	gi->gi_referenced = 1;
+	if (gi->gi_block_bitmap) {
+		sb->u.ext2_sb.s_alloc_stats->bitmap_hits++;
+		return gi->gi_block_bitmap;
 	}
-	/*
-	 * Or can we do a fast lookup based on a loaded group on a filesystem
-	 * small enough to be mapped directly into the superblock?
-	 */
-	else if (sb->u.ext2_sb.s_groups_count <= EXT2_MAX_GROUP_LOADED && 
-		 sb->u.ext2_sb.s_block_bitmap_number[block_group] == block_group &&
-		 sb->u.ext2_sb.s_block_bitmap[block_group]) {
-		slot = block_group;
+	gdp = ext2_get_group_desc (sb, block_group, NULL);
+	if (!gdp)
+		return NULL;
+	sb->u.ext2_sb.s_alloc_stats->bitmap_reads++;
+	bh = bread (sb->s_dev, le32_to_cpu(gdp->bg_block_bitmap), sb->s_blocksize);
+	if (!bh) {
+		ext2_error (sb, "load_block_bitmap",
+			    "Cannot read block bitmap - "
+			    "block_group = %d, block_bitmap = %lu",
+			    block_group, (unsigned long) gdp->bg_block_bitmap);
+		return NULL;
 	}
-	/*
-	 * If not, then do a full lookup for this block group.
-	 */
-	else {
-		slot = load__block_bitmap (sb, block_group);
+	/* bread() may have slept */
+	if (gi->gi_block_bitmap) {
+		brelse (bh);
+		return gi->gi_block_bitmap;
 	}
-
-	/*
-	 * <0 means we just got an error
-	 */
-	if (slot < 0)
-		return slot;
-	
-	/*
-	 * If it's a valid slot, we may still have cached a previous IO error,
-	 * in which case the bh in the superblock cache will be zero.
-	 */
-	if (!sb->u.ext2_sb.s_block_bitmap[slot])
-		return -EIO;
-	
-	/*
-	 * Must have been read in OK to get this far.
-	 */
-	return slot;
+	gi->gi_block_bitmap = bh;
+	sb->u.ext2_sb.s_alloc_stats->bitmaps_cached++;
+	return bh;
 }
 
 void ext2_free_blocks (const struct inode * inode, unsigned long block,
@@ -255,10 +268,10 @@ void ext2_free_blocks (const struct inode * inode, unsigned long block,
 	unsigned long block_group;
 	unsigned long bit;
 	unsigned long i;
-	int bitmap_nr;
 	unsigned long overflow;
 	struct super_block * sb;
 	struct ext2_group_desc * gdp;
+	struct ext2_group_info * gi;
 	struct ext2_super_block * es;
 
 	sb = inode->i_sb;
@@ -266,14 +279,13 @@ void ext2_free_blocks (const struct inode * inode, unsigned long block,
 		printk ("ext2_free_blocks: nonexistent device");
 		return;
 	}
-	lock_super (sb);
 	es = sb->u.ext2_sb.s_es;
 	if (block < le32_to_cpu(es->s_first_data_block) || 
 	    (block + count) > le32_to_cpu(es->s_blocks_count)) {
 		ext2_error (sb, "ext2_free_blocks",
 			    "Freeing blocks not in datazone - "
 			    "block = %lu, count = %lu", block, count);
-		goto error_return;
+		return;
 	}
 
 	ext2_debug ("freeing block %lu\n", block);
@@ -292,11 +304,11 @@ do_more:
 		overflow = bit + count - EXT2_BLOCKS_PER_GROUP(sb);
 		count -= overflow;
 	}
-	bitmap_nr = load_block_bitmap (sb, block_group);
-	if (bitmap_nr < 0)
+	gi = sb->u.ext2_sb.s_group_info + block_group;
+	down (&gi->gi_lock);
+	bh = load_block_bitmap (sb, block_group);
+	if (!bh)
 		goto error_return;
-	
-	bh = sb->u.ext2_sb.s_block_bitmap[bitmap_nr];
 	gdp = ext2_get_group_desc (sb, block_group, &bh2);
 	if (!gdp)
 		goto error_return;
@@ -319,31 +331,50 @@ do_more:
 				      "bit already cleared for block %lu", 
 				      block);
 		else {
+			/* directory and symlink blocks may be in the journal */
+			if (!S_ISREG(inode->i_mode))
+				ext2_journal_revoke (sb, block + i);
 			DQUOT_FREE_BLOCK(sb, inode, 1);
 			gdp->bg_free_blocks_count =
 				cpu_to_le16(le16_to_cpu(gdp->bg_free_blocks_count)+1);
-			es->s_free_blocks_count =
-				cpu_to_le32(le32_to_cpu(es->s_free_blocks_count)+1);
+			gi->gi_free_blocks++;
 		}
 	}
 	
-	mark_buffer_dirty(bh2, 1);
-	mark_buffer_dirty(sb->u.ext2_sb.s_sbh, 1);
+	ext2_journal_dirty_metadata (sb, bh2);
 
-	mark_buffer_dirty(bh, 1);
-	if (sb->s_flags & MS_SYNCHRONOUS) {
-		ll_rw_block (WRITE, 1, &bh);
-		wait_on_buffer (bh);
-	}
+	ext2_journal_dirty_metadata (sb, bh);
+	if (sb->s_flags & MS_SYNCHRONOUS)
+		ext2_sync_metadata (sb, bh);
+	sb->s_dirt = 1;
+	up (&gi->gi_lock);
 	if (overflow) {
 		block += count;
 		count = overflow;
 		goto do_more;
 	}
-	sb->s_dirt = 1;
-error_return:
-	unlock_super (sb);
 	return;
+
+error_return:
+	up (&gi->gi_lock);
+}
+
+/*
+ * Are we down to the reserved blocks? The superblock count is only
+ * brought up to date when the superblock is written, so it is good
+ * enough while we are well clear of the reserve; closer than that,
+ * sum the group counts.
+ */
+static int ext2_in_reserve (struct super_block * sb)
+{
+	unsigned long reserved;
+
+	reserved = le32_to_cpu(sb->u.ext2_sb.s_es->s_r_blocks_count);
+	if (!reserved)
+		return 0;
+	if (le32_to_cpu(sb->u.ext2_sb.s_es->s_free_blocks_count) > 2 * reserved)
+		return 0;
+	return ext2_count_free_blocks (sb) <= reserved;
 }
 
 /*
@@ -352,17 +383,26 @@ error_return:
  * is allocated.  Otherwise a forward search is made for a free block; within 
  * each block group the search first looks for an entire free byte in the block
  * bitmap, and then for any free bit if that fails.
+ *
+ * If prealloc_block is given, the free blocks following the one found
+ * are preallocated as well, up to *prealloc_count blocks in all (or
+ * the superblock's preallocation default, if that is larger).
+ *
+ * Groups are picked from the free counts in the group table, so only
+ * the bitmap of the group a block is taken from is looked at. Only
+ * that group is locked, so allocations in other groups can go on while
+ * this one waits for its bitmap to be read.
  */
-int ext2_new_block (const struct inode * inode, unsigned long goal,
+static int __ext2_new_block (const struct inode * inode, unsigned long goal,
     u32 * prealloc_count, u32 * prealloc_block, int * err)
 {
 	struct buffer_head * bh;
 	struct buffer_head * bh2;
 	char * p, * r;
 	int i, j, k, tmp;
-	int bitmap_nr;
 	struct super_block * sb;
 	struct ext2_group_desc * gdp;
+	struct ext2_group_info * gi;
 	struct ext2_super_block * es;
 #ifdef EXT2FS_DEBUG
 	static int goal_hits = 0, goal_attempts = 0;
@@ -374,16 +414,13 @@ int ext2_new_block (const struct inode * inode, unsigned long goal,
 		return 0;
 	}
 
-	lock_super (sb);
 	es = sb->u.ext2_sb.s_es;
-	if (le32_to_cpu(es->s_free_blocks_count) <= le32_to_cpu(es->s_r_blocks_count) &&
+	if (ext2_in_reserve (sb) &&
 	    ((sb->u.ext2_sb.s_resuid != current->fsuid) &&
 	     (sb->u.ext2_sb.s_resgid == 0 ||
 	      !in_group_p (sb->u.ext2_sb.s_resgid)) && 
-	     !capable(CAP_SYS_RESOURCE))) {
-		unlock_super (sb);
+	     !capable(CAP_SYS_RESOURCE)))
 		return 0;
-	}
 
 	ext2_debug ("goal=%lu.\n", goal);
 
@@ -395,21 +432,21 @@ repeat:
 	    goal >= le32_to_cpu(es->s_blocks_count))
 		goal = le32_to_cpu(es->s_first_data_block);
 	i = (goal - le32_to_cpu(es->s_first_data_block)) / EXT2_BLOCKS_PER_GROUP(sb);
-	gdp = ext2_get_group_desc (sb, i, &bh2);
-	if (!gdp)
-		goto io_error;
+	gi = sb->u.ext2_sb.s_group_info + i;
 
-	if (le16_to_cpu(gdp->bg_free_blocks_count) > 0) {
+	if (gi->gi_free_blocks > 0) {
+		down (&gi->gi_lock);
+		gdp = ext2_get_group_desc (sb, i, &bh2);
+		if (!gdp)
+			goto io_error;
 		j = ((goal - le32_to_cpu(es->s_first_data_block)) % EXT2_BLOCKS_PER_GROUP(sb));
 #ifdef EXT2FS_DEBUG
 		if (j)
 			goal_attempts++;
 #endif
-		bitmap_nr = load_block_bitmap (sb, i);
-		if (bitmap_nr < 0)
+		bh = load_block_bitmap (sb, i);
+		if (!bh)
 			goto io_error;
-		
-		bh = sb->u.ext2_sb.s_block_bitmap[bitmap_nr];
 
 		ext2_debug ("goal is at %d:%d.\n", i, j);
 
@@ -461,36 +498,38 @@ repeat:
 			j = k;
 			goto got_block;
 		}
+		up (&gi->gi_lock);
 	}
 
 	ext2_debug ("Bit not found in block group %d.\n", i);
 
 	/*
 	 * Now search the rest of the groups.  We assume that 
-	 * i and gdp correctly point to the last group visited.
+	 * i correctly points to the last group visited. The
+	 * unlocked count is only a hint: check it again once
+	 * the group is locked.
 	 */
 	for (k = 0; k < sb->u.ext2_sb.s_groups_count; k++) {
 		i++;
 		if (i >= sb->u.ext2_sb.s_groups_count)
 			i = 0;
-		gdp = ext2_get_group_desc (sb, i, &bh2);
-		if (!gdp) {
-			*err = -EIO;
-			unlock_super (sb);
-			return 0;
-		}
-		if (le16_to_cpu(gdp->bg_free_blocks_count) > 0)
+		gi = sb->u.ext2_sb.s_group_info + i;
+		if (!gi->gi_free_blocks)
+			continue;
+		down (&gi->gi_lock);
+		if (gi->gi_free_blocks > 0)
 			break;
+		up (&gi->gi_lock);
 	}
-	if (k >= sb->u.ext2_sb.s_groups_count) {
-		unlock_super (sb);
+	sb->u.ext2_sb.s_alloc_stats->groups_scanned += k;
+	if (k >= sb->u.ext2_sb.s_groups_count)
 		return 0;
-	}
-	bitmap_nr = load_block_bitmap (sb, i);
-	if (bitmap_nr < 0)
+	gdp = ext2_get_group_desc (sb, i, &bh2);
+	if (!gdp)
+		goto io_error;
+	bh = load_block_bitmap (sb, i);
+	if (!bh)
 		goto io_error;
-	
-	bh = sb->u.ext2_sb.s_block_bitmap[bitmap_nr];
 	r = memscan(bh->b_data, 0, EXT2_BLOCKS_PER_GROUP(sb) >> 3);
 	j = (r - bh->b_data) << 3;
 	if (j < EXT2_BLOCKS_PER_GROUP(sb))
@@ -501,7 +540,7 @@ repeat:
 	if (j >= EXT2_BLOCKS_PER_GROUP(sb)) {
 		ext2_error (sb, "ext2_new_block",
 			    "Free blocks count corrupted for block group %d", i);
-		unlock_super (sb);
+		up (&gi->gi_lock);
 		return 0;
 	}
 
@@ -521,7 +560,7 @@ got_block:
 	 * Check quota for allocation of this block.
 	 */
 	if(DQUOT_ALLOC_BLOCK(sb, inode, 1)) {
-		unlock_super(sb);
+		up (&gi->gi_lock);
 		*err = -EDQUOT;
 		return 0;
 	}
@@ -540,6 +579,7 @@ got_block:
 		ext2_warning (sb, "ext2_new_block",
 			      "bit already set for block %d", j);
 		DQUOT_FREE_BLOCK(sb, inode, 1);
+		up (&gi->gi_lock);
 		goto repeat;
 	}
 
@@ -554,6 +594,11 @@ got_block:
 
 		prealloc_goal = es->s_prealloc_blocks ?
 			es->s_prealloc_blocks : EXT2_DEFAULT_PREALLOC_BLOCKS;
+		/* the caller may ask for a longer run */
+		if (*prealloc_count > prealloc_goal)
+			prealloc_goal = *prealloc_count;
+		if (prealloc_goal > EXT2_MAX_PREALLOC_BLOCKS)
+			prealloc_goal = EXT2_MAX_PREALLOC_BLOCKS;
 
 		*prealloc_count = 0;
 		*prealloc_block = tmp + 1;
@@ -571,9 +616,7 @@ got_block:
 		gdp->bg_free_blocks_count =
 			cpu_to_le16(le16_to_cpu(gdp->bg_free_blocks_count) -
 			       *prealloc_count);
-		es->s_free_blocks_count =
-			cpu_to_le32(le32_to_cpu(es->s_free_blocks_count) -
-			       *prealloc_count);
+		gi->gi_free_blocks -= *prealloc_count;
 		ext2_debug ("Preallocated a further %lu bits.\n",
 			    *prealloc_count);
 	}
@@ -581,18 +624,16 @@ got_block:
 
 	j = tmp;
 
-	mark_buffer_dirty(bh, 1);
-	if (sb->s_flags & MS_SYNCHRONOUS) {
-		ll_rw_block (WRITE, 1, &bh);
-		wait_on_buffer (bh);
-	}
+	ext2_journal_dirty_metadata (sb, bh);
+	if (sb->s_flags & MS_SYNCHRONOUS)
+		ext2_sync_metadata (sb, bh);
 
 	if (j >= le32_to_cpu(es->s_blocks_count)) {
 		ext2_error (sb, "ext2_new_block",
 			    "block(%d) >= blocks count(%d) - "
 			    "block_group = %d, es == %p ",j,
 			le32_to_cpu(es->s_blocks_count), i, es);
-		unlock_super (sb);
+		up (&gi->gi_lock);
 		return 0;
 	}
 
@@ -600,31 +641,45 @@ got_block:
 		    "Goal hits %d of %d.\n", j, goal_hits, goal_attempts);
 
 	gdp->bg_free_blocks_count = cpu_to_le16(le16_to_cpu(gdp->bg_free_blocks_count) - 1);
-	mark_buffer_dirty(bh2, 1);
-	es->s_free_blocks_count = cpu_to_le32(le32_to_cpu(es->s_free_blocks_count) - 1);
-	mark_buffer_dirty(sb->u.ext2_sb.s_sbh, 1);
+	gi->gi_free_blocks--;
+	ext2_journal_dirty_metadata (sb, bh2);
 	sb->s_dirt = 1;
-	unlock_super (sb);
+	up (&gi->gi_lock);
 	*err = 0;
 	return j;
 	
 io_error:
 	*err = -EIO;
-	unlock_super (sb);
+	up (&gi->gi_lock);
 	return 0;
 	
 }
 
+int ext2_new_block (const struct inode * inode, unsigned long goal,
+    u32 * prealloc_count, u32 * prealloc_block, int * err)
+{
+	struct timeval start;
+	int block;
+
+	do_gettimeofday(&start);
+	block = __ext2_new_block (inode, goal, prealloc_count, prealloc_block,
+				  err);
+	if (inode->i_sb)
+		ext2_alloc_latency (&inode->i_sb->u.ext2_sb.s_alloc_stats->blocks,
+				    &start, !block);
+	return block;
+}
+
 unsigned long ext2_count_free_blocks (struct super_block * sb)
 {
 #ifdef EXT2FS_DEBUG
 	struct ext2_super_block * es;
+	struct buffer_head * bh;
 	unsigned long desc_count, bitmap_count, x;
-	int bitmap_nr;
 	struct ext2_group_desc * gdp;
+	struct ext2_group_info * gi;
 	int i;
 	
-	lock_super (sb);
 	es = sb->u.ext2_sb.s_es;
 	desc_count = 0;
 	bitmap_count = 0;
@@ -634,22 +689,31 @@ unsigned long ext2_count_free_blocks (struct super_block * sb)
 		if (!gdp)
 			continue;
 		desc_count += le16_to_cpu(gdp->bg_free_blocks_count);
-		bitmap_nr = load_block_bitmap (sb, i);
-		if (bitmap_nr < 0)
+		gi = sb->u.ext2_sb.s_group_info + i;
+		down (&gi->gi_lock);
+		bh = load_block_bitmap (sb, i);
+		if (!bh) {
+			up (&gi->gi_lock);
 			continue;
+		}
 		
-		x = ext2_count_free (sb->u.ext2_sb.s_block_bitmap[bitmap_nr],
-				     sb->s_blocksize);
+		x = ext2_count_free (bh, sb->s_blocksize);
+		up (&gi->gi_lock);
 		printk ("group %d: stored = %d, counted = %lu\n",
 			i, le16_to_cpu(gdp->bg_free_blocks_count), x);
 		bitmap_count += x;
 	}
 	printk("ext2_count_free_blocks: stored = %lu, computed = %lu, %lu\n",
 	       le32_to_cpu(es->s_free_blocks_count), desc_count, bitmap_count);
-	unlock_super (sb);
 	return bitmap_count;
 #else
-	return le32_to_cpu(sb->u.ext2_sb.s_es->s_free_blocks_count);
+	struct ext2_group_info * gi = sb->u.ext2_sb.s_group_info;
+	unsigned long count = 0;
+	int i;
+
+	for (i = 0; i < sb->u.ext2_sb.s_groups_count; i++)
+		count += gi[i].gi_free_blocks;
+	return count;
 #endif
 }
 
@@ -686,11 +750,10 @@ void ext2_check_blocks_bitmap (struct super_block * sb)
 	struct ext2_super_block * es;
 	unsigned long desc_count, bitmap_count, x;
 	unsigned long desc_blocks;
-	int bitmap_nr;
 	struct ext2_group_desc * gdp;
+	struct ext2_group_info * gi;
 	int i, j;
 
-	lock_super (sb);
 	es = sb->u.ext2_sb.s_es;
 	desc_count = 0;
 	bitmap_count = 0;
@@ -702,11 +765,13 @@ void ext2_check_blocks_bitmap (struct super_block * sb)
 		if (!gdp)
 			continue;
 		desc_count += le16_to_cpu(gdp->bg_free_blocks_count);
-		bitmap_nr = load_block_bitmap (sb, i);
-		if (bitmap_nr < 0)
+		gi = sb->u.ext2_sb.s_group_info + i;
+		down (&gi->gi_lock);
+		bh = load_block_bitmap (sb, i);
+		if (!bh) {
+			up (&gi->gi_lock);
 			continue;
-		
-		bh = sb->u.ext2_sb.s_block_bitmap[bitmap_nr];
+		}
 
 		if (!(sb->u.ext2_sb.s_feature_ro_compat &
 		     EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER) ||
@@ -746,6 +811,7 @@ void ext2_check_blocks_bitmap (struct super_block * sb)
 				    "Wrong free blocks count for group %d, "
 				    "stored = %d, counted = %lu", i,
 				    le16_to_cpu(gdp->bg_free_blocks_count), x);
+		up (&gi->gi_lock);
 		bitmap_count += x;
 	}
 	if (le32_to_cpu(es->s_free_blocks_count) != bitmap_count)
@@ -753,5 +819,4 @@ void ext2_check_blocks_bitmap (struct super_block * sb)
 			    "Wrong free blocks count in super block, "
 			    "stored = %lu, counted = %lu",
 			    (unsigned long) le32_to_cpu(es->s_free_blocks_count), bitmap_count);
-	unlock_super (sb);
 }
@@ -87,7 +87,7 @@ static inline void remove_suid(struct inode *inode)
 	mode &= inode->i_mode;
 	if (mode && !capable(CAP_FSETID)) {
 		inode->i_mode &= ~mode;
-		mark_inode_dirty(inode);
+		ext2_mark_inode_dirty(inode);
 	}
 }
 
@@ -97,15 +97,27 @@ static inline void remove_suid(struct inode *inode)
 static ssize_t
 ext2_file_write(struct file *file, const char *buf, size_t count, loff_t *ppos)
 {
+	struct inode *inode = file->f_dentry->d_inode;
+	unsigned long want;
 	ssize_t retval;
 
+	/*
+	 * Tell ext2_alloc_block() how big this write is, so that the
+	 * blocks it needs are allocated as one run rather than one at
+	 * a time as each page gets written.
+	 */
+	want = (count + inode->i_sb->s_blocksize - 1) >>
+		EXT2_BLOCK_SIZE_BITS(inode->i_sb);
+	if (want > EXT2_MAX_PREALLOC_BLOCKS)
+		want = EXT2_MAX_PREALLOC_BLOCKS;
+	inode->u.ext2_i.i_alloc_want = want;
 	retval = generic_file_write(file, buf, count,
 						 ppos, block_write_partial_page);
+	inode->u.ext2_i.i_alloc_want = 0;
 	if (retval > 0) {
-		struct inode *inode = file->f_dentry->d_inode;
 		remove_suid(inode);
 		inode->i_ctime = inode->i_mtime = CURRENT_TIME;
-		mark_inode_dirty(inode);
+		ext2_mark_inode_dirty(inode);
 	}
 	return retval;
 }
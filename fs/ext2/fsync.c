@@ -127,6 +127,13 @@ int ext2_sync_file(struct file * file, struct dentry *dentry)
 
 	err = generic_buffer_fdatasync(inode, 0, ~0UL);
 
+	/*
+	 * With a journal, the indirect blocks go out with the commit
+	 * that ext2_sync_inode() waits for.
+	 */
+	if (inode->i_sb->u.ext2_sb.s_journal)
+		goto skip;
+
 	for (wait=0; wait<=1; wait++)
 	{
 		err |= sync_indirect(inode,
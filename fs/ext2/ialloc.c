@@ -35,126 +35,51 @@
 
 
 /*
- * Read the inode allocation bitmap for a given block_group, reading
- * into the specified slot in the superblock's bitmap cache.
+ * Return the inode bitmap of a group from the group table, reading it
+ * on first use (see load_block_bitmap in balloc.c). The caller holds
+ * the group's gi_lock.
  *
- * Return >=0 on success or a -ve error code.
+ * On an I/O error, NULL is returned and the read is retried next time.
  */
-static int read_inode_bitmap (struct super_block * sb,
-			       unsigned long block_group,
-			       unsigned int bitmap_nr)
+static struct buffer_head * load_inode_bitmap (struct super_block * sb,
+					       unsigned int block_group)
 {
+	struct ext2_group_info * gi;
 	struct ext2_group_desc * gdp;
-	struct buffer_head * bh = NULL;
-	int retval = 0;
-
-	gdp = ext2_get_group_desc (sb, block_group, NULL);
-	if (!gdp) {
-		retval = -EIO;
-		goto error_out;
-	}
-	bh = bread (sb->s_dev, le32_to_cpu(gdp->bg_inode_bitmap), sb->s_blocksize);
-	if (!bh) {
-		ext2_error (sb, "read_inode_bitmap",
-			    "Cannot read inode bitmap - "
-			    "block_group = %lu, inode_bitmap = %lu",
-			    block_group, (unsigned long) gdp->bg_inode_bitmap);
-		retval = -EIO;
-	}
-	/*
-	 * On IO error, just leave a zero in the superblock's block pointer for
-	 * this group.  The IO will be retried next time.
-	 */
-error_out:
-	sb->u.ext2_sb.s_inode_bitmap_number[bitmap_nr] = block_group;
-	sb->u.ext2_sb.s_inode_bitmap[bitmap_nr] = bh;
-	return retval;
-}
-
-/*
- * load_inode_bitmap loads the inode bitmap for a blocks group
- *
- * It maintains a cache for the last bitmaps loaded.  This cache is managed
- * with a LRU algorithm.
- *
- * Notes:
- * 1/ There is one cache per mounted file system.
- * 2/ If the file system contains less than EXT2_MAX_GROUP_LOADED groups,
- *    this function reads the bitmap without maintaining a LRU cache.
- * 
- * Return the slot used to store the bitmap, or a -ve error code.
- */
-static int load_inode_bitmap (struct super_block * sb,
-			      unsigned int block_group)
-{
-	int i, j, retval = 0;
-	unsigned long inode_bitmap_number;
-	struct buffer_head * inode_bitmap;
+	struct buffer_head * bh;
 
 	if (block_group >= sb->u.ext2_sb.s_groups_count)
 		ext2_panic (sb, "load_inode_bitmap",
 			    "block_group >= groups_count - "
 			    "block_group = %d, groups_count = %lu",
 			     block_group, sb->u.ext2_sb.s_groups_count);
-	if (sb->u.ext2_sb.s_loaded_inode_bitmaps > 0 &&
-	    sb->u.ext2_sb.s_inode_bitmap_number[0] == block_group &&
-	    sb->u.ext2_sb.s_inode_bitmap[0] != NULL)
-		return 0;
-	if (sb->u.ext2_sb.s_groups_count <= EXT2_MAX_GROUP_LOADED) {
-		if (sb->u.ext2_sb.s_inode_bitmap[block_group]) {
-			if (sb->u.ext2_sb.s_inode_bitmap_number[block_group] != block_group)
-				ext2_panic (sb, "load_inode_bitmap",
-					    "block_group != inode_bitmap_number");
-			else
-				return block_group;
-		} else {
-			retval = read_inode_bitmap (sb, block_group,
-						    block_group);
-			if (retval < 0)
-				return retval;
-			return block_group;
-		}
-	}
 
-	for (i = 0; i < sb->u.ext2_sb.s_loaded_inode_bitmaps &&
-		    sb->u.ext2_sb.s_inode_bitmap_number[i] != block_group;
-	     i++)
-		;
-	if (i < sb->u.ext2_sb.s_loaded_inode_bitmaps &&
-  	    sb->u.ext2_sb.s_inode_bitmap_number[i] == block_group) {
-		inode_bitmap_number = sb->u.ext2_sb.s_inode_bitmap_number[i];
-		inode_bitmap = sb->u.ext2_sb.s_inode_bitmap[i];
-		for (j = i; j > 0; j--) {
-			sb->u.ext2_sb.s_inode_bitmap_number[j] =
-				sb->u.ext2_sb.s_inode_bitmap_number[j - 1];
-			sb->u.ext2_sb.s_inode_bitmap[j] =
-				sb->u.ext2_sb.s_inode_bitmap[j - 1];
-		}
-		sb->u.ext2_sb.s_inode_bitmap_number[0] = inode_bitmap_number;
-		sb->u.ext2_sb.s_inode_bitmap[0] = inode_bitmap;
-
-		/*
-		 * There's still one special case here --- if inode_bitmap == 0
-		 * then our last attempt to read the bitmap failed and we have
-		 * just ended up caching that failure.  Try again to read it.
-		 */
-		if (!inode_bitmap)
-			retval = read_inode_bitmap (sb, block_group, 0);
-		
-	} else {
-		if (sb->u.ext2_sb.s_loaded_inode_bitmaps < EXT2_MAX_GROUP_LOADED)
-			sb->u.ext2_sb.s_loaded_inode_bitmaps++;
-		else
-			brelse (sb->u.ext2_sb.s_inode_bitmap[EXT2_MAX_GROUP_LOADED - 1]);
-		for (j = sb->u.ext2_sb.s_loaded_inode_bitmaps - 1; j > 0; j--) {
-			sb->u.ext2_sb.s_inode_bitmap_number[j] =
-				sb->u.ext2_sb.s_inode_bitmap_number[j - 1];
-			sb->u.ext2_sb.s_inode_bitmap[j] =
-				sb->u.ext2_sb.s_inode_bitmap[j - 1];
-		}
-		retval = read_inode_bitmap (sb, block_group, 0);
+	gi = sb->u.ext2_sb.s_group_info + block_group;
+	gi->gi_referenced = 1;
+	if (gi->gi_inode_bitmap) {
+		sb->u.ext2_sb.s_alloc_stats->bitmap_hits++;
+		return gi->gi_inode_bitmap;
 	}
-	return retval;
+	gdp = ext2_get_group_desc (sb, block_group, NULL);
+	if (!gdp)
+		return NULL;
+	sb->u.ext2_sb.s_alloc_stats->bitmap_reads++;
+	bh = bread (sb->s_dev, le32_to_cpu(gdp->bg_inode_bitmap), sb->s_blocksize);
+	if (!bh) {
+		ext2_error (sb, "load_inode_bitmap",
+			    "Cannot read inode bitmap - "
+			    "block_group = %d, inode_bitmap = %lu",
+			    block_group, (unsigned long) gdp->bg_inode_bitmap);
+		return NULL;
+	}
+	/* bread() may have slept */
+	if (gi->gi_inode_bitmap) {
+		brelse (bh);
+		return gi->gi_inode_bitmap;
+	}
+	gi->gi_inode_bitmap = bh;
+	sb->u.ext2_sb.s_alloc_stats->bitmaps_cached++;
+	return bh;
 }
 
 /*
@@ -182,8 +107,8 @@ void ext2_free_inode (struct inode * inode)
 	struct buffer_head * bh2;
 	unsigned long block_group;
 	unsigned long bit;
-	int bitmap_nr;
 	struct ext2_group_desc * gdp;
+	struct ext2_group_info * gi;
 	struct ext2_super_block * es;
 
 	if (!inode->i_dev) {
@@ -208,27 +133,26 @@ void ext2_free_inode (struct inode * inode)
 	ext2_debug ("freeing inode %lu\n", ino);
 
 	/*
-	 * Note: we must free any quota before locking the superblock,
+	 * Note: we must free any quota before locking the group,
 	 * as writing the quota to disk may need the lock as well.
 	 */
 	DQUOT_FREE_INODE(sb, inode);
 	DQUOT_DROP(inode);
 
-	lock_super (sb);
 	es = sb->u.ext2_sb.s_es;
 	if (ino < EXT2_FIRST_INO(sb) || 
 	    ino > le32_to_cpu(es->s_inodes_count)) {
 		ext2_error (sb, "free_inode",
 			    "reserved inode or nonexistent inode");
-		goto error_return;
+		return;
 	}
 	block_group = (ino - 1) / EXT2_INODES_PER_GROUP(sb);
 	bit = (ino - 1) % EXT2_INODES_PER_GROUP(sb);
-	bitmap_nr = load_inode_bitmap (sb, block_group);
-	if (bitmap_nr < 0)
+	gi = sb->u.ext2_sb.s_group_info + block_group;
+	down (&gi->gi_lock);
+	bh = load_inode_bitmap (sb, block_group);
+	if (!bh)
 		goto error_return;
-	
-	bh = sb->u.ext2_sb.s_inode_bitmap[bitmap_nr];
 
 	is_directory = S_ISDIR(inode->i_mode);
 
@@ -247,20 +171,18 @@ void ext2_free_inode (struct inode * inode)
 			if (is_directory)
 				gdp->bg_used_dirs_count =
 					cpu_to_le16(le16_to_cpu(gdp->bg_used_dirs_count) - 1);
+			gi->gi_free_inodes++;
+			if (is_directory)
+				gi->gi_used_dirs--;
 		}
-		mark_buffer_dirty(bh2, 1);
-		es->s_free_inodes_count =
-			cpu_to_le32(le32_to_cpu(es->s_free_inodes_count) + 1);
-		mark_buffer_dirty(sb->u.ext2_sb.s_sbh, 1);
-	}
-	mark_buffer_dirty(bh, 1);
-	if (sb->s_flags & MS_SYNCHRONOUS) {
-		ll_rw_block (WRITE, 1, &bh);
-		wait_on_buffer (bh);
+		ext2_journal_dirty_metadata (sb, bh2);
 	}
+	ext2_journal_dirty_metadata (sb, bh);
+	if (sb->s_flags & MS_SYNCHRONOUS)
+		ext2_sync_metadata (sb, bh);
 	sb->s_dirt = 1;
 error_return:
-	unlock_super (sb);
+	up (&gi->gi_lock);
 }
 
 /*
@@ -272,17 +194,22 @@ error_return:
  *
  * For other inodes, search forward from the parent directory\'s block
  * group to find a free inode.
+ *
+ * Both searches only look at the counts in the group table; the group
+ * descriptor and inode bitmap are fetched for the chosen group alone,
+ * under that group's lock.
  */
-struct inode * ext2_new_inode (const struct inode * dir, int mode, int * err)
+static struct inode * __ext2_new_inode (const struct inode * dir, int mode,
+					int * err)
 {
 	struct super_block * sb;
 	struct buffer_head * bh;
 	struct buffer_head * bh2;
-	int i, j, avefreei;
+	int i, j, avefreei, group;
 	struct inode * inode;
-	int bitmap_nr;
 	struct ext2_group_desc * gdp;
-	struct ext2_group_desc * tmp;
+	struct ext2_group_info * gi;
+	struct ext2_alloc_stats * stats;
 	struct ext2_super_block * es;
 
 	/* Cannot create files in a deleted directory */
@@ -300,14 +227,15 @@ struct inode * ext2_new_inode (const struct inode * dir, int mode, int * err)
 	sb = dir->i_sb;
 	inode->i_sb = sb;
 	inode->i_flags = 0;
-	lock_super (sb);
 	es = sb->u.ext2_sb.s_es;
+	gi = sb->u.ext2_sb.s_group_info;
+	stats = sb->u.ext2_sb.s_alloc_stats;
 repeat:
-	gdp = NULL; i=0;
+	group = -1;
 	
 	*err = -ENOSPC;
 	if (S_ISDIR(mode)) {
-		avefreei = le32_to_cpu(es->s_free_inodes_count) /
+		avefreei = ext2_count_free_inodes (sb) /
 			sb->u.ext2_sb.s_groups_count;
 /* I am not yet convinced that this next bit is necessary.
 		i = dir->u.ext2_i.i_block_group;
@@ -323,21 +251,14 @@ repeat:
 			i = ++i % sb->u.ext2_sb.s_groups_count;
 		}
 */
-		if (!gdp) {
-			for (j = 0; j < sb->u.ext2_sb.s_groups_count; j++) {
-				tmp = ext2_get_group_desc (sb, j, &bh2);
-				if (tmp &&
-				    le16_to_cpu(tmp->bg_free_inodes_count) &&
-				    le16_to_cpu(tmp->bg_free_inodes_count) >= avefreei) {
-					if (!gdp || 
-					    (le16_to_cpu(tmp->bg_free_blocks_count) >
-					     le16_to_cpu(gdp->bg_free_blocks_count))) {
-						i = j;
-						gdp = tmp;
-					}
-				}
-			}
+		for (j = 0; j < sb->u.ext2_sb.s_groups_count; j++) {
+			if (gi[j].gi_free_inodes &&
+			    gi[j].gi_free_inodes >= avefreei &&
+			    (group < 0 ||
+			     gi[j].gi_free_blocks > gi[group].gi_free_blocks))
+				group = j;
 		}
+		stats->groups_scanned += sb->u.ext2_sb.s_groups_count;
 	}
 	else 
 	{
@@ -345,9 +266,8 @@ repeat:
 		 * Try to place the inode in its parent directory
 		 */
 		i = dir->u.ext2_i.i_block_group;
-		tmp = ext2_get_group_desc (sb, i, &bh2);
-		if (tmp && le16_to_cpu(tmp->bg_free_inodes_count))
-			gdp = tmp;
+		if (gi[i].gi_free_inodes)
+			group = i;
 		else
 		{
 			/*
@@ -358,15 +278,14 @@ repeat:
 				i += j;
 				if (i >= sb->u.ext2_sb.s_groups_count)
 					i -= sb->u.ext2_sb.s_groups_count;
-				tmp = ext2_get_group_desc (sb, i, &bh2);
-				if (tmp &&
-				    le16_to_cpu(tmp->bg_free_inodes_count)) {
-					gdp = tmp;
+				stats->groups_scanned++;
+				if (gi[i].gi_free_inodes) {
+					group = i;
 					break;
 				}
 			}
 		}
-		if (!gdp) {
+		if (group < 0) {
 			/*
 			 * That failed: try linear search for a free inode
 			 */
@@ -374,52 +293,57 @@ repeat:
 			for (j = 2; j < sb->u.ext2_sb.s_groups_count; j++) {
 				if (++i >= sb->u.ext2_sb.s_groups_count)
 					i = 0;
-				tmp = ext2_get_group_desc (sb, i, &bh2);
-				if (tmp &&
-				    le16_to_cpu(tmp->bg_free_inodes_count)) {
-					gdp = tmp;
+				stats->groups_scanned++;
+				if (gi[i].gi_free_inodes) {
+					group = i;
 					break;
 				}
 			}
 		}
 	}
 
-	if (!gdp) {
-		unlock_super (sb);
+	if (group < 0) {
 		iput(inode);
 		return NULL;
 	}
-	bitmap_nr = load_inode_bitmap (sb, i);
-	if (bitmap_nr < 0) {
-		unlock_super (sb);
+	i = group;
+	down (&gi[i].gi_lock);
+	if (!gi[i].gi_free_inodes) {
+		/* Someone else took the last one */
+		up (&gi[i].gi_lock);
+		goto repeat;
+	}
+	gdp = ext2_get_group_desc (sb, i, &bh2);
+	bh = load_inode_bitmap (sb, i);
+	if (!gdp || !bh) {
+		up (&gi[i].gi_lock);
 		iput(inode);
 		*err = -EIO;
 		return NULL;
 	}
 
-	bh = sb->u.ext2_sb.s_inode_bitmap[bitmap_nr];
 	if ((j = ext2_find_first_zero_bit ((unsigned long *) bh->b_data,
 				      EXT2_INODES_PER_GROUP(sb))) <
 	    EXT2_INODES_PER_GROUP(sb)) {
 		if (ext2_set_bit (j, bh->b_data)) {
 			ext2_warning (sb, "ext2_new_inode",
 				      "bit already set for inode %d", j);
+			up (&gi[i].gi_lock);
 			goto repeat;
 		}
-		mark_buffer_dirty(bh, 1);
-		if (sb->s_flags & MS_SYNCHRONOUS) {
-			ll_rw_block (WRITE, 1, &bh);
-			wait_on_buffer (bh);
-		}
+		ext2_journal_dirty_metadata (sb, bh);
+		if (sb->s_flags & MS_SYNCHRONOUS)
+			ext2_sync_metadata (sb, bh);
 	} else {
 		if (le16_to_cpu(gdp->bg_free_inodes_count) != 0) {
 			ext2_error (sb, "ext2_new_inode",
 				    "Free inodes count corrupted in group %d",
 				    i);
-			unlock_super (sb);
+			up (&gi[i].gi_lock);
 			iput (inode);
 			return NULL;
 		}
+		up (&gi[i].gi_lock);
 		goto repeat;
 	}
 	j += i * EXT2_INODES_PER_GROUP(sb) + 1;
@@ -427,7 +351,7 @@ repeat:
 		ext2_error (sb, "ext2_new_inode",
 			    "reserved inode or inode > inodes count - "
 			    "block_group = %d,inode=%d", i, j);
-		unlock_super (sb);
+		up (&gi[i].gi_lock);
 		iput (inode);
 		return NULL;
 	}
@@ -436,11 +360,12 @@ repeat:
 	if (S_ISDIR(mode))
 		gdp->bg_used_dirs_count =
 			cpu_to_le16(le16_to_cpu(gdp->bg_used_dirs_count) + 1);
-	mark_buffer_dirty(bh2, 1);
-	es->s_free_inodes_count =
-		cpu_to_le32(le32_to_cpu(es->s_free_inodes_count) - 1);
-	mark_buffer_dirty(sb->u.ext2_sb.s_sbh, 1);
+	gi[i].gi_free_inodes--;
+	if (S_ISDIR(mode))
+		gi[i].gi_used_dirs++;
+	ext2_journal_dirty_metadata (sb, bh2);
 	sb->s_dirt = 1;
+	up (&gi[i].gi_lock);
 	inode->i_mode = mode;
 	inode->i_sb = sb;
 	inode->i_nlink = 1;
@@ -470,14 +395,15 @@ repeat:
 	inode->u.ext2_i.i_dir_acl = 0;
 	inode->u.ext2_i.i_dtime = 0;
 	inode->u.ext2_i.i_block_group = i;
+	inode->u.ext2_i.i_prealloc_window = 0;
+	inode->u.ext2_i.i_alloc_want = 0;
 	inode->i_op = NULL;
 	if (inode->u.ext2_i.i_flags & EXT2_SYNC_FL)
 		inode->i_flags |= MS_SYNCHRONOUS;
 	insert_inode_hash(inode);
 	inode->i_generation++;
-	mark_inode_dirty(inode);
+	ext2_mark_inode_dirty(inode);
 
-	unlock_super (sb);
 	if(DQUOT_ALLOC_INODE(sb, inode)) {
 		sb->dq_op->drop(inode);
 		inode->i_nlink = 0;
@@ -491,16 +417,29 @@ repeat:
 	return inode;
 }
 
+struct inode * ext2_new_inode (const struct inode * dir, int mode, int * err)
+{
+	struct timeval start;
+	struct inode * inode;
+
+	do_gettimeofday(&start);
+	inode = __ext2_new_inode (dir, mode, err);
+	if (dir && dir->i_sb)
+		ext2_alloc_latency (&dir->i_sb->u.ext2_sb.s_alloc_stats->inodes,
+				    &start, !inode);
+	return inode;
+}
+
 unsigned long ext2_count_free_inodes (struct super_block * sb)
 {
 #ifdef EXT2FS_DEBUG
 	struct ext2_super_block * es;
+	struct buffer_head * bh;
 	unsigned long desc_count, bitmap_count, x;
-	int bitmap_nr;
 	struct ext2_group_desc * gdp;
+	struct ext2_group_info * gi;
 	int i;
 
-	lock_super (sb);
 	es = sb->u.ext2_sb.s_es;
 	desc_count = 0;
 	bitmap_count = 0;
@@ -510,34 +449,43 @@ unsigned long ext2_count_free_inodes (struct super_block * sb)
 		if (!gdp)
 			continue;
 		desc_count += le16_to_cpu(gdp->bg_free_inodes_count);
-		bitmap_nr = load_inode_bitmap (sb, i);
-		if (bitmap_nr < 0)
+		gi = sb->u.ext2_sb.s_group_info + i;
+		down (&gi->gi_lock);
+		bh = load_inode_bitmap (sb, i);
+		if (!bh) {
+			up (&gi->gi_lock);
 			continue;
+		}
 
-		x = ext2_count_free (sb->u.ext2_sb.s_inode_bitmap[bitmap_nr],
-				     EXT2_INODES_PER_GROUP(sb) / 8);
+		x = ext2_count_free (bh, EXT2_INODES_PER_GROUP(sb) / 8);
+		up (&gi->gi_lock);
 		printk ("group %d: stored = %d, counted = %lu\n",
 			i, le16_to_cpu(gdp->bg_free_inodes_count), x);
 		bitmap_count += x;
 	}
 	printk("ext2_count_free_inodes: stored = %lu, computed = %lu, %lu\n",
 		le32_to_cpu(es->s_free_inodes_count), desc_count, bitmap_count);
-	unlock_super (sb);
 	return desc_count;
 #else
-	return le32_to_cpu(sb->u.ext2_sb.s_es->s_free_inodes_count);
+	struct ext2_group_info * gi = sb->u.ext2_sb.s_group_info;
+	unsigned long count = 0;
+	int i;
+
+	for (i = 0; i < sb->u.ext2_sb.s_groups_count; i++)
+		count += gi[i].gi_free_inodes;
+	return count;
 #endif
 }
 
 void ext2_check_inodes_bitmap (struct super_block * sb)
 {
 	struct ext2_super_block * es;
+	struct buffer_head * bh;
 	unsigned long desc_count, bitmap_count, x;
-	int bitmap_nr;
 	struct ext2_group_desc * gdp;
+	struct ext2_group_info * gi;
 	int i;
 
-	lock_super (sb);
 	es = sb->u.ext2_sb.s_es;
 	desc_count = 0;
 	bitmap_count = 0;
@@ -547,12 +495,16 @@ void ext2_check_inodes_bitmap (struct super_block * sb)
 		if (!gdp)
 			continue;
 		desc_count += le16_to_cpu(gdp->bg_free_inodes_count);
-		bitmap_nr = load_inode_bitmap (sb, i);
-		if (bitmap_nr < 0)
+		gi = sb->u.ext2_sb.s_group_info + i;
+		down (&gi->gi_lock);
+		bh = load_inode_bitmap (sb, i);
+		if (!bh) {
+			up (&gi->gi_lock);
 			continue;
+		}
 		
-		x = ext2_count_free (sb->u.ext2_sb.s_inode_bitmap[bitmap_nr],
-				     EXT2_INODES_PER_GROUP(sb) / 8);
+		x = ext2_count_free (bh, EXT2_INODES_PER_GROUP(sb) / 8);
+		up (&gi->gi_lock);
 		if (le16_to_cpu(gdp->bg_free_inodes_count) != x)
 			ext2_error (sb, "ext2_check_inodes_bitmap",
 				    "Wrong free inodes count in group %d, "
@@ -566,5 +518,4 @@ void ext2_check_inodes_bitmap (struct super_block * sb)
 			    "stored = %lu, counted = %lu",
 			    (unsigned long) le32_to_cpu(es->s_free_inodes_count),
 			    bitmap_count);
-	unlock_super (sb);
 }
@@ -43,16 +43,20 @@ void ext2_put_inode (struct inode * inode)
  */
 void ext2_delete_inode (struct inode * inode)
 {
+	struct ext2_handle handle;
+
 	if (inode->i_ino == EXT2_ACL_IDX_INO ||
 	    inode->i_ino == EXT2_ACL_DATA_INO)
 		return;
+	ext2_journal_start (inode->i_sb, &handle);
 	inode->u.ext2_i.i_dtime	= CURRENT_TIME;
-	mark_inode_dirty(inode);
+	ext2_mark_inode_dirty(inode);
 	ext2_update_inode(inode, IS_SYNC(inode));
 	inode->i_size = 0;
 	if (inode->i_blocks)
 		ext2_truncate (inode);
 	ext2_free_inode (inode);
+	ext2_journal_stop (&handle);
 }
 
 #define inode_bmap(inode, nr) (le32_to_cpu((inode)->u.ext2_i.i_data[(nr)]))
@@ -78,16 +82,46 @@ static inline int block_bmap (struct buffer_head * bh, int nr)
 void ext2_discard_prealloc (struct inode * inode)
 {
 #ifdef EXT2_PREALLOCATE
+	struct ext2_handle handle;
 	unsigned short total;
 
 	if (inode->u.ext2_i.i_prealloc_count) {
+		ext2_journal_start (inode->i_sb, &handle);
 		total = inode->u.ext2_i.i_prealloc_count;
 		inode->u.ext2_i.i_prealloc_count = 0;
 		ext2_free_blocks (inode, inode->u.ext2_i.i_prealloc_block, total);
+		ext2_journal_stop (&handle);
 	}
 #endif
 }
 
+#ifdef EXT2_PREALLOCATE
+/*
+ * How many blocks to ask ext2_new_block() for when the preallocation
+ * window has run out: at least what is left of the current write, and
+ * a window that doubles for as long as the file keeps growing right
+ * behind the last one. Files that are appended to side by side then
+ * end up in long runs rather than interleaved in 8-block pieces.
+ */
+static inline u32 ext2_prealloc_want (struct inode * inode,
+				      unsigned long goal)
+{
+	struct ext2_inode_info * ei = &inode->u.ext2_i;
+	u32 want;
+
+	if (ei->i_prealloc_window && goal == ei->i_prealloc_block)
+		want = ei->i_prealloc_window << 1;
+	else
+		want = EXT2_DEFAULT_PREALLOC_BLOCKS;
+	if (want < ei->i_alloc_want)
+		want = ei->i_alloc_want;
+	if (want > EXT2_MAX_PREALLOC_BLOCKS)
+		want = EXT2_MAX_PREALLOC_BLOCKS;
+	ei->i_prealloc_window = want;
+	return want;
+}
+#endif
+
 static int ext2_alloc_block (struct inode * inode, unsigned long goal, int *err)
 {
 #ifdef EXT2FS_DEBUG
@@ -111,11 +145,13 @@ static int ext2_alloc_block (struct inode * inode, unsigned long goal, int *err)
 		ext2_discard_prealloc (inode);
 		ext2_debug ("preallocation miss (%lu/%lu).\n",
 			    alloc_hits, ++alloc_attempts);
-		if (S_ISREG(inode->i_mode))
+		if (S_ISREG(inode->i_mode)) {
+			inode->u.ext2_i.i_prealloc_count =
+				ext2_prealloc_want (inode, goal);
 			result = ext2_new_block (inode, goal, 
 				 &inode->u.ext2_i.i_prealloc_count,
 				 &inode->u.ext2_i.i_prealloc_block, err);
-		else
+		} else
 			result = ext2_new_block (inode, goal, 0, 0, err);
 	}
 #else
@@ -189,6 +225,11 @@ out:
 	return ret;
 }
 
+long ext2_bmap (struct inode * inode, long block)
+{
+	return ext2_block_map (inode, block);
+}
+
 static struct buffer_head * inode_getblk (struct inode * inode, int nr,
 	int new_block, int * err, int metadata, long *phys, int *new)
 {
@@ -256,9 +297,10 @@ repeat:
 		result = getblk (inode->i_dev, tmp, blocksize);
 		memset(result->b_data, 0, blocksize);
 		mark_buffer_uptodate(result, 1);
-		mark_buffer_dirty(result, 1);
+		ext2_journal_dirty_metadata (inode->i_sb, result);
 		if (*p) {
 			ext2_free_blocks (inode, tmp, 1);
+			ext2_journal_forget (inode->i_sb, result);
 			bforget (result);
 			goto repeat;
 		}
@@ -288,7 +330,7 @@ repeat:
 	if (IS_SYNC(inode) || inode->u.ext2_i.i_osync)
 		ext2_sync_inode (inode);
 	else
-		mark_inode_dirty(inode);
+		ext2_mark_inode_dirty(inode);
 	return result;
 }
 
@@ -365,9 +407,10 @@ repeat:
 		result = getblk (bh->b_dev, tmp, blocksize);
 		memset(result->b_data, 0, inode->i_sb->s_blocksize);
 		mark_buffer_uptodate(result, 1);
-		mark_buffer_dirty(result, 1);
+		ext2_journal_dirty_metadata (inode->i_sb, result);
 		if (*p) {
 			ext2_free_blocks (inode, tmp, 1);
+			ext2_journal_forget (inode->i_sb, result);
 			bforget (result);
 			goto repeat;
 		}
@@ -387,14 +430,12 @@ repeat:
 		*new = 1;
 	}
 	*p = le32_to_cpu(tmp);
-	mark_buffer_dirty(bh, 1);
-	if (IS_SYNC(inode) || inode->u.ext2_i.i_osync) {
-		ll_rw_block (WRITE, 1, &bh);
-		wait_on_buffer (bh);
-	}
+	ext2_journal_dirty_metadata (inode->i_sb, bh);
+	if (IS_SYNC(inode) || inode->u.ext2_i.i_osync)
+		ext2_sync_metadata (inode->i_sb, bh);
 	inode->i_ctime = CURRENT_TIME;
 	inode->i_blocks += blocksize/512;
-	mark_inode_dirty(inode);
+	ext2_mark_inode_dirty(inode);
 	inode->u.ext2_i.i_next_alloc_block = new_block;
 	inode->u.ext2_i.i_next_alloc_goal = tmp;
 	*err = 0;
@@ -405,6 +446,7 @@ out:
 
 int ext2_get_block(struct inode *inode, long iblock, struct buffer_head *bh_result, int create)
 {
+	struct ext2_handle handle;
 	int ret, err, new;
 	struct buffer_head *bh;
 	unsigned long ptr, phys;
@@ -438,6 +480,7 @@ int ext2_get_block(struct inode *inode, long iblock, struct buffer_head *bh_resu
 	bh = NULL;
 
 	lock_kernel();
+	ext2_journal_start (inode->i_sb, &handle);
 
 	if (iblock < 0)
 		goto abort_negative;
@@ -514,9 +557,14 @@ out:
 	bh_result->b_dev = inode->i_dev;
 	bh_result->b_blocknr = phys;
 	bh_result->b_state |= (1UL << BH_Mapped); /* safe */
-	if (new)
+	if (new) {
 		bh_result->b_state |= (1UL << BH_New);
+		/* ext2_getblk() hands us a dummy for directories */
+		if (S_ISREG(inode->i_mode))
+			ext2_journal_dirty_data (inode, bh_result);
+	}
 abort:
+	ext2_journal_stop (&handle);
 	unlock_kernel();
 	return err;
 
@@ -544,7 +592,7 @@ struct buffer_head * ext2_getblk(struct inode * inode, long block, int create, i
 		if (buffer_new(&dummy)) {
 			memset(bh->b_data, 0, inode->i_sb->s_blocksize);
 			mark_buffer_uptodate(bh, 1);
-			mark_buffer_dirty(bh, 1);
+			ext2_journal_dirty_metadata (inode->i_sb, bh);
 		}
 		return bh;
 	}
@@ -694,6 +742,8 @@ void ext2_read_inode (struct inode * inode)
 	inode->u.ext2_i.i_block_group = block_group;
 	inode->u.ext2_i.i_next_alloc_block = 0;
 	inode->u.ext2_i.i_next_alloc_goal = 0;
+	inode->u.ext2_i.i_prealloc_window = 0;
+	inode->u.ext2_i.i_alloc_want = 0;
 	if (inode->u.ext2_i.i_prealloc_count)
 		ext2_error (inode->i_sb, "ext2_read_inode",
 			    "New inode has non-zero prealloc count!");
@@ -817,10 +867,9 @@ static int ext2_update_inode(struct inode * inode, int do_sync)
 		raw_inode->i_block[0] = cpu_to_le32(kdev_t_to_nr(inode->i_rdev));
 	else for (block = 0; block < EXT2_N_BLOCKS; block++)
 		raw_inode->i_block[block] = inode->u.ext2_i.i_data[block];
-	mark_buffer_dirty(bh, 1);
+	ext2_journal_dirty_metadata (inode->i_sb, bh);
 	if (do_sync) {
-		ll_rw_block (WRITE, 1, &bh);
-		wait_on_buffer (bh);
+		ext2_sync_metadata (inode->i_sb, bh);
 		if (buffer_req(bh) && !buffer_uptodate(bh)) {
 			printk ("IO error syncing ext2 inode ["
 				"%s:%08lx]\n",
@@ -894,7 +943,7 @@ int ext2_notify_change(struct dentry *dentry, struct iattr *iattr)
 		inode->i_flags &= ~S_IMMUTABLE;
 		inode->u.ext2_i.i_flags &= ~EXT2_IMMUTABLE_FL;
 	}
-	mark_inode_dirty(inode);
+	ext2_mark_inode_dirty(inode);
 out:
 	return retval;
 }
@@ -12,6 +12,36 @@
 #include <linux/sched.h>
 #include <asm/uaccess.h>
 
+/*
+ * Walk the block map of a file and count the runs of physically
+ * contiguous blocks; holes end a run.
+ */
+static int ext2_frag_report (struct inode * inode,
+			     struct ext2_frag_report * report)
+{
+	unsigned long block, nr_blocks;
+	long phys, last = 0;
+
+	report->blocks = 0;
+	report->extents = 0;
+	nr_blocks = (inode->i_size + inode->i_sb->s_blocksize - 1) >>
+		EXT2_BLOCK_SIZE_BITS(inode->i_sb);
+	for (block = 0; block < nr_blocks; block++) {
+		phys = ext2_bmap (inode, block);
+		if (phys) {
+			report->blocks++;
+			if (phys != last + 1)
+				report->extents++;
+		}
+		last = phys;
+		if (signal_pending(current))
+			return -EINTR;
+		if (current->need_resched)
+			schedule();
+	}
+	return 0;
+}
+
 
 int ext2_ioctl (struct inode * inode, struct file * filp, unsigned int cmd,
 		unsigned long arg)
@@ -70,7 +100,7 @@ int ext2_ioctl (struct inode * inode, struct file * filp, unsigned int cmd,
 		else
 			inode->i_flags &= ~MS_NOATIME;
 		inode->i_ctime = CURRENT_TIME;
-		mark_inode_dirty(inode);
+		ext2_mark_inode_dirty(inode);
 		return 0;
 	}
 	case EXT2_IOC_GETVERSION:
@@ -83,8 +113,29 @@ int ext2_ioctl (struct inode * inode, struct file * filp, unsigned int cmd,
 		if (get_user(inode->i_generation, (int *) arg))
 			return -EFAULT;	
 		inode->i_ctime = CURRENT_TIME;
-		mark_inode_dirty(inode);
+		ext2_mark_inode_dirty(inode);
 		return 0;
+	case EXT2_IOC_GETFRAG: {
+		struct ext2_frag_report report;
+		int err;
+
+		if (!S_ISREG(inode->i_mode) && !S_ISDIR(inode->i_mode))
+			return -EINVAL;
+		err = ext2_frag_report(inode, &report);
+		if (err)
+			return err;
+		if (copy_to_user((void *) arg, &report, sizeof(report)))
+			return -EFAULT;
+		return 0;
+	}
+	case EXT2_IOC_GETALLOCSTATS: {
+		struct ext2_alloc_stats stats;
+
+		stats = *inode->i_sb->u.ext2_sb.s_alloc_stats;
+		if (copy_to_user((void *) arg, &stats, sizeof(stats)))
+			return -EFAULT;
+		return 0;
+	}
 	default:
 		return -ENOTTY;
 	}
@@ -0,0 +1,1384 @@
+/*
+ *  linux/fs/ext2/journal.c
+ *
+ *  Write-ahead logging of ext2 metadata.
+ *
+ *  Metadata buffers are not written in place as they are changed:
+ *  they are pinned in the running transaction, and kjournald copies
+ *  them into a log file every few seconds, followed by a commit block.
+ *  Only then are they let go to their home locations. After a crash,
+ *  the committed transactions still in the log are written home again
+ *  at mount time, which leaves the filesystem as it was at the last
+ *  commit - no fsck needed.
+ *
+ *  Filesystem operations bracket their changes with ext2_journal_start
+ *  and ext2_journal_stop, so that a transaction holds either all or
+ *  none of an operation. Operations which used to write their buffers
+ *  synchronously now just wait for the commit, which every process
+ *  waiting at the time shares.
+ *
+ *  In ordered mode (the default), the data blocks allocated in a
+ *  transaction are written before its metadata goes to the log, so a
+ *  file never ends up pointing at blocks holding someone else's data.
+ *
+ *  Everything here runs under the big kernel lock.
+ */
+
+#include <linux/fs.h>
+#include <linux/locks.h>
+#include <linux/malloc.h>
+#include <linux/sched.h>
+#include <linux/smp_lock.h>
+#include <linux/string.h>
+#include <asm/semaphore.h>
+
+#define EXT2_JOURNAL_MIN_BLOCKS	1024
+#define EXT2_JOURNAL_MAX_BLOCKS	16384
+#define EXT2_JOURNAL_INTERVAL	(5 * HZ)	/* Commit at least this often */
+#define EXT2_JOURNAL_MAX_DATA	16384	/* Ordered data buffers per transaction */
+
+/* Transaction states */
+#define T_RUNNING	0	/* Taking new handles */
+#define T_LOCKED	1	/* Waiting for its handles to stop */
+#define T_COMMIT	2	/* Being written to the log */
+#define T_CHECKPOINT	3	/* Committed, buffers going home */
+
+struct ext2_transaction {
+	unsigned int t_sequence;
+	int t_state;
+	int t_handles;			/* Handles open against it */
+	int t_nr_buffers;		/* Slots used in t_buffers */
+	int t_nr_revoke;
+	int t_nr_data;
+	int t_max_data;
+	int t_revoke_overflow;		/* Revokes were lost */
+	unsigned long t_start;		/* First log block, once committed */
+	unsigned long t_end;		/* Log block after its commit block */
+	unsigned long t_expires;	/* When kjournald commits it anyway */
+	struct buffer_head ** t_buffers;	/* Slots are NULL once forgotten */
+	unsigned long * t_revoke;
+	struct buffer_head ** t_data;	/* Ordered data */
+	struct list_head t_list;	/* On the checkpoint list */
+};
+
+struct ext2_journal {
+	struct super_block * j_sb;
+	struct inode * j_inode;
+	struct buffer_head * j_sb_bh;	/* Journal super block */
+	unsigned long * j_map;		/* Log block -> device block */
+	unsigned long j_first;		/* First log block */
+	unsigned long j_last;		/* One past the last log block */
+	unsigned long j_head;		/* Where the next commit goes */
+	unsigned long j_tail;		/* Oldest log block still needed */
+	unsigned long j_sb_start;	/* s_start as on disk */
+	unsigned int j_tail_sequence;	/* Transaction which starts at j_tail */
+	unsigned int j_commit_sequence;	/* Last transaction committed */
+	unsigned int j_commit_request;	/* Commit up to this one */
+	int j_tags_per_block;
+	int j_revokes_per_block;
+	int j_max_buffers;		/* Per transaction */
+	int j_max_revoke;
+	unsigned long j_soft_limit;	/* Log blocks: wake kjournald */
+	unsigned long j_limit;		/* Log blocks: hold off new handles */
+	int j_barrier;			/* No new handles until checkpointed */
+	int j_exiting;
+	struct ext2_transaction * j_running;
+	struct ext2_transaction * j_committing;
+	struct list_head j_checkpoint;	/* Committed transactions, oldest first */
+	struct semaphore j_checkpoint_sem;
+	struct task_struct * j_task;	/* kjournald */
+	struct semaphore * j_sem;	/* kjournald start/exit handshake */
+	wait_queue_head_t j_wait_commit;	/* kjournald sleeps here */
+	wait_queue_head_t j_wait_done;	/* Commits done, handles allowed */
+	wait_queue_head_t j_wait_handles;	/* Last handle of a locked transaction */
+};
+
+#define tid_gt(a, b)	((int) ((a) - (b)) > 0)
+
+static inline unsigned long log_len (struct ext2_journal * j)
+{
+	return j->j_last - j->j_first;
+}
+
+static inline unsigned long log_next (struct ext2_journal * j, unsigned long n)
+{
+	if (++n == j->j_last)
+		n = j->j_first;
+	return n;
+}
+
+/*
+ * One block always stays unused, so that j_head == j_tail means empty.
+ */
+static inline unsigned long log_free (struct ext2_journal * j)
+{
+	unsigned long len = log_len(j);
+
+	return len - 1 - (j->j_head + len - j->j_tail) % len;
+}
+
+/*
+ * How many log blocks a transaction would take if committed now.
+ */
+static unsigned long t_log_blocks (struct ext2_journal * j,
+				   struct ext2_transaction * t)
+{
+	return t->t_nr_buffers +
+	       (t->t_nr_buffers + j->j_tags_per_block - 1) / j->j_tags_per_block +
+	       (t->t_nr_revoke + j->j_revokes_per_block - 1) / j->j_revokes_per_block +
+	       1;
+}
+
+static inline int t_empty (struct ext2_transaction * t)
+{
+	return !t->t_nr_buffers && !t->t_nr_revoke;
+}
+
+static struct ext2_transaction * alloc_transaction (struct ext2_journal * j)
+{
+	struct ext2_transaction * t;
+
+	t = kmalloc (sizeof (*t), GFP_KERNEL);
+	if (!t)
+		return NULL;
+	memset (t, 0, sizeof (*t));
+	t->t_buffers = kmalloc (j->j_max_buffers * sizeof (struct buffer_head *),
+				GFP_KERNEL);
+	t->t_revoke = kmalloc (j->j_max_revoke * sizeof (unsigned long),
+			       GFP_KERNEL);
+	if (!t->t_buffers || !t->t_revoke) {
+		if (t->t_buffers)
+			kfree (t->t_buffers);
+		if (t->t_revoke)
+			kfree (t->t_revoke);
+		kfree (t);
+		return NULL;
+	}
+	t->t_expires = jiffies + EXT2_JOURNAL_INTERVAL;
+	INIT_LIST_HEAD(&t->t_list);
+	return t;
+}
+
+static void free_transaction (struct ext2_transaction * t)
+{
+	kfree (t->t_buffers);
+	kfree (t->t_revoke);
+	if (t->t_data)
+		kfree (t->t_data);
+	kfree (t);
+}
+
+/*
+ * The journal super block goes to disk synchronously: log space past
+ * the old tail is reused only once it is there.
+ */
+static void journal_write_sb (struct ext2_journal * j, unsigned long start)
+{
+	struct ext2_journal_super_block * jsb =
+		(struct ext2_journal_super_block *) j->j_sb_bh->b_data;
+
+	jsb->s_start = cpu_to_le32(start);
+	jsb->s_sequence = cpu_to_le32(j->j_tail_sequence);
+	j->j_sb_start = start;
+	mark_buffer_dirty(j->j_sb_bh, 1);
+	ll_rw_block (WRITE, 1, &j->j_sb_bh);
+	wait_on_buffer (j->j_sb_bh);
+}
+
+/*
+ * Look for a buffer in a transaction, and let go of it if asked to.
+ */
+static int unfile_from (struct ext2_transaction * t, struct buffer_head * bh,
+			int drop)
+{
+	int i;
+
+	for (i = 0; i < t->t_nr_buffers; i++)
+		if (t->t_buffers[i] == bh) {
+			if (drop) {
+				t->t_buffers[i] = NULL;
+				brelse (bh);
+			}
+			return 1;
+		}
+	return 0;
+}
+
+static void unfile_checkpoint (struct ext2_journal * j, struct buffer_head * bh)
+{
+	struct list_head * p;
+
+	/* it's most likely in the latest one */
+	for (p = j->j_checkpoint.prev; p != &j->j_checkpoint; p = p->prev)
+		if (unfile_from (list_entry(p, struct ext2_transaction, t_list),
+				 bh, 1))
+			break;
+	clear_bit(BH_JCheckpoint, &bh->b_state);
+}
+
+/*
+ * Count the references the journal holds on a buffer, dropping them
+ * all if asked to.
+ */
+static int journal_holds (struct ext2_journal * j, struct buffer_head * bh,
+			  int drop)
+{
+	struct list_head * p;
+	int holds = 0;
+
+	if (buffer_journaled(bh))
+		holds += unfile_from (j->j_running, bh, drop);
+	if (j->j_committing)
+		holds += unfile_from (j->j_committing, bh, drop);
+	if (buffer_jcheckpoint(bh))
+		for (p = j->j_checkpoint.next; p != &j->j_checkpoint; p = p->next)
+			holds += unfile_from (list_entry(p, struct ext2_transaction,
+							 t_list), bh, drop);
+	if (drop) {
+		clear_bit(BH_Journaled, &bh->b_state);
+		clear_bit(BH_JCheckpoint, &bh->b_state);
+	}
+	return holds;
+}
+
+static void journal_record_revoke (struct ext2_journal * j, unsigned long block)
+{
+	struct ext2_transaction * t = j->j_running;
+
+	if (t->t_nr_revoke < j->j_max_revoke)
+		t->t_revoke[t->t_nr_revoke++] = block;
+	else
+		t->t_revoke_overflow = 1;
+}
+
+/*
+ * Checkpointing: a committed transaction leaves the log once all its
+ * buffers are on disk, and aren't part of the running transaction -
+ * that one may have written them home half-changed, and the old copy
+ * in the log is what covers for it. When a later transaction logs a
+ * buffer again, it takes it over.
+ */
+static int checkpoint_done (struct ext2_transaction * t)
+{
+	struct buffer_head * bh;
+	int i;
+
+	for (i = 0; i < t->t_nr_buffers; i++) {
+		bh = t->t_buffers[i];
+		if (bh && (buffer_dirty(bh) || buffer_locked(bh) ||
+			   buffer_journaled(bh)))
+			return 0;
+	}
+	return 1;
+}
+
+static void checkpoint_write (struct ext2_transaction * t)
+{
+	struct buffer_head * bh;
+	int i;
+
+	for (i = 0; i < t->t_nr_buffers; i++) {
+		bh = t->t_buffers[i];
+		if (bh && buffer_dirty(bh) && !buffer_locked(bh) &&
+		    !buffer_journaled(bh))
+			ll_rw_block (WRITE, 1, &bh);
+	}
+}
+
+static void checkpoint_wait (struct ext2_transaction * t)
+{
+	struct buffer_head * bh;
+	int i;
+
+	for (i = 0; i < t->t_nr_buffers; i++) {
+		bh = t->t_buffers[i];
+		if (bh && buffer_locked(bh)) {
+			atomic_inc(&bh->b_count);
+			wait_on_buffer (bh);
+			brelse (bh);
+		}
+	}
+}
+
+/*
+ * Move the tail past the transactions which are done with. If 'wait'
+ * is set, write everything out first, so that the log ends up empty
+ * unless the running transaction has buffers in it.
+ */
+static void journal_checkpoint (struct ext2_journal * j, int wait)
+{
+	struct ext2_transaction * t;
+	struct list_head * p;
+	int i, moved = 0;
+
+	down (&j->j_checkpoint_sem);
+	if (wait || log_free(j) < log_len(j) / 2) {
+		for (p = j->j_checkpoint.next; p != &j->j_checkpoint; p = p->next)
+			checkpoint_write (list_entry(p, struct ext2_transaction,
+						     t_list));
+		run_task_queue(&tq_disk);
+	}
+	if (wait)
+		for (p = j->j_checkpoint.next; p != &j->j_checkpoint; p = p->next)
+			checkpoint_wait (list_entry(p, struct ext2_transaction,
+						    t_list));
+
+	while (!list_empty(&j->j_checkpoint)) {
+		t = list_entry(j->j_checkpoint.next, struct ext2_transaction,
+			       t_list);
+		if (!checkpoint_done (t))
+			break;
+		for (i = 0; i < t->t_nr_buffers; i++)
+			if (t->t_buffers[i]) {
+				clear_bit(BH_JCheckpoint,
+					  &t->t_buffers[i]->b_state);
+				brelse (t->t_buffers[i]);
+			}
+		list_del(&t->t_list);
+		if (list_empty(&j->j_checkpoint)) {
+			j->j_tail = j->j_committing ? j->j_committing->t_start :
+						      j->j_head;
+			j->j_tail_sequence = t->t_sequence + 1;
+		} else {
+			j->j_tail = list_entry(j->j_checkpoint.next,
+					       struct ext2_transaction,
+					       t_list)->t_start;
+			j->j_tail_sequence = t->t_sequence + 1;
+		}
+		free_transaction (t);
+		moved = 1;
+	}
+	if (moved && j->j_sb_start)
+		journal_write_sb (j, j->j_tail);
+	up (&j->j_checkpoint_sem);
+}
+
+/*
+ * Write out a block in the log, and wait for it.
+ */
+static int write_log_blocks (struct buffer_head ** bhs, int nr)
+{
+	int i, err = 0;
+
+	for (i = 0; i < nr; i++)
+		mark_buffer_dirty(bhs[i], 0);
+	ll_rw_block (WRITE, nr, bhs);
+	for (i = 0; i < nr; i++) {
+		wait_on_buffer (bhs[i]);
+		if (!buffer_uptodate(bhs[i]))
+			err = -EIO;
+	}
+	return err;
+}
+
+static void fill_header (struct buffer_head * bh, int type, unsigned int sequence)
+{
+	struct ext2_journal_header * h = (struct ext2_journal_header *) bh->b_data;
+
+	memset (bh->b_data, 0, bh->b_size);
+	h->h_magic = cpu_to_le32(EXT2_JOURNAL_MAGIC);
+	h->h_blocktype = cpu_to_le32(type);
+	h->h_sequence = cpu_to_le32(sequence);
+	mark_buffer_uptodate(bh, 1);
+}
+
+/*
+ * The log can't take the transaction, even with everything else
+ * checkpointed. It is dropped from the journal instead: its buffers
+ * go home like those of a committed one, and so does everything still
+ * in the log, with new handles held off until then. The filesystem is
+ * marked in error and made read-only, as a crash before the buffers
+ * are all home leaves it half updated.
+ */
+static void journal_abort (struct ext2_journal * j, struct ext2_transaction * t,
+			   struct ext2_transaction * next)
+{
+	struct super_block * sb = j->j_sb;
+	struct buffer_head * bh;
+	int i;
+
+	/* switch first, so that nothing more gets added to t */
+	j->j_barrier = 1;
+	next->t_sequence = t->t_sequence + 1;
+	j->j_running = next;
+	for (i = 0; i < t->t_nr_buffers; i++) {
+		bh = t->t_buffers[i];
+		if (!bh)
+			continue;
+		clear_bit(BH_Journaled, &bh->b_state);
+		mark_buffer_dirty(bh, 1);
+		brelse (bh);
+	}
+	j->j_commit_sequence = t->t_sequence;
+	free_transaction (t);
+
+	ext2_error (sb, "journal_commit",
+		    "journal full, transaction %u written in place",
+		    next->t_sequence - 1);
+	if (!(sb->s_flags & MS_RDONLY)) {
+		printk ("Remounting filesystem read-only\n");
+		sb->s_flags |= MS_RDONLY;
+	}
+	journal_checkpoint (j, 1);
+	j->j_barrier = 0;
+	wake_up(&j->j_wait_done);
+}
+
+/*
+ * Commit the running transaction. Only kjournald does this, but at
+ * unmount time, once kjournald is gone.
+ */
+static void journal_commit (struct ext2_journal * j)
+{
+	struct super_block * sb = j->j_sb;
+	struct ext2_transaction * t = j->j_running, * next;
+	struct buffer_head ** log = NULL, * bh;
+	struct ext2_journal_tag * tag = NULL;
+	struct ext2_journal_revoke_header * r;
+	unsigned long pos, nblocks, allocated = 0;
+	int i, n, tags, err;
+
+	while (!(next = alloc_transaction (j))) {
+		current->state = TASK_UNINTERRUPTIBLE;
+		schedule_timeout(HZ / 10);
+	}
+	t->t_state = T_LOCKED;
+	while (t->t_handles)
+		sleep_on(&j->j_wait_handles);
+
+	/*
+	 * Ordered data first. The buffers are written without the page
+	 * lock, as bdflush does: a writer may sit on a page lock waiting
+	 * for this very transaction to unlock.
+	 */
+	for (i = 0; i < t->t_nr_data; i++) {
+		bh = t->t_data[i];
+		if (buffer_dirty(bh) && buffer_mapped(bh))
+			ll_rw_block (WRITE, 1, &bh);
+	}
+	for (i = 0; i < t->t_nr_data; i++) {
+		wait_on_buffer (t->t_data[i]);
+		brelse (t->t_data[i]);
+	}
+	t->t_nr_data = 0;
+
+	/*
+	 * Get hold of the log blocks, and make room for them in the log.
+	 * Until the switch below nobody can get a handle, but changes
+	 * without one may still come in whenever we sleep, so the size is
+	 * worked out again after anything which may sleep.
+	 */
+	for (;;) {
+		struct buffer_head ** new;
+
+		nblocks = t_log_blocks (j, t);
+		if (log_free (j) < nblocks) {
+			unsigned long before = log_free (j);
+
+			journal_checkpoint (j, 1);
+			if (log_free (j) > before)
+				continue;
+			for (i = 0; i < allocated; i++)
+				brelse (log[i]);
+			if (log)
+				kfree (log);
+			journal_abort (j, t, next);
+			return;
+		}
+		if (allocated >= nblocks)
+			break;
+
+		new = kmalloc (nblocks * sizeof (struct buffer_head *), GFP_KERNEL);
+		if (!new) {
+			current->state = TASK_UNINTERRUPTIBLE;
+			schedule_timeout(HZ / 10);
+			continue;
+		}
+		if (log) {
+			memcpy (new, log, allocated * sizeof (struct buffer_head *));
+			kfree (log);
+		}
+		log = new;
+		pos = j->j_head;
+		for (i = 0; i < allocated; i++)
+			pos = log_next (j, pos);
+		while (allocated < nblocks) {
+			log[allocated++] = getblk (sb->s_dev, j->j_map[pos],
+						   sb->s_blocksize);
+			pos = log_next (j, pos);
+		}
+	}
+
+	/*
+	 * Copy the buffers into the log and switch to the next transaction,
+	 * all without sleeping.
+	 */
+	n = 0;
+	tags = 0;
+	for (i = 0; i < t->t_nr_buffers; i++) {
+		struct buffer_head * copy;
+
+		bh = t->t_buffers[i];
+		if (!bh)
+			continue;
+		if (!tags) {
+			fill_header (log[n], EXT2_JOURNAL_DESCRIPTOR_BLOCK,
+				     t->t_sequence);
+			tag = (struct ext2_journal_tag *)
+			      (log[n++]->b_data + sizeof (struct ext2_journal_header));
+		} else
+			tag++;
+		copy = log[n++];
+		memcpy (copy->b_data, bh->b_data, bh->b_size);
+		mark_buffer_uptodate(copy, 1);
+		tag->t_blocknr = cpu_to_le32(bh->b_blocknr);
+		tag->t_flags = 0;
+		if (*(__u32 *) copy->b_data == cpu_to_le32(EXT2_JOURNAL_MAGIC)) {
+			*(__u32 *) copy->b_data = 0;
+			tag->t_flags = cpu_to_le32(EXT2_JTAG_ESCAPE);
+		}
+		clear_bit(BH_Journaled, &bh->b_state);
+		if (++tags == j->j_tags_per_block) {
+			tag->t_flags |= cpu_to_le32(EXT2_JTAG_LAST);
+			tags = 0;
+		}
+	}
+	if (tags)
+		tag->t_flags |= cpu_to_le32(EXT2_JTAG_LAST);
+	for (i = 0; i < t->t_nr_revoke; ) {
+		int count;
+
+		fill_header (log[n], EXT2_JOURNAL_REVOKE_BLOCK, t->t_sequence);
+		r = (struct ext2_journal_revoke_header *) log[n++]->b_data;
+		for (count = 0; count < j->j_revokes_per_block &&
+				i < t->t_nr_revoke; count++, i++)
+			((__u32 *) (r + 1))[count] = cpu_to_le32(t->t_revoke[i]);
+		r->r_count = cpu_to_le32(count);
+	}
+
+	t->t_state = T_COMMIT;
+	t->t_start = j->j_head;
+	j->j_committing = t;
+	next->t_sequence = t->t_sequence + 1;
+	j->j_running = next;
+	if (log_free (j) - (n + 1) < log_len (j) / 2 || t->t_revoke_overflow)
+		j->j_barrier = 1;
+	else
+		wake_up(&j->j_wait_done);
+
+	/* The log blocks, then the commit block on its own */
+	err = write_log_blocks (log, n);
+	fill_header (log[n], EXT2_JOURNAL_COMMIT_BLOCK, t->t_sequence);
+	err |= write_log_blocks (log + n, 1);
+	n++;
+	if (err)
+		ext2_error (sb, "journal_commit",
+			    "I/O error writing transaction %u to the journal",
+			    t->t_sequence);
+	for (i = 0; i < allocated; i++)
+		brelse (log[i]);
+	kfree (log);
+
+	pos = j->j_head;
+	while (n--)
+		pos = log_next (j, pos);
+	j->j_head = t->t_end = pos;
+	if (!j->j_sb_start) {
+		if (list_empty(&j->j_checkpoint)) {
+			j->j_tail = t->t_start;
+			j->j_tail_sequence = t->t_sequence;
+		}
+		journal_write_sb (j, j->j_tail);
+	}
+
+	/* Now the buffers may go home */
+	for (i = 0; i < t->t_nr_buffers; i++) {
+		bh = t->t_buffers[i];
+		if (!bh)
+			continue;
+		if (buffer_jcheckpoint(bh))
+			unfile_checkpoint (j, bh);
+		set_bit(BH_JCheckpoint, &bh->b_state);
+		mark_buffer_dirty(bh, 1);
+	}
+	t->t_state = T_CHECKPOINT;
+	list_add_tail(&t->t_list, &j->j_checkpoint);
+	j->j_committing = NULL;
+	j->j_commit_sequence = t->t_sequence;
+
+	if (t->t_revoke_overflow)
+		ext2_warning (sb, "journal_commit",
+			      "too many blocks freed at once, "
+			      "checkpointing the whole journal");
+	if (j->j_barrier) {
+		journal_checkpoint (j, 1);
+		j->j_barrier = 0;
+	}
+	wake_up(&j->j_wait_done);
+}
+
+static int kjournald (void * data)
+{
+	struct ext2_journal * j = data;
+	struct ext2_transaction * t;
+	long timeout;
+
+	lock_kernel();
+	exit_mm(current);
+	exit_files(current);
+	exit_fs(current);
+	current->session = 1;
+	current->pgrp = 1;
+	sprintf(current->comm, "kjournald");
+	spin_lock_irq(&current->sigmask_lock);
+	flush_signals(current);
+	sigfillset(&current->blocked);
+	recalc_sigpending(current);
+	spin_unlock_irq(&current->sigmask_lock);
+	j->j_task = current;
+	up (j->j_sem);
+
+	while (!j->j_exiting) {
+		t = j->j_running;
+		if (!t_empty (t) &&
+		    (tid_gt(j->j_commit_request, j->j_commit_sequence) ||
+		     time_after_eq(jiffies, t->t_expires) ||
+		     t_log_blocks (j, t) >= j->j_soft_limit ||
+		     t->t_nr_data >= EXT2_JOURNAL_MAX_DATA / 2)) {
+			journal_commit (j);
+			continue;
+		}
+		journal_checkpoint (j, 0);
+		t = j->j_running;
+		if (j->j_exiting || (!t_empty (t) &&
+		    tid_gt(j->j_commit_request, j->j_commit_sequence)))
+			continue;
+		timeout = t->t_expires - jiffies;
+		if (timeout <= 0 || timeout > EXT2_JOURNAL_INTERVAL)
+			timeout = EXT2_JOURNAL_INTERVAL;
+		interruptible_sleep_on_timeout(&j->j_wait_commit, timeout);
+	}
+	j->j_task = NULL;
+	up (j->j_sem);
+	return 0;
+}
+
+/*
+ * Wait until everything logged so far is committed.
+ */
+static void journal_wait_commit (struct ext2_journal * j)
+{
+	unsigned int sequence = j->j_running->t_sequence;
+
+	if (t_empty (j->j_running))
+		sequence--;
+	if (current == j->j_task || !j->j_task)
+		return;
+	if (tid_gt(sequence, j->j_commit_request))
+		j->j_commit_request = sequence;
+	wake_up(&j->j_wait_commit);
+	while (tid_gt(sequence, j->j_commit_sequence))
+		sleep_on(&j->j_wait_done);
+}
+
+void ext2_journal_force_commit (struct super_block * sb)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+
+	if (!j)
+		return;
+	lock_kernel();
+	journal_wait_commit (j);
+	unlock_kernel();
+}
+
+void ext2_journal_start (struct super_block * sb, struct ext2_handle * handle)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+	struct ext2_handle * h;
+
+	handle->h_journal = j;
+	if (!j)
+		return;
+	lock_kernel();
+	handle->h_nested = 0;
+	handle->h_sync = 0;
+	for (h = current->journal_info; h; h = h->h_next)
+		if (h->h_journal == j) {
+			handle->h_nested = 1;
+			break;
+		}
+	/*
+	 * kjournald itself mustn't wait for its own commit: it may get
+	 * here through memory reclaim.
+	 */
+	if (!handle->h_nested && current != j->j_task)
+		while (j->j_barrier || j->j_running->t_state != T_RUNNING ||
+		       t_log_blocks (j, j->j_running) >= j->j_limit) {
+			wake_up(&j->j_wait_commit);
+			sleep_on(&j->j_wait_done);
+		}
+	handle->h_transaction = j->j_running;
+	handle->h_transaction->t_handles++;
+	handle->h_next = current->journal_info;
+	current->journal_info = handle;
+	unlock_kernel();
+}
+
+void ext2_journal_stop (struct ext2_handle * handle)
+{
+	struct ext2_journal * j = handle->h_journal;
+	struct ext2_transaction * t = handle->h_transaction;
+	struct ext2_handle * h;
+
+	if (!j)
+		return;
+	lock_kernel();
+	if (current->journal_info != handle)
+		BUG();
+	current->journal_info = handle->h_next;
+	if (!--t->t_handles && t->t_state == T_LOCKED)
+		wake_up(&j->j_wait_handles);
+	if (handle->h_nested) {
+		/* the enclosing handle commits for us */
+		if (handle->h_sync)
+			for (h = handle->h_next; h; h = h->h_next)
+				if (h->h_journal == j) {
+					h->h_sync = 1;
+					break;
+				}
+	} else if (handle->h_sync)
+		journal_wait_commit (j);
+	else if (t_log_blocks (j, t) >= j->j_soft_limit)
+		wake_up(&j->j_wait_commit);
+	unlock_kernel();
+}
+
+/*
+ * Called instead of mark_buffer_dirty() for metadata.
+ */
+void ext2_journal_dirty_metadata (struct super_block * sb,
+				  struct buffer_head * bh)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+	struct ext2_transaction * t;
+
+	if (!j) {
+		mark_buffer_dirty(bh, 1);
+		return;
+	}
+	lock_kernel();
+	if (test_and_set_bit(BH_Journaled, &bh->b_state))
+		goto out;
+	t = j->j_running;
+	if (t->t_nr_buffers == j->j_max_buffers) {
+		/*
+		 * A single operation should never get here: the limits
+		 * are far above what one can change.
+		 */
+		clear_bit(BH_Journaled, &bh->b_state);
+		ext2_warning (sb, "ext2_journal_dirty_metadata",
+			      "transaction full, writing block %lu in place",
+			      bh->b_blocknr);
+		mark_buffer_dirty(bh, 1);
+		ll_rw_block (WRITE, 1, &bh);
+		wait_on_buffer (bh);
+		goto out;
+	}
+	atomic_inc(&bh->b_count);
+	t->t_buffers[t->t_nr_buffers++] = bh;
+out:
+	unlock_kernel();
+}
+
+/*
+ * A data block was just allocated into this buffer: in ordered mode
+ * it is written out before the transaction commits.
+ */
+void ext2_journal_dirty_data (struct inode * inode, struct buffer_head * bh)
+{
+	struct ext2_journal * j = inode->i_sb->u.ext2_sb.s_journal;
+	struct ext2_transaction * t;
+
+	if (!j || test_opt (inode->i_sb, DATA_WRITEBACK))
+		return;
+	lock_kernel();
+	t = j->j_running;
+	if (t->t_nr_data == t->t_max_data) {
+		struct buffer_head ** new;
+		int max = t->t_max_data ? 2 * t->t_max_data : 64;
+
+		if (max > EXT2_JOURNAL_MAX_DATA)
+			goto out;
+		new = kmalloc (max * sizeof (struct buffer_head *), GFP_KERNEL);
+		if (!new)
+			goto out;
+		/* we may have slept, but the transaction can't have changed */
+		if (t->t_data) {
+			memcpy (new, t->t_data,
+				t->t_nr_data * sizeof (struct buffer_head *));
+			kfree (t->t_data);
+		}
+		t->t_data = new;
+		t->t_max_data = max;
+	}
+	atomic_inc(&bh->b_count);
+	t->t_data[t->t_nr_data++] = bh;
+	if (t->t_nr_data == EXT2_JOURNAL_MAX_DATA / 2)
+		wake_up(&j->j_wait_commit);
+out:
+	unlock_kernel();
+}
+
+/*
+ * Used where a metadata buffer used to be written synchronously:
+ * the enclosing handle commits when it stops.
+ */
+void ext2_sync_metadata (struct super_block * sb, struct buffer_head * bh)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+	struct ext2_handle * h;
+
+	if (!j) {
+		ll_rw_block (WRITE, 1, &bh);
+		wait_on_buffer (bh);
+		return;
+	}
+	lock_kernel();
+	for (h = current->journal_info; h; h = h->h_next)
+		if (h->h_journal == j)
+			break;
+	if (h)
+		h->h_sync = 1;
+	else
+		journal_wait_commit (j);
+	unlock_kernel();
+}
+
+/*
+ * The inode is written into its buffer right away when journaling, so
+ * that it is logged with the rest of the operation.
+ */
+void ext2_mark_inode_dirty (struct inode * inode)
+{
+	if (inode->i_sb->u.ext2_sb.s_journal)
+		ext2_write_inode (inode);
+	else
+		mark_inode_dirty(inode);
+}
+
+/*
+ * An indirect block is about to be freed. Fails if somebody but the
+ * caller and the journal is using the buffer; otherwise the journal
+ * lets go of it and makes sure no old copy of it gets replayed.
+ */
+int ext2_journal_forget (struct super_block * sb, struct buffer_head * bh)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+	int err = 0;
+
+	if (!j)
+		return atomic_read(&bh->b_count) == 1 ? 0 : -EBUSY;
+	lock_kernel();
+	if (atomic_read(&bh->b_count) != 1 + journal_holds (j, bh, 0))
+		err = -EBUSY;
+	else {
+		journal_holds (j, bh, 1);
+		mark_buffer_clean(bh);
+		journal_record_revoke (j, bh->b_blocknr);
+	}
+	unlock_kernel();
+	return err;
+}
+
+/*
+ * A metadata block has been freed.
+ */
+void ext2_journal_revoke (struct super_block * sb, unsigned long block)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+	struct buffer_head * bh;
+
+	if (!j)
+		return;
+	lock_kernel();
+	bh = get_hash_table (sb->s_dev, block, sb->s_blocksize);
+	if (bh) {
+		if (journal_holds (j, bh, 1))
+			mark_buffer_clean(bh);
+		brelse (bh);
+	}
+	journal_record_revoke (j, block);
+	unlock_kernel();
+}
+
+/*
+ * Recovery. Three passes over the log: find the last complete
+ * transaction, collect the revoked blocks, then write the logged
+ * blocks home.
+ */
+#define PASS_SCAN	0
+#define PASS_REVOKE	1
+#define PASS_REPLAY	2
+
+#define REVOKE_HASH	256
+
+struct revoke_record {
+	struct revoke_record * next;
+	unsigned long block;
+	unsigned int sequence;
+};
+
+static int record_revoke (struct revoke_record ** hash, unsigned long block,
+			  unsigned int sequence)
+{
+	struct revoke_record * r;
+
+	for (r = hash[block % REVOKE_HASH]; r; r = r->next)
+		if (r->block == block) {
+			if (tid_gt(sequence, r->sequence))
+				r->sequence = sequence;
+			return 0;
+		}
+	r = kmalloc (sizeof (*r), GFP_KERNEL);
+	if (!r)
+		return -ENOMEM;
+	r->block = block;
+	r->sequence = sequence;
+	r->next = hash[block % REVOKE_HASH];
+	hash[block % REVOKE_HASH] = r;
+	return 0;
+}
+
+static int revoked (struct revoke_record ** hash, unsigned long block,
+		    unsigned int sequence)
+{
+	struct revoke_record * r;
+
+	for (r = hash[block % REVOKE_HASH]; r; r = r->next)
+		if (r->block == block)
+			return tid_gt(r->sequence, sequence);
+	return 0;
+}
+
+static int replay_block (struct ext2_journal * j, unsigned long pos,
+			 unsigned long block, int flags)
+{
+	struct super_block * sb = j->j_sb;
+	struct buffer_head * copy, * bh;
+
+	if (block >= le32_to_cpu(sb->u.ext2_sb.s_es->s_blocks_count)) {
+		printk ("EXT2-fs: journal tags block %lu past the end of "
+			"the filesystem\n", block);
+		return -EIO;
+	}
+	copy = bread (sb->s_dev, j->j_map[pos], sb->s_blocksize);
+	if (!copy)
+		return -EIO;
+	bh = getblk (sb->s_dev, block, sb->s_blocksize);
+	memcpy (bh->b_data, copy->b_data, sb->s_blocksize);
+	if (flags & EXT2_JTAG_ESCAPE)
+		*(__u32 *) bh->b_data = cpu_to_le32(EXT2_JOURNAL_MAGIC);
+	mark_buffer_uptodate(bh, 1);
+	mark_buffer_dirty(bh, 1);
+	brelse (bh);
+	brelse (copy);
+	return 0;
+}
+
+static int journal_scan (struct ext2_journal * j, int pass,
+			 struct revoke_record ** hash, unsigned int * end)
+{
+	struct ext2_journal_super_block * jsb =
+		(struct ext2_journal_super_block *) j->j_sb_bh->b_data;
+	unsigned long pos = le32_to_cpu(jsb->s_start), p, seen = 0;
+	unsigned int sequence = le32_to_cpu(jsb->s_sequence);
+	struct ext2_journal_header * h;
+	struct ext2_journal_tag * tag;
+	struct ext2_journal_revoke_header * r;
+	struct buffer_head * bh;
+	int i, err = 0;
+
+	while (seen < log_len (j)) {
+		if (pass != PASS_SCAN && sequence == *end)
+			break;
+		bh = bread (j->j_sb->s_dev, j->j_map[pos], j->j_sb->s_blocksize);
+		if (!bh)
+			return -EIO;
+		h = (struct ext2_journal_header *) bh->b_data;
+		if (le32_to_cpu(h->h_magic) != EXT2_JOURNAL_MAGIC ||
+		    le32_to_cpu(h->h_sequence) != sequence) {
+			brelse (bh);
+			break;
+		}
+		switch (le32_to_cpu(h->h_blocktype)) {
+		case EXT2_JOURNAL_DESCRIPTOR_BLOCK:
+			tag = (struct ext2_journal_tag *) (h + 1);
+			p = pos;
+			for (i = 0; i < j->j_tags_per_block; i++, tag++) {
+				p = log_next (j, p);
+				seen++;
+				if (pass == PASS_REPLAY &&
+				    !revoked (hash, le32_to_cpu(tag->t_blocknr),
+					      sequence))
+					err = replay_block (j, p,
+						le32_to_cpu(tag->t_blocknr),
+						le32_to_cpu(tag->t_flags));
+				if (err || le32_to_cpu(tag->t_flags) & EXT2_JTAG_LAST)
+					break;
+			}
+			pos = p;
+			break;
+		case EXT2_JOURNAL_REVOKE_BLOCK:
+			r = (struct ext2_journal_revoke_header *) h;
+			if (pass == PASS_REVOKE)
+				for (i = 0; i < le32_to_cpu(r->r_count) &&
+					    i < j->j_revokes_per_block; i++) {
+					err = record_revoke (hash,
+						le32_to_cpu(((__u32 *) (r + 1))[i]),
+						sequence);
+					if (err)
+						break;
+				}
+			break;
+		case EXT2_JOURNAL_COMMIT_BLOCK:
+			sequence++;
+			break;
+		default:
+			brelse (bh);
+			goto out;
+		}
+		brelse (bh);
+		if (err)
+			return err;
+		pos = log_next (j, pos);
+		seen++;
+	}
+out:
+	if (pass == PASS_SCAN)
+		*end = sequence;
+	return 0;
+}
+
+static int journal_recover (struct ext2_journal * j)
+{
+	struct ext2_journal_super_block * jsb =
+		(struct ext2_journal_super_block *) j->j_sb_bh->b_data;
+	struct revoke_record * hash[REVOKE_HASH], * r;
+	unsigned int end;
+	int i, err;
+
+	memset (hash, 0, sizeof (hash));
+	err = journal_scan (j, PASS_SCAN, hash, &end);
+	if (!err)
+		err = journal_scan (j, PASS_REVOKE, hash, &end);
+	if (!err)
+		err = journal_scan (j, PASS_REPLAY, hash, &end);
+	for (i = 0; i < REVOKE_HASH; i++)
+		while ((r = hash[i]) != NULL) {
+			hash[i] = r->next;
+			kfree (r);
+		}
+	if (err) {
+		printk ("EXT2-fs: %s: error %d recovering the journal\n",
+			bdevname(j->j_sb->s_dev), err);
+		return err;
+	}
+	printk ("EXT2-fs: %s: recovered %u transactions from the journal\n",
+		bdevname(j->j_sb->s_dev), end - le32_to_cpu(jsb->s_sequence));
+	fsync_dev(j->j_sb->s_dev);
+
+	/*
+	 * Start afresh one past the last sequence we saw, so that no
+	 * leftover of an uncommitted transaction can pass for a new one.
+	 */
+	j->j_tail_sequence = end + 1;
+	journal_write_sb (j, 0);
+	return 0;
+}
+
+/*
+ * Turn the file into a journal: it must be a regular file without
+ * holes. Its contents are wiped, and it is made immutable.
+ */
+static int journal_create (struct super_block * sb, struct inode * inode)
+{
+	struct ext2_super_block * es = sb->u.ext2_sb.s_es;
+	struct ext2_journal_super_block * jsb;
+	struct buffer_head * bh;
+	unsigned long blocks, i, block;
+
+	if (le32_to_cpu(es->s_rev_level) == EXT2_GOOD_OLD_REV) {
+		printk ("EXT2-fs: a journal needs a dynamic revision "
+			"filesystem\n");
+		return -EINVAL;
+	}
+	blocks = inode->i_size >> EXT2_BLOCK_SIZE_BITS(sb);
+	if (!S_ISREG(inode->i_mode) || !inode->i_nlink ||
+	    blocks < EXT2_JOURNAL_MIN_BLOCKS) {
+		printk ("EXT2-fs: inode %lu can't be a journal: it must be a "
+			"regular file of at least %d blocks\n",
+			inode->i_ino, EXT2_JOURNAL_MIN_BLOCKS);
+		return -EINVAL;
+	}
+	if (blocks > EXT2_JOURNAL_MAX_BLOCKS)
+		blocks = EXT2_JOURNAL_MAX_BLOCKS;
+	for (i = 0; i < blocks; i++) {
+		block = ext2_bmap (inode, i);
+		if (!block) {
+			printk ("EXT2-fs: journal inode %lu has holes\n",
+				inode->i_ino);
+			return -EINVAL;
+		}
+		bh = getblk (sb->s_dev, block, sb->s_blocksize);
+		memset (bh->b_data, 0, sb->s_blocksize);
+		if (!i) {
+			jsb = (struct ext2_journal_super_block *) bh->b_data;
+			jsb->s_header.h_magic = cpu_to_le32(EXT2_JOURNAL_MAGIC);
+			jsb->s_header.h_blocktype =
+				cpu_to_le32(EXT2_JOURNAL_SUPER_BLOCK);
+			jsb->s_blocksize = cpu_to_le32(sb->s_blocksize);
+			jsb->s_maxlen = cpu_to_le32(blocks);
+			jsb->s_first = cpu_to_le32(1);
+			jsb->s_sequence = cpu_to_le32(1);
+			jsb->s_start = 0;
+		}
+		mark_buffer_uptodate(bh, 1);
+		mark_buffer_dirty(bh, 1);
+		brelse (bh);
+	}
+	inode->u.ext2_i.i_flags |= EXT2_IMMUTABLE_FL;
+	inode->i_flags |= S_IMMUTABLE;
+	ext2_sync_inode (inode);
+
+	es->s_journal_inum = cpu_to_le32(inode->i_ino);
+	sb->u.ext2_sb.s_feature_compat |= EXT2_FEATURE_COMPAT_HAS_JOURNAL;
+	es->s_feature_compat = cpu_to_le32(sb->u.ext2_sb.s_feature_compat);
+	mark_buffer_dirty(sb->u.ext2_sb.s_sbh, 1);
+	fsync_dev(sb->s_dev);
+	printk ("EXT2-fs: %s: created a %lu block journal in inode %lu\n",
+		bdevname(sb->s_dev), blocks, inode->i_ino);
+	return 0;
+}
+
+/*
+ * The RECOVER feature is set on disk while the filesystem is mounted
+ * read-write with a journal: kernels which can't replay it won't
+ * mount it.
+ */
+void ext2_journal_set_recover (struct super_block * sb, int on)
+{
+	struct ext2_super_block * es = sb->u.ext2_sb.s_es;
+	struct buffer_head * bh = sb->u.ext2_sb.s_sbh;
+
+	if (on)
+		sb->u.ext2_sb.s_feature_incompat |= EXT2_FEATURE_INCOMPAT_RECOVER;
+	else
+		sb->u.ext2_sb.s_feature_incompat &= ~EXT2_FEATURE_INCOMPAT_RECOVER;
+	es->s_feature_incompat = cpu_to_le32(sb->u.ext2_sb.s_feature_incompat);
+	mark_buffer_dirty(bh, 1);
+	ll_rw_block (WRITE, 1, &bh);
+	wait_on_buffer (bh);
+}
+
+/*
+ * Called at mount time, once the group descriptors are in. 'inum' is
+ * the journal= mount option, which makes a journal out of that inode
+ * if the filesystem has none yet.
+ */
+int ext2_journal_load (struct super_block * sb, unsigned long inum)
+{
+	struct ext2_super_block * es = sb->u.ext2_sb.s_es;
+	struct ext2_journal_super_block * jsb;
+	struct ext2_journal * j;
+	struct inode * inode;
+	unsigned long i, maxlen;
+	int err = -EINVAL;
+	DECLARE_MUTEX_LOCKED(sem);
+
+	sb->u.ext2_sb.s_journal = NULL;
+	if (!EXT2_HAS_COMPAT_FEATURE(sb, EXT2_FEATURE_COMPAT_HAS_JOURNAL)) {
+		if (EXT2_HAS_INCOMPAT_FEATURE(sb, EXT2_FEATURE_INCOMPAT_RECOVER)) {
+			printk ("EXT2-fs: %s: needs recovery, but has no "
+				"journal\n", bdevname(sb->s_dev));
+			return -EINVAL;
+		}
+		if (!inum)
+			return 0;
+		if (sb->s_flags & MS_RDONLY) {
+			printk ("EXT2-fs: can't create a journal on a "
+				"read-only mount\n");
+			return -EROFS;
+		}
+	} else {
+		if (inum && inum != le32_to_cpu(es->s_journal_inum))
+			printk ("EXT2-fs: %s: already has a journal in "
+				"inode %u\n", bdevname(sb->s_dev),
+				le32_to_cpu(es->s_journal_inum));
+		inum = 0;
+	}
+
+	inode = iget (sb, inum ? inum : le32_to_cpu(es->s_journal_inum));
+	if (!inode)
+		return -EIO;
+	if (inum && (err = journal_create (sb, inode)) != 0)
+		goto out_iput;
+
+	err = -ENOMEM;
+	j = kmalloc (sizeof (*j), GFP_KERNEL);
+	if (!j)
+		goto out_iput;
+	memset (j, 0, sizeof (*j));
+	j->j_sb = sb;
+	j->j_inode = inode;
+	INIT_LIST_HEAD(&j->j_checkpoint);
+	init_MUTEX(&j->j_checkpoint_sem);
+	init_waitqueue_head(&j->j_wait_commit);
+	init_waitqueue_head(&j->j_wait_done);
+	init_waitqueue_head(&j->j_wait_handles);
+
+	err = -EIO;
+	if (!(i = ext2_bmap (inode, 0)) ||
+	    !(j->j_sb_bh = bread (sb->s_dev, i, sb->s_blocksize))) {
+		printk ("EXT2-fs: unable to read the journal super block\n");
+		goto out_free;
+	}
+	jsb = (struct ext2_journal_super_block *) j->j_sb_bh->b_data;
+	maxlen = le32_to_cpu(jsb->s_maxlen);
+	err = -EINVAL;
+	if (le32_to_cpu(jsb->s_header.h_magic) != EXT2_JOURNAL_MAGIC ||
+	    le32_to_cpu(jsb->s_header.h_blocktype) != EXT2_JOURNAL_SUPER_BLOCK ||
+	    le32_to_cpu(jsb->s_blocksize) != sb->s_blocksize ||
+	    maxlen < EXT2_JOURNAL_MIN_BLOCKS || maxlen > EXT2_JOURNAL_MAX_BLOCKS ||
+	    le32_to_cpu(jsb->s_first) != 1 ||
+	    le32_to_cpu(jsb->s_start) >= maxlen) {
+		printk ("EXT2-fs: %s: bad journal super block\n",
+			bdevname(sb->s_dev));
+		goto out_free;
+	}
+	err = -ENOMEM;
+	j->j_map = kmalloc (maxlen * sizeof (unsigned long), GFP_KERNEL);
+	if (!j->j_map)
+		goto out_free;
+	err = -EINVAL;
+	for (i = 0; i < maxlen; i++)
+		if (!(j->j_map[i] = ext2_bmap (inode, i))) {
+			printk ("EXT2-fs: journal inode %lu has holes\n",
+				inode->i_ino);
+			goto out_free;
+		}
+	j->j_first = 1;
+	j->j_last = maxlen;
+	j->j_tags_per_block = (sb->s_blocksize - sizeof (struct ext2_journal_header)) /
+			      sizeof (struct ext2_journal_tag);
+	j->j_revokes_per_block = (sb->s_blocksize -
+				  sizeof (struct ext2_journal_revoke_header)) /
+				 sizeof (__u32);
+
+	if (le32_to_cpu(jsb->s_start)) {
+		err = -EROFS;
+		if (is_read_only(sb->s_dev)) {
+			printk ("EXT2-fs: %s: the journal needs recovery, "
+				"but the device is read-only\n",
+				bdevname(sb->s_dev));
+			goto out_free;
+		}
+		err = journal_recover (j);
+		if (err)
+			goto out_free;
+		/* the super block and the group descriptors may have changed */
+		sb->u.ext2_sb.s_feature_compat = le32_to_cpu(es->s_feature_compat);
+		sb->u.ext2_sb.s_feature_incompat = le32_to_cpu(es->s_feature_incompat);
+		sb->u.ext2_sb.s_feature_ro_compat = le32_to_cpu(es->s_feature_ro_compat);
+		sb->u.ext2_sb.s_mount_state = le16_to_cpu(es->s_state);
+	} else
+		j->j_tail_sequence = le32_to_cpu(jsb->s_sequence);
+
+	/*
+	 * A transaction may take up to half of the log, revoke records
+	 * included, so that one can always commit while the previous
+	 * one is still being checkpointed.
+	 */
+	i = log_len (j) / 16 ? log_len (j) / 16 : 1;
+	j->j_max_revoke = i * j->j_revokes_per_block;
+	j->j_max_buffers = (log_len (j) / 2 - 1 - i - 1) * j->j_tags_per_block /
+			   (j->j_tags_per_block + 1);
+	j->j_limit = log_len (j) / 4;
+	j->j_soft_limit = log_len (j) / 8;
+	j->j_head = j->j_tail = j->j_first;
+	j->j_commit_sequence = j->j_commit_request = j->j_tail_sequence - 1;
+
+	err = -ENOMEM;
+	j->j_running = alloc_transaction (j);
+	if (!j->j_running)
+		goto out_free;
+	j->j_running->t_sequence = j->j_tail_sequence;
+
+	j->j_sem = &sem;
+	if (kernel_thread(kjournald, j, 0) < 0) {
+		free_transaction (j->j_running);
+		goto out_free;
+	}
+	down (&sem);
+
+	sb->u.ext2_sb.s_journal = j;
+	if (!(sb->s_flags & MS_RDONLY))
+		ext2_journal_set_recover (sb, 1);
+	return 0;
+
+out_free:
+	if (j->j_map)
+		kfree (j->j_map);
+	if (j->j_sb_bh)
+		brelse (j->j_sb_bh);
+	kfree (j);
+out_iput:
+	iput (inode);
+	return err;
+}
+
+/*
+ * Commit and write everything home, and mark the log empty.
+ */
+void ext2_journal_flush (struct super_block * sb)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+
+	if (!j)
+		return;
+	lock_kernel();
+	journal_wait_commit (j);
+	journal_checkpoint (j, 1);
+	if (list_empty(&j->j_checkpoint) && t_empty (j->j_running))
+		journal_write_sb (j, 0);
+	unlock_kernel();
+}
+
+void ext2_journal_release (struct super_block * sb)
+{
+	struct ext2_journal * j = sb->u.ext2_sb.s_journal;
+	DECLARE_MUTEX_LOCKED(sem);
+
+	if (!j)
+		return;
+	lock_kernel();
+	j->j_sem = &sem;
+	j->j_exiting = 1;
+	wake_up(&j->j_wait_commit);
+	down (&sem);
+
+	if (!t_empty (j->j_running))
+		journal_commit (j);
+	journal_checkpoint (j, 1);
+	if (!(sb->s_flags & MS_RDONLY)) {
+		journal_write_sb (j, 0);
+		ext2_journal_set_recover (sb, 0);
+	}
+	sb->u.ext2_sb.s_journal = NULL;
+	free_transaction (j->j_running);
+	brelse (j->j_sb_bh);
+	kfree (j->j_map);
+	iput (j->j_inode);
+	kfree (j);
+	unlock_kernel();
+}
@@ -21,6 +21,7 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/locks.h>
+#include <linux/malloc.h>
 #include <linux/quotaops.h>
 
 
@@ -49,6 +50,730 @@ static inline int ext2_match (int len, const char * const name,
 	return !memcmp(name, de->name, len);
 }
 
+/*
+ * Hashed directory index.
+ *
+ * A directory that outgrows its first block gets an index of name
+ * hashes when the filesystem is mounted with "-o index". The index is
+ * kept in ordinary directory blocks, where a kernel that doesn't know
+ * about it sees only empty entries: block 0 holds "." and a ".." whose
+ * rec_len covers the rest of the block, and the root of the index
+ * lives in that space. The root points to leaf blocks, or (with
+ * indirect_levels set) to index nodes that point to leaves. Each
+ * pointer covers the hashes from its own up to the next one's. Leaves
+ * are plain directory blocks.
+ *
+ * A kernel that adds an entry without updating the index clears
+ * EXT2_INDEX_FL, after which the directory is searched linearly again.
+ *
+ * When a leaf is split and both halves keep names with the same hash,
+ * the new index entry gets the low bit of its hash set, and a lookup
+ * for that hash goes on into the next block.
+ */
+
+#define DX_HASH_VERSION		0
+#define DX_MAX_LEVELS		2	/* the root, and one level of nodes */
+#define ERR_BAD_DX_DIR		-75000	/* the index is unusable */
+
+struct fake_dirent {
+	__u32	inode;
+	__u16	rec_len;
+	__u8	name_len;
+	__u8	file_type;
+};
+
+struct dx_countlimit {
+	__u16	limit;
+	__u16	count;
+};
+
+/* the hash of the first entry in a block holds a dx_countlimit */
+struct dx_entry {
+	__u32	hash;
+	__u32	block;
+};
+
+struct dx_root_info {
+	__u32	reserved_zero;
+	__u8	hash_version;
+	__u8	info_length;		/* sizeof(struct dx_root_info) */
+	__u8	indirect_levels;
+	__u8	unused_flags;
+};
+
+struct dx_root {
+	struct fake_dirent	dot;
+	char			dot_name[4];
+	struct fake_dirent	dotdot;
+	char			dotdot_name[4];
+	struct dx_root_info	info;
+	struct dx_entry		entries[0];
+};
+
+struct dx_node {
+	struct fake_dirent	fake;
+	struct dx_entry		entries[0];
+};
+
+/* one level of a lookup path through the index */
+struct dx_frame {
+	struct buffer_head *	bh;
+	struct dx_entry *	entries;
+	struct dx_entry *	at;
+};
+
+/* a live entry of a leaf being split */
+struct dx_map_entry {
+	__u32	hash;
+	__u16	offs;
+	__u16	size;
+};
+
+static inline int is_dx (struct inode * dir)
+{
+	return dir->u.ext2_i.i_flags & EXT2_INDEX_FL;
+}
+
+static inline unsigned dx_get_block (struct dx_entry * entry)
+{
+	return le32_to_cpu(entry->block);
+}
+
+static inline void dx_set_block (struct dx_entry * entry, unsigned block)
+{
+	entry->block = cpu_to_le32(block);
+}
+
+static inline __u32 dx_get_hash (struct dx_entry * entry)
+{
+	return le32_to_cpu(entry->hash);
+}
+
+static inline void dx_set_hash (struct dx_entry * entry, __u32 hash)
+{
+	entry->hash = cpu_to_le32(hash);
+}
+
+static inline unsigned dx_get_count (struct dx_entry * entries)
+{
+	return le16_to_cpu(((struct dx_countlimit *) entries)->count);
+}
+
+static inline void dx_set_count (struct dx_entry * entries, unsigned count)
+{
+	((struct dx_countlimit *) entries)->count = cpu_to_le16(count);
+}
+
+static inline unsigned dx_get_limit (struct dx_entry * entries)
+{
+	return le16_to_cpu(((struct dx_countlimit *) entries)->limit);
+}
+
+static inline void dx_set_limit (struct dx_entry * entries, unsigned limit)
+{
+	((struct dx_countlimit *) entries)->limit = cpu_to_le16(limit);
+}
+
+static inline unsigned dx_root_limit (struct inode * dir)
+{
+	return (dir->i_sb->s_blocksize - sizeof(struct dx_root)) /
+		sizeof(struct dx_entry);
+}
+
+static inline unsigned dx_node_limit (struct inode * dir)
+{
+	return (dir->i_sb->s_blocksize - sizeof(struct dx_node)) /
+		sizeof(struct dx_entry);
+}
+
+/*
+ * The low bit is left clear for the collision flag.
+ */
+static __u32 dx_hash (const char * name, int len)
+{
+	__u32 hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+
+	while (len--) {
+		__u32 hash = hash1 +
+			(hash0 ^ (*(const unsigned char *) name++ * 7152373));
+
+		if (hash & 0x80000000)
+			hash -= 0x7fffffff;
+		hash1 = hash0;
+		hash0 = hash;
+	}
+	return hash0 << 1;
+}
+
+static void dx_release (struct dx_frame * frames)
+{
+	int i;
+
+	for (i = 0; i < DX_MAX_LEVELS; i++) {
+		brelse (frames[i].bh);
+		frames[i].bh = NULL;
+	}
+}
+
+/*
+ * Walk down the index to the leaf that covers hash. Returns the frame
+ * of the lowest index level, or NULL with *err set; the caller has to
+ * dx_release() the frames in both cases.
+ */
+static struct dx_frame * dx_probe (struct inode * dir, __u32 hash,
+				   struct dx_frame * frames, int * err)
+{
+	struct dx_frame * frame = frames;
+	struct buffer_head * bh;
+	struct dx_root * root;
+	struct dx_entry * entries, * p, * q, * m;
+	unsigned count, levels;
+	int i;
+
+	for (i = 0; i < DX_MAX_LEVELS; i++)
+		frames[i].bh = NULL;
+	bh = ext2_bread (dir, 0, 0, err);
+	if (!bh)
+		return NULL;
+	root = (struct dx_root *) bh->b_data;
+	entries = root->entries;
+	if (root->info.reserved_zero ||
+	    root->info.hash_version != DX_HASH_VERSION ||
+	    root->info.info_length != sizeof(root->info) ||
+	    root->info.indirect_levels >= DX_MAX_LEVELS ||
+	    dx_get_limit(entries) != dx_root_limit(dir))
+		goto bad_index;
+	levels = root->info.indirect_levels;
+
+	for (;;) {
+		frame->bh = bh;
+		count = dx_get_count(entries);
+		if (!count || count > dx_get_limit(entries))
+			goto bad_index;
+
+		/* find the last entry with a hash not above ours */
+		p = entries + 1;
+		q = entries + count - 1;
+		while (p <= q) {
+			m = p + (q - p) / 2;
+			if (dx_get_hash(m) > hash)
+				q = m - 1;
+			else
+				p = m + 1;
+		}
+		frame->entries = entries;
+		frame->at = p - 1;
+		if (!levels--)
+			return frame;
+
+		bh = ext2_bread (dir, dx_get_block(frame->at), 0, err);
+		if (!bh)
+			return NULL;
+		frame++;
+		frame->bh = bh;
+		entries = ((struct dx_node *) bh->b_data)->entries;
+		if (dx_get_limit(entries) != dx_node_limit(dir))
+			goto bad_index;
+	}
+
+bad_index:
+	ext2_warning (dir->i_sb, "dx_probe",
+		      "bad index in directory #%lu", dir->i_ino);
+	if (!frame->bh)
+		brelse (bh);
+	*err = ERR_BAD_DX_DIR;
+	return NULL;
+}
+
+/*
+ * Step frame to the next leaf if it continues the names with this
+ * hash. Returns 1 if it did, 0 if there is no such leaf, or an error.
+ */
+static int dx_next_leaf (struct inode * dir, __u32 hash,
+			 struct dx_frame * frames, struct dx_frame * frame)
+{
+	struct dx_frame * p = frame;
+	struct buffer_head * bh;
+	__u32 next;
+	int err;
+
+	for (;;) {
+		p->at++;
+		if (p->at < p->entries + dx_get_count(p->entries))
+			break;
+		if (p == frames)
+			return 0;
+		p--;
+	}
+	next = dx_get_hash(p->at);
+	if (!(next & 1) || (next & ~1) != hash)
+		return 0;
+
+	while (p < frame) {
+		bh = ext2_bread (dir, dx_get_block(p->at), 0, &err);
+		if (!bh)
+			return err;
+		p++;
+		brelse (p->bh);
+		p->bh = bh;
+		p->entries = ((struct dx_node *) bh->b_data)->entries;
+		p->at = p->entries;
+	}
+	return 1;
+}
+
+static struct ext2_dir_entry_2 * dx_search_leaf (struct inode * dir,
+						 struct buffer_head * bh,
+						 const char * name, int namelen)
+{
+	struct ext2_dir_entry_2 * de = (struct ext2_dir_entry_2 *) bh->b_data;
+	char * dlimit = bh->b_data + dir->i_sb->s_blocksize;
+	unsigned long offset = 0;
+
+	while ((char *) de < dlimit) {
+		if (!ext2_check_dir_entry ("dx_search_leaf", dir, de, bh,
+					   offset))
+			return NULL;
+		if (ext2_match (namelen, name, de))
+			return de;
+		offset += le16_to_cpu(de->rec_len);
+		de = (struct ext2_dir_entry_2 *)
+			((char *) de + le16_to_cpu(de->rec_len));
+	}
+	return NULL;
+}
+
+static struct buffer_head * ext2_dx_find_entry (struct inode * dir,
+					const char * name, int namelen,
+					struct ext2_dir_entry_2 ** res_dir,
+					int * err)
+{
+	struct dx_frame frames[DX_MAX_LEVELS], * frame;
+	struct buffer_head * bh;
+	struct ext2_dir_entry_2 * de;
+	__u32 hash = dx_hash (name, namelen);
+
+	frame = dx_probe (dir, hash, frames, err);
+	if (!frame)
+		goto out;
+	do {
+		bh = ext2_bread (dir, dx_get_block(frame->at), 0, err);
+		if (!bh)
+			goto out;
+		de = dx_search_leaf (dir, bh, name, namelen);
+		if (de) {
+			dx_release (frames);
+			*res_dir = de;
+			return bh;
+		}
+		brelse (bh);
+		*err = dx_next_leaf (dir, hash, frames, frame);
+	} while (*err > 0);
+out:
+	dx_release (frames);
+	return NULL;
+}
+
+/*
+ * Put a new entry into one directory block, the same way
+ * ext2_add_entry() does.
+ */
+static struct ext2_dir_entry_2 * dx_add_dirent (struct inode * dir,
+						const char * name, int namelen,
+						struct buffer_head * bh,
+						int * err)
+{
+	unsigned short rec_len = EXT2_DIR_REC_LEN(namelen);
+	struct ext2_dir_entry_2 * de, * de1;
+	char * dlimit = bh->b_data + dir->i_sb->s_blocksize;
+	unsigned long offset = 0;
+
+	de = (struct ext2_dir_entry_2 *) bh->b_data;
+	while ((char *) de < dlimit) {
+		if (!ext2_check_dir_entry ("dx_add_dirent", dir, de, bh,
+					   offset)) {
+			*err = -EIO;
+			return NULL;
+		}
+		if (ext2_match (namelen, name, de)) {
+			*err = -EEXIST;
+			return NULL;
+		}
+		if ((le32_to_cpu(de->inode) == 0 && le16_to_cpu(de->rec_len) >= rec_len) ||
+		    (le16_to_cpu(de->rec_len) >= EXT2_DIR_REC_LEN(de->name_len) + rec_len)) {
+			if (le32_to_cpu(de->inode)) {
+				de1 = (struct ext2_dir_entry_2 *) ((char *) de +
+					EXT2_DIR_REC_LEN(de->name_len));
+				de1->rec_len = cpu_to_le16(le16_to_cpu(de->rec_len) -
+					EXT2_DIR_REC_LEN(de->name_len));
+				de->rec_len = cpu_to_le16(EXT2_DIR_REC_LEN(de->name_len));
+				de = de1;
+			}
+			de->inode = 0;
+			de->name_len = namelen;
+			de->file_type = 0;
+			memcpy (de->name, name, namelen);
+			dir->i_mtime = dir->i_ctime = CURRENT_TIME;
+			ext2_mark_inode_dirty(dir);
+			dir->i_version = ++event;
+			ext2_journal_dirty_metadata (dir->i_sb, bh);
+			*err = 0;
+			return de;
+		}
+		offset += le16_to_cpu(de->rec_len);
+		de = (struct ext2_dir_entry_2 *)
+			((char *) de + le16_to_cpu(de->rec_len));
+	}
+	*err = -ENOSPC;
+	return NULL;
+}
+
+static struct buffer_head * dx_append_block (struct inode * dir,
+					     unsigned * block, int * err)
+{
+	struct buffer_head * bh;
+
+	*block = dir->i_size >> EXT2_BLOCK_SIZE_BITS(dir->i_sb);
+	bh = ext2_bread (dir, *block, 1, err);
+	if (!bh)
+		return NULL;
+	dir->i_size += dir->i_sb->s_blocksize;
+	ext2_mark_inode_dirty(dir);
+	return bh;
+}
+
+static void dx_dirty (struct inode * dir, struct buffer_head * bh)
+{
+	ext2_journal_dirty_metadata (dir->i_sb, bh);
+	if (IS_SYNC(dir))
+		ext2_sync_metadata (dir->i_sb, bh);
+}
+
+static void dx_insert_entry (struct dx_frame * frame, __u32 hash,
+			     unsigned block)
+{
+	struct dx_entry * entries = frame->entries;
+	struct dx_entry * new = frame->at + 1;
+	unsigned count = dx_get_count(entries);
+
+	memmove (new + 1, new, (char *) (entries + count) - (char *) new);
+	dx_set_hash (new, hash);
+	dx_set_block (new, block);
+	dx_set_count (entries, count + 1);
+}
+
+/*
+ * Make sure the lowest index level has room for one more leaf, by
+ * adding a level below the root or by splitting a node. Returns the
+ * frame to insert into.
+ */
+static struct dx_frame * dx_make_room (struct inode * dir,
+				       struct dx_frame * frames,
+				       struct dx_frame * frame, int * err)
+{
+	struct dx_entry * entries = frame->entries, * entries2;
+	unsigned count = dx_get_count(entries);
+	unsigned count1, block;
+	struct buffer_head * bh2;
+
+	if (count < dx_get_limit(entries))
+		return frame;
+
+	if (frame == frames && frame < frames + DX_MAX_LEVELS - 1) {
+		/* a full root with leaves below it: move it down a level */
+		struct dx_root * root = (struct dx_root *) frame->bh->b_data;
+
+		bh2 = dx_append_block (dir, &block, err);
+		if (!bh2)
+			return NULL;
+		memset (bh2->b_data, 0, sizeof(struct fake_dirent));
+		((struct dx_node *) bh2->b_data)->fake.rec_len =
+			cpu_to_le16(dir->i_sb->s_blocksize);
+		entries2 = ((struct dx_node *) bh2->b_data)->entries;
+		memcpy (entries2, entries, count * sizeof(struct dx_entry));
+		dx_set_limit (entries2, dx_node_limit(dir));
+
+		dx_set_count (entries, 1);
+		dx_set_block (entries, block);
+		root->info.indirect_levels = 1;
+
+		frame[1].bh = bh2;
+		frame[1].entries = entries2;
+		frame[1].at = entries2 + (frame->at - entries);
+		frame->at = entries;
+		dx_dirty (dir, frame->bh);
+		dx_dirty (dir, bh2);
+		return frame + 1;
+	}
+
+	if (dx_get_count(frames->entries) >= dx_get_limit(frames->entries)) {
+		ext2_warning (dir->i_sb, "dx_make_room",
+			      "directory #%lu index full", dir->i_ino);
+		*err = -ENOSPC;
+		return NULL;
+	}
+
+	/* split the node in two, and point the root at the new half */
+	bh2 = dx_append_block (dir, &block, err);
+	if (!bh2)
+		return NULL;
+	memset (bh2->b_data, 0, sizeof(struct fake_dirent));
+	((struct dx_node *) bh2->b_data)->fake.rec_len =
+		cpu_to_le16(dir->i_sb->s_blocksize);
+	entries2 = ((struct dx_node *) bh2->b_data)->entries;
+	count1 = count / 2;
+	memcpy (entries2, entries + count1,
+		(count - count1) * sizeof(struct dx_entry));
+	dx_insert_entry (frames, dx_get_hash(entries + count1), block);
+	dx_set_count (entries, count1);
+	dx_set_count (entries2, count - count1);
+	dx_set_limit (entries2, dx_node_limit(dir));
+	dx_dirty (dir, frames->bh);
+	dx_dirty (dir, frame->bh);
+	dx_dirty (dir, bh2);
+
+	if (frame->at >= entries + count1) {
+		frame->at = entries2 + (frame->at - (entries + count1));
+		frame->entries = entries2;
+		brelse (frame->bh);
+		frame->bh = bh2;
+	} else
+		brelse (bh2);
+	return frame;
+}
+
+static struct ext2_dir_entry_2 * dx_pack_dirents (char * base, int size)
+{
+	struct ext2_dir_entry_2 * de = (struct ext2_dir_entry_2 *) base;
+	struct ext2_dir_entry_2 * to = de, * prev = de;
+	char * top = base + size;
+
+	while ((char *) de < top) {
+		struct ext2_dir_entry_2 * next = (struct ext2_dir_entry_2 *)
+			((char *) de + le16_to_cpu(de->rec_len));
+
+		if (de->inode) {
+			int rec_len = EXT2_DIR_REC_LEN(de->name_len);
+
+			if (de != to)
+				memmove (to, de, rec_len);
+			to->rec_len = cpu_to_le16(rec_len);
+			prev = to;
+			to = (struct ext2_dir_entry_2 *) ((char *) to + rec_len);
+		}
+		de = next;
+	}
+	return prev;
+}
+
+/*
+ * Split a full leaf: the live entries in the upper half of the hash
+ * order move to a new block, which gets its own index entry. Returns
+ * whichever of the two blocks hash now belongs to.
+ */
+static struct buffer_head * dx_split_leaf (struct inode * dir,
+					   struct dx_frame * frame,
+					   struct buffer_head * bh,
+					   __u32 hash, int * err)
+{
+	unsigned blocksize = dir->i_sb->s_blocksize;
+	struct dx_map_entry * map;
+	struct ext2_dir_entry_2 * de, * de2;
+	struct buffer_head * bh2;
+	unsigned block, offset;
+	__u32 hash2;
+	int count, split, continued, i, j;
+
+	map = kmalloc ((blocksize / EXT2_DIR_REC_LEN(1) + 1) * sizeof(*map),
+		       GFP_KERNEL);
+	*err = -ENOMEM;
+	if (!map)
+		goto out_brelse;
+
+	/* map the live entries, and sort the map by hash */
+	count = 0;
+	for (offset = 0; offset < blocksize; offset += le16_to_cpu(de->rec_len)) {
+		de = (struct ext2_dir_entry_2 *) (bh->b_data + offset);
+		if (!de->inode)
+			continue;
+		map[count].hash = dx_hash (de->name, de->name_len);
+		map[count].offs = offset;
+		map[count].size = EXT2_DIR_REC_LEN(de->name_len);
+		count++;
+	}
+	for (i = 1; i < count; i++) {
+		struct dx_map_entry tmp = map[i];
+
+		for (j = i; j > 0 && map[j - 1].hash > tmp.hash; j--)
+			map[j] = map[j - 1];
+		map[j] = tmp;
+	}
+	*err = -ENOSPC;
+	if (count < 2)
+		goto out_free;
+
+	bh2 = dx_append_block (dir, &block, err);
+	if (!bh2)
+		goto out_free;
+
+	split = count / 2;
+	hash2 = map[split].hash;
+	continued = hash2 == map[split - 1].hash;
+
+	/* copy the upper half over, and free it in the old block */
+	de2 = (struct ext2_dir_entry_2 *) bh2->b_data;
+	for (i = split; i < count; i++) {
+		de = (struct ext2_dir_entry_2 *) (bh->b_data + map[i].offs);
+		memcpy (de2, de, map[i].size);
+		de2->rec_len = cpu_to_le16(map[i].size);
+		de->inode = 0;
+		if (i < count - 1)
+			de2 = (struct ext2_dir_entry_2 *)
+				((char *) de2 + map[i].size);
+	}
+	de2->rec_len = cpu_to_le16(bh2->b_data + blocksize - (char *) de2);
+	de = dx_pack_dirents (bh->b_data, blocksize);
+	de->rec_len = cpu_to_le16(bh->b_data + blocksize - (char *) de);
+
+	dx_insert_entry (frame, hash2 + continued, block);
+	dx_dirty (dir, frame->bh);
+	dx_dirty (dir, bh);
+	dx_dirty (dir, bh2);
+	kfree (map);
+
+	if (hash >= hash2 + continued) {
+		brelse (bh);
+		return bh2;
+	}
+	brelse (bh2);
+	return bh;
+
+out_free:
+	kfree (map);
+out_brelse:
+	brelse (bh);
+	return NULL;
+}
+
+static struct buffer_head * ext2_dx_add_entry (struct inode * dir,
+					const char * name, int namelen,
+					struct ext2_dir_entry_2 ** res_dir,
+					int * err)
+{
+	struct dx_frame frames[DX_MAX_LEVELS], * frame;
+	struct buffer_head * bh;
+	struct ext2_dir_entry_2 * de;
+	__u32 hash = dx_hash (name, namelen);
+
+	frame = dx_probe (dir, hash, frames, err);
+	if (!frame)
+		goto out;
+	bh = ext2_bread (dir, dx_get_block(frame->at), 0, err);
+	if (!bh)
+		goto out;
+	de = dx_add_dirent (dir, name, namelen, bh, err);
+	if (de)
+		goto found;
+	if (*err != -ENOSPC)
+		goto out_brelse;
+
+	frame = dx_make_room (dir, frames, frame, err);
+	if (!frame)
+		goto out_brelse;
+	bh = dx_split_leaf (dir, frame, bh, hash, err);
+	if (!bh)
+		goto out;
+	de = dx_add_dirent (dir, name, namelen, bh, err);
+	if (!de)
+		goto out_brelse;
+found:
+	dx_release (frames);
+	*res_dir = de;
+	return bh;
+
+out_brelse:
+	brelse (bh);
+out:
+	dx_release (frames);
+	return NULL;
+}
+
+/*
+ * Turn a directory with one full block into an indexed one: the
+ * entries after ".." move to a new leaf block, and the root of the
+ * index takes their place.
+ */
+static struct buffer_head * ext2_dx_make_indexed (struct inode * dir,
+					const char * name, int namelen,
+					struct ext2_dir_entry_2 ** res_dir,
+					int * err)
+{
+	struct super_block * sb = dir->i_sb;
+	unsigned blocksize = sb->s_blocksize;
+	struct buffer_head * bh, * bh2;
+	struct dx_root * root;
+	struct ext2_dir_entry_2 * de;
+	char * data;
+	unsigned block, len;
+
+	bh = ext2_bread (dir, 0, 0, err);
+	if (!bh)
+		return NULL;
+	root = (struct dx_root *) bh->b_data;
+	data = (char *) &root->dotdot + le16_to_cpu(root->dotdot.rec_len);
+	if (le16_to_cpu(root->dot.rec_len) != EXT2_DIR_REC_LEN(1) ||
+	    root->dot.name_len != 1 || root->dotdot.name_len != 2 ||
+	    data < (char *) &root->info || data > bh->b_data + blocksize) {
+		brelse (bh);
+		*err = ERR_BAD_DX_DIR;
+		return NULL;
+	}
+
+	bh2 = dx_append_block (dir, &block, err);
+	if (!bh2) {
+		brelse (bh);
+		return NULL;
+	}
+	len = bh->b_data + blocksize - data;
+	memcpy (bh2->b_data, data, len);
+	de = (struct ext2_dir_entry_2 *) bh2->b_data;
+	if (len) {
+		while ((char *) de + le16_to_cpu(de->rec_len) < bh2->b_data + len)
+			de = (struct ext2_dir_entry_2 *)
+				((char *) de + le16_to_cpu(de->rec_len));
+		de->rec_len = cpu_to_le16(le16_to_cpu(de->rec_len) +
+					  blocksize - len);
+	} else {
+		de->inode = 0;
+		de->rec_len = cpu_to_le16(blocksize);
+	}
+
+	root->dotdot.rec_len = cpu_to_le16(blocksize - EXT2_DIR_REC_LEN(1));
+	memset (&root->info, 0, sizeof(root->info));
+	root->info.hash_version = DX_HASH_VERSION;
+	root->info.info_length = sizeof(root->info);
+	dx_set_block (root->entries, block);
+	dx_set_count (root->entries, 1);
+	dx_set_limit (root->entries, dx_root_limit(dir));
+	dir->u.ext2_i.i_flags |= EXT2_INDEX_FL;
+	ext2_mark_inode_dirty(dir);
+	dx_dirty (dir, bh2);
+	dx_dirty (dir, bh);
+	brelse (bh2);
+	brelse (bh);
+
+	if (!EXT2_HAS_COMPAT_FEATURE(sb, EXT2_FEATURE_COMPAT_DIR_INDEX)) {
+		lock_super (sb);
+		EXT2_SB(sb)->s_feature_compat |= EXT2_FEATURE_COMPAT_DIR_INDEX;
+		EXT2_SB(sb)->s_es->s_feature_compat =
+			cpu_to_le32(EXT2_SB(sb)->s_feature_compat);
+		ext2_journal_dirty_metadata (sb, EXT2_SB(sb)->s_sbh);
+		sb->s_dirt = 1;
+		unlock_super (sb);
+	}
+	return ext2_dx_add_entry (dir, name, namelen, res_dir, err);
+}
+
 /*
  *	ext2_find_entry()
  *
@@ -73,6 +798,15 @@ static struct buffer_head * ext2_find_entry (struct inode * dir,
 	if (namelen > EXT2_NAME_LEN)
 		return NULL;
 
+	if (is_dx(dir)) {
+		struct buffer_head * bh;
+
+		bh = ext2_dx_find_entry (dir, name, namelen, res_dir, &err);
+		if (bh || err != ERR_BAD_DX_DIR)
+			return bh;
+		/* fall back to searching every block */
+	}
+
 	memset (bh_use, 0, sizeof (bh_use));
 	toread = 0;
 	for (block = 0; block < NAMEI_RA_SIZE; ++block) {
@@ -220,6 +954,14 @@ static struct buffer_head * ext2_add_entry (struct inode * dir,
 		*err = -ENOENT;
 		return NULL;
 	}
+	if (is_dx(dir)) {
+		bh = ext2_dx_add_entry (dir, name, namelen, res_dir, err);
+		if (bh || *err != ERR_BAD_DX_DIR)
+			return bh;
+		/* a broken index: go on without it */
+		dir->u.ext2_i.i_flags &= ~EXT2_INDEX_FL;
+		ext2_mark_inode_dirty(dir);
+	}
 	bh = ext2_bread (dir, 0, 0, err);
 	if (!bh)
 		return NULL;
@@ -231,6 +973,14 @@ static struct buffer_head * ext2_add_entry (struct inode * dir,
 		if ((char *)de >= sb->s_blocksize + bh->b_data) {
 			brelse (bh);
 			bh = NULL;
+			if (offset == sb->s_blocksize &&
+			    dir->i_size == sb->s_blocksize &&
+			    test_opt (sb, INDEX)) {
+				bh = ext2_dx_make_indexed (dir, name, namelen,
+							   res_dir, err);
+				if (bh || *err != ERR_BAD_DX_DIR)
+					return bh;
+			}
 			bh = ext2_bread (dir, offset >> EXT2_BLOCK_SIZE_BITS(sb), 1, err);
 			if (!bh)
 				return NULL;
@@ -247,7 +997,7 @@ static struct buffer_head * ext2_add_entry (struct inode * dir,
 				de->rec_len = le16_to_cpu(sb->s_blocksize);
 				dir->i_size = offset + sb->s_blocksize;
 				dir->u.ext2_i.i_flags &= ~EXT2_BTREE_FL;
-				mark_inode_dirty(dir);
+				ext2_mark_inode_dirty(dir);
 			} else {
 
 				ext2_debug ("skipping to next block\n");
@@ -294,9 +1044,9 @@ static struct buffer_head * ext2_add_entry (struct inode * dir,
 			 */
 			dir->i_mtime = dir->i_ctime = CURRENT_TIME;
 			dir->u.ext2_i.i_flags &= ~EXT2_BTREE_FL;
-			mark_inode_dirty(dir);
+			ext2_mark_inode_dirty(dir);
 			dir->i_version = ++event;
-			mark_buffer_dirty(bh, 1);
+			ext2_journal_dirty_metadata (dir->i_sb, bh);
 			*res_dir = de;
 			*err = 0;
 			return bh;
@@ -370,48 +1120,53 @@ static inline void ext2_set_de_type(struct super_block *sb,
  */
 int ext2_create (struct inode * dir, struct dentry * dentry, int mode)
 {
+	struct ext2_handle handle;
 	struct inode * inode;
 	struct buffer_head * bh;
 	struct ext2_dir_entry_2 * de;
 	int err = -EIO;
 
+	ext2_journal_start (dir->i_sb, &handle);
 	/*
 	 * N.B. Several error exits in ext2_new_inode don't set err.
 	 */
 	inode = ext2_new_inode (dir, mode, &err);
 	if (!inode)
-		return err;
+		goto out;
 
 	inode->i_op = &ext2_file_inode_operations;
 	inode->i_mode = mode;
-	mark_inode_dirty(inode);
+	ext2_mark_inode_dirty(inode);
 	bh = ext2_add_entry (dir, dentry->d_name.name, dentry->d_name.len, &de, &err);
 	if (!bh) {
 		inode->i_nlink--;
-		mark_inode_dirty(inode);
+		ext2_mark_inode_dirty(inode);
 		iput (inode);
-		return err;
+		goto out;
 	}
 	de->inode = cpu_to_le32(inode->i_ino);
 	ext2_set_de_type(dir->i_sb, de, S_IFREG);
 	dir->i_version = ++event;
-	mark_buffer_dirty(bh, 1);
-	if (IS_SYNC(dir)) {
-		ll_rw_block (WRITE, 1, &bh);
-		wait_on_buffer (bh);
-	}
+	ext2_journal_dirty_metadata (dir->i_sb, bh);
+	if (IS_SYNC(dir))
+		ext2_sync_metadata (dir->i_sb, bh);
 	brelse (bh);
 	d_instantiate(dentry, inode);
-	return 0;
+	err = 0;
+out:
+	ext2_journal_stop (&handle);
+	return err;
 }
 
 int ext2_mknod (struct inode * dir, struct dentry *dentry, int mode, int rdev)
 {
+	struct ext2_handle handle;
 	struct inode * inode;
 	struct buffer_head * bh;
 	struct ext2_dir_entry_2 * de;
 	int err = -EIO;
 
+	ext2_journal_start (dir->i_sb, &handle);
 	inode = ext2_new_inode (dir, mode, &err);
 	if (!inode)
 		goto out;
@@ -424,27 +1179,27 @@ int ext2_mknod (struct inode * dir, struct dentry *dentry, int mode, int rdev)
 	de->inode = cpu_to_le32(inode->i_ino);
 	dir->i_version = ++event;
 	ext2_set_de_type(dir->i_sb, de, inode->i_mode);
-	mark_inode_dirty(inode);
-	mark_buffer_dirty(bh, 1);
-	if (IS_SYNC(dir)) {
-		ll_rw_block (WRITE, 1, &bh);
-		wait_on_buffer (bh);
-	}
+	ext2_mark_inode_dirty(inode);
+	ext2_journal_dirty_metadata (dir->i_sb, bh);
+	if (IS_SYNC(dir))
+		ext2_sync_metadata (dir->i_sb, bh);
 	d_instantiate(dentry, inode);
 	brelse(bh);
 	err = 0;
 out:
+	ext2_journal_stop (&handle);
 	return err;
 
 out_no_entry:
 	inode->i_nlink--;
-	mark_inode_dirty(inode);
+	ext2_mark_inode_dirty(inode);
 	iput(inode);
 	goto out;
 }
 
 int ext2_mkdir(struct inode * dir, struct dentry * dentry, int mode)
 {
+	struct ext2_handle handle;
 	struct inode * inode;
 	struct buffer_head * bh, * dir_block;
 	struct ext2_dir_entry_2 * de;
@@ -452,8 +1207,9 @@ int ext2_mkdir(struct inode * dir, struct dentry * dentry, int mode)
 
 	err = -EMLINK;
 	if (dir->i_nlink >= EXT2_LINK_MAX)
-		goto out;
+		return err;
 
+	ext2_journal_start (dir->i_sb, &handle);
 	err = -EIO;
 	inode = ext2_new_inode (dir, S_IFDIR, &err);
 	if (!inode)
@@ -465,9 +1221,9 @@ int ext2_mkdir(struct inode * dir, struct dentry * dentry, int mode)
 	dir_block = ext2_bread (inode, 0, 1, &err);
 	if (!dir_block) {
 		inode->i_nlink--; /* is this nlink == 0? */
-		mark_inode_dirty(inode);
+		ext2_mark_inode_dirty(inode);
 		iput (inode);
-		return err;
+		goto out;
 	}
 	de = (struct ext2_dir_entry_2 *) dir_block->b_data;
 	de->inode = cpu_to_le32(inode->i_ino);
@@ -482,35 +1238,33 @@ int ext2_mkdir(struct inode * dir, struct dentry * dentry, int mode)
 	strcpy (de->name, "..");
 	ext2_set_de_type(dir->i_sb, de, S_IFDIR);
 	inode->i_nlink = 2;
-	mark_buffer_dirty(dir_block, 1);
+	ext2_journal_dirty_metadata (dir->i_sb, dir_block);
 	brelse (dir_block);
 	inode->i_mode = S_IFDIR | mode;
 	if (dir->i_mode & S_ISGID)
 		inode->i_mode |= S_ISGID;
-	mark_inode_dirty(inode);
+	ext2_mark_inode_dirty(inode);
 	bh = ext2_add_entry (dir, dentry->d_name.name, dentry->d_name.len, &de, &err);
 	if (!bh)
 		goto out_no_entry;
 	de->inode = cpu_to_le32(inode->i_ino);
 	ext2_set_de_type(dir->i_sb, de, S_IFDIR);
 	dir->i_version = ++event;
-	mark_buffer_dirty(bh, 1);
-	if (IS_SYNC(dir)) {
-		ll_rw_block (WRITE, 1, &bh);
-		wait_on_buffer (bh);
-	}
+	ext2_journal_dirty_metadata (dir->i_sb, bh);
+	if (IS_SYNC(dir))
+		ext2_sync_metadata (dir->i_sb, bh);
 	dir->i_nlink++;
-	dir->u.ext2_i.i_flags &= ~EXT2_BTREE_FL;
-	mark_inode_dirty(dir);
+	ext2_mark_inode_dirty(dir);
 	d_instantiate(dentry, inode);
 	brelse (bh);
 	err = 0;
 out:
+	ext2_journal_stop (&handle);
 	return err;
 
 out_no_entry:
 	inode->i_nlink = 0;
-	mark_inode_dirty(inode);
+	ext2_mark_inode_dirty(inode);
 	iput (inode);
 	goto out;
 }
@@ -579,11 +1333,13 @@ static int empty_dir (struct inode * inode)
 
 int ext2_rmdir (struct inode * dir, struct dentry *dentry)
 {
+	struct ext2_handle handle;
 	int retval;
 	struct inode * inode;
 	struct buffer_head * bh;
 	struct ext2_dir_entry_2 * de;
 
+	ext2_journal_start (dir->i_sb, &handle);
 	retval = -ENOENT;
 	bh = ext2_find_entry (dir, dentry->d_name.name, dentry->d_name.len, &de);
 	if (!bh)
@@ -604,11 +1360,9 @@ int ext2_rmdir (struct inode * dir, struct dentry *dentry)
 	dir->i_version = ++event;
 	if (retval)
 		goto end_rmdir;
-	mark_buffer_dirty(bh, 1);
-	if (IS_SYNC(dir)) {
-		ll_rw_block (WRITE, 1, &bh);
-		wait_on_buffer (bh);
-	}
+	ext2_journal_dirty_metadata (dir->i_sb, bh);
+	if (IS_SYNC(dir))
+		ext2_sync_metadata (dir->i_sb, bh);
 	if (inode->i_nlink != 2)
 		ext2_warning (inode->i_sb, "ext2_rmdir",
 			      "empty directory has nlink!=2 (%d)",
@@ -616,25 +1370,27 @@ int ext2_rmdir (struct inode * dir, struct dentry *dentry)
 	inode->i_version = ++event;
 	inode->i_nlink = 0;
 	inode->i_size = 0;
-	mark_inode_dirty(inode);
+	ext2_mark_inode_dirty(inode);
 	dir->i_nlink--;
 	inode->i_ctime = dir->i_ctime = dir->i_mtime = CURRENT_TIME;
-	dir->u.ext2_i.i_flags &= ~EXT2_BTREE_FL;
-	mark_inode_dirty(dir);
+	ext2_mark_inode_dirty(dir);
 	d_delete(dentry);
 
 end_rmdir:
 	brelse (bh);
+	ext2_journal_stop (&handle);
 	return retval;
 }
 
 int ext2_unlink(struct inode * dir, struct dentry *dentry)
 {
+	struct ext2_handle handle;
 	int retval;
 	struct inode * inode;
 	struct buffer_head * bh;
 	struct ext2_dir_entry_2 * de;
 
+	ext2_journal_start (dir->i_sb, &handle);
 	retval = -ENOENT;
 	bh = ext2_find_entry (dir, dentry->d_name.name, dentry->d_name.len, &de);
 	if (!bh)
@@ -657,22 +1413,20 @@ int ext2_unlink(struct inode * dir, struct dentry *dentry)
 	if (retval)
 		goto end_unlink;
 	dir->i_version = ++event;
-	mark_buffer_dirty(bh, 1);
-	if (IS_SYNC(dir)) {
-		ll_rw_block (WRITE, 1, &bh);
-		wait_on_buffer (bh);
-	}
+	ext2_journal_dirty_metadata (dir->i_sb, bh);
+	if (IS_SYNC(dir))
+		ext2_sync_metadata (dir->i_sb, bh);
 	dir->i_ctime = dir->i_mtime = CURRENT_TIME;
-	dir->u.ext2_i.i_flags &= ~EXT2_BTREE_FL;
-	mark_inode_dirty(dir);
+	ext2_mark_inode_dirty(dir);
 	inode->i_nlink--;
-	mark_inode_dirty(inode);
+	ext2_mark_inode_dirty(inode);
 	inode->i_ctime = dir->i_ctime;
 	retval = 0;
 	d_delete(dentry);	/* This also frees the inode */
 
 end_unlink:
 	brelse (bh);
+	ext2_journal_stop (&handle);
 	return retval;
 }
 
@@ -682,12 +1436,13 @@ int ext2_symlink (struct inode * dir, struct dentry *dentry, const char * symnam
 	struct inode * inode;
 	struct buffer_head * bh = NULL, * name_block = NULL;
 	char * link;
+	struct ext2_handle handle;
 	int i, l, err = -EIO;
 	char c;
 
-	if (!(inode = ext2_new_inode (dir, S_IFLNK, &err))) {
-		return err;
-	}
+	ext2_journal_start (dir->i_sb, &handle);
+	if (!(inode = ext2_new_inode (dir, S_IFLNK, &err)))
+		goto out;
 	inode->i_mode = S_IFLNK | S_IRWXUGO;
 	inode->i_op = &ext2_symlink_inode_operations;
 	for (l = 0; l < inode->i_sb->s_blocksize - 1 &&
@@ -700,9 +1455,9 @@ int ext2_symlink (struct inode * dir, struct dentry *dentry, const char * symnam
 		name_block = ext2_bread (inode, 0, 1, &err);
 		if (!name_block) {
 			inode->i_nlink--;
-			mark_inode_dirty(inode);
+			ext2_mark_inode_dirty(inode);
 			iput (inode);
-			return err;
+			goto out;
 		}
 		link = name_block->b_data;
 	} else {
@@ -716,11 +1471,11 @@ int ext2_symlink (struct inode * dir, struct dentry *dentry, const char * symnam
 		link[i++] = c;
 	link[i] = 0;
 	if (name_block) {
-		mark_buffer_dirty(name_block, 1);
+		ext2_journal_dirty_metadata (dir->i_sb, name_block);
 		brelse (name_block);
 	}
 	inode->i_size = i;
-	mark_inode_dirty(inode);
+	ext2_mark_inode_dirty(inode);
 
 	bh = ext2_add_entry (dir, dentry->d_name.name, dentry->d_name.len, &de, &err);
 	if (!bh)
@@ -728,20 +1483,19 @@ int ext2_symlink (struct inode * dir, struct dentry *dentry, const char * symnam
 	de->inode = cpu_to_le32(inode->i_ino);
 	ext2_set_de_type(dir->i_sb, de, S_IFLNK);
 	dir->i_version = ++event;
-	mark_buffer_dirty(bh, 1);
-	if (IS_SYNC(dir)) {
-		ll_rw_block (WRITE, 1, &bh);
-		wait_on_buffer (bh);
-	}
+	ext2_journal_dirty_metadata (dir->i_sb, bh);
+	if (IS_SYNC(dir))
+		ext2_sync_metadata (dir->i_sb, bh);
 	brelse (bh);
 	d_instantiate(dentry, inode);
 	err = 0;
 out:
+	ext2_journal_stop (&handle);
 	return err;
 
 out_no_entry:
 	inode->i_nlink--;
-	mark_inode_dirty(inode);
+	ext2_mark_inode_dirty(inode);
 	iput (inode);
 	goto out;
 }
@@ -750,6 +1504,7 @@ int ext2_link (struct dentry * old_dentry,
 		struct inode * dir, struct dentry *dentry)
 {
 	struct inode *inode = old_dentry->d_inode;
+	struct ext2_handle handle;
 	struct ext2_dir_entry_2 * de;
 	struct buffer_head * bh;
 	int err;
@@ -760,25 +1515,27 @@ int ext2_link (struct dentry * old_dentry,
 	if (inode->i_nlink >= EXT2_LINK_MAX)
 		return -EMLINK;
 
+	ext2_journal_start (dir->i_sb, &handle);
 	bh = ext2_add_entry (dir, dentry->d_name.name, dentry->d_name.len, &de, &err);
 	if (!bh)
-		return err;
+		goto out;
 
 	de->inode = cpu_to_le32(inode->i_ino);
 	ext2_set_de_type(dir->i_sb, de, inode->i_mode);
 	dir->i_version = ++event;
-	mark_buffer_dirty(bh, 1);
-	if (IS_SYNC(dir)) {
-		ll_rw_block (WRITE, 1, &bh);
-		wait_on_buffer (bh);
-	}
+	ext2_journal_dirty_metadata (dir->i_sb, bh);
+	if (IS_SYNC(dir))
+		ext2_sync_metadata (dir->i_sb, bh);
 	brelse (bh);
 	inode->i_nlink++;
 	inode->i_ctime = CURRENT_TIME;
-	mark_inode_dirty(inode);
+	ext2_mark_inode_dirty(inode);
 	inode->i_count++;
 	d_instantiate(dentry, inode);
-	return 0;
+	err = 0;
+out:
+	ext2_journal_stop (&handle);
+	return err;
 }
 
 #define PARENT_INO(buffer) \
@@ -795,8 +1552,10 @@ int ext2_rename (struct inode * old_dir, struct dentry *old_dentry,
 	struct inode * old_inode, * new_inode;
 	struct buffer_head * old_bh, * new_bh, * dir_bh;
 	struct ext2_dir_entry_2 * old_de, * new_de;
+	struct ext2_handle handle;
 	int retval;
 
+	ext2_journal_start (old_dir->i_sb, &handle);
 	old_bh = new_bh = dir_bh = NULL;
 
 	old_bh = ext2_find_entry (old_dir, old_dentry->d_name.name, old_dentry->d_name.len, &old_de);
@@ -862,35 +1621,29 @@ int ext2_rename (struct inode * old_dir, struct dentry *old_dentry,
 	if (new_inode) {
 		new_inode->i_nlink--;
 		new_inode->i_ctime = CURRENT_TIME;
-		mark_inode_dirty(new_inode);
+		ext2_mark_inode_dirty(new_inode);
 	}
 	old_dir->i_ctime = old_dir->i_mtime = CURRENT_TIME;
-	old_dir->u.ext2_i.i_flags &= ~EXT2_BTREE_FL;
-	mark_inode_dirty(old_dir);
+	ext2_mark_inode_dirty(old_dir);
 	if (dir_bh) {
 		PARENT_INO(dir_bh->b_data) = le32_to_cpu(new_dir->i_ino);
-		mark_buffer_dirty(dir_bh, 1);
+		ext2_journal_dirty_metadata (old_dir->i_sb, dir_bh);
 		old_dir->i_nlink--;
-		mark_inode_dirty(old_dir);
+		ext2_mark_inode_dirty(old_dir);
 		if (new_inode) {
 			new_inode->i_nlink--;
-			mark_inode_dirty(new_inode);
+			ext2_mark_inode_dirty(new_inode);
 		} else {
 			new_dir->i_nlink++;
-			new_dir->u.ext2_i.i_flags &= ~EXT2_BTREE_FL;
-			mark_inode_dirty(new_dir);
+			ext2_mark_inode_dirty(new_dir);
 		}
 	}
-	mark_buffer_dirty(old_bh,  1);
-	if (IS_SYNC(old_dir)) {
-		ll_rw_block (WRITE, 1, &old_bh);
-		wait_on_buffer (old_bh);
-	}
-	mark_buffer_dirty(new_bh, 1);
-	if (IS_SYNC(new_dir)) {
-		ll_rw_block (WRITE, 1, &new_bh);
-		wait_on_buffer (new_bh);
-	}
+	ext2_journal_dirty_metadata (old_dir->i_sb, old_bh);
+	if (IS_SYNC(old_dir))
+		ext2_sync_metadata (old_dir->i_sb, old_bh);
+	ext2_journal_dirty_metadata (old_dir->i_sb, new_bh);
+	if (IS_SYNC(new_dir))
+		ext2_sync_metadata (old_dir->i_sb, new_bh);
 
 	retval = 0;
 
@@ -898,5 +1651,6 @@ end_rename:
 	brelse (dir_bh);
 	brelse (old_bh);
 	brelse (new_bh);
+	ext2_journal_stop (&handle);
 	return retval;
 }
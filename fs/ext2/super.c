@@ -37,7 +37,7 @@ void ext2_error (struct super_block * sb, const char * function,
 		sb->u.ext2_sb.s_mount_state |= EXT2_ERROR_FS;
 		sb->u.ext2_sb.s_es->s_state =
 			cpu_to_le16(le16_to_cpu(sb->u.ext2_sb.s_es->s_state) | EXT2_ERROR_FS);
-		mark_buffer_dirty(sb->u.ext2_sb.s_sbh, 1);
+		ext2_journal_dirty_metadata (sb, sb->u.ext2_sb.s_sbh);
 		sb->s_dirt = 1;
 	}
 	va_start (args, fmt);
@@ -93,27 +93,38 @@ void ext2_warning (struct super_block * sb, const char * function,
 		bdevname(sb->s_dev), function, error_buf);
 }
 
+/*
+ * The allocators only keep the free counts of each group up to date;
+ * sum them into the superblock before it goes to disk.
+ */
+static void ext2_update_free_counts (struct super_block * sb)
+{
+	struct ext2_super_block * es = sb->u.ext2_sb.s_es;
+
+	if (!sb->u.ext2_sb.s_group_info)
+		return;
+	es->s_free_blocks_count = cpu_to_le32(ext2_count_free_blocks (sb));
+	es->s_free_inodes_count = cpu_to_le32(ext2_count_free_inodes (sb));
+}
+
 void ext2_put_super (struct super_block * sb)
 {
 	int db_count;
 	int i;
 
+	ext2_journal_release (sb);
 	if (!(sb->s_flags & MS_RDONLY)) {
+		ext2_update_free_counts (sb);
 		sb->u.ext2_sb.s_es->s_state = le16_to_cpu(sb->u.ext2_sb.s_mount_state);
 		mark_buffer_dirty(sb->u.ext2_sb.s_sbh, 1);
 	}
+	ext2_release_group_info (sb);
 	db_count = sb->u.ext2_sb.s_db_per_group;
 	for (i = 0; i < db_count; i++)
 		if (sb->u.ext2_sb.s_group_desc[i])
 			brelse (sb->u.ext2_sb.s_group_desc[i]);
 	kfree_s (sb->u.ext2_sb.s_group_desc,
 		 db_count * sizeof (struct buffer_head *));
-	for (i = 0; i < EXT2_MAX_GROUP_LOADED; i++)
-		if (sb->u.ext2_sb.s_inode_bitmap[i])
-			brelse (sb->u.ext2_sb.s_inode_bitmap[i]);
-	for (i = 0; i < EXT2_MAX_GROUP_LOADED; i++)
-		if (sb->u.ext2_sb.s_block_bitmap[i])
-			brelse (sb->u.ext2_sb.s_block_bitmap[i]);
 	brelse (sb->u.ext2_sb.s_sbh);
 
 	MOD_DEC_USE_COUNT;
@@ -129,7 +140,10 @@ static struct super_operations ext2_sops = {
 	ext2_put_super,
 	ext2_write_super,
 	ext2_statfs,
-	ext2_remount
+	ext2_remount,
+	NULL,			/* clear_inode */
+	NULL,			/* umount_begin */
+	ext2_shrink_bitmaps
 };
 
 /*
@@ -137,6 +151,7 @@ static struct super_operations ext2_sops = {
  */
 static int parse_options (char * options, unsigned long * sb_block,
 			  unsigned short *resuid, unsigned short * resgid,
+			  unsigned long * journal_inum,
 			  unsigned long * mount_options)
 {
 	char * this_char;
@@ -170,6 +185,22 @@ static int parse_options (char * options, unsigned long * sb_block,
 				return 0;
 			}
 		}
+		else if (!strcmp (this_char, "data")) {
+			if (!value || !*value) {
+				printk ("EXT2-fs: the data option requires "
+					"an argument");
+				return 0;
+			}
+			if (!strcmp (value, "ordered"))
+				clear_opt (*mount_options, DATA_WRITEBACK);
+			else if (!strcmp (value, "writeback"))
+				set_opt (*mount_options, DATA_WRITEBACK);
+			else {
+				printk ("EXT2-fs: Invalid data option: %s\n",
+					value);
+				return 0;
+			}
+		}
 		else if (!strcmp (this_char, "debug"))
 			set_opt (*mount_options, DEBUG);
 		else if (!strcmp (this_char, "errors")) {
@@ -204,6 +235,21 @@ static int parse_options (char * options, unsigned long * sb_block,
 			set_opt (*mount_options, GRPID);
 		else if (!strcmp (this_char, "minixdf"))
 			set_opt (*mount_options, MINIX_DF);
+		else if (!strcmp (this_char, "index"))
+			set_opt (*mount_options, INDEX);
+		else if (!strcmp (this_char, "journal")) {
+			if (!value || !*value) {
+				printk ("EXT2-fs: the journal option requires "
+					"an argument");
+				return 0;
+			}
+			*journal_inum = simple_strtoul (value, &value, 0);
+			if (*value) {
+				printk ("EXT2-fs: Invalid journal option: %s\n",
+					value);
+				return 0;
+			}
+		}
 		else if (!strcmp (this_char, "nocheck")) {
 			clear_opt (*mount_options, CHECK_NORMAL);
 			clear_opt (*mount_options, CHECK_STRICT);
@@ -288,12 +334,17 @@ static void ext2_setup_super (struct super_block * sb,
 			(le32_to_cpu(es->s_lastcheck) + le32_to_cpu(es->s_checkinterval) <= CURRENT_TIME))
 			printk ("EXT2-fs warning: checktime reached, "
 				"running e2fsck is recommended\n");
-		es->s_state = cpu_to_le16(le16_to_cpu(es->s_state) & ~EXT2_VALID_FS);
+		/*
+		 * With a journal, the filesystem is consistent on disk
+		 * whenever the journal has been replayed.
+		 */
+		if (!sb->u.ext2_sb.s_journal)
+			es->s_state = cpu_to_le16(le16_to_cpu(es->s_state) & ~EXT2_VALID_FS);
 		if (!(__s16) le16_to_cpu(es->s_max_mnt_count))
 			es->s_max_mnt_count = (__s16) cpu_to_le16(EXT2_DFL_MAX_MNT_COUNT);
 		es->s_mnt_count=cpu_to_le16(le16_to_cpu(es->s_mnt_count) + 1);
 		es->s_mtime = cpu_to_le32(CURRENT_TIME);
-		mark_buffer_dirty(sb->u.ext2_sb.s_sbh, 1);
+		ext2_journal_dirty_metadata (sb, sb->u.ext2_sb.s_sbh);
 		sb->s_dirt = 1;
 		if (test_opt (sb, DEBUG))
 			printk ("[EXT II FS %s, %s, bs=%lu, fs=%lu, gc=%lu, "
@@ -375,6 +426,7 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 	unsigned long sb_block = 1;
 	unsigned short resuid = EXT2_DEF_RESUID;
 	unsigned short resgid = EXT2_DEF_RESGID;
+	unsigned long journal_inum = 0;
 	unsigned long logic_sb_block = 1;
 	unsigned long offset = 0;
 	kdev_t dev = sb->s_dev;
@@ -397,9 +449,10 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 	  }
 
 	sb->u.ext2_sb.s_mount_opt = 0;
+	sb->u.ext2_sb.s_journal = NULL;
 	set_opt (sb->u.ext2_sb.s_mount_opt, CHECK_NORMAL);
 	if (!parse_options ((char *) data, &sb_block, &resuid, &resgid,
-	    &sb->u.ext2_sb.s_mount_opt)) {
+	    &journal_inum, &sb->u.ext2_sb.s_mount_opt)) {
 		sb->s_dev = 0;
 		return NULL;
 	}
@@ -605,14 +658,8 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 		printk ("EXT2-fs: group descriptors corrupted !\n");
 		goto failed_mount;
 	}
-	for (i = 0; i < EXT2_MAX_GROUP_LOADED; i++) {
-		sb->u.ext2_sb.s_inode_bitmap_number[i] = 0;
-		sb->u.ext2_sb.s_inode_bitmap[i] = NULL;
-		sb->u.ext2_sb.s_block_bitmap_number[i] = 0;
-		sb->u.ext2_sb.s_block_bitmap[i] = NULL;
-	}
-	sb->u.ext2_sb.s_loaded_inode_bitmaps = 0;
-	sb->u.ext2_sb.s_loaded_block_bitmaps = 0;
+	sb->u.ext2_sb.s_group_info = NULL;
+	sb->u.ext2_sb.s_alloc_stats = NULL;
 	sb->u.ext2_sb.s_db_per_group = db_count;
 	unlock_super (sb);
 	/*
@@ -620,7 +667,16 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 	 */
 	sb->s_dev = dev;
 	sb->s_op = &ext2_sops;
-	sb->s_root = d_alloc_root(iget(sb, EXT2_ROOT_INO));
+	sb->s_root = NULL;
+	if (!ext2_journal_load (sb, journal_inum)) {
+		/* After replay, so that the counts are current */
+		if (!ext2_load_group_info (sb))
+			sb->s_root = d_alloc_root(iget(sb, EXT2_ROOT_INO));
+		if (!sb->s_root) {
+			ext2_release_group_info (sb);
+			ext2_journal_release (sb);
+		}
+	}
 	if (!sb->s_root) {
 		sb->s_dev = 0;
 		for (i = 0; i < db_count; i++)
@@ -640,8 +696,9 @@ struct super_block * ext2_read_super (struct super_block * sb, void * data,
 static void ext2_commit_super (struct super_block * sb,
 			       struct ext2_super_block * es)
 {
+	ext2_update_free_counts (sb);
 	es->s_wtime = cpu_to_le32(CURRENT_TIME);
-	mark_buffer_dirty(sb->u.ext2_sb.s_sbh, 1);
+	ext2_journal_dirty_metadata (sb, sb->u.ext2_sb.s_sbh);
 	sb->s_dirt = 0;
 }
 
@@ -665,7 +722,8 @@ void ext2_write_super (struct super_block * sb)
 
 		ext2_debug ("setting valid to 0\n");
 
-		if (le16_to_cpu(es->s_state) & EXT2_VALID_FS) {
+		if (le16_to_cpu(es->s_state) & EXT2_VALID_FS &&
+		    !sb->u.ext2_sb.s_journal) {
 			es->s_state = cpu_to_le16(le16_to_cpu(es->s_state) & ~EXT2_VALID_FS);
 			es->s_mtime = cpu_to_le32(CURRENT_TIME);
 		}
@@ -680,13 +738,13 @@ int ext2_remount (struct super_block * sb, int * flags, char * data)
 	unsigned short resuid = sb->u.ext2_sb.s_resuid;
 	unsigned short resgid = sb->u.ext2_sb.s_resgid;
 	unsigned long new_mount_opt;
-	unsigned long tmp;
+	unsigned long tmp, journal_inum;
 
 	/*
 	 * Allow the "check" option to be passed as a remount option.
 	 */
 	new_mount_opt = EXT2_MOUNT_CHECK_NORMAL;
-	if (!parse_options (data, &tmp, &resuid, &resgid,
+	if (!parse_options (data, &tmp, &resuid, &resgid, &journal_inum,
 			    &new_mount_opt))
 		return -EINVAL;
 
@@ -697,6 +755,15 @@ int ext2_remount (struct super_block * sb, int * flags, char * data)
 	if ((*flags & MS_RDONLY) == (sb->s_flags & MS_RDONLY))
 		return 0;
 	if (*flags & MS_RDONLY) {
+		/*
+		 * Write out the free counts, and leave nothing in the
+		 * journal to replay.
+		 */
+		ext2_commit_super (sb, es);
+		if (sb->u.ext2_sb.s_journal) {
+			ext2_journal_flush (sb);
+			ext2_journal_set_recover (sb, 0);
+		}
 		if (le16_to_cpu(es->s_state) & EXT2_VALID_FS ||
 		    !(sb->u.ext2_sb.s_mount_state & EXT2_VALID_FS))
 			return 0;
@@ -717,7 +784,10 @@ int ext2_remount (struct super_block * sb, int * flags, char * data)
 		 * by e2fsck since we originally mounted the partition.)
 		 */
 		sb->u.ext2_sb.s_mount_state = le16_to_cpu(es->s_state);
+		ext2_load_group_info (sb);
 		sb->s_flags &= ~MS_RDONLY;
+		if (sb->u.ext2_sb.s_journal)
+			ext2_journal_set_recover (sb, 1);
 		ext2_setup_super (sb, es);
 	}
 	return 0;
@@ -76,6 +76,8 @@ static int ext2_secrm_seed = 152;	/* Random generator base */
  *
  * We now ensure that b_count == 1 before calling bforget() and that the
  * parent buffer (if any) is unlocked before clearing the block pointer.
+ * References held by the journal don't count: ext2_journal_forget()
+ * drops them, and revokes the block so that it isn't replayed.
  * The operations are always performed in this order:
  *	(1) Make sure that the parent buffer is unlocked.
  *	(2) Use find_buffer() to find the block buffer without blocking,
@@ -124,28 +126,26 @@ static int check_block_empty(struct inode *inode, struct buffer_head *bh,
 		if (*(ind++))
 			goto in_use;
 
-	if (atomic_read(&bh->b_count) == 1) {
+	if (!ext2_journal_forget(inode->i_sb, bh)) {
 		int tmp;
 		tmp = le32_to_cpu(*p);
 		*p = 0;
 		inode->i_blocks -= (inode->i_sb->s_blocksize / 512);
-		mark_inode_dirty(inode);
+		ext2_mark_inode_dirty(inode);
 		/*
 		 * Forget the buffer, then mark the parent buffer dirty.
 		 */
 		bforget(bh);
 		if (ind_bh)
-			mark_buffer_dirty(ind_bh, 1);
+			ext2_journal_dirty_metadata (inode->i_sb, ind_bh);
 		ext2_free_blocks(inode, tmp, 1);
 		goto out;
 	}
 	retry = 1;
 
 in_use:
-	if (IS_SYNC(inode) && buffer_dirty(bh)) {
-		ll_rw_block (WRITE, 1, &bh);
-		wait_on_buffer (bh);
-	}
+	if (IS_SYNC(inode) && (buffer_dirty(bh) || buffer_journaled(bh)))
+		ext2_sync_metadata (inode->i_sb, bh);
 	brelse (bh);
 
 out:
@@ -171,7 +171,7 @@ static int trunc_direct (struct inode * inode)
 
 		*p = 0;
 		inode->i_blocks -= blocks;
-		mark_inode_dirty(inode);
+		ext2_mark_inode_dirty(inode);
 
 		/* accumulate blocks to free if they're contiguous */
 		if (free_count == 0)
@@ -212,9 +212,9 @@ static int trunc_indirect (struct inode * inode, int offset, u32 * p, struct buf
 			inode->i_ino, tmp);
 		*p = 0;
 		if (dind_bh)
-			mark_buffer_dirty(dind_bh, 1);
+			ext2_journal_dirty_metadata (inode->i_sb, dind_bh);
 		else
-			mark_inode_dirty(inode);
+			ext2_mark_inode_dirty(inode);
 		return 0;
 	}
 
@@ -233,8 +233,8 @@ static int trunc_indirect (struct inode * inode, int offset, u32 * p, struct buf
 
 		*ind = 0;
 		inode->i_blocks -= blocks;
-		mark_inode_dirty(inode);
-		mark_buffer_dirty(ind_bh, 1);
+		ext2_mark_inode_dirty(inode);
+		ext2_journal_dirty_metadata (inode->i_sb, ind_bh);
 
 		/* accumulate blocks to free if they're contiguous */
 		if (free_count == 0)
@@ -280,9 +280,9 @@ static int trunc_dindirect (struct inode * inode, int offset, u32 * p,
 			inode->i_ino, tmp);
 		*p = 0;
 		if (tind_bh)
-			mark_buffer_dirty(tind_bh, 1);
+			ext2_journal_dirty_metadata (inode->i_sb, tind_bh);
 		else
-			mark_inode_dirty(inode);
+			ext2_mark_inode_dirty(inode);
 		return 0;
 	}
 
@@ -326,7 +326,7 @@ static int trunc_tindirect (struct inode * inode)
 			"Read failure, inode=%ld, block=%d",
 			inode->i_ino, tmp);
 		*p = 0;
-		mark_inode_dirty(inode);
+		ext2_mark_inode_dirty(inode);
 		return 0;
 	}
 
@@ -353,11 +353,14 @@ static int trunc_tindirect (struct inode * inode)
 		
 void ext2_truncate (struct inode * inode)
 {
+	struct ext2_handle handle;
+
 	if (!(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode) ||
 	    S_ISLNK(inode->i_mode)))
 		return;
 	if (IS_APPEND(inode) || IS_IMMUTABLE(inode))
 		return;
+	ext2_journal_start (inode->i_sb, &handle);
 	ext2_discard_prealloc(inode);
 	while (1) {
 		int retry = trunc_direct(inode);
@@ -379,5 +382,6 @@ void ext2_truncate (struct inode * inode)
 		schedule();
 	}
 	inode->i_mtime = inode->i_ctime = CURRENT_TIME;
-	mark_inode_dirty(inode);
+	ext2_mark_inode_dirty(inode);
+	ext2_journal_stop (&handle);
 }
@@ -113,15 +113,14 @@ static int fat_write_partial_page(struct file *file, struct page *page, unsigned
 {
 	struct dentry *dentry = file->f_dentry;
 	struct inode *inode = dentry->d_inode;
-	struct page *new_page, **hash;
+	struct page *new_page;
 	unsigned long pgpos;
 	struct page *page_cache = NULL;
 	long status;
 
 	pgpos = MSDOS_I(inode)->i_realsize >> PAGE_CACHE_SHIFT;
 	while (pgpos < page->index) {
-		hash = page_hash(&inode->i_data, pgpos);
-repeat_find:	new_page = __find_lock_page(&inode->i_data, pgpos, hash);
+repeat_find:	new_page = find_lock_page(&inode->i_data, pgpos);
 		if (!new_page) {
 			if (!page_cache) {
 				page_cache = page_cache_alloc();
@@ -131,7 +130,7 @@ repeat_find:	new_page = __find_lock_page(&inode->i_data, pgpos, hash);
 				goto out;
 			}
 			new_page = page_cache;
-			if (add_to_page_cache_unique(new_page,&inode->i_data,pgpos,hash))
+			if (add_to_page_cache_unique(new_page,&inode->i_data,pgpos))
 				goto repeat_find;
 			page_cache = NULL;
 		}
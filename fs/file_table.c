@@ -10,6 +10,7 @@
 #include <linux/file.h>
 #include <linux/init.h>
 #include <linux/smp_lock.h>
+#include <linux/eventpoll.h>
 
 /* SLAB cache for filp's. */
 static kmem_cache_t *filp_cache;
@@ -61,6 +62,7 @@ struct file * get_empty_filp(void)
 		file_list_unlock();
 		memset(f, 0, sizeof(*f));
 		atomic_set(&f->f_count,1);
+		INIT_LIST_HEAD(&f->f_ep_links);
 		f->f_version = ++event;
 		f->f_uid = current->fsuid;
 		f->f_gid = current->fsgid;
@@ -106,6 +108,7 @@ int init_private_file(struct file *filp, struct dentry *dentry, int mode)
 	memset(filp, 0, sizeof(*filp));
 	filp->f_mode   = mode;
 	atomic_set(&filp->f_count, 1);
+	INIT_LIST_HEAD(&filp->f_ep_links);
 	filp->f_dentry = dentry;
 	filp->f_uid    = current->fsuid;
 	filp->f_gid    = current->fsgid;
@@ -124,6 +127,7 @@ static void __fput(struct file *filp)
 	struct dentry * dentry = filp->f_dentry;
 	struct inode * inode = dentry->d_inode;
 
+	eventpoll_release(filp);
 	if (filp->f_op && filp->f_op->release)
 		filp->f_op->release(inode, filp);
 	filp->f_dentry = NULL;
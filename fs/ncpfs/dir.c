@@ -372,11 +372,10 @@ static struct page *
 ncp_get_cache_page(struct inode *inode, unsigned long offset, int used)
 {
 	struct address_space *i_data = &inode->i_data;
-	struct page *new_page, *page, **hash;
+	struct page *new_page, *page;
 
-	hash = page_hash(i_data, offset);
 
-	page = __find_lock_page(i_data, offset, hash);
+	page = find_lock_page(i_data, offset);
 	if (used || page)
 		return page;
 
@@ -386,10 +385,10 @@ ncp_get_cache_page(struct inode *inode, unsigned long offset, int used)
 
 	for (;;) {
 		page = new_page;
-		if (!add_to_page_cache_unique(page, i_data, offset, hash))
+		if (!add_to_page_cache_unique(page, i_data, offset))
 			break;
 		page_cache_release(page);
-		page = __find_lock_page(i_data, offset, hash);
+		page = find_lock_page(i_data, offset);
 		if (page) {
 			page_cache_free(new_page);
 			break;
@@ -168,8 +168,7 @@ static int do_ncp_rpc_call(struct ncp_server *server, int size,
 			break;
 		}
 	      re_select:
-		wait_table.nr = 0;
-		wait_table.entry = &entry;
+		poll_initwait(&wait_table, &entry);
 		/* mb() is not necessary because ->poll() will serialize
 		   instructions adding the wait_table waitqueues in the
 		   waitqueue-head before going to calculate the mask-retval. */
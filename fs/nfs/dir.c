@@ -308,7 +308,7 @@ static struct page *try_to_get_dirent_page(struct file *file, __u32 cookie, int
 	struct nfs_readdirres rd_res;
 	struct dentry *dentry = file->f_dentry;
 	struct inode *inode = dentry->d_inode;
-	struct page *page, **hash, *page_cache;
+	struct page *page, *page_cache;
 	long offset;
 	__u32 *cookiep;
 
@@ -332,16 +332,15 @@ static struct page *try_to_get_dirent_page(struct file *file, __u32 cookie, int
 		goto out;
 	}
 
-	hash = page_hash(&inode->i_data, offset);
 repeat:
-	page = __find_lock_page(&inode->i_data, offset, hash);
+	page = find_lock_page(&inode->i_data, offset);
 	if (page) {
 		page_cache_free(page_cache);
 		goto unlock_out;
 	}
 
 	page = page_cache;
-	if (add_to_page_cache_unique(page, &inode->i_data, offset, hash)) {
+	if (add_to_page_cache_unique(page, &inode->i_data, offset)) {
 		page_cache_release(page);
 		goto repeat;
 	}
@@ -420,7 +419,7 @@ static int nfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
 {
 	struct dentry *dentry = filp->f_dentry;
 	struct inode *inode = dentry->d_inode;
-	struct page *page, **hash;
+	struct page *page;
 	long offset;
 	int res;
 
@@ -434,8 +433,7 @@ static int nfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
 	if ((offset = nfs_readdir_offset(inode, filp->f_pos)) < 0)
 		goto no_dirent_page;
 
-	hash = page_hash(&inode->i_data, offset);
-	page = __find_get_page(&inode->i_data, offset, hash);
+	page = find_get_page(&inode->i_data, offset);
 	if (!page)
 		goto no_dirent_page;
 	if (!Page_Uptodate(page))
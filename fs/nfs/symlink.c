@@ -59,23 +59,22 @@ struct inode_operations nfs_symlink_inode_operations = {
 static struct page *try_to_get_symlink_page(struct dentry *dentry, struct inode *inode)
 {
 	struct nfs_readlinkargs rl_args;
-	struct page *page, **hash, *page_cache;
+	struct page *page, *page_cache;
 
 	page = NULL;
 	page_cache = page_cache_alloc();
 	if (!page_cache)
 		goto out;
 
-	hash = page_hash(&inode->i_data, 0);
 repeat:
-	page = __find_lock_page(&inode->i_data, 0, hash);
+	page = find_lock_page(&inode->i_data, 0);
 	if (page) {
 		page_cache_free(page_cache);
 		goto unlock_out;
 	}
 
 	page = page_cache;
-	if (add_to_page_cache_unique(page, &inode->i_data, 0, hash)) {
+	if (add_to_page_cache_unique(page, &inode->i_data, 0)) {
 		page_cache_release(page);
 		goto repeat;
 	}
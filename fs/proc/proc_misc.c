@@ -29,6 +29,7 @@
 #include <linux/smp.h>
 #include <linux/signal.h>
 #include <linux/module.h>
+#include <linux/hugetlb.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgtable.h>
@@ -62,6 +63,12 @@ extern int get_irq_list(char *);
 extern int get_dma_list(char *);
 extern int get_locks_status (char *, char **, off_t, int);
 extern int get_swaparea_info (char *);
+extern int get_schedstat(char *);
+extern int get_timerstat(char *);
+extern int get_vmstat(char *);
+extern int get_writeback_list(char *);
+extern int get_blkqueue_list(char *);
+extern int get_dcache_stats(char *);
 #ifdef CONFIG_SGI_DS1286
 extern int get_ds1286_status(char *);
 #endif
@@ -75,11 +82,11 @@ static int loadavg_read_proc(char *page, char **start, off_t off,
 	a = avenrun[0] + (FIXED_1/200);
 	b = avenrun[1] + (FIXED_1/200);
 	c = avenrun[2] + (FIXED_1/200);
-	len = sprintf(page,"%d.%02d %d.%02d %d.%02d %d/%d %d\n",
+	len = sprintf(page,"%d.%02d %d.%02d %d.%02d %lu/%d %d\n",
 		LOAD_INT(a), LOAD_FRAC(a),
 		LOAD_INT(b), LOAD_FRAC(b),
 		LOAD_INT(c), LOAD_FRAC(c),
-		nr_running, nr_threads, last_pid);
+		nr_running(), nr_threads, last_pid);
 	if (len <= off+count) *eof = 1;
 	*start = page + off;
 	len -= off;
@@ -176,6 +183,7 @@ static int meminfo_read_proc(char *page, char **start, off_t off,
                 K(i.freeram-i.freehigh),
                 K(i.totalswap),
                 K(i.freeswap));
+	len += hugetlb_report_meminfo(page + len);
 
 	if (len <= off+count) *eof = 1;
 	*start = page + off;
@@ -521,6 +529,77 @@ static int slabinfo_read_proc(char *page, char **start, off_t off,
 	return len;
 }
 
+static int schedstat_read_proc(char *page, char **start, off_t off,
+				 int count, int *eof, void *data)
+{
+	int len = get_schedstat(page);
+	if (len <= off+count) *eof = 1;
+	*start = page + off;
+	len -= off;
+	if (len>count) len = count;
+	if (len<0) len = 0;
+	return len;
+}
+
+static int timerstat_read_proc(char *page, char **start, off_t off,
+				 int count, int *eof, void *data)
+{
+	int len = get_timerstat(page);
+	if (len <= off+count) *eof = 1;
+	*start = page + off;
+	len -= off;
+	if (len>count) len = count;
+	if (len<0) len = 0;
+	return len;
+}
+static int vmstat_read_proc(char *page, char **start, off_t off,
+				 int count, int *eof, void *data)
+{
+	int len = get_vmstat(page);
+	if (len <= off+count) *eof = 1;
+	*start = page + off;
+	len -= off;
+	if (len>count) len = count;
+	if (len<0) len = 0;
+	return len;
+}
+
+static int writeback_read_proc(char *page, char **start, off_t off,
+				 int count, int *eof, void *data)
+{
+	int len = get_writeback_list(page);
+	if (len <= off+count) *eof = 1;
+	*start = page + off;
+	len -= off;
+	if (len>count) len = count;
+	if (len<0) len = 0;
+	return len;
+}
+
+static int blkqueues_read_proc(char *page, char **start, off_t off,
+				 int count, int *eof, void *data)
+{
+	int len = get_blkqueue_list(page);
+	if (len <= off+count) *eof = 1;
+	*start = page + off;
+	len -= off;
+	if (len>count) len = count;
+	if (len<0) len = 0;
+	return len;
+}
+
+static int dcache_read_proc(char *page, char **start, off_t off,
+				 int count, int *eof, void *data)
+{
+	int len = get_dcache_stats(page);
+	if (len <= off+count) *eof = 1;
+	*start = page + off;
+	len -= off;
+	if (len>count) len = count;
+	if (len<0) len = 0;
+	return len;
+}
+
 static int memory_read_proc(char *page, char **start, off_t off,
 				 int count, int *eof, void *data)
 {
@@ -655,13 +734,30 @@ void proc_misc_init(void)
 		{"locks",	locks_read_proc},
 		{"mounts",	mounts_read_proc},
 		{"swaps",	swaps_read_proc},
+#ifndef __SMP__
 		{"slabinfo",	slabinfo_read_proc},
+#endif
+		{"schedstat",	schedstat_read_proc},
+		{"timerstat",	timerstat_read_proc},
+		{"vmstat",	vmstat_read_proc},
+		{"writeback",	writeback_read_proc},
+		{"blkqueues",	blkqueues_read_proc},
+		{"dcache",	dcache_read_proc},
 		{"iomem",	memory_read_proc},
 		{"execdomains",	execdomains_read_proc},
 		{NULL,NULL}
 	};
+#ifdef __SMP__
+	struct proc_dir_entry *entry;
+#endif
 	for(p=simple_ones;p->name;p++)
 		create_proc_read_entry(p->name, 0, NULL, p->read_proc, NULL);
+#ifdef __SMP__
+	entry = create_proc_read_entry("slabinfo", S_IWUSR | S_IRUGO, NULL,
+				       slabinfo_read_proc, NULL);
+	if (entry)
+		entry->write_proc = slabinfo_write_proc;
+#endif
 
 	/* And now for trickier ones */
 	proc_register(&proc_root, &proc_root_kmsg);
@@ -60,6 +60,10 @@ static void free_wait(poll_table * p)
 
 void __pollwait(struct file * filp, wait_queue_head_t * wait_address, poll_table *p)
 {
+	if (p->qproc) {
+		p->qproc(filp, wait_address, p);
+		return;
+	}
 	for (;;) {
 		if (p->nr < __MAX_POLL_TABLE_ENTRIES) {
 			struct poll_table_entry * entry;
@@ -77,9 +81,7 @@ ok_table:
 			poll_table *tmp = (poll_table *) __get_free_page(GFP_KERNEL);
 			if (!tmp)
 				return;
-			tmp->nr = 0;
-			tmp->entry = (struct poll_table_entry *)(tmp + 1);
-			tmp->next = NULL;
+			poll_initwait(tmp, (struct poll_table_entry *)(tmp + 1));
 			p->next = tmp;
 			p = tmp;
 			goto ok_table;
@@ -158,9 +160,7 @@ int do_select(int n, fd_set_bits *fds, long *timeout)
 		if (!wait_table)
 			return -ENOMEM;
 
-		wait_table->nr = 0;
-		wait_table->entry = (struct poll_table_entry *)(wait_table + 1);
-		wait_table->next = NULL;
+		poll_initwait(wait_table, (struct poll_table_entry *)(wait_table + 1));
 		wait = wait_table;
 	}
 
@@ -396,9 +396,7 @@ asmlinkage long sys_poll(struct pollfd * ufds, unsigned int nfds, long timeout)
 		wait_table = (poll_table *) __get_free_page(GFP_KERNEL);
 		if (!wait_table)
 			goto out;
-		wait_table->nr = 0;
-		wait_table->entry = (struct poll_table_entry *)(wait_table + 1);
-		wait_table->next = NULL;
+		poll_initwait(wait_table, (struct poll_table_entry *)(wait_table + 1));
 		wait = wait_table;
 	}
 
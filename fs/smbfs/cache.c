@@ -47,12 +47,10 @@ static unsigned long
 get_cached_page(struct address_space *mapping, unsigned long offset, int new)
 {
 	struct page * page;
-	struct page ** hash;
 	struct page *cached_page = NULL;
 
  again:
-	hash = page_hash(mapping, offset);
-	page = __find_lock_page(mapping, offset, hash);
+	page = find_lock_page(mapping, offset);
 	if(!page && new) {
 		/* not in cache, alloc a new page if we didn't do it yet */
 		if (!cached_page) {
@@ -67,7 +65,7 @@ get_cached_page(struct address_space *mapping, unsigned long offset, int new)
 		if (page->buffers)
 			BUG();
 		printk(KERN_DEBUG "smbfs: get_cached_page\n");
-		if (add_to_page_cache_unique(page, mapping, offset, hash))
+		if (add_to_page_cache_unique(page, mapping, offset))
 			/* Hmm, a page has materialized in the
                            cache. Fine. Go back and get that page
                           instead... */
@@ -456,6 +456,27 @@ void sync_supers(kdev_t dev)
 	}
 }
 
+/*
+ * Memory is short: let the filesystems give back what they keep
+ * cached of their own, a share depending on 'priority' as for the
+ * dcache. shrink_caches() must not sleep.
+ */
+void shrink_super_caches(int priority)
+{
+	struct super_block * sb;
+
+	lock_kernel();
+	for (sb = sb_entry(super_blocks.next);
+	     sb != sb_entry(&super_blocks); 
+	     sb = sb_entry(sb->s_list.next)) {
+		if (!sb->s_dev)
+			continue;
+		if (sb->s_op && sb->s_op->shrink_caches)
+			sb->s_op->shrink_caches(sb, priority);
+	}
+	unlock_kernel();
+}
+
 struct super_block * get_super(kdev_t dev)
 {
 	struct super_block * s;
@@ -518,8 +539,11 @@ struct super_block *get_empty_super(void)
 	     s  = sb_entry(s->s_list.next)) {
 		if (s->s_dev)
 			continue;
-		if (!s->s_lock)
+		if (!s->s_lock) {
+			/* the statistics were for the previous mount */
+			memset(&s->s_dcache_stat, 0, sizeof(s->s_dcache_stat));
 			return s;
+		}
 		printk("VFS: empty superblock %p locked!\n", s);
 	}
 	/* Need a new one... */
@@ -533,6 +557,7 @@ struct super_block *get_empty_super(void)
 		list_add (&s->s_list, super_blocks.prev);
 		init_waitqueue_head(&s->s_wait);
 		INIT_LIST_HEAD(&s->s_files);
+		INIT_LIST_HEAD(&s->s_dentry_lru);
 	}
 	return s;
 }
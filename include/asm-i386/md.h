@@ -8,6 +8,9 @@
 
 /* #define HAVE_ARCH_XORBLOCK */
 
+/* MMX versions of the multi-source xor_block(), see <asm/xor.h> */
+#define HAVE_ARCH_XOR_TEMPLATES
+
 #define MD_XORBLOCK_ALIGNMENT	sizeof(long)
 
 #endif /* __ASM_MD_H */
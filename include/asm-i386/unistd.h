@@ -196,6 +196,10 @@
 #define __NR_putpmsg		189	/* some people actually want streams */
 #define __NR_vfork		190
 #define __NR_ugetrlimit		191	/* SuS compliant getrlimit */
+#define __NR_epoll_create	192
+#define __NR_epoll_ctl		193
+#define __NR_epoll_wait		194
+#define __NR_rt_sigtimedwait4	195
 
 /* user-visible error numbers are in the range -1 - -124: see <asm-i386/errno.h> */
 
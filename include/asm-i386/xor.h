@@ -0,0 +1,168 @@
+/*
+ * include/asm-i386/xor.h
+ *
+ * MMX parity routines for drivers/block/xor.c. Every loop loads 64
+ * bytes of the destination into %mm0-%mm7, XORs in the same 64 bytes
+ * of each source and stores the result, so the destination is read
+ * and written once however many sources there are.
+ *
+ * The FPU state of the current process is saved the same way
+ * arch/i386/lib/mmx.c does it.
+ */
+
+#ifndef __ASM_XOR_H
+#define __ASM_XOR_H
+
+#include <asm/processor.h>
+#include <asm/system.h>
+
+#define XMMX_SAVE	do { unlazy_fpu(current); clts(); } while (0)
+#define XMMX_RESTORE	stts()
+
+#define LD(x,y)		"	movq   8*("#x")(%1), %%mm"#y"\n"
+#define ST(x,y)		"	movq %%mm"#y",   8*("#x")(%1)\n"
+#define XO(p,x,y)	"	pxor   8*("#x")(%"#p"), %%mm"#y"\n"
+#define XO1(x,y)	XO(2,x,y)
+#define XO2(x,y)	XO(3,x,y)
+#define XO3(x,y)	XO(4,x,y)
+
+#define ALL8(op)	op(0,0) op(1,1) op(2,2) op(3,3) \
+			op(4,4) op(5,5) op(6,6) op(7,7)
+
+static void
+xor_mmx_2(unsigned long bytes, unsigned long *p1, unsigned long *p2)
+{
+	unsigned long lines = bytes >> 6;
+
+	XMMX_SAVE;
+	__asm__ __volatile__ (
+	"	.align 32\n"
+	"1:\n"
+	ALL8(LD)
+	ALL8(XO1)
+	ALL8(ST)
+	"	addl $64, %1\n"
+	"	addl $64, %2\n"
+	"	decl %0\n"
+	"	jnz 1b\n"
+	: "=r" (lines), "=r" (p1), "=r" (p2)
+	: "0" (lines), "1" (p1), "2" (p2)
+	: "memory");
+	XMMX_RESTORE;
+}
+
+static void
+xor_mmx_3(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+	  unsigned long *p3)
+{
+	unsigned long lines = bytes >> 6;
+
+	XMMX_SAVE;
+	__asm__ __volatile__ (
+	"	.align 32\n"
+	"1:\n"
+	ALL8(LD)
+	ALL8(XO1)
+	ALL8(XO2)
+	ALL8(ST)
+	"	addl $64, %1\n"
+	"	addl $64, %2\n"
+	"	addl $64, %3\n"
+	"	decl %0\n"
+	"	jnz 1b\n"
+	: "=r" (lines), "=r" (p1), "=r" (p2), "=r" (p3)
+	: "0" (lines), "1" (p1), "2" (p2), "3" (p3)
+	: "memory");
+	XMMX_RESTORE;
+}
+
+static void
+xor_mmx_4(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+	  unsigned long *p3, unsigned long *p4)
+{
+	unsigned long lines = bytes >> 6;
+
+	XMMX_SAVE;
+	__asm__ __volatile__ (
+	"	.align 32\n"
+	"1:\n"
+	ALL8(LD)
+	ALL8(XO1)
+	ALL8(XO2)
+	ALL8(XO3)
+	ALL8(ST)
+	"	addl $64, %1\n"
+	"	addl $64, %2\n"
+	"	addl $64, %3\n"
+	"	addl $64, %4\n"
+	"	decl %0\n"
+	"	jnz 1b\n"
+	: "=r" (lines), "=r" (p1), "=r" (p2), "=r" (p3), "=r" (p4)
+	: "0" (lines), "1" (p1), "2" (p2), "3" (p3), "4" (p4)
+	: "memory");
+	XMMX_RESTORE;
+}
+
+/*
+ * Six pointers would take more than the ten operands gcc allows, so
+ * p4 and p5 are plain inputs here, saved and restored around the loop.
+ */
+#define XO4_5(x,y)	XO(8,x,y)
+#define XO5_5(x,y)	XO(9,x,y)
+
+static void
+xor_mmx_5(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+	  unsigned long *p3, unsigned long *p4, unsigned long *p5)
+{
+	unsigned long lines = bytes >> 6;
+
+	XMMX_SAVE;
+	__asm__ __volatile__ (
+	"	pushl %8\n"
+	"	pushl %9\n"
+	"	.align 32\n"
+	"1:\n"
+	ALL8(LD)
+	ALL8(XO1)
+	ALL8(XO2)
+	ALL8(XO4_5)
+	ALL8(XO5_5)
+	ALL8(ST)
+	"	addl $64, %1\n"
+	"	addl $64, %2\n"
+	"	addl $64, %3\n"
+	"	addl $64, %8\n"
+	"	addl $64, %9\n"
+	"	decl %0\n"
+	"	jnz 1b\n"
+	"	popl %9\n"
+	"	popl %8\n"
+	: "=r" (lines), "=r" (p1), "=r" (p2), "=r" (p3)
+	: "0" (lines), "1" (p1), "2" (p2), "3" (p3), "r" (p4), "r" (p5)
+	: "memory");
+	XMMX_RESTORE;
+}
+
+#undef LD
+#undef ST
+#undef XO
+#undef XO1
+#undef XO2
+#undef XO3
+#undef XO4_5
+#undef XO5_5
+#undef ALL8
+
+static struct xor_block_template xor_block_mmx = {
+	NULL, "mmx", 0,
+	xor_mmx_2, xor_mmx_3, xor_mmx_4, xor_mmx_5
+};
+
+/* only offered to the calibration on CPUs that have MMX */
+#define XOR_ARCH_TEMPLATES					\
+	do {							\
+		if (boot_cpu_data.x86_capability & X86_FEATURE_MMX) \
+			xor_speed(&xor_block_mmx);		\
+	} while (0)
+
+#endif /* __ASM_XOR_H */
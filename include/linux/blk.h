@@ -14,17 +14,16 @@
 extern spinlock_t io_request_lock;
 
 /*
- * NR_REQUEST is the number of entries in the request-queue.
- * NOTE that writes may use only the low 2/3 of these: reads
+ * NR_REQUEST is the number of entries in the pool of each request
+ * queue. NOTE that writes may use only the low 2/3 of these: reads
  * take precedence.
  */
 #define NR_REQUEST	128
 
 /*
- * This is used in the elevator algorithm.  We don't prioritise reads
- * over writes any more --- although reads are more time-critical than
- * writes, by treating them equally we increase filesystem throughput.
- * This turns out to give better overall performance.  -- sct
+ * This is used in the elevator algorithm to sort requests within a
+ * queue. Whether reads go before writes is up to the elevator of the
+ * queue (see drivers/block/elevator.c).
  */
 #define IN_ORDER(s1,s2) \
 ((s1)->rq_dev < (s2)->rq_dev || (((s1)->rq_dev == (s2)->rq_dev && \
@@ -5,6 +5,7 @@
 #include <linux/sched.h>
 #include <linux/genhd.h>
 #include <linux/tqueue.h>
+#include <linux/elevator.h>
 
 /*
  * Ok, this is an expanded form so that we can use the same
@@ -32,11 +33,27 @@ struct request {
 	struct buffer_head * bh;
 	struct buffer_head * bhtail;
 	struct request * next;
+	unsigned long start_time;	/* jiffies when queued */
+	unsigned long deadline;		/* don't pass it after this */
 };
 
 typedef void (request_fn_proc) (void);
 typedef struct request ** (queue_proc) (kdev_t dev);
 
+/*
+ * Completion latency of the requests of a queue, in milliseconds from
+ * add_request() to the end of the last buffer. Bucket i of the
+ * histogram counts latencies below 2^i ms, the last one the rest.
+ */
+#define BLK_LAT_HIST	12
+
+struct blk_queue_stats {
+	unsigned long		completed[2];	/* READ, WRITE */
+	unsigned long		total_ms[2];
+	unsigned long		max_ms[2];
+	unsigned long		hist[2][BLK_LAT_HIST];
+};
+
 struct blk_dev_struct {
 	request_fn_proc		*request_fn;
 	/*
@@ -47,6 +64,15 @@ struct blk_dev_struct {
 	struct request		*current_request;
 	struct request   plug;
 	struct tq_struct plug_tq;
+	/*
+	 * Protects the request lists, the request pool and the
+	 * stats. request_fn is called with it held. All drivers
+	 * still share io_request_lock.
+	 */
+	spinlock_t		*queue_lock;
+	struct request		*requests;	/* NR_REQUEST of them, once registered */
+	struct blk_queue_stats	*stats;
+	elevator_t		elevator;
 };
 
 struct sec_size {
@@ -60,6 +86,9 @@ extern wait_queue_head_t wait_for_request;
 extern void resetup_one_dev(struct gendisk *dev, int drive);
 extern void unplug_device(void * data);
 extern void make_request(int major,int rw, struct buffer_head * bh);
+extern void req_finished_io(struct request * req);
+extern int get_blkqueue_list(char * page);
+extern int blk_alloc_requests(int major, int gfp_mask);
 
 /* md needs this function to remap requests */
 extern int md_map (int minor, kdev_t *rdev, unsigned long *rsector, unsigned long size);
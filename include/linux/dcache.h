@@ -12,6 +12,8 @@
  * with heavy changes by Linus Torvalds
  */
 
+#include <linux/seqlock.h>
+
 #define IS_ROOT(x) ((x) == (x)->d_parent)
 
 /*
@@ -70,10 +72,18 @@ struct dentry {
 	struct dentry_operations  *d_op;
 	struct super_block * d_sb;	/* The root of the dentry tree */
 	unsigned long d_reftime;	/* last time referenced */
+	seqcount_t d_seq;		/* name and parent changes, for d_fast_lookup */
 	void * d_fsdata;		/* fs-specific data */
 	unsigned char d_iname[DNAME_INLINE_LEN]; /* small names */
 };
 
+/* per-superblock d_lookup() statistics, for /proc/dcache */
+struct dcache_sb_stat {
+	unsigned long hits;		/* found a positive dentry */
+	unsigned long negative;		/* found a negative dentry */
+	unsigned long misses;		/* not in the dcache */
+};
+
 struct dentry_operations {
 	int (*d_revalidate)(struct dentry *, int);
 	int (*d_hash) (struct dentry *, struct qstr *);
@@ -111,11 +121,18 @@ struct dentry_operations {
  * d_drop() is used mainly for stuff that wants
  * to invalidate a dentry for some reason (NFS
  * timeouts or autofs deletes).
+ *
+ * Unhashing bumps dentry_hash_seq, for the benefit
+ * of hash walks done without the big kernel lock.
  */
+extern seqcount_t dentry_hash_seq;
+
 static __inline__ void d_drop(struct dentry * dentry)
 {
+	write_seqcount_begin(&dentry_hash_seq);
 	list_del(&dentry->d_hash);
 	INIT_LIST_HEAD(&dentry->d_hash);
+	write_seqcount_end(&dentry_hash_seq);
 }
 
 static __inline__ int dname_external(struct dentry *d)
@@ -170,6 +187,8 @@ extern void d_move(struct dentry *, struct dentry *);
 
 /* appendix may either be NULL or be used for transname suffixes */
 extern struct dentry * d_lookup(struct dentry *, struct qstr *);
+/* the same, dropping the big kernel lock for the hash walk */
+extern struct dentry * d_fast_lookup(struct dentry *, struct qstr *);
 
 /* validate "insecure" dentry pointer */
 extern int d_validate(struct dentry *, struct dentry *, unsigned int, unsigned int);
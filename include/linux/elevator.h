@@ -0,0 +1,47 @@
+#ifndef _LINUX_ELEVATOR_H
+#define _LINUX_ELEVATOR_H
+
+/*
+ * Request queue ordering policies, selectable per queue with the
+ * BLKELVGET/BLKELVSET ioctls.
+ */
+#define ELEVATOR_NOOP		0	/* FIFO, for controllers that sort themselves */
+#define ELEVATOR_DEADLINE	1	/* sorted, reads first, bounded waits */
+
+typedef struct blkelv_ioctl_arg_s {
+	int elevator;		/* ELEVATOR_* */
+	int read_expire;	/* in milliseconds, 0 for the default */
+	int write_expire;
+} blkelv_ioctl_arg_t;
+
+#ifdef __KERNEL__
+
+struct request;
+struct blk_dev_struct;
+typedef struct elevator_s elevator_t;
+
+/*
+ * Insert a request in a non-empty queue. The head of the queue may be
+ * in the hands of the driver already, so it must stay in front.
+ */
+typedef void (elevator_add_fn) (elevator_t *, struct request * head,
+				struct request * req);
+
+struct elevator_s {
+	int id;
+	const char * name;
+	elevator_add_fn * add_request;
+	unsigned long read_expire;	/* jiffies */
+	unsigned long write_expire;
+};
+
+extern elevator_t elevator_noop;
+extern elevator_t elevator_deadline;
+extern elevator_t * elevator_default;
+
+extern int blkelvget_ioctl(struct blk_dev_struct *, blkelv_ioctl_arg_t *);
+extern int blkelvset_ioctl(struct blk_dev_struct *, const blkelv_ioctl_arg_t *);
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_ELEVATOR_H */
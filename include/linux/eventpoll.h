@@ -0,0 +1,49 @@
+#ifndef _LINUX_EVENTPOLL_H
+#define _LINUX_EVENTPOLL_H
+
+/*
+ * epoll: a persistent set of file descriptors to watch, which is
+ * changed incrementally with epoll_ctl() and returns only the ready
+ * descriptors from epoll_wait().
+ */
+
+#include <linux/types.h>
+
+/* epoll_ctl() operations */
+#define EPOLL_CTL_ADD	1	/* start watching a descriptor */
+#define EPOLL_CTL_DEL	2	/* stop watching it */
+#define EPOLL_CTL_MOD	3	/* change the events or data of a descriptor */
+
+/*
+ * The event bits are the POLL* ones. POLLERR and POLLHUP are always
+ * watched. EPOLLET asks for edge-triggered reporting: a descriptor is
+ * returned once per wakeup of its wait queue rather than for as long
+ * as it stays ready.
+ */
+#define EPOLLET		(1U << 31)
+
+struct epoll_event {
+	__u32 events;
+	__u64 data;
+} __attribute__ ((packed));
+
+#ifdef __KERNEL__
+
+struct file;
+
+extern void eventpoll_release_file(struct file *);
+
+/* Called from fput() when the last reference to a file goes away. */
+#define eventpoll_release(file) do {				\
+	if (!list_empty(&(file)->f_ep_links))			\
+		eventpoll_release_file(file);			\
+} while (0)
+
+asmlinkage long sys_epoll_create(int size);
+asmlinkage long sys_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+asmlinkage long sys_epoll_wait(int epfd, struct epoll_event *events,
+	int maxevents, int timeout);
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_EVENTPOLL_H */
@@ -32,6 +32,7 @@
  */
 #define EXT2_PREALLOCATE
 #define EXT2_DEFAULT_PREALLOC_BLOCKS	8
+#define EXT2_MAX_PREALLOC_BLOCKS	256
 
 /*
  * The second extended file system version
@@ -198,6 +199,7 @@ struct ext2_group_desc
 #define EXT2_ECOMPR_FL			0x00000800 /* Compression error */
 /* End compression flags --- maybe not all used */	
 #define EXT2_BTREE_FL			0x00001000 /* btree format dir */
+#define EXT2_INDEX_FL			0x00001000 /* hash-indexed directory */
 #define EXT2_RESERVED_FL		0x80000000 /* reserved for ext2 lib */
 
 #define EXT2_FL_USER_VISIBLE		0x00001FFF /* User visible flags */
@@ -210,6 +212,43 @@ struct ext2_group_desc
 #define	EXT2_IOC_SETFLAGS		_IOW('f', 2, long)
 #define	EXT2_IOC_GETVERSION		_IOR('v', 1, long)
 #define	EXT2_IOC_SETVERSION		_IOW('v', 2, long)
+#define	EXT2_IOC_GETFRAG		_IOR('f', 8, struct ext2_frag_report)
+#define	EXT2_IOC_GETALLOCSTATS		_IOR('f', 9, struct ext2_alloc_stats)
+
+/*
+ * EXT2_IOC_GETFRAG: how many physically contiguous runs the data
+ * blocks of a file are in.
+ */
+struct ext2_frag_report {
+	__u32	blocks;			/* mapped data blocks */
+	__u32	extents;		/* contiguous runs of them */
+};
+
+/*
+ * EXT2_IOC_GETALLOCSTATS: how the block and inode allocators of the
+ * filesystem a file is on have been doing since mount. Latencies are
+ * in microseconds, lock waits included; bucket n of a histogram counts
+ * the calls which took less than 2^(n+1) of them, the last one all the
+ * slower ones.
+ */
+#define EXT2_ALLOC_HIST			12
+
+struct ext2_alloc_latency {
+	__u32	calls;
+	__u32	failed;			/* returned no block or inode */
+	__u32	usecs;			/* total */
+	__u32	max_usecs;
+	__u32	hist[EXT2_ALLOC_HIST];
+};
+
+struct ext2_alloc_stats {
+	__u32	bitmap_hits;		/* bitmap already in the group table */
+	__u32	bitmap_reads;		/* bitmap had to be read */
+	__u32	bitmaps_cached;		/* bitmaps in the group table now */
+	__u32	groups_scanned;		/* group summaries looked at */
+	struct ext2_alloc_latency blocks;
+	struct ext2_alloc_latency inodes;
+};
 
 /*
  * Structure of an inode on the disk
@@ -310,6 +349,8 @@ struct ext2_inode {
 #define EXT2_MOUNT_ERRORS_RO		0x0020	/* Remount fs ro on errors */
 #define EXT2_MOUNT_ERRORS_PANIC		0x0040	/* Panic on errors */
 #define EXT2_MOUNT_MINIX_DF		0x0080	/* Mimics the Minix statfs */
+#define EXT2_MOUNT_INDEX		0x0100	/* Index big directories */
+#define EXT2_MOUNT_DATA_WRITEBACK	0x0200	/* Don't order data before the journal */
 
 #define clear_opt(o, opt)		o &= ~EXT2_MOUNT_##opt
 #define set_opt(o, opt)			o |= EXT2_MOUNT_##opt
@@ -388,7 +429,14 @@ struct ext2_super_block {
 	__u8	s_prealloc_blocks;	/* Nr of blocks to try to preallocate*/
 	__u8	s_prealloc_dir_blocks;	/* Nr to preallocate for dirs */
 	__u16	s_padding1;
-	__u32	s_reserved[204];	/* Padding to the end of the block */
+	/*
+	 * Journaling support, valid if EXT2_FEATURE_COMPAT_HAS_JOURNAL set.
+	 */
+	__u8	s_journal_uuid[16];	/* uuid of journal superblock */
+	__u32	s_journal_inum;		/* inode number of journal file */
+	__u32	s_journal_dev;		/* device number of journal file */
+	__u32	s_last_orphan;		/* start of list of inodes to delete */
+	__u32	s_reserved[197];	/* Padding to the end of the block */
 };
 
 #ifdef __KERNEL__
@@ -432,6 +480,8 @@ struct ext2_super_block {
 	( EXT2_SB(sb)->s_feature_incompat & (mask) )
 
 #define EXT2_FEATURE_COMPAT_DIR_PREALLOC	0x0001
+#define EXT2_FEATURE_COMPAT_HAS_JOURNAL		0x0004
+#define EXT2_FEATURE_COMPAT_DIR_INDEX		0x0020
 
 #define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
 #define EXT2_FEATURE_RO_COMPAT_LARGE_FILE	0x0002
@@ -439,9 +489,11 @@ struct ext2_super_block {
 
 #define EXT2_FEATURE_INCOMPAT_COMPRESSION	0x0001
 #define EXT2_FEATURE_INCOMPAT_FILETYPE		0x0002
+#define EXT2_FEATURE_INCOMPAT_RECOVER		0x0004
 
 #define EXT2_FEATURE_COMPAT_SUPP	0
-#define EXT2_FEATURE_INCOMPAT_SUPP	EXT2_FEATURE_INCOMPAT_FILETYPE
+#define EXT2_FEATURE_INCOMPAT_SUPP	(EXT2_FEATURE_INCOMPAT_FILETYPE| \
+					 EXT2_FEATURE_INCOMPAT_RECOVER)
 #define EXT2_FEATURE_RO_COMPAT_SUPP	(EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER| \
 					 EXT2_FEATURE_RO_COMPAT_LARGE_FILE| \
 					 EXT2_FEATURE_RO_COMPAT_BTREE_DIR)
@@ -503,7 +555,70 @@ struct ext2_dir_entry_2 {
 #define EXT2_DIR_REC_LEN(name_len)	(((name_len) + 8 + EXT2_DIR_ROUND) & \
 					 ~EXT2_DIR_ROUND)
 
+/*
+ * The journal lives in a regular file, whose first block holds the
+ * journal super block. The rest is a circular log of transactions:
+ * descriptor blocks, each followed by copies of the blocks it tags,
+ * then revoke blocks, then a commit block. A transaction which has
+ * no commit block on disk is ignored at recovery time.
+ *
+ * Every log block but the copies starts with a header; a copy whose
+ * first word happens to be the magic number is logged with it
+ * cleared and EXT2_JTAG_ESCAPE set.
+ */
+#define EXT2_JOURNAL_MAGIC	0x4a324558	/* "XE2J" */
+
+#define EXT2_JOURNAL_SUPER_BLOCK	1
+#define EXT2_JOURNAL_DESCRIPTOR_BLOCK	2
+#define EXT2_JOURNAL_COMMIT_BLOCK	3
+#define EXT2_JOURNAL_REVOKE_BLOCK	4
+
+struct ext2_journal_header {
+	__u32	h_magic;
+	__u32	h_blocktype;
+	__u32	h_sequence;		/* Transaction the block belongs to */
+};
+
+struct ext2_journal_super_block {
+	struct ext2_journal_header s_header;
+	__u32	s_blocksize;		/* Must be the fs block size */
+	__u32	s_maxlen;		/* Blocks in the journal file */
+	__u32	s_first;		/* First log block */
+	__u32	s_sequence;		/* First transaction expected in the log */
+	__u32	s_start;		/* Where it is; 0 if the log is empty */
+};
+
+struct ext2_journal_tag {
+	__u32	t_blocknr;		/* Where the copy goes */
+	__u32	t_flags;
+};
+
+#define EXT2_JTAG_ESCAPE	1	/* First word of the copy was the magic */
+#define EXT2_JTAG_LAST		2	/* Last tag in the descriptor */
+
+/*
+ * Revoked blocks are not replayed from transactions older than the
+ * one revoking them: they were freed, and may hold data by now.
+ */
+struct ext2_journal_revoke_header {
+	struct ext2_journal_header r_header;
+	__u32	r_count;		/* Block numbers which follow */
+};
+
 #ifdef __KERNEL__
+/*
+ * A handle brackets one filesystem operation: the transaction it is
+ * logged in won't be committed until every handle on it has stopped,
+ * so an operation is either all in the log or not at all.
+ */
+struct ext2_handle {
+	struct ext2_journal * h_journal;
+	struct ext2_transaction * h_transaction;
+	struct ext2_handle * h_next;	/* Enclosing handle of this task */
+	int h_nested;
+	int h_sync;			/* Commit before returning */
+};
+
 /*
  * Function prototypes
  */
@@ -530,6 +645,11 @@ extern void ext2_check_blocks_bitmap (struct super_block *);
 extern struct ext2_group_desc * ext2_get_group_desc(struct super_block * sb,
 						    unsigned int block_group,
 						    struct buffer_head ** bh);
+extern int ext2_load_group_info (struct super_block *);
+extern void ext2_release_group_info (struct super_block *);
+extern void ext2_shrink_bitmaps (struct super_block *, int);
+extern void ext2_alloc_latency (struct ext2_alloc_latency *,
+				struct timeval *, int);
 
 /* bitmap.c */
 extern unsigned long ext2_count_free (struct buffer_head *, unsigned);
@@ -572,6 +692,22 @@ extern void ext2_discard_prealloc (struct inode *);
 extern int ext2_ioctl (struct inode *, struct file *, unsigned int,
 		       unsigned long);
 
+/* journal.c */
+extern int ext2_journal_load (struct super_block *, unsigned long);
+extern void ext2_journal_release (struct super_block *);
+extern void ext2_journal_flush (struct super_block *);
+extern void ext2_journal_set_recover (struct super_block *, int);
+extern void ext2_journal_start (struct super_block *, struct ext2_handle *);
+extern void ext2_journal_stop (struct ext2_handle *);
+extern void ext2_journal_dirty_metadata (struct super_block *,
+					 struct buffer_head *);
+extern void ext2_journal_dirty_data (struct inode *, struct buffer_head *);
+extern void ext2_sync_metadata (struct super_block *, struct buffer_head *);
+extern void ext2_journal_force_commit (struct super_block *);
+extern int ext2_journal_forget (struct super_block *, struct buffer_head *);
+extern void ext2_journal_revoke (struct super_block *, unsigned long);
+extern void ext2_mark_inode_dirty (struct inode *);
+
 /* namei.c */
 extern void ext2_release (struct inode *, struct file *);
 extern struct dentry *ext2_lookup (struct inode *, struct dentry *);
@@ -24,7 +24,28 @@
  */
 /* #define EXT2_MAX_GROUP_DESC	8 */
 
-#define EXT2_MAX_GROUP_LOADED	8
+struct ext2_journal;
+struct ext2_alloc_stats;
+
+/*
+ * In-memory state of a block group: its bitmaps once they have been
+ * loaded, and the free counts of its descriptor, which the allocators
+ * scan to pick a group without going through the descriptor blocks.
+ *
+ * gi_lock protects the bitmaps, the counts and the group descriptor.
+ * The counts may be read without it as a hint; the superblock totals
+ * are only summed from them for statfs and when the superblock is
+ * written.
+ */
+struct ext2_group_info {
+	struct semaphore gi_lock;
+	struct buffer_head * gi_block_bitmap;
+	struct buffer_head * gi_inode_bitmap;
+	unsigned short gi_free_blocks;
+	unsigned short gi_free_inodes;
+	unsigned short gi_used_dirs;
+	unsigned short gi_referenced;	/* bitmaps used since the last shrink */
+};
 
 /*
  * second extended-fs super-block data in memory
@@ -43,12 +64,9 @@ struct ext2_sb_info {
 	struct buffer_head * s_sbh;	/* Buffer containing the super block */
 	struct ext2_super_block * s_es;	/* Pointer to the super block in the buffer */
 	struct buffer_head ** s_group_desc;
-	unsigned short s_loaded_inode_bitmaps;
-	unsigned short s_loaded_block_bitmaps;
-	unsigned long s_inode_bitmap_number[EXT2_MAX_GROUP_LOADED];
-	struct buffer_head * s_inode_bitmap[EXT2_MAX_GROUP_LOADED];
-	unsigned long s_block_bitmap_number[EXT2_MAX_GROUP_LOADED];
-	struct buffer_head * s_block_bitmap[EXT2_MAX_GROUP_LOADED];
+	struct ext2_group_info * s_group_info;	/* One per group */
+	struct ext2_alloc_stats * s_alloc_stats;
+	unsigned long s_shrink_group;	/* Where bitmap shrinking goes on */
 	unsigned long  s_mount_opt;
 	unsigned short s_resuid;
 	unsigned short s_resgid;
@@ -61,6 +79,7 @@ struct ext2_sb_info {
 	int s_feature_compat;
 	int s_feature_incompat;
 	int s_feature_ro_compat;
+	struct ext2_journal * s_journal;	/* NULL if not journaled */
 };
 
 #endif	/* _LINUX_EXT2_FS_SB */
@@ -18,6 +18,7 @@
 #include <linux/list.h>
 #include <linux/dcache.h>
 #include <linux/stat.h>
+#include <linux/radix-tree.h>
 
 #include <asm/atomic.h>
 #include <asm/bitops.h>
@@ -159,6 +160,8 @@ extern int max_super_blocks, nr_super_blocks;
 #define BLKSECTSET _IO(0x12,102)/* set max sectors per request (ll_rw_blk.c) */
 #define BLKSECTGET _IO(0x12,103)/* get max sectors per request (ll_rw_blk.c) */
 #define BLKSSZGET  _IO(0x12,104)/* get block device sector size */
+#define BLKELVGET  _IOR(0x12,106,blkelv_ioctl_arg_t)/* get elevator (linux/elevator.h) */
+#define BLKELVSET  _IOW(0x12,107,blkelv_ioctl_arg_t)/* set elevator (linux/elevator.h) */
 #if 0
 #define BLKPG      _IO(0x12,105)/* See blkpg.h */
 /* This was here just to show that the number is taken -
@@ -181,7 +184,7 @@ extern void update_atime (struct inode *);
 extern void buffer_init(unsigned long);
 extern void inode_init(void);
 extern void file_table_init(void);
-extern void dcache_init(void);
+extern void dcache_init(unsigned long);
 
 typedef char buffer_block[BLOCK_SIZE];
 
@@ -193,6 +196,9 @@ typedef char buffer_block[BLOCK_SIZE];
 #define BH_Mapped	4	/* 1 if the buffer has a disk mapping */
 #define BH_New		5	/* 1 if the buffer is new and not yet written out */
 #define BH_Protected	6	/* 1 if the buffer is protected */
+#define BH_Writeback	7	/* 1 if a write of the buffer is in flight */
+#define BH_Journaled	8	/* 1 if in the running transaction of a journal */
+#define BH_JCheckpoint	9	/* 1 if logged, and waiting to be written home */
 
 /*
  * Try to keep the most commonly used fields in single cache lines (16
@@ -246,6 +252,8 @@ void init_buffer(struct buffer_head *, bh_end_io_t *, void *);
 #define buffer_mapped(bh)	__buffer_state(bh,Mapped)
 #define buffer_new(bh)		__buffer_state(bh,New)
 #define buffer_protected(bh)	__buffer_state(bh,Protected)
+#define buffer_journaled(bh)	__buffer_state(bh,Journaled)
+#define buffer_jcheckpoint(bh)	__buffer_state(bh,JCheckpoint)
 
 #define bh_offset(bh)		((unsigned long)(bh)->b_data & ~PAGE_MASK)
 
@@ -334,8 +342,16 @@ struct iattr {
  */
 struct page;
 
+/*
+ * Page cache tags, see radix_tree_tag_set(): pages with dirty
+ * buffers, and pages whose buffers are being written out.
+ */
+#define PAGECACHE_TAG_DIRTY	0
+#define PAGECACHE_TAG_WRITEBACK	1
+
 struct address_space {
-	struct list_head	pages;
+	struct radix_tree_root	page_tree;	/* pages, by index */
+	spinlock_t		page_lock;	/* protects page_tree */
 	unsigned long		nrpages;
 };
 
@@ -441,6 +457,9 @@ struct file {
 
 	/* needed for tty driver, and maybe others */
 	void			*private_data;
+
+	/* epoll interest sets watching this file, see fs/eventpoll.c */
+	struct list_head	f_ep_links;
 };
 extern spinlock_t files_lock;
 #define file_list_lock() spin_lock(&files_lock);
@@ -558,6 +577,10 @@ struct super_block {
 	struct list_head	s_dirty;	/* dirty inodes */
 	struct list_head	s_files;
 
+	struct list_head	s_dentry_lru;	/* unused dentries, newest first */
+	int			s_nr_dentry_unused;
+	struct dcache_sb_stat	s_dcache_stat;
+
 	union {
 		struct minix_sb_info	minix_sb;
 		struct ext2_sb_info	ext2_sb;
@@ -671,6 +694,7 @@ struct super_operations {
 	int (*remount_fs) (struct super_block *, int *, char *);
 	void (*clear_inode) (struct inode *);
 	void (*umount_begin) (struct super_block *);
+	void (*shrink_caches) (struct super_block *, int);
 };
 
 struct dquot_operations {
@@ -826,6 +850,8 @@ extern inline void mark_buffer_dirty(struct buffer_head * bh, int flag)
 }
 
 extern void balance_dirty(kdev_t);
+extern void mark_buffer_writeback(struct buffer_head *);
+extern void end_buffer_writeback(struct buffer_head *);
 extern int check_disk_change(kdev_t);
 extern int invalidate_inodes(struct super_block *);
 extern void invalidate_inode_pages(struct inode *);
@@ -836,6 +862,7 @@ extern void write_inode_now(struct inode *);
 extern void sync_dev(kdev_t);
 extern int fsync_dev(kdev_t);
 extern void sync_supers(kdev_t);
+extern void shrink_super_caches(int);
 extern int bmap(struct inode *, int);
 extern int notify_change(struct dentry *, struct iattr *);
 extern int permission(struct inode *, int);
@@ -0,0 +1,67 @@
+#ifndef _LINUX_HUGETLB_H
+#define _LINUX_HUGETLB_H
+
+/*
+ * Huge pages: shared memory segments (SHM_HUGETLB) and shared anonymous
+ * mappings (MAP_HUGETLB) backed by a boot- or sysctl-sized pool of
+ * HPAGE_SIZE pages, each mapped by a single pmd.
+ *
+ * Huge pages are allocated and mapped when the area is created, and
+ * are never swapped. A huge vma can only be unmapped in HPAGE_SIZE
+ * units, and can't be mprotect()ed or mremap()ed.
+ */
+
+#include <linux/config.h>
+
+#ifdef CONFIG_HUGETLB_PAGE
+
+#include <linux/sysctl.h>
+
+#define is_hugetlb_mmap(flags)	((flags) & MAP_HUGETLB)
+
+static inline int is_vm_hugetlb_page(struct vm_area_struct * vma)
+{
+	return vma->vm_flags & VM_HUGETLB;
+}
+
+static inline int is_aligned_hugepage_range(unsigned long addr, unsigned long len)
+{
+	return !((addr | len) & ~HPAGE_MASK);
+}
+
+extern int htlbpage_max;
+
+extern struct page * alloc_hugetlb_page(void);
+extern void free_hugetlb_page(struct page *);
+extern int hugetlb_prefault(struct vm_area_struct *, struct page **);
+extern struct page * follow_huge_addr(struct mm_struct *, unsigned long);
+extern int copy_hugetlb_page_range(struct mm_struct *, struct mm_struct *,
+	struct vm_area_struct *);
+extern void unmap_hugepage_range(struct vm_area_struct *, unsigned long,
+	unsigned long);
+extern int pmd_huge(pmd_t);
+extern struct page * follow_huge_pmd(struct mm_struct *, unsigned long, pmd_t *);
+extern unsigned long hugetlb_get_unmapped_area(unsigned long, unsigned long);
+extern unsigned long hugetlb_mmap(unsigned long, unsigned long, unsigned long,
+	unsigned long);
+extern int hugetlb_sysctl_handler(ctl_table *, int, struct file *, void *,
+	size_t *);
+extern int hugetlb_report_meminfo(char *);
+
+#else
+
+#define is_hugetlb_mmap(flags)			0
+#define is_vm_hugetlb_page(vma)			0
+#define is_aligned_hugepage_range(addr, len)	0
+#define pmd_huge(pmd)				0
+#define follow_huge_pmd(mm, addr, pmd)		NULL
+#define follow_huge_addr(mm, addr)		NULL
+#define hugetlb_prefault(vma, pages)		({ BUG(); 0; })
+#define hugetlb_mmap(addr, len, prot, flags)	({ BUG(); -EINVAL; })
+#define copy_hugetlb_page_range(dst, src, vma)	({ BUG(); 0; })
+#define unmap_hugepage_range(vma, start, end)	BUG()
+#define hugetlb_report_meminfo(buf)		0
+
+#endif /* CONFIG_HUGETLB_PAGE */
+
+#endif /* _LINUX_HUGETLB_H */
@@ -25,6 +25,12 @@ struct kernel_stat {
 	unsigned int dk_drive_wblk[DK_NDRIVE];
 	unsigned int pgpgin, pgpgout;
 	unsigned int pswpin, pswpout;
+	unsigned int pgscan, pgsteal;
+	unsigned int pgactivate, pgdeactivate;
+	unsigned int pgrefault;
+	unsigned int kswapd_wakeup, allocstall;
+	unsigned int ptescan, pteunmap;		/* swap_out() page table walk */
+	unsigned int rmapscan, rmapunmap;	/* try_to_unmap() */
 	unsigned int irqs[NR_CPUS][NR_IRQS];
 	unsigned int ipackets, opackets;
 	unsigned int ierrors, oerrors;
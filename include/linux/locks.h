@@ -28,6 +28,8 @@ extern inline void lock_buffer(struct buffer_head * bh)
 
 extern inline void unlock_buffer(struct buffer_head *bh)
 {
+	if (test_bit(BH_Writeback, &bh->b_state))
+		end_buffer_writeback(bh);
 	clear_bit(BH_Lock, &bh->b_state);
 	wake_up(&bh->b_wait);
 }
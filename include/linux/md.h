@@ -37,6 +37,8 @@
 #define START_MD     		_IO (MD_MAJOR, 2)
 #define STOP_MD      		_IO (MD_MAJOR, 3)
 #define REGISTER_DEV_NEW	_IO (MD_MAJOR, 4)
+#define GET_STRIPE_CACHE	_IOR (MD_MAJOR, 5, int)	/* raid5: stripes in the cache */
+#define SET_STRIPE_CACHE	_IO (MD_MAJOR, 6)
 
 /*
    personalities :
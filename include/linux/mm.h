@@ -83,6 +83,7 @@ struct vm_area_struct {
 #define VM_EXECUTABLE	0x1000
 #define VM_LOCKED	0x2000
 #define VM_IO           0x4000  /* Memory mapped I/O or similar */
+#define VM_HUGETLB	0x8000	/* backed by huge pages, see hugetlb.h */
 
 #define VM_STACK_FLAGS	0x0177
 
@@ -142,6 +143,7 @@ typedef struct page {
 	struct buffer_head * buffers;
 	unsigned long virtual; /* nonzero if kmapped */
 	struct zone_struct *zone;
+	struct pte_chain *pte_chain;	/* ptes mapping this page */
 } mem_map_t;
 
 #define get_page(p)		atomic_inc(&(p)->count)
@@ -162,6 +164,9 @@ typedef struct page {
 #define PG_skip			10
 #define PG_swap_entry		11
 #define PG_highmem		12
+#define PG_active		13
+#define PG_lru			14
+#define PG_chainlock		15
 				/* bits 21-30 unused */
 #define PG_reserved		31
 
@@ -186,6 +191,12 @@ typedef struct page {
 #define PageSlab(page)		test_bit(PG_slab, &(page)->flags)
 #define PageSwapCache(page)	test_bit(PG_swap_cache, &(page)->flags)
 #define PageReserved(page)	test_bit(PG_reserved, &(page)->flags)
+#define PageActive(page)	test_bit(PG_active, &(page)->flags)
+#define SetPageActive(page)	set_bit(PG_active, &(page)->flags)
+#define ClearPageActive(page)	clear_bit(PG_active, &(page)->flags)
+#define PageLRU(page)		test_bit(PG_lru, &(page)->flags)
+#define SetPageLRU(page)	set_bit(PG_lru, &(page)->flags)
+#define ClearPageLRU(page)	clear_bit(PG_lru, &(page)->flags)
 
 #define PageSetSlab(page)	set_bit(PG_slab, &(page)->flags)
 #define PageSetSwapCache(page)	set_bit(PG_swap_cache, &(page)->flags)
@@ -253,12 +264,11 @@ typedef struct page {
  * For pages belonging to inodes, the page->count is the number of
  * attaches, plus 1 if buffers are allocated to the page.
  *
- * All pages belonging to an inode make up a doubly linked list
- * inode->i_pages, using the fields page->next and page->prev. (These
- * fields are also used for freelist management when page->count==0.)
- * There is also a hash table mapping (inode,offset) to the page
- * in memory if present. The lists for this hash table use the fields
- * page->next_hash and page->pprev_hash.
+ * All pages belonging to an inode are indexed by page->index in the
+ * radix tree inode->i_data.page_tree, protected by i_data.page_lock.
+ * Tags in the tree mark the pages with dirty buffers and the pages
+ * under writeback. (page->list is used for freelist management when
+ * page->count==0.)
  *
  * All process pages can do I/O:
  * - inode pages may need to be read from disk,
@@ -274,8 +284,16 @@ typedef struct page {
  * error happened.
  *
  * For choosing which pages to swap out, inode pages carry a
- * PG_referenced bit, which is set any time the system accesses
- * that page through the (inode,offset) hash table.
+ * PG_referenced bit, which is set any time the system looks
+ * that page up in the page cache.
+ *
+ * PG_lru is set while the page sits on one of the LRU lists, and
+ * PG_active tells which one: a page starts out inactive and is
+ * moved to the active list when it is referenced a second time.
+ * Both bits are protected by pagemap_lru_lock.
+ *
+ * page->pte_chain lists the user ptes that map the page (see
+ * mm/rmap.c); PG_chainlock is the spinlock bit protecting it.
  *
  * PG_skip is used on sparc/sparc64 architectures to "skip" certain
  * parts of the address space.
@@ -293,6 +311,9 @@ extern mem_map_t * mem_map;
 /* the AP+ needs to allocate 8MB contiguous, aligned chunks of ram
    for the ring buffers */
 #define MAX_ORDER 12
+#elif defined(CONFIG_HUGETLB_PAGE) && HUGETLB_PAGE_ORDER >= 10
+/* the huge page pool is filled from the buddy allocator */
+#define MAX_ORDER (HUGETLB_PAGE_ORDER + 1)
 #else
 #define MAX_ORDER 10
 #endif
@@ -302,6 +323,34 @@ typedef struct free_area_struct {
 	unsigned int * map;
 } free_area_t;
 
+/*
+ * Per-CPU lists of free order-0 pages in front of the buddy lists.
+ * "Hot" pages were freed recently and are likely to still be in the
+ * CPU cache, "cold" pages come straight from the buddy lists and are
+ * handed out for I/O (__GFP_COLD). Pages move to and from the buddy
+ * lists 'batch' at a time. Only the owning CPU touches them, with
+ * interrupts disabled.
+ */
+typedef struct per_cpu_pages {
+	int count;		/* pages on the list */
+	int high;		/* drain a batch when we get here */
+	int batch;
+	struct list_head list;
+	unsigned long hits;	/* pages handed out from the list */
+	unsigned long refills;	/* batches taken from the buddy lists */
+	unsigned long drains;	/* batches given back */
+} per_cpu_pages_t;
+
+#define PCP_HOT		0
+#define PCP_COLD	1
+
+typedef union per_cpu_pageset {
+	per_cpu_pages_t pcp[2];
+	char __pad[L1_CACHE_ALIGN(2*sizeof(per_cpu_pages_t))];
+} __attribute__((__aligned__(SMP_CACHE_BYTES))) per_cpu_pageset_t;
+
+struct pglist_data;
+
 typedef struct zone_struct {
 	/*
 	 * Commonly accessed fields:
@@ -317,42 +366,65 @@ typedef struct zone_struct {
 	 */
 	free_area_t free_area[MAX_ORDER];
 
+	per_cpu_pageset_t pageset[NR_CPUS];
+
 	/*
 	 * rarely used fields:
 	 */
 	char * name;
 	unsigned long size;
+	struct pglist_data * zone_pgdat;	/* node this zone is on */
 } zone_t;
 
 #define ZONE_DMA		0
 #define ZONE_NORMAL		1
 #define ZONE_HIGHMEM		2
 
+#define MAX_NR_ZONES		3
+
 /*
- * NUMA architectures will have more:
+ * Memory is split into nodes, each with its own set of zones.
+ * mem_map is still one array; a node owns the contiguous range
+ * [node_start_mapnr, node_start_mapnr + node_size) of it.
  */
-#define MAX_NR_ZONES		3
+#define MAX_NR_NODES		8
 
 /*
  * One allocation request operates on a zonelist. A zonelist
  * is a list of zones, the first one is the 'goal' of the
  * allocation, the other zones are fallback zones, in decreasing
- * priority. On NUMA we want to fall back on other CPU's zones
- * as well.
+ * priority: first the zones of the allocating CPU's node, then
+ * those of the other nodes, nearest first.
  *
- * Right now a zonelist takes up less than a cacheline. We never
- * modify it apart from boot-up, and only a few indices are used,
- * so despite the zonelist table being relatively big, the cache
- * footprint of this construct is very small.
+ * We never modify a zonelist apart from boot-up, and only a few
+ * indices are used, so despite the zonelist tables being
+ * relatively big, the cache footprint of this construct is small.
  */
 typedef struct zonelist_struct {
-	zone_t * zones [MAX_NR_ZONES+1]; // NULL delimited
+	zone_t * zones [MAX_NR_ZONES*MAX_NR_NODES+1]; // NULL delimited
 	int gfp_mask;
 } zonelist_t;
 
 #define NR_GFPINDEX		0x100
+#define GFP_ZONEMASK		(NR_GFPINDEX-1)
+
+/* Not part of the zonelist index: */
+#define __GFP_COLD		0x100	/* page will be filled by I/O, don't waste a hot one */
+
+typedef struct pglist_data {
+	zone_t node_zones[MAX_NR_ZONES];
+	zonelist_t *node_zonelists;	/* [NR_GFPINDEX], from bootmem */
+	int node_id;
+	unsigned long node_start_mapnr;
+	unsigned long node_size;
+} pg_data_t;
 
-extern zonelist_t zonelists [NR_GFPINDEX];
+extern int numnodes;
+extern pg_data_t node_data[MAX_NR_NODES];
+extern unsigned char cpu_to_node_map[NR_CPUS];
+
+#define NODE_DATA(nid)		(node_data + (nid))
+#define numa_node_id()		(cpu_to_node_map[smp_processor_id()])
 
 /*
  * There is only one page-allocator function, and two main namespaces to
@@ -360,19 +432,31 @@ extern zonelist_t zonelists [NR_GFPINDEX];
  * can allocate highmem pages, the *get*page*() variants return
  * virtual kernel addresses to the allocated page(s).
  */
-extern struct page * FASTCALL(__alloc_pages(zonelist_t *zonelist, unsigned long order));
+extern struct page * FASTCALL(__alloc_pages(zonelist_t *zonelist, unsigned long order, int cold));
 
-extern inline struct page * alloc_pages(int gfp_mask, unsigned long order)
+extern inline struct page * alloc_pages_node(int nid, int gfp_mask, unsigned long order)
 {
+	zonelist_t *zonelist;
+
+	zonelist = NODE_DATA(nid)->node_zonelists + (gfp_mask & GFP_ZONEMASK);
 	/*  temporary check. */
-	if (zonelists[gfp_mask].gfp_mask != (gfp_mask))
+	if (zonelist->gfp_mask != (gfp_mask & GFP_ZONEMASK))
 		BUG();
 	/*
 	 * Gets optimized away by the compiler.
 	 */
 	if (order >= MAX_ORDER)
 		return NULL;
-	return __alloc_pages(zonelists+(gfp_mask), order);
+	return __alloc_pages(zonelist, order, gfp_mask & __GFP_COLD);
+}
+
+/*
+ * Allocate on the node of the current CPU, falling back to the
+ * nearest other nodes:
+ */
+extern inline struct page * alloc_pages(int gfp_mask, unsigned long order)
+{
+	return alloc_pages_node(numa_node_id(), gfp_mask, order);
 }
 
 #define alloc_page(gfp_mask) \
@@ -456,6 +540,7 @@ extern int check_pgt_cache(void);
 
 extern void paging_init(void);
 extern void free_area_init(unsigned int * zones_size);
+extern void numa_setup(char *str);
 extern void mem_init(void);
 extern void show_mem(void);
 extern void oom(struct task_struct * tsk);
@@ -21,12 +21,26 @@ typedef struct poll_table_struct {
 	struct poll_table_struct * next;
 	unsigned int nr;
 	struct poll_table_entry * entry;
+	/* if set, called by poll_wait() instead of queueing an entry */
+	void (*qproc)(struct file *, wait_queue_head_t *, struct poll_table_struct *);
 } poll_table;
 
 #define __MAX_POLL_TABLE_ENTRIES ((PAGE_SIZE - sizeof (poll_table)) / sizeof (struct poll_table_entry))
 
 extern void __pollwait(struct file * filp, wait_queue_head_t * wait_address, poll_table *p);
 
+/*
+ * Every poll_table has to be set up with this before it is handed to
+ * ->poll(), so that __pollwait() doesn't find a stale qproc.
+ */
+extern inline void poll_initwait(poll_table *pt, struct poll_table_entry *entry)
+{
+	pt->next = NULL;
+	pt->nr = 0;
+	pt->entry = entry;
+	pt->qproc = NULL;
+}
+
 extern inline void poll_wait(struct file * filp, wait_queue_head_t * wait_address, poll_table *p)
 {
 	if (p && wait_address)
@@ -0,0 +1,46 @@
+#ifndef _LINUX_RADIX_TREE_H
+#define _LINUX_RADIX_TREE_H
+
+/*
+ * A radix tree maps unsigned long indices to pointers. Each slot
+ * can carry a few tag bits which are propagated up the tree, so
+ * that lookups can find all tagged items without visiting the
+ * untagged ones.
+ *
+ * The tree does no locking of its own: callers serialize all
+ * modifications and lookups on a given tree.
+ */
+
+#define RADIX_TREE_MAX_TAGS	2
+
+struct radix_tree_node;
+
+struct radix_tree_root {
+	unsigned int		height;
+	int			gfp_mask;
+	struct radix_tree_node	*rnode;
+};
+
+#define RADIX_TREE_INIT(mask)	{ 0, (mask), NULL }
+
+#define INIT_RADIX_TREE(root, mask)	\
+do {					\
+	(root)->height = 0;		\
+	(root)->gfp_mask = (mask);	\
+	(root)->rnode = NULL;		\
+} while (0)
+
+extern void radix_tree_init(void);
+extern int radix_tree_preload(int gfp_mask);
+extern int radix_tree_insert(struct radix_tree_root *, unsigned long, void *);
+extern void *radix_tree_lookup(struct radix_tree_root *, unsigned long);
+extern void *radix_tree_delete(struct radix_tree_root *, unsigned long);
+extern void *radix_tree_tag_set(struct radix_tree_root *, unsigned long, int);
+extern void *radix_tree_tag_clear(struct radix_tree_root *, unsigned long, int);
+extern unsigned int radix_tree_gang_lookup(struct radix_tree_root *,
+		void **results, unsigned long first_index, unsigned int max_items);
+extern unsigned int radix_tree_gang_lookup_tag(struct radix_tree_root *,
+		void **results, unsigned long first_index, unsigned int max_items,
+		int tag);
+
+#endif /* _LINUX_RADIX_TREE_H */
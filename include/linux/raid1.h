@@ -9,6 +9,8 @@ struct mirror_info {
 	kdev_t		dev;
 	int		next;
 	int		sect_limit;
+	unsigned long	head_position;	/* sector after the last I/O */
+	unsigned long	reads;		/* reads balanced onto this mirror */
 
 	/*
 	 * State bits:
@@ -35,6 +35,7 @@ struct stripe_head {
 	int			count;			/* nr of waiters */
 	int			write_method;		/* reconstruct-write / read-modify-write */
 	int			phase;			/* PHASE_BEGIN, ..., PHASE_COMPLETE */
+	unsigned long		begin;			/* jiffies when it entered PHASE_BEGIN */
 	wait_queue_head_t	wait;			/* processes waiting for this stripe */
 };
 
@@ -89,6 +90,28 @@ struct raid5_data {
 	int			nr_pending_stripes;
 	int			nr_cached_stripes;
 
+	/*
+	 * Partial write stripes held back for the rest of their data
+	 */
+	struct timer_list	delay_timer;
+
+	/*
+	 * SET_STRIPE_CACHE, carried out by raid5d: the new size, and the
+	 * stripes allocated for it
+	 */
+	struct semaphore	resize_sem;
+	int			resize_nr;
+	struct stripe_head	*resize_list;
+	wait_queue_head_t	wait_for_resize;
+
+	/*
+	 * How write stripes went out: all data blocks new, reconstruct
+	 * write (rest of the data read or cached), read-modify-write
+	 */
+	unsigned long		full_stripe_writes;
+	unsigned long		rcw_writes;
+	unsigned long		rmw_writes;
+
 	/*
 	 * Free stripes pool
 	 */
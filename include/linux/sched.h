@@ -64,7 +64,7 @@ extern unsigned long avenrun[];		/* Load averages */
 #define CT_TO_SECS(x)	((x) / HZ)
 #define CT_TO_USECS(x)	(((x) % HZ) * 1000000/HZ)
 
-extern int nr_running, nr_threads;
+extern int nr_threads;
 extern int last_pid;
 
 #include <linux/fs.h>
@@ -116,6 +116,14 @@ extern int last_pid;
  */
 #define SCHED_YIELD		0x10
 
+/*
+ * Run-queue priority levels, lower runs first: SCHED_FIFO and
+ * SCHED_RR processes use 0..MAX_RT_PRIO-1 (by rt_priority),
+ * SCHED_OTHER ones the 40 levels above that (by ->priority).
+ */
+#define MAX_RT_PRIO		100
+#define MAX_PRIO		(MAX_RT_PRIO + 40)
+
 struct sched_param {
 	int sched_priority;
 };
@@ -129,13 +137,12 @@ struct sched_param {
 #include <linux/spinlock.h>
 
 /*
- * This serializes "schedule()" and also protects
- * the run-queue from deletions/modifications (but
- * _adding_ to the beginning of the run-queue has
- * a separate lock).
+ * This protects the task list. The run-queues are per-CPU
+ * and have their own locks, private to kernel/sched.c.
  */
 extern rwlock_t tasklist_lock;
-extern spinlock_t runqueue_lock;
+
+extern unsigned long nr_running(void);
 
 extern void sched_init(void);
 extern void init_idle(void);
@@ -285,6 +292,9 @@ struct task_struct {
 	int lock_depth;		/* Lock depth. We can context switch in and out of holding a syscall kernel lock... */	
 	struct task_struct *next_task, *prev_task;
 	struct list_head run_list;
+	struct prio_array *array;	/* priority array we are queued in */
+	int prio;			/* index into it */
+	unsigned long sleep_epoch;	/* array switches seen before sleeping */
 
 /* task state */
 	struct linux_binfmt *binfmt;
@@ -363,6 +373,8 @@ struct task_struct {
    	u32 self_exec_id;
 /* Protection of fields allocatio/deallocation */
 	struct semaphore exit_sem;
+/* filesystem journal handles held, innermost first */
+	void *journal_info;
 };
 
 /*
@@ -401,6 +413,7 @@ struct task_struct {
 /* counter */	DEF_PRIORITY,DEF_PRIORITY,0, \
 /* SMP */	0,0,0,-1, \
 /* schedlink */	&init_task,&init_task, LIST_HEAD_INIT(init_task.run_list), \
+/* prio */	NULL,MAX_PRIO,0, \
 /* binfmt */	NULL, \
 /* ec,brk... */	0,0,0,0,0,0, \
 /* pid etc.. */	0,0,0,0,0, \
@@ -506,6 +519,7 @@ extern void FASTCALL(interruptible_sleep_on(wait_queue_head_t *q));
 extern long FASTCALL(interruptible_sleep_on_timeout(wait_queue_head_t *q,
 						    signed long timeout));
 extern void FASTCALL(wake_up_process(struct task_struct * tsk));
+extern void wake_up_forked_process(struct task_struct * tsk);
 
 #define wake_up(x)			__wake_up((x),TASK_UNINTERRUPTIBLE | TASK_INTERRUPTIBLE)
 #define wake_up_sync(x)			__wake_up_sync((x),TASK_UNINTERRUPTIBLE | TASK_INTERRUPTIBLE)
@@ -712,6 +726,11 @@ extern void exit_sighand(struct task_struct *);
 
 extern void daemonize(void);
 
+#ifdef __SMP__
+extern void quiescent_snapshot(unsigned long *);
+extern int quiescent_passed(unsigned long *);
+#endif
+
 extern int do_execve(char *, char **, char **, struct pt_regs *);
 extern int do_fork(unsigned long, unsigned long, struct pt_regs *);
 
@@ -821,12 +840,7 @@ do {									\
 	for (p = &init_task ; (p = p->next_task) != &init_task ; )
 
 
-static inline void del_from_runqueue(struct task_struct * p)
-{
-	nr_running--;
-	list_del(&p->run_list);
-	p->run_list.next = NULL;
-}
+extern void del_from_runqueue(struct task_struct * p);
 
 extern inline int task_on_runqueue(struct task_struct *p)
 {
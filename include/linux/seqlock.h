@@ -0,0 +1,56 @@
+#ifndef __LINUX_SEQLOCK_H
+#define __LINUX_SEQLOCK_H
+
+/*
+ * Sequence counters: let readers run without a lock, and find out
+ * afterwards whether a writer got in the way, in which case they just
+ * try again.
+ *
+ * The writers have to be serialized by some other means (a lock, or
+ * the big kernel lock). The count is odd while a write is going on.
+ *
+ *	do {
+ *		seq = read_seqcount_begin(&foo->seq);
+ *		... read foo ...
+ *	} while (read_seqcount_retry(&foo->seq, seq));
+ */
+
+#include <linux/kernel.h>
+#include <asm/system.h>
+
+typedef struct {
+	volatile unsigned int sequence;
+} seqcount_t;
+
+#define SEQCNT_ZERO		{ 0 }
+#define seqcount_init(s)	do { (s)->sequence = 0; } while (0)
+
+static inline unsigned int read_seqcount_begin(const seqcount_t * s)
+{
+	unsigned int ret;
+
+	while ((ret = s->sequence) & 1)
+		barrier();
+	rmb();
+	return ret;
+}
+
+static inline int read_seqcount_retry(const seqcount_t * s, unsigned int start)
+{
+	rmb();
+	return s->sequence != start;
+}
+
+static inline void write_seqcount_begin(seqcount_t * s)
+{
+	s->sequence++;
+	wmb();
+}
+
+static inline void write_seqcount_end(seqcount_t * s)
+{
+	wmb();
+	s->sequence++;
+}
+
+#endif /* __LINUX_SEQLOCK_H */
@@ -39,6 +39,9 @@ struct shmid_ds {
 #define	SHM_RND		020000	/* round attach address to SHMLBA boundary */
 #define	SHM_REMAP	040000	/* take-over region on attach */
 
+/* shmget () flags, also kept in shm_mode */
+#define	SHM_HUGETLB	04000	/* back the segment with huge pages */
+
 /* super user shmctl commands */
 #define SHM_LOCK 	11
 #define SHM_UNLOCK 	12
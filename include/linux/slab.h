@@ -62,6 +62,12 @@ extern void kfree_s(const void *, size_t);
 
 extern void kmem_cache_reap(int);
 extern int get_slabinfo(char *);
+#ifdef __SMP__
+extern void kmem_cpucache_init(void);
+extern int slabinfo_write_proc(struct file *, const char *, unsigned long, void *);
+#else
+#define kmem_cpucache_init()	do { } while (0)
+#endif
 
 /* System wide caches */
 extern kmem_cache_t	*vm_area_cachep;
@@ -65,7 +65,6 @@ FASTCALL(unsigned int nr_free_pages(void));
 FASTCALL(unsigned int nr_free_buffer_pages(void));
 FASTCALL(unsigned int nr_free_highpages(void));
 extern int nr_lru_pages;
-extern struct list_head lru_cache;
 extern atomic_t nr_async_pages;
 extern struct address_space swapper_space;
 extern atomic_t page_cache_size;
@@ -74,6 +73,7 @@ extern atomic_t buffermem_pages;
 /* Incomplete types for prototype declarations: */
 struct task_struct;
 struct vm_area_struct;
+struct mm_struct;
 struct sysinfo;
 
 /* linux/ipc/shm.c */
@@ -81,6 +81,18 @@ extern int shm_swap (int, int);
 
 /* linux/mm/swap.c */
 extern void swap_setup (void);
+extern void lru_cache_add(struct page *);
+extern void lru_cache_del(struct page *);
+extern void mark_page_accessed(struct page *);
+
+/* linux/mm/rmap.c */
+#define SWAP_SUCCESS	0
+#define SWAP_AGAIN	1
+#define SWAP_FAIL	2
+extern void page_add_rmap(struct page *, struct mm_struct *, unsigned long);
+extern void page_remove_rmap(struct page *, struct mm_struct *, unsigned long);
+extern int try_to_unmap(struct page *);
+extern void pte_chain_init(void);
 
 /* linux/mm/vmscan.c */
 extern int try_to_free_pages(unsigned int gfp_mask);
@@ -155,23 +167,22 @@ static inline int is_page_shared(struct page *page)
 extern spinlock_t pagemap_lru_lock;
 
 /*
- * Helper macros for lru_pages handling.
+ * The page LRU is split by page type, so that file pages and
+ * anonymous (swap cache) pages are aged separately, and each type
+ * has an active and an inactive list. New pages go on the inactive
+ * list and are promoted only when referenced again; reclaim works
+ * from the tail of the inactive lists.
  */
-#define	lru_cache_add(page)			\
-do {						\
-	spin_lock(&pagemap_lru_lock);		\
-	list_add(&(page)->lru, &lru_cache);	\
-	nr_lru_pages++;				\
-	spin_unlock(&pagemap_lru_lock);		\
-} while (0)
-
-#define	lru_cache_del(page)			\
-do {						\
-	spin_lock(&pagemap_lru_lock);		\
-	list_del(&(page)->lru);			\
-	nr_lru_pages--;				\
-	spin_unlock(&pagemap_lru_lock);		\
-} while (0)
+#define LRU_FILE	0
+#define LRU_ANON	1
+#define NR_LRU_TYPES	2
+
+#define page_lru_type(page)	(PageSwapCache(page) ? LRU_ANON : LRU_FILE)
+
+extern struct list_head active_list[NR_LRU_TYPES];
+extern struct list_head inactive_list[NR_LRU_TYPES];
+extern int nr_active_pages[NR_LRU_TYPES];
+extern int nr_inactive_pages[NR_LRU_TYPES];
 
 #endif /* __KERNEL__*/
 
@@ -51,6 +51,7 @@ struct timer_list {
 	unsigned long expires;
 	unsigned long data;
 	void (*function)(unsigned long);
+	struct tvec_base *base;	/* wheel the timer is pending on */
 };
 
 extern void add_timer(struct timer_list * timer);
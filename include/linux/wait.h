@@ -41,16 +41,25 @@ extern int printk(const char *fmt, ...);
 } while (0)
 #endif
 
+typedef struct __wait_queue wait_queue_t;
+
+/*
+ * A wait queue entry either wakes up its task, or, if it has a 'func',
+ * calls that instead. The function runs from wake_up() with the wait
+ * queue lock held and interrupts disabled, so it mustn't sleep.
+ */
+typedef void (*wait_queue_func_t)(wait_queue_t *wait, unsigned int mode);
+
 struct __wait_queue {
 	unsigned int compiler_warning;
 	struct task_struct * task;
+	wait_queue_func_t func;
 	struct list_head task_list;
 #if WAITQUEUE_DEBUG
 	long __magic;
 	long __waker;
 #endif
 };
-typedef struct __wait_queue wait_queue_t;
 
 /*
  * 'dual' spinlock architecture. Can be switched between spinlock_t and
@@ -107,7 +116,7 @@ typedef struct __wait_queue_head wait_queue_head_t;
 #endif
 
 #define __WAITQUEUE_INITIALIZER(name,task) \
-	{ 0x1234567, task, { NULL, NULL } __WAITQUEUE_DEBUG_INIT(name)}
+	{ 0x1234567, task, NULL, { NULL, NULL } __WAITQUEUE_DEBUG_INIT(name)}
 #define DECLARE_WAITQUEUE(name,task) \
 	wait_queue_t name = __WAITQUEUE_INITIALIZER(name,task)
 
@@ -140,6 +149,17 @@ static inline void init_waitqueue_entry(wait_queue_t *q,
 		WQ_BUG();
 #endif
 	q->task = p;
+	q->func = NULL;
+#if WAITQUEUE_DEBUG
+	q->__magic = (long)&q->__magic;
+#endif
+}
+
+static inline void init_waitqueue_func_entry(wait_queue_t *q,
+				 wait_queue_func_t func)
+{
+	q->task = NULL;
+	q->func = func;
 #if WAITQUEUE_DEBUG
 	q->__magic = (long)&q->__magic;
 #endif
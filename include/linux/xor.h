@@ -0,0 +1,31 @@
+#ifndef _XOR_H
+#define _XOR_H
+
+/*
+ * Multi-source XOR for RAID4/5 parity: p1 ^= p2 ^ ... ^ pN, in one
+ * pass over the destination.
+ */
+
+#include <linux/fs.h>
+
+#define MAX_XOR_BLOCKS 5	/* the destination plus four sources */
+
+extern void xor_block(unsigned int count, struct buffer_head **bh_ptr);
+
+struct xor_block_template {
+	struct xor_block_template *next;
+	const char *name;
+	int speed;			/* KB/sec, from calibrate_xor_block() */
+	void (*do_2)(unsigned long, unsigned long *, unsigned long *);
+	void (*do_3)(unsigned long, unsigned long *, unsigned long *,
+		     unsigned long *);
+	void (*do_4)(unsigned long, unsigned long *, unsigned long *,
+		     unsigned long *, unsigned long *);
+	void (*do_5)(unsigned long, unsigned long *, unsigned long *,
+		     unsigned long *, unsigned long *, unsigned long *);
+};
+
+extern struct xor_block_template *xor_active_template;
+extern void calibrate_xor_block(void);
+
+#endif /* _XOR_H */
@@ -25,6 +25,7 @@
 #include <linux/hdreg.h>
 #include <linux/iobuf.h>
 #include <linux/bootmem.h>
+#include <linux/swap.h>
 
 #include <asm/io.h>
 #include <asm/bugs.h>
@@ -501,10 +502,11 @@ asmlinkage void __init start_kernel(void)
 
 	fork_init(mempages);
 	filescache_init();
-	dcache_init();
+	dcache_init(mempages);
 	vma_init();
 	buffer_init(mempages);
-	page_cache_init(mempages);
+	radix_tree_init();
+	pte_chain_init();
 	kiobuf_init();
 	signals_init();
 	inode_init();
@@ -524,6 +526,7 @@ asmlinkage void __init start_kernel(void)
 	 *	make syscalls (and thus be locked).
 	 */
 	smp_init();
+	kmem_cpucache_init();
 	kernel_thread(init, NULL, CLONE_FS | CLONE_FILES | CLONE_SIGHAND);
 	unlock_kernel();
 	current->need_resched = 1;
@@ -23,6 +23,7 @@
 #include <linux/pagemap.h>
 #include <linux/proc_fs.h>
 #include <linux/highmem.h>
+#include <linux/hugetlb.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgtable.h>
@@ -34,6 +35,7 @@ struct shmid_kernel /* extend struct shmis_ds with private fields */
 	struct shmid_ds		u;
 	unsigned long		shm_npages; /* size of segment (pages) */
 	pte_t			**shm_dir;  /* ptr to array of ptrs to frames -> SHMMAX */ 
+	struct page		**shm_hpages; /* huge pages, for SHM_HUGETLB */
 	struct vm_area_struct	*attaches;  /* descriptors for attaches */
 	int                     id; /* backreference to id for shm_close */
 	struct semaphore sem;
@@ -63,7 +65,7 @@ static unsigned int num_segs = 0;
 static unsigned short shm_seq = 0; /* incremented, for recognizing stale ids */
 
 /* locks order:
-	shm_lock -> pagecache_lock (end of shm_swap)
+	shm_lock -> swapper_space.page_lock (end of shm_swap)
 	shp->sem -> other spinlocks (shm_nopage) */
 spinlock_t shm_lock = SPIN_LOCK_UNLOCKED;
 
@@ -135,6 +137,47 @@ static void shm_free(pte_t** dir, unsigned long pages)
 	kfree (dir);
 }
 
+#ifdef CONFIG_HUGETLB_PAGE
+/*
+ * SHM_HUGETLB segments get all of their huge pages at creation, are
+ * mapped in full on attach, and are never swapped.
+ */
+static struct page **shm_alloc_huge(unsigned long pages)
+{
+	unsigned long i, nr = pages >> (HPAGE_SHIFT - PAGE_SHIFT);
+	struct page **dir;
+
+	dir = kmalloc(nr * sizeof(struct page *), GFP_KERNEL);
+	if (!dir)
+		return NULL;
+	for (i = 0; i < nr; i++) {
+		dir[i] = alloc_hugetlb_page();
+		if (!dir[i]) {
+			while (i--)
+				free_hugetlb_page(dir[i]);
+			kfree(dir);
+			return NULL;
+		}
+	}
+	return dir;
+}
+
+static void shm_free_huge(struct page **dir, unsigned long pages)
+{
+	unsigned long i, nr = pages >> (HPAGE_SHIFT - PAGE_SHIFT);
+
+	for (i = 0; i < nr; i++)
+		free_hugetlb_page(dir[i]);
+	kfree(dir);
+}
+
+#define shm_lba(shp)	((shp)->shm_hpages ? HPAGE_SIZE : SHMLBA)
+#else
+#define shm_alloc_huge(pages)		NULL
+#define shm_free_huge(dir, pages)	BUG()
+#define shm_lba(shp)			SHMLBA
+#endif
+
 static int shm_expand (unsigned int size)
 {
 	int id;
@@ -225,6 +268,13 @@ static int newseg (key_t key, int shmflg, size_t size)
 		return err;
 	if (size < SHMMIN)
 		return -EINVAL;
+	if (shmflg & SHM_HUGETLB) {
+#ifdef CONFIG_HUGETLB_PAGE
+		numpages = ((size + ~HPAGE_MASK) & HPAGE_MASK) >> PAGE_SHIFT;
+#else
+		return -EINVAL;
+#endif
+	}
 	if (shm_tot + numpages >= shmall)
 		return -ENOSPC;
 	for (id = 0; id < num_segs; id++)
@@ -243,8 +293,14 @@ found:
 		wake_up (&shm_wait);
 		return -ENOMEM;
 	}
-	shp->shm_dir = shm_alloc (numpages);
-	if (!shp->shm_dir) {
+	if (shmflg & SHM_HUGETLB) {
+		shp->shm_dir = NULL;
+		shp->shm_hpages = shm_alloc_huge (numpages);
+	} else {
+		shp->shm_dir = shm_alloc (numpages);
+		shp->shm_hpages = NULL;
+	}
+	if (!shp->shm_dir && !shp->shm_hpages) {
 		kfree(shp);
 		spin_lock(&shm_lock);
 		shm_segs[id] = (struct shmid_kernel *) IPC_UNUSED;
@@ -253,7 +309,7 @@ found:
 	}
 
 	shp->u.shm_perm.key = key;
-	shp->u.shm_perm.mode = (shmflg & S_IRWXUGO);
+	shp->u.shm_perm.mode = (shmflg & (S_IRWXUGO | SHM_HUGETLB));
 	shp->u.shm_perm.cuid = shp->u.shm_perm.uid = current->euid;
 	shp->u.shm_perm.cgid = shp->u.shm_perm.gid = current->egid;
 	shp->u.shm_segsz = size;
@@ -335,10 +391,17 @@ static void killseg (int id)
 	used_segs--;
 	if (id == max_shmid)
 		while (max_shmid-- > 0 && (shm_segs[max_shmid] == IPC_UNUSED));
-	if (!shp->shm_dir)
+	if (!shp->shm_dir && !shp->shm_hpages)
 		BUG();
 	spin_unlock(&shm_lock);
 	numpages = shp->shm_npages;
+	if (shp->shm_hpages) {
+		shm_free_huge (shp->shm_hpages, numpages);
+		kfree(shp);
+		spin_lock(&shm_lock);
+		shm_tot -= numpages;
+		return;
+	}
 	for (i = 0, rss = 0, swp = 0; i < numpages ; i++) {
 		pte_t pte;
 		pte = SHM_ENTRY (shp,i);
@@ -590,6 +653,7 @@ asmlinkage long sys_shmat (int shmid, char *shmaddr, int shmflg, ulong *raddr)
 	unsigned int id;
 	unsigned long addr;
 	unsigned long len;
+	unsigned long lba;
 
 	down(&current->mm->mmap_sem);
 	spin_lock(&shm_lock);
@@ -600,28 +664,30 @@ asmlinkage long sys_shmat (int shmid, char *shmaddr, int shmflg, ulong *raddr)
 	if (shp == IPC_UNUSED || shp == IPC_NOID)
 		goto out;
 
+	/* huge page segments are attached at huge page boundaries */
+	lba = shm_lba(shp);
+	len = PAGE_SIZE*shp->shm_npages;
 	if (!(addr = (ulong) shmaddr)) {
 		if (shmflg & SHM_REMAP)
 			goto out;
 		err = -ENOMEM;
 		addr = 0;
 	again:
-		if (!(addr = get_unmapped_area(addr, (unsigned long)shp->u.shm_segsz)))
+		if (!(addr = get_unmapped_area(addr, len)))
 			goto out;
-		if(addr & (SHMLBA - 1)) {
-			addr = (addr + (SHMLBA - 1)) & ~(SHMLBA - 1);
+		if(addr & (lba - 1)) {
+			addr = (addr + (lba - 1)) & ~(lba - 1);
 			goto again;
 		}
-	} else if (addr & (SHMLBA-1)) {
+	} else if (addr & (lba-1)) {
 		if (shmflg & SHM_RND)
-			addr &= ~(SHMLBA-1);       /* round down */
+			addr &= ~(lba-1);       /* round down */
 		else
 			goto out;
 	}
 	/*
 	 * Check if addr exceeds TASK_SIZE (from do_mmap)
 	 */
-	len = PAGE_SIZE*shp->shm_npages;
 	err = -EINVAL;
 	if (addr >= TASK_SIZE || len > TASK_SIZE  || addr > TASK_SIZE - len)
 		goto out;
@@ -632,7 +698,7 @@ asmlinkage long sys_shmat (int shmid, char *shmaddr, int shmflg, ulong *raddr)
 	if (addr < current->mm->start_stack &&
 	    addr > current->mm->start_stack - PAGE_SIZE*(shp->shm_npages + 4))
 		goto out;
-	if (!(shmflg & SHM_REMAP) && find_vma_intersection(current->mm, addr, addr + (unsigned long)shp->u.shm_segsz))
+	if (!(shmflg & SHM_REMAP) && find_vma_intersection(current->mm, addr, addr + len))
 		goto out;
 
 	err = -EACCES;
@@ -661,7 +727,8 @@ asmlinkage long sys_shmat (int shmid, char *shmaddr, int shmflg, ulong *raddr)
 	shmd->vm_page_prot = (shmflg & SHM_RDONLY) ? PAGE_READONLY : PAGE_SHARED;
 	shmd->vm_flags = VM_SHM | VM_MAYSHARE | VM_SHARED
 			 | VM_MAYREAD | VM_MAYEXEC | VM_READ | VM_EXEC
-			 | ((shmflg & SHM_RDONLY) ? 0 : VM_MAYWRITE | VM_WRITE);
+			 | ((shmflg & SHM_RDONLY) ? 0 : VM_MAYWRITE | VM_WRITE)
+			 | (shp->shm_hpages ? VM_HUGETLB : 0);
 	shmd->vm_file = NULL;
 	shmd->vm_pgoff = 0;
 	shmd->vm_ops = &shm_vm_ops;
@@ -678,6 +745,20 @@ asmlinkage long sys_shmat (int shmid, char *shmaddr, int shmflg, ulong *raddr)
 	shp->u.shm_lpid = current->pid;
 	shp->u.shm_atime = CURRENT_TIME;
 
+	/*
+	 * Huge pages are mapped right away: they are never faulted in.
+	 * Once attached, the segment goes away through do_munmap().
+	 */
+	if (is_vm_hugetlb_page(shmd)) {
+		spin_unlock(&shm_lock);
+		err = hugetlb_prefault(shmd, shp->shm_hpages);
+		if (err)
+			do_munmap(addr, len);
+		spin_lock(&shm_lock);
+		if (err)
+			goto out;
+	}
+
 	*raddr = addr;
 	err = 0;
 out:
@@ -847,6 +928,9 @@ int shm_swap (int prio, int gfp_mask)
 	counter = shm_rss >> prio;
 	if (!counter)
 		return 0;
+	/* room in the swap cache index, for add_to_swap_cache() below */
+	if (radix_tree_preload(GFP_ATOMIC))
+		return 0;
 	lock_kernel();
 	/* subtle: preload the swap count for the swap cache. We can't
 	   increase the count inside the critical section as we can't release
@@ -862,7 +946,7 @@ int shm_swap (int prio, int gfp_mask)
 	spin_lock(&shm_lock);
  check_id:
 	shp = shm_segs[swap_id];
-	if (shp == IPC_UNUSED || shp == IPC_NOID || shp->u.shm_perm.mode & SHM_LOCKED ) {
+	if (shp == IPC_UNUSED || shp == IPC_NOID || shp->u.shm_perm.mode & (SHM_LOCKED | SHM_HUGETLB)) {
  next_id:
 		swap_idx = 0;
 		if (++swap_id > max_shmid) {
@@ -898,6 +982,12 @@ failed:
 		unlock_kernel();
 		return 0;
 	}
+	/*
+	 * Unmap the page from the attaching processes through its pte
+	 * chain. That fails while the page is still being referenced.
+	 */
+	if (page_count(page_map) != 1 && try_to_unmap(page_map) != SWAP_SUCCESS)
+		goto check_table;
 	if (page_count(page_map) != 1)
 		goto check_table;
 	if (!(page_map = prepare_highmem_swapout(page_map)))
@@ -956,6 +1046,8 @@ void shm_unuse(swp_entry_t entry, struct page *page)
 		struct shmid_kernel *seg = shm_segs[i];
 		if ((seg == IPC_UNUSED) || (seg == IPC_NOID))
 			continue;
+		if (seg->u.shm_perm.mode & SHM_HUGETLB)
+			continue;
 		for (n = 0; n < seg->shm_npages; n++) {
 			if (pte_none(SHM_ENTRY(seg,n)))
 				continue;
@@ -30,12 +30,13 @@ static void release(struct task_struct * p)
 
 		/*
 		 * Wait to make sure the process isn't on the
-		 * runqueue (active on some other CPU still)
+		 * runqueue (active on some other CPU still).
+		 * has_cpu is cleared by __schedule_tail() after
+		 * a write barrier, so no runqueue lock is needed.
 		 */
 		do {
-			spin_lock_irq(&runqueue_lock);
 			has_cpu = p->has_cpu;
-			spin_unlock_irq(&runqueue_lock);
+			rmb();
 		} while (has_cpu);
 #endif
 		free_uid(p);
@@ -25,7 +25,6 @@
 
 /* The idle threads do not count.. */
 int nr_threads=0;
-int nr_running=0;
 
 int max_threads;
 unsigned long total_forks = 0;	/* Handle normal Linux uptimes. */
@@ -630,6 +629,7 @@ int do_fork(unsigned long clone_flags, unsigned long usp, struct pt_regs *regs)
 		__MOD_INC_USE_COUNT(p->binfmt->module);
 
 	p->did_exec = 0;
+	p->journal_info = NULL;
 	p->swappable = 0;
 	p->state = TASK_UNINTERRUPTIBLE;
 
@@ -645,6 +645,7 @@ int do_fork(unsigned long clone_flags, unsigned long usp, struct pt_regs *regs)
 	p->state = TASK_RUNNING;
 	p->run_list.next = NULL;
 	p->run_list.prev = NULL;
+	p->array = NULL;
 
 	if ((clone_flags & CLONE_VFORK) || !(clone_flags & CLONE_PARENT))
 		p->p_pptr = p->p_opptr = current;
@@ -728,7 +729,7 @@ int do_fork(unsigned long clone_flags, unsigned long usp, struct pt_regs *regs)
 	nr_threads++;
 	write_unlock_irq(&tasklist_lock);
 
-	wake_up_process(p);		/* do this last */
+	wake_up_forked_process(p);	/* do this last */
 	++total_forks;
 
 bad_fork:
@@ -11,6 +11,7 @@
 #include <linux/errno.h>
 #include <linux/mm.h>
 #include <linux/highmem.h>
+#include <linux/hugetlb.h>
 
 #include <asm/pgtable.h>
 #include <asm/uaccess.h>
@@ -27,6 +28,16 @@ static int access_one_page(struct task_struct * tsk, struct vm_area_struct * vma
 	unsigned long maddr; 
 	struct page *page;
 
+	/* Huge pages are always mapped, and always shared */
+	if (is_vm_hugetlb_page(vma)) {
+		if (write && !(vma->vm_flags & VM_WRITE))
+			return 0;
+		page = follow_huge_addr(vma->vm_mm, addr);
+		if (!page)
+			return 0;
+		goto access_page;
+	}
+
 repeat:
 	pgdir = pgd_offset(vma->vm_mm, addr);
 	if (pgd_none(*pgdir))
@@ -47,6 +58,7 @@ repeat:
 	if (mapnr >= max_mapnr)
 		return 0;
 	page = mem_map + mapnr;
+access_page:
 	flush_cache_page(vma, addr);
 
 	if (write) {
@@ -98,18 +98,58 @@ struct task_struct * init_tasks[NR_CPUS] = {&init_task, };
 /*
  * The tasklist_lock protects the linked list of processes.
  *
- * The scheduler lock is protecting against multiple entry
- * into the scheduling code, and doesn't need to worry
- * about interrupts (because interrupts cannot call the
- * scheduler).
+ * Every CPU has its own run-queue, protected by its own
+ * spinlock which has to be interrupt-safe. A task sits on
+ * the run-queue of p->processor, and p->processor of a
+ * runnable task only changes with the run-queue locks of
+ * both the old and the new CPU held. When two run-queue
+ * locks are needed they are taken in run-queue address
+ * order, see double_rq_lock().
  *
- * The run-queue lock locks the parts that actually access
- * and change the run-queues, and have to be interrupt-safe.
+ * The tasklist_lock nests outside the run-queue locks.
  */
-spinlock_t runqueue_lock = SPIN_LOCK_UNLOCKED;  /* second */
 rwlock_t tasklist_lock = RW_LOCK_UNLOCKED;	/* third */
 
-static LIST_HEAD(runqueue_head);
+/*
+ * Each run-queue has two priority arrays: processes with time
+ * left sit in the active one, those that used up their slice
+ * wait in the expired one. When the active array runs empty
+ * the two are switched, which replaces the old recalculation
+ * loop over every task in the system. A bitmap of non-empty
+ * priority levels makes picking the next process O(1).
+ */
+#define BITMAP_SIZE	((MAX_PRIO+BITS_PER_LONG-1)/BITS_PER_LONG)
+
+struct prio_array {
+	int nr_active;
+	unsigned long bitmap[BITMAP_SIZE];
+	struct list_head queue[MAX_PRIO];
+};
+
+struct runqueue {
+	spinlock_t lock;
+	unsigned long nr_running;
+	struct prio_array *active, *expired, arrays[2];
+	unsigned long nr_switches;	/* active/expired array switches */
+	/* statistics, see get_schedstat() */
+	unsigned long nr_balance;	/* load_balance() runs */
+	unsigned long nr_pulled;	/* tasks pulled by the balancer */
+	unsigned long nr_wake_moved;	/* wakeups moved to this CPU */
+};
+
+/*
+ * Per-CPU run-queues are aligned on cacheline boundaries,
+ * so that CPUs do not bounce each other's locks.
+ */
+#define RQ_PAD	((sizeof(struct runqueue) + SMP_CACHE_BYTES-1) & ~(SMP_CACHE_BYTES-1))
+
+static union {
+	struct runqueue rq;
+	char __pad [RQ_PAD];
+} runqueues [NR_CPUS] __cacheline_aligned;
+
+#define cpu_rq(cpu)	(&runqueues[(cpu)].rq)
+#define task_rq(p)	cpu_rq((p)->processor)
 
 /*
  * We align per-CPU scheduling data on cacheline boundaries,
@@ -119,6 +159,7 @@ static union {
 	struct schedule_data {
 		struct task_struct * curr;
 		cycles_t last_schedule;
+		unsigned long quiescent;	/* times through schedule() */
 	} schedule_data;
 	char __pad [SMP_CACHE_BYTES];
 } aligned_data [NR_CPUS] __cacheline_aligned = { {{&init_task,0}}};
@@ -130,12 +171,10 @@ struct kernel_stat kstat = { 0 };
 #ifdef __SMP__
 
 #define idle_task(cpu) (init_tasks[cpu_number_map[(cpu)]])
-#define can_schedule(p)	(!(p)->has_cpu)
 
 #else
 
 #define idle_task(cpu) (&init_task)
-#define can_schedule(p) (1)
 
 #endif
 
@@ -197,92 +236,141 @@ out:
 }
 
 /*
- * subtle. We want to discard a yielded process only if it's being
- * considered for a reschedule. Wakeup-time 'queries' of the scheduling
- * state do not count. Another optimization we do: sched_yield()-ed
- * processes are runnable (and thus will be considered for scheduling)
- * right when they are calling schedule(). So the only place we need
- * to care about SCHED_YIELD is when we calculate the previous process'
- * goodness ...
+ * The run-queue index of a process, see MAX_PRIO. ->priority
+ * (1..2*DEF_PRIORITY, from nice) is spread over the 40 levels
+ * above the real-time ones.
  */
-static inline int prev_goodness(struct task_struct * p, int this_cpu, struct mm_struct *this_mm)
+static inline int effective_prio(struct task_struct * p)
 {
-	if (p->policy & SCHED_YIELD) {
-		p->policy &= ~SCHED_YIELD;
-		return 0;
-	}
-	return goodness(p, this_cpu, this_mm);
+	int priority;
+
+	if ((p->policy & ~SCHED_YIELD) != SCHED_OTHER)
+		return MAX_RT_PRIO-1 - p->rt_priority;
+
+	priority = p->priority;
+	if (priority > 2*DEF_PRIORITY)
+		priority = 2*DEF_PRIORITY;
+	return MAX_PRIO-1 - priority * (MAX_PRIO-MAX_RT_PRIO-1) / (2*DEF_PRIORITY);
 }
 
 /*
  * the 'goodness value' of replacing a process on a given CPU.
  * positive value means 'replace', zero or negative means 'dont'.
+ *
+ * schedule() always runs the first process of the best priority
+ * level, so a better level wins outright and goodness() only
+ * decides between processes of the same level.
  */
 static inline int preemption_goodness(struct task_struct * prev, struct task_struct * p, int cpu)
 {
+	int prio = effective_prio(p);
+
+	if (prio != prev->prio)
+		return prev->prio - prio;
 	return goodness(p, cpu, prev->mm) - goodness(prev, cpu, prev->mm);
 }
 
 /*
- * This is ugly, but reschedule_idle() is very timing-critical.
- * We enter with the runqueue spinlock held, but we might end
- * up unlocking it early, so the caller must not unlock the
- * runqueue, it's always done by reschedule_idle().
+ * Lock the run-queue a task is on. p->processor might change
+ * while we spin on the lock (the task might get migrated), so
+ * recheck it once we hold the lock.
  */
-static inline void reschedule_idle(struct task_struct * p, unsigned long flags)
+static inline struct runqueue * task_rq_lock(struct task_struct *p, unsigned long *flags)
 {
+	struct runqueue *rq;
+
+repeat_lock_task:
+	rq = task_rq(p);
+	spin_lock_irqsave(&rq->lock, *flags);
+	if (rq != task_rq(p)) {
+		spin_unlock_irqrestore(&rq->lock, *flags);
+		goto repeat_lock_task;
+	}
+	return rq;
+}
+
+static inline void task_rq_unlock(struct runqueue *rq, unsigned long *flags)
+{
+	spin_unlock_irqrestore(&rq->lock, *flags);
+}
+
+/*
+ * Lock two run-queues, in address order to avoid deadlocks.
+ * The caller must have disabled interrupts.
+ */
+static inline void double_rq_lock(struct runqueue *rq1, struct runqueue *rq2)
+{
+	if (rq1 == rq2)
+		spin_lock(&rq1->lock);
+	else if (rq1 < rq2) {
+		spin_lock(&rq1->lock);
+		spin_lock(&rq2->lock);
+	} else {
+		spin_lock(&rq2->lock);
+		spin_lock(&rq1->lock);
+	}
+}
+
+static inline void double_rq_unlock(struct runqueue *rq1, struct runqueue *rq2)
+{
+	spin_unlock(&rq1->lock);
+	if (rq1 != rq2)
+		spin_unlock(&rq2->lock);
+}
+
 #ifdef __SMP__
-	int this_cpu = smp_processor_id(), target_cpu;
+
+/*
+ * Pick the CPU a woken-up process should be queued on. This
+ * runs without any run-queue lock held, so it is only a hint.
+ * The last CPU of the process is preferred (its cache might
+ * still be warm), unless it is busy and some other CPU idles.
+ * A process that is still switching out somewhere (has_cpu)
+ * is never moved.
+ */
+static inline int wake_up_cpu(struct task_struct * p)
+{
+	int best_cpu = p->processor, cpu, i;
 	struct task_struct *tsk;
-	int cpu, best_cpu, i;
+
+	if (p->has_cpu)
+		return best_cpu;
 
 	/*
 	 * shortcut if the woken up task's last CPU is
 	 * idle now.
 	 */
-	best_cpu = p->processor;
-	tsk = idle_task(best_cpu);
-	if (cpu_curr(best_cpu) == tsk)
-		goto send_now;
+	tsk = cpu_curr(best_cpu);
+	if (tsk == idle_task(best_cpu))
+		return best_cpu;
 
 	/*
-	 * The only heuristics - we use the tsk->avg_slice value
-	 * to detect 'frequent reschedulers'.
-	 *
-	 * If both the woken-up process and the preferred CPU is
-	 * is a frequent rescheduler, then skip the asynchronous
-	 * wakeup, the frequent rescheduler will likely chose this
-	 * task during it's next schedule():
+	 * If both the woken-up process and the preferred CPU
+	 * are frequent reschedulers (see tsk->avg_slice), then
+	 * stay where we are, the frequent rescheduler will
+	 * likely chose this task during it's next schedule():
 	 */
-	tsk = cpu_curr(best_cpu);
  	if ((p->avg_slice < cacheflush_time) &&
 			(tsk->avg_slice < cacheflush_time))
-		goto out_no_target;
+		return best_cpu;
 
 	/*
 	 * We know that the preferred CPU has a cache-affine current
-	 * process, lets try to find a new idle CPU for the woken-up
-	 * process:
+	 * process, lets try to find a new idle CPU with an empty
+	 * run-queue for the woken-up process:
 	 */
 	for (i = 0; i < smp_num_cpus; i++) {
 		cpu = cpu_logical_map(i);
-		tsk = cpu_curr(cpu);
-		/*
-		 * We use the first available idle CPU. This creates
-		 * a priority list between idle CPUs, but this is not
-		 * a problem.
-		 */
-		if (tsk == idle_task(cpu))
-			goto send_now;
+		if (cpu_curr(cpu) == idle_task(cpu) && !cpu_rq(cpu)->nr_running)
+			return cpu;
 	}
 
 	/*
 	 * No CPU is idle, but maybe this process has enough priority
 	 * to preempt it's preferred CPU. (this is a shortcut):
 	 */
-	tsk = cpu_curr(best_cpu);
 	if (preemption_goodness(tsk, p, best_cpu) > 0)
-		goto send_now;
+		return best_cpu;
 
 	/*
 	 * We should get here rarely - or in the high CPU contention
@@ -292,19 +380,46 @@ static inline void reschedule_idle(struct task_struct * p, unsigned long flags)
 	 */
 	for (i = 0; i < smp_num_cpus; i++) {
 		cpu = cpu_logical_map(i);
-		tsk = cpu_curr(cpu);
-		if (preemption_goodness(tsk, p, cpu) > 0)
-			goto send_now;
+		if (preemption_goodness(cpu_curr(cpu), p, cpu) > 0)
+			return cpu;
 	}
+	return best_cpu;
+}
+
+#else
+
+#define wake_up_cpu(p)	((p)->processor)
+
+#endif
+
+/*
+ * Kick the CPU the process has just been queued on, if it is
+ * idle or the process should preempt what runs there. We enter
+ * with the run-queue spinlock held, and it is always unlocked
+ * here, so that the IPI can be sent outside of the lock.
+ */
+static inline void reschedule_idle(struct task_struct * p, struct runqueue * rq, unsigned long flags)
+{
+#ifdef __SMP__
+	int this_cpu = smp_processor_id(), target_cpu = p->processor;
+	struct task_struct *tsk;
+
+	tsk = cpu_curr(target_cpu);
+	if (tsk == idle_task(target_cpu))
+		goto send_now;
+	if ((p->avg_slice < cacheflush_time) &&
+			(tsk->avg_slice < cacheflush_time))
+		goto out_no_target;
+	if (preemption_goodness(tsk, p, target_cpu) > 0)
+		goto send_now;
 
 out_no_target:
-	spin_unlock_irqrestore(&runqueue_lock, flags);
+	spin_unlock_irqrestore(&rq->lock, flags);
 	return;
 		
 send_now:
-	target_cpu = tsk->processor;
 	tsk->need_resched = 1;
-	spin_unlock_irqrestore(&runqueue_lock, flags);
+	spin_unlock_irqrestore(&rq->lock, flags);
 	/*
 	 * the APIC stuff can go outside of the lock because
 	 * it uses no task information, only CPU#.
@@ -319,32 +434,130 @@ send_now:
 	tsk = cpu_curr(this_cpu);
 	if (preemption_goodness(tsk, p, this_cpu) > 0)
 		tsk->need_resched = 1;
+	spin_unlock_irqrestore(&rq->lock, flags);
 #endif
 }
 
+#define prio_set(idx, map)	((map)[(idx)/BITS_PER_LONG] |= 1UL << ((idx) % BITS_PER_LONG))
+#define prio_clear(idx, map)	((map)[(idx)/BITS_PER_LONG] &= ~(1UL << ((idx) % BITS_PER_LONG)))
+
+/*
+ * Find the best non-empty priority level. There are only
+ * BITMAP_SIZE words to look at, whatever the number of
+ * runnable processes is.
+ */
+static inline int sched_find_first_bit(unsigned long *bitmap)
+{
+	int i;
+
+	for (i = 0; i < BITMAP_SIZE; i++)
+		if (bitmap[i])
+			return i*BITS_PER_LONG + ffz(~bitmap[i]);
+	return MAX_PRIO;
+}
+
+static inline void dequeue_task(struct task_struct * p, struct prio_array * array)
+{
+	array->nr_active--;
+	list_del(&p->run_list);
+	if (list_empty(array->queue + p->prio))
+		prio_clear(p->prio, array->bitmap);
+}
+
 /*
  * Careful!
  *
- * This has to add the process to the _beginning_ of the
- * run-queue, not the end. See the comment about "This is
- * subtle" in the scheduler proper..
+ * A woken-up process goes to the _beginning_ of its priority
+ * level, so that when reschedule_idle() decided that it should
+ * preempt the current process, schedule() really picks it.
  */
-static inline void add_to_runqueue(struct task_struct * p)
+static inline void enqueue_task_head(struct task_struct * p, struct prio_array * array)
 {
-	list_add(&p->run_list, &runqueue_head);
-	nr_running++;
+	p->prio = effective_prio(p);
+	list_add(&p->run_list, array->queue + p->prio);
+	prio_set(p->prio, array->bitmap);
+	array->nr_active++;
+	p->array = array;
 }
 
-static inline void move_last_runqueue(struct task_struct * p)
+static inline void enqueue_task(struct task_struct * p, struct prio_array * array)
 {
-	list_del(&p->run_list);
-	list_add_tail(&p->run_list, &runqueue_head);
+	p->prio = effective_prio(p);
+	list_add_tail(&p->run_list, array->queue + p->prio);
+	prio_set(p->prio, array->bitmap);
+	array->nr_active++;
+	p->array = array;
 }
 
-static inline void move_first_runqueue(struct task_struct * p)
+static inline void add_to_runqueue(struct task_struct * p, struct runqueue * rq)
 {
-	list_del(&p->run_list);
-	list_add(&p->run_list, &runqueue_head);
+	enqueue_task_head(p, rq->active);
+	rq->nr_running++;
+}
+
+static inline void __del_from_runqueue(struct task_struct * p, struct runqueue * rq)
+{
+	rq->nr_running--;
+	dequeue_task(p, p->array);
+	p->array = NULL;
+	p->run_list.next = NULL;
+	p->sleep_epoch = rq->nr_switches;
+}
+
+/*
+ * Move a process to the end of its priority level, in the
+ * expired array if it has used up its timeslice. Real-time
+ * processes never expire.
+ */
+static inline void requeue_task(struct task_struct * p, struct runqueue * rq, int expire)
+{
+	dequeue_task(p, p->array);
+	if (expire && (p->policy & ~SCHED_YIELD) == SCHED_OTHER)
+		enqueue_task(p, rq->expired);
+	else
+		enqueue_task(p, rq->active);
+}
+
+/*
+ * The old scheduler recalculated every process's counter each
+ * time the runnable ones ran out, which favoured sleepers. Do
+ * that lazily: apply the recalculations a process missed while
+ * it was asleep when it wakes up. The value converges quickly,
+ * so the loop is bounded.
+ */
+static inline void recalc_sleeper(struct task_struct * p, struct runqueue * rq)
+{
+	unsigned long missed = rq->nr_switches - p->sleep_epoch;
+
+	if (missed > 8)
+		missed = 8;
+	while (missed--)
+		p->counter = (p->counter >> 1) + p->priority;
+}
+
+void del_from_runqueue(struct task_struct * p)
+{
+	struct runqueue *rq;
+	unsigned long flags;
+
+	rq = task_rq_lock(p, &flags);
+	__del_from_runqueue(p, rq);
+	task_rq_unlock(rq, &flags);
+}
+
+/*
+ * Number of runnable processes, summed over all CPUs. This is
+ * not exact (we do not take the run-queue locks), but it is
+ * only used for statistics.
+ */
+unsigned long nr_running(void)
+{
+	unsigned long sum = 0;
+	int i;
+
+	for (i = 0; i < smp_num_cpus; i++)
+		sum += cpu_rq(cpu_logical_map(i))->nr_running;
+	return sum;
 }
 
 /*
@@ -354,40 +567,87 @@ static inline void move_first_runqueue(struct task_struct * p)
  * progress), and as such you're allowed to do the simpler
  * "current->state = TASK_RUNNING" to mark yourself runnable
  * without the overhead of this.
+ *
+ * On SMP the process might be queued on another CPU than it
+ * last ran on, see wake_up_cpu(). This takes the run-queue
+ * locks of both CPUs.
  */
 inline void wake_up_process(struct task_struct * p)
 {
+	struct runqueue *rq, *target_rq;
 	unsigned long flags;
+	int target_cpu;
+
+repeat_lock_task:
+	rq = task_rq(p);
+	target_cpu = wake_up_cpu(p);
+	target_rq = cpu_rq(target_cpu);
+	__save_flags(flags);
+	__cli();
+	double_rq_lock(rq, target_rq);
+	if (rq != task_rq(p)) {
+		double_rq_unlock(rq, target_rq);
+		__restore_flags(flags);
+		goto repeat_lock_task;
+	}
 
 	/*
 	 * We want the common case fall through straight, thus the goto.
 	 */
-	spin_lock_irqsave(&runqueue_lock, flags);
 	p->state = TASK_RUNNING;
 	if (task_on_runqueue(p))
 		goto out;
-	add_to_runqueue(p);
-	reschedule_idle(p, flags); // spin_unlocks runqueue
+	recalc_sleeper(p, rq);
+	if (rq != target_rq) {
+		/*
+		 * p->processor has to change before we drop the old
+		 * lock, concurrent wakers recheck it. If the process
+		 * is switching out on some CPU again, leave it be.
+		 */
+		if (!p->has_cpu) {
+			p->processor = target_cpu;
+			target_rq->nr_wake_moved++;
+			spin_unlock(&rq->lock);
+			rq = target_rq;
+		} else
+			spin_unlock(&target_rq->lock);
+	}
+	add_to_runqueue(p, rq);
+	reschedule_idle(p, rq, flags); // spin_unlocks runqueue
 
 	return;
 out:
-	spin_unlock_irqrestore(&runqueue_lock, flags);
+	double_rq_unlock(rq, target_rq);
+	__restore_flags(flags);
 }
 
 static inline void wake_up_process_synchronous(struct task_struct * p)
 {
+	struct runqueue *rq;
 	unsigned long flags;
 
 	/*
 	 * We want the common case fall through straight, thus the goto.
+	 * The waker is about to sleep, so keep the process local.
 	 */
-	spin_lock_irqsave(&runqueue_lock, flags);
+	rq = task_rq_lock(p, &flags);
 	p->state = TASK_RUNNING;
 	if (task_on_runqueue(p))
 		goto out;
-	add_to_runqueue(p);
+	recalc_sleeper(p, rq);
+	add_to_runqueue(p, rq);
 out:
-	spin_unlock_irqrestore(&runqueue_lock, flags);
+	task_rq_unlock(rq, &flags);
+}
+
+/*
+ * A new child has not slept yet, so it must not get a sleeper
+ * bonus in recalc_sleeper() based on its parent's old epoch.
+ */
+void wake_up_forked_process(struct task_struct * p)
+{
+	p->sleep_epoch = task_rq(p)->nr_switches;
+	wake_up_process(p);
 }
 
 static void process_timeout(unsigned long __data)
@@ -399,6 +659,18 @@ static void process_timeout(unsigned long __data)
 
 /*
  * Event timer code
+ *
+ * Every CPU has its own timer wheel (tv1..tv5) and lock, and a
+ * timer is queued on the wheel of the CPU that armed it last.
+ * add_timer(), mod_timer() and del_timer() thus mostly touch a
+ * CPU-local, uncontended lock. A pending timer is protected by
+ * the lock of timer->base; timer->base is only meaningful while
+ * the timer is pending, and only changes with both the old and
+ * the new base locked (see mod_timer()).
+ *
+ * The timers still expire from timer_bh, which runs on one CPU
+ * at a time and walks all the wheels, so timer functions keep
+ * their old serialization against the other bottom halves.
  */
 #define TVN_BITS 6
 #define TVR_BITS 8
@@ -417,19 +689,31 @@ struct timer_vec_root {
         struct timer_list *vec[TVR_SIZE];
 };
 
-static struct timer_vec tv5 = { 0 };
-static struct timer_vec tv4 = { 0 };
-static struct timer_vec tv3 = { 0 };
-static struct timer_vec tv2 = { 0 };
-static struct timer_vec_root tv1 = { 0 };
-
-static struct timer_vec * const tvecs[] = {
-	(struct timer_vec *)&tv1, &tv2, &tv3, &tv4, &tv5
+#define NOOF_TVECS 5
+
+struct tvec_base {
+	spinlock_t lock;
+	unsigned long timer_jiffies;
+	struct timer_vec_root tv1;
+	struct timer_vec tv2, tv3, tv4, tv5;
+	struct timer_vec *tvecs[NOOF_TVECS];
+	/* statistics, see get_timerstat() */
+	unsigned long nr_add;
+	unsigned long nr_mod;
+	unsigned long nr_mod_fast;	/* mod_timer() without a lock */
+	unsigned long nr_del;
+	unsigned long nr_cascade;	/* timers moved down a wheel */
+	unsigned long nr_run;
 };
 
-#define NOOF_TVECS (sizeof(tvecs) / sizeof(tvecs[0]))
+#define TVEC_PAD ((sizeof(struct tvec_base) + SMP_CACHE_BYTES-1) & ~(SMP_CACHE_BYTES-1))
 
-static unsigned long timer_jiffies = 0;
+static union {
+	struct tvec_base base;
+	char __pad [TVEC_PAD];
+} tvec_bases [NR_CPUS] __cacheline_aligned;
+
+#define cpu_tvec(cpu)	(&tvec_bases[(cpu)].base)
 
 static inline void insert_timer(struct timer_list *timer,
 				struct timer_list **vec, int idx)
@@ -440,52 +724,74 @@ static inline void insert_timer(struct timer_list *timer,
 	timer->prev = (struct timer_list *)&vec[idx];
 }
 
-static inline void internal_add_timer(struct timer_list *timer)
+static inline void internal_add_timer(struct tvec_base *base, struct timer_list *timer)
 {
 	/*
-	 * must be cli-ed when calling this
+	 * must be cli-ed and hold base->lock when calling this
 	 */
 	unsigned long expires = timer->expires;
-	unsigned long idx = expires - timer_jiffies;
+	unsigned long idx = expires - base->timer_jiffies;
 
+	timer->base = base;
 	if (idx < TVR_SIZE) {
 		int i = expires & TVR_MASK;
-		insert_timer(timer, tv1.vec, i);
+		insert_timer(timer, base->tv1.vec, i);
 	} else if (idx < 1 << (TVR_BITS + TVN_BITS)) {
 		int i = (expires >> TVR_BITS) & TVN_MASK;
-		insert_timer(timer, tv2.vec, i);
+		insert_timer(timer, base->tv2.vec, i);
 	} else if (idx < 1 << (TVR_BITS + 2 * TVN_BITS)) {
 		int i = (expires >> (TVR_BITS + TVN_BITS)) & TVN_MASK;
-		insert_timer(timer, tv3.vec, i);
+		insert_timer(timer, base->tv3.vec, i);
 	} else if (idx < 1 << (TVR_BITS + 3 * TVN_BITS)) {
 		int i = (expires >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK;
-		insert_timer(timer, tv4.vec, i);
+		insert_timer(timer, base->tv4.vec, i);
 	} else if ((signed long) idx < 0) {
 		/* can happen if you add a timer with expires == jiffies,
 		 * or you set a timer to go off in the past
 		 */
-		insert_timer(timer, tv1.vec, tv1.index);
+		insert_timer(timer, base->tv1.vec, base->tv1.index);
 	} else if (idx <= 0xffffffffUL) {
 		int i = (expires >> (TVR_BITS + 3 * TVN_BITS)) & TVN_MASK;
-		insert_timer(timer, tv5.vec, i);
+		insert_timer(timer, base->tv5.vec, i);
 	} else {
 		/* Can only get here on architectures with 64-bit jiffies */
 		timer->next = timer->prev = timer;
 	}
 }
 
-spinlock_t timerlist_lock = SPIN_LOCK_UNLOCKED;
+/*
+ * Lock the base of a pending timer. Returns NULL, with nothing
+ * locked, if the timer is not pending. The timer might move to
+ * another base while we spin (mod_timer() on another CPU), so
+ * recheck once we hold the lock.
+ */
+static inline struct tvec_base * lock_timer_base(struct timer_list *timer, unsigned long *flags)
+{
+	struct tvec_base *base;
+
+	for (;;) {
+		if (!timer->prev)
+			return NULL;
+		base = timer->base;
+		spin_lock_irqsave(&base->lock, *flags);
+		if (timer->prev && base == timer->base)
+			return base;
+		spin_unlock_irqrestore(&base->lock, *flags);
+	}
+}
 
 void add_timer(struct timer_list *timer)
 {
+	struct tvec_base *base = cpu_tvec(smp_processor_id());
 	unsigned long flags;
 
-	spin_lock_irqsave(&timerlist_lock, flags);
+	spin_lock_irqsave(&base->lock, flags);
 	if (timer->prev)
 		goto bug;
-	internal_add_timer(timer);
+	internal_add_timer(base, timer);
+	base->nr_add++;
 out:
-	spin_unlock_irqrestore(&timerlist_lock, flags);
+	spin_unlock_irqrestore(&base->lock, flags);
 	return;
 
 bug:
@@ -509,24 +815,71 @@ static inline int detach_timer(struct timer_list *timer)
 
 void mod_timer(struct timer_list *timer, unsigned long expires)
 {
+	struct tvec_base *base, *new_base;
 	unsigned long flags;
 
-	spin_lock_irqsave(&timerlist_lock, flags);
+	/*
+	 * Re-arming a pending timer with an unchanged expiry time
+	 * (network timers do this all the time) needs no lock at
+	 * all: if it fires meanwhile, that is the expiry asked for.
+	 */
+	if (timer->prev && timer->expires == expires) {
+		cpu_tvec(smp_processor_id())->nr_mod_fast++;
+		return;
+	}
+
+	__save_flags(flags);
+	__cli();
+	new_base = cpu_tvec(smp_processor_id());
+repeat:
+	base = timer->base;
+	if (!timer->prev || base == new_base) {
+		/* inactive, or pending on this CPU: only our lock */
+		spin_lock(&new_base->lock);
+		if (timer->prev && timer->base != new_base) {
+			spin_unlock(&new_base->lock);
+			goto repeat;
+		}
+		base = new_base;
+	} else {
+		/* pending elsewhere: move it over to this CPU */
+		if (base < new_base) {
+			spin_lock(&base->lock);
+			spin_lock(&new_base->lock);
+		} else {
+			spin_lock(&new_base->lock);
+			spin_lock(&base->lock);
+		}
+		if (!timer->prev || timer->base != base) {
+			spin_unlock(&base->lock);
+			spin_unlock(&new_base->lock);
+			goto repeat;
+		}
+	}
 	timer->expires = expires;
 	detach_timer(timer);
-	internal_add_timer(timer);
-	spin_unlock_irqrestore(&timerlist_lock, flags);
+	internal_add_timer(new_base, timer);
+	new_base->nr_mod++;
+	if (base != new_base)
+		spin_unlock(&base->lock);
+	spin_unlock(&new_base->lock);
+	__restore_flags(flags);
 }
 
 int del_timer(struct timer_list * timer)
 {
-	int ret;
+	struct tvec_base *base;
 	unsigned long flags;
-
-	spin_lock_irqsave(&timerlist_lock, flags);
-	ret = detach_timer(timer);
-	timer->next = timer->prev = 0;
-	spin_unlock_irqrestore(&timerlist_lock, flags);
+	int ret = 0;
+
+	base = lock_timer_base(timer, &flags);
+	if (base) {
+		ret = detach_timer(timer);
+		timer->next = timer->prev = 0;
+		base->nr_del++;
+		spin_unlock_irqrestore(&base->lock, flags);
+	} else
+		timer->next = 0;
 	return ret;
 }
 
@@ -582,6 +935,151 @@ signed long schedule_timeout(signed long timeout)
 	return timeout < 0 ? 0 : timeout;
 }
 
+#ifdef __SMP__
+
+/*
+ * Lock the busiest queue as well, this_rq is locked already.
+ * If we have to drop this_rq's lock to keep the lock order,
+ * the caller has to revalidate whatever it looked at.
+ */
+static inline void double_lock_balance(struct runqueue *this_rq, struct runqueue *busiest)
+{
+	if (!spin_trylock(&busiest->lock)) {
+		if (busiest < this_rq) {
+			spin_unlock(&this_rq->lock);
+			spin_lock(&busiest->lock);
+			spin_lock(&this_rq->lock);
+		} else
+			spin_lock(&busiest->lock);
+	}
+}
+
+/*
+ * Is it worth moving p away from the CPU it is queued on?
+ * A process that is switching in or out there (has_cpu) can
+ * not be moved, and one sharing the mm of what currently
+ * runs there has warm TLB and cache state - the same things
+ * goodness() rewards with PROC_CHANGE_PENALTY and the mm bonus.
+ */
+static inline int can_migrate_task(struct task_struct *p, int src_cpu)
+{
+	if (p->has_cpu)
+		return 0;
+	if (p->mm && p->mm == cpu_curr(src_cpu)->active_mm)
+		return 0;
+	return 1;
+}
+
+/*
+ * Pull processes from the longest run-queue over to this one,
+ * until the two queue lengths are about even. Called with
+ * this_rq locked and interrupts disabled, from schedule() when
+ * a CPU is about to go idle and from the timer tick.
+ *
+ * Queue lengths include the process currently running on each
+ * CPU, since that stays on the run-queue while it runs.
+ *
+ * Returns the number of processes pulled.
+ */
+static int load_balance(struct runqueue *this_rq, int this_cpu)
+{
+	struct runqueue *busiest = NULL, *rq;
+	struct prio_array *array;
+	struct list_head *head, *tmp;
+	unsigned long max_load = 0;
+	int i, idx, cpu, busiest_cpu = 0, imbalance, pulled = 0;
+
+	this_rq->nr_balance++;
+
+	/* find the busiest queue, this is racy but only a hint */
+	for (i = 0; i < smp_num_cpus; i++) {
+		cpu = cpu_logical_map(i);
+		rq = cpu_rq(cpu);
+		if (rq == this_rq)
+			continue;
+		if (rq->nr_running > max_load) {
+			max_load = rq->nr_running;
+			busiest = rq;
+			busiest_cpu = cpu;
+		}
+	}
+	if (!busiest || max_load < this_rq->nr_running + 2)
+		return 0;
+
+	double_lock_balance(this_rq, busiest);
+
+	/* the queues might have changed while we were not looking */
+	imbalance = ((long) busiest->nr_running - (long) this_rq->nr_running) / 2;
+	if (imbalance < 1)
+		goto out_unlock;
+
+	/*
+	 * Take expired processes first, then the lowest priority
+	 * levels, each from the tail: they will wait the longest
+	 * here and are the least likely to be cache-hot.
+	 */
+	array = busiest->expired;
+new_array:
+	for (idx = MAX_PRIO-1; idx >= 0 && imbalance > 0; idx--) {
+		if (!array->bitmap[idx / BITS_PER_LONG]) {
+			idx -= idx % BITS_PER_LONG;
+			continue;
+		}
+		head = array->queue + idx;
+		tmp = head->prev;
+		while (tmp != head && imbalance > 0) {
+			struct task_struct *p = list_entry(tmp, struct task_struct, run_list);
+
+			tmp = tmp->prev;
+			if (!can_migrate_task(p, busiest_cpu))
+				continue;
+
+			dequeue_task(p, array);
+			busiest->nr_running--;
+			p->processor = this_cpu;
+			if (array == busiest->expired)
+				enqueue_task(p, this_rq->expired);
+			else
+				enqueue_task(p, this_rq->active);
+			this_rq->nr_running++;
+			this_rq->nr_pulled++;
+			imbalance--;
+			pulled++;
+		}
+	}
+	if (imbalance > 0 && array == busiest->expired) {
+		array = busiest->active;
+		goto new_array;
+	}
+out_unlock:
+	spin_unlock(&busiest->lock);
+	return pulled;
+}
+
+/*
+ * Idle CPUs look for work on every tick, busy ones only
+ * every BUSY_REBALANCE_TICK ticks.
+ */
+#define IDLE_REBALANCE_TICK	1
+#define BUSY_REBALANCE_TICK	(HZ/5 ? : 1)
+
+static inline void rebalance_tick(struct task_struct *p, int cpu)
+{
+	struct runqueue *rq = cpu_rq(cpu);
+	int idle = (p == idle_task(cpu));
+	unsigned long flags;
+
+	if (jiffies % (idle ? IDLE_REBALANCE_TICK : BUSY_REBALANCE_TICK))
+		return;
+	spin_lock_irqsave(&rq->lock, flags);
+	/* let schedule() weigh the new arrivals against p */
+	if (load_balance(rq, cpu))
+		p->need_resched = 1;
+	spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+#endif /* __SMP__ */
+
 /*
  * schedule_tail() is getting called from the fork return path. This
  * cleans up all remaining scheduler things, without impacting the
@@ -590,13 +1088,11 @@ signed long schedule_timeout(signed long timeout)
 static inline void __schedule_tail(struct task_struct *prev)
 {
 #ifdef __SMP__
-	if ((prev->state == TASK_RUNNING) &&
-			(prev != idle_task(smp_processor_id()))) {
-		unsigned long flags;
-
-		spin_lock_irqsave(&runqueue_lock, flags);
-		reschedule_idle(prev, flags); // spin_unlocks runqueue
-	}
+	/*
+	 * prev stays on this CPU's run-queue if it is still
+	 * runnable, idle CPUs pull it over in load_balance()
+	 * once has_cpu is clear.
+	 */
 	wmb();
 	prev->has_cpu = 0;
 #endif /* __SMP__ */
@@ -620,9 +1116,13 @@ void schedule_tail(struct task_struct *prev)
 asmlinkage void schedule(void)
 {
 	struct schedule_data * sched_data;
-	struct task_struct *prev, *next, *p;
-	struct list_head *tmp;
-	int this_cpu, c;
+	struct task_struct *prev, *next;
+	struct prio_array *array;
+	struct runqueue *rq;
+	int this_cpu, idx;
+#ifdef __SMP__
+	int idle_balanced = 0;
+#endif
 
 	if (!current->active_mm) BUG();
 	if (tq_scheduler)
@@ -647,13 +1147,15 @@ handle_bh_back:
 	 * only one process per CPU.
 	 */
 	sched_data = & aligned_data[this_cpu].schedule_data;
+	sched_data->quiescent++;
+	rq = cpu_rq(this_cpu);
 
-	spin_lock_irq(&runqueue_lock);
+	spin_lock_irq(&rq->lock);
 
-	/* move an exhausted RR process to be last.. */
-	if (prev->policy == SCHED_RR)
-		goto move_rr_last;
-move_rr_back:
+	/* requeue a process that used up its timeslice or yielded.. */
+	if (prev->array && (!prev->counter || (prev->policy & SCHED_YIELD)))
+		goto expire_prev;
+expire_prev_back:
 
 	switch (prev->state) {
 		case TASK_INTERRUPTIBLE:
@@ -662,7 +1164,7 @@ move_rr_back:
 				break;
 			}
 		default:
-			del_from_runqueue(prev);
+			__del_from_runqueue(prev, rq);
 		case TASK_RUNNING:
 	}
 	prev->need_resched = 0;
@@ -671,30 +1173,25 @@ move_rr_back:
 	 * this is the scheduler proper:
 	 */
 
+#ifdef __SMP__
 repeat_schedule:
+#endif
+	if (!rq->nr_running)
+		goto pick_idle;
+	array = rq->active;
+	if (!array->nr_active)
+		goto switch_arrays;
+switch_arrays_back:
+
 	/*
-	 * Default process to select..
+	 * The first process of the best non-empty priority level.
+	 * Only prev can be running on this CPU, so every process
+	 * on this run-queue can be scheduled.
 	 */
-	next = idle_task(this_cpu);
-	c = -1000;
-	if (prev->state == TASK_RUNNING)
-		goto still_running;
-still_running_back:
-
-	tmp = runqueue_head.next;
-	while (tmp != &runqueue_head) {
-		p = list_entry(tmp, struct task_struct, run_list);
-		if (can_schedule(p)) {
-			int weight = goodness(p, this_cpu, prev->active_mm);
-			if (weight > c)
-				c = weight, next = p;
-		}
-		tmp = tmp->next;
-	}
+	idx = sched_find_first_bit(array->bitmap);
+	next = list_entry(array->queue[idx].next, struct task_struct, run_list);
+pick_idle_back:
 
-	/* Do we need to re-calculate counters? */
-	if (!c)
-		goto recalculate;
 	/*
 	 * from this point on nothing can prevent us from
 	 * switching to the next task, save this fact in
@@ -703,9 +1200,8 @@ still_running_back:
 	sched_data->curr = next;
 #ifdef __SMP__
  	next->has_cpu = 1;
-	next->processor = this_cpu;
 #endif
-	spin_unlock_irq(&runqueue_lock);
+	spin_unlock_irq(&rq->lock);
 
 	if (prev == next)
 		goto same_process;
@@ -734,9 +1230,9 @@ still_running_back:
 	}
 
 	/*
-	 * We drop the scheduler lock early (it's a global spinlock),
-	 * thus we have to lock the previous process from getting
-	 * rescheduled during switch_to().
+	 * We drop the run-queue lock early, thus we have to lock
+	 * the previous process from getting rescheduled or
+	 * migrated during switch_to().
 	 */
 
 #endif /* __SMP__ */
@@ -781,22 +1277,43 @@ same_process:
 	reacquire_kernel_lock(current);
 	return;
 
-recalculate:
-	{
-		struct task_struct *p;
-		spin_unlock_irq(&runqueue_lock);
-		read_lock(&tasklist_lock);
-		for_each_task(p)
-			p->counter = (p->counter >> 1) + p->priority;
-		read_unlock(&tasklist_lock);
-		spin_lock_irq(&runqueue_lock);
+switch_arrays:
+	/*
+	 * Every runnable process here has used up its timeslice,
+	 * they already got a new one when they were expired.
+	 */
+	rq->active = rq->expired;
+	rq->expired = array;
+	array = rq->active;
+	rq->nr_switches++;
+	goto switch_arrays_back;
+
+pick_idle:
+#ifdef __SMP__
+	/* Nothing to run here, try to steal some work first. */
+	if (!idle_balanced) {
+		idle_balanced = 1;
+		load_balance(rq, this_cpu);
+		goto repeat_schedule;
 	}
-	goto repeat_schedule;
+#endif
+	next = idle_task(this_cpu);
+	goto pick_idle_back;
 
-still_running:
-	c = prev_goodness(prev, this_cpu, prev->active_mm);
-	next = prev;
-	goto still_running_back;
+expire_prev:
+	{
+		int yielded = prev->policy & SCHED_YIELD;
+
+		prev->policy &= ~SCHED_YIELD;
+		if (!prev->counter) {
+			prev->counter = prev->priority;
+			/* SCHED_FIFO processes have no timeslice */
+			if (prev->policy != SCHED_FIFO)
+				requeue_task(prev, rq, 1);
+		} else if (yielded)
+			requeue_task(prev, rq, 0);
+	}
+	goto expire_prev_back;
 
 handle_bh:
 	do_bottom_half();
@@ -806,13 +1323,6 @@ handle_tq_scheduler:
 	run_task_queue(&tq_scheduler);
 	goto tq_scheduler_back;
 
-move_rr_last:
-	if (!prev->counter) {
-		prev->counter = prev->priority;
-		move_last_runqueue(prev);
-	}
-	goto move_rr_back;
-
 scheduling_in_interrupt:
 	printk("Scheduling in interrupt\n");
 	*(int *)0 = 0;
@@ -849,6 +1359,10 @@ static inline void __wake_up_common(wait_queue_head_t *q, unsigned int mode, con
 #if WAITQUEUE_DEBUG
 		CHECK_MAGIC(curr->__magic);
 #endif
+		if (curr->func) {
+			curr->func(curr, mode);
+			continue;
+		}
 		p = curr->task;
 		state = p->state;
 		if (state & mode) {
@@ -943,7 +1457,7 @@ long sleep_on_timeout(wait_queue_head_t *q, long timeout)
 
 void scheduling_functions_end_here(void) { }
 
-static inline void cascade_timers(struct timer_vec *tv)
+static inline void cascade_timers(struct tvec_base *base, struct timer_vec *tv)
 {
         /* cascade all the timers from tv up one level */
         struct timer_list *timer;
@@ -955,38 +1469,47 @@ static inline void cascade_timers(struct timer_vec *tv)
         while (timer) {
                 struct timer_list *tmp = timer;
                 timer = timer->next;
-                internal_add_timer(tmp);
+                internal_add_timer(base, tmp);
+                base->nr_cascade++;
         }
         tv->vec[tv->index] = NULL;
         tv->index = (tv->index + 1) & TVN_MASK;
 }
 
-static inline void run_timer_list(void)
+static inline void run_timer_base(struct tvec_base *base)
 {
-	spin_lock_irq(&timerlist_lock);
-	while ((long)(jiffies - timer_jiffies) >= 0) {
+	spin_lock_irq(&base->lock);
+	while ((long)(jiffies - base->timer_jiffies) >= 0) {
 		struct timer_list *timer;
-		if (!tv1.index) {
+		if (!base->tv1.index) {
 			int n = 1;
 			do {
-				cascade_timers(tvecs[n]);
-			} while (tvecs[n]->index == 1 && ++n < NOOF_TVECS);
+				cascade_timers(base, base->tvecs[n]);
+			} while (base->tvecs[n]->index == 1 && ++n < NOOF_TVECS);
 		}
-		while ((timer = tv1.vec[tv1.index])) {
+		while ((timer = base->tv1.vec[base->tv1.index])) {
 			void (*fn)(unsigned long) = timer->function;
 			unsigned long data = timer->data;
 			detach_timer(timer);
 			timer->next = timer->prev = NULL;
-			spin_unlock_irq(&timerlist_lock);
+			base->nr_run++;
+			spin_unlock_irq(&base->lock);
 			fn(data);
-			spin_lock_irq(&timerlist_lock);
+			spin_lock_irq(&base->lock);
 		}
-		++timer_jiffies; 
-		tv1.index = (tv1.index + 1) & TVR_MASK;
+		++base->timer_jiffies; 
+		base->tv1.index = (base->tv1.index + 1) & TVR_MASK;
 	}
-	spin_unlock_irq(&timerlist_lock);
+	spin_unlock_irq(&base->lock);
 }
 
+static inline void run_timer_list(void)
+{
+	int i;
+
+	for (i = 0; i < smp_num_cpus; i++)
+		run_timer_base(cpu_tvec(cpu_logical_map(i)));
+}
 
 static inline void run_old_timers(void)
 {
@@ -1297,6 +1820,13 @@ void update_one_process(struct task_struct *p,
 	do_process_times(p, user, system);
 	do_it_virt(p, user);
 	do_it_prof(p, ticks);
+#ifdef __SMP__
+	/*
+	 * Every port calls this from its per-CPU timer tick,
+	 * which makes it the place to drive the load balancer.
+	 */
+	rebalance_tick(p, cpu);
+#endif
 }	
 
 static void update_process_times(unsigned long ticks, unsigned long system)
@@ -1556,6 +2086,8 @@ static int setscheduler(pid_t pid, int policy,
 {
 	struct sched_param lp;
 	struct task_struct *p;
+	struct runqueue *rq;
+	unsigned long flags;
 	int retval;
 
 	retval = -EINVAL;
@@ -1567,16 +2099,16 @@ static int setscheduler(pid_t pid, int policy,
 		goto out_nounlock;
 
 	/*
-	 * We play safe to avoid deadlocks.
+	 * The tasklist_lock nests outside the run-queue locks.
 	 */
-	spin_lock_irq(&runqueue_lock);
 	read_lock(&tasklist_lock);
 
 	p = find_process_by_pid(pid);
 
 	retval = -ESRCH;
 	if (!p)
-		goto out_unlock;
+		goto out_unlock_tasklist;
+	rq = task_rq_lock(p, &flags);
 			
 	if (policy < 0)
 		policy = p->policy;
@@ -1608,14 +2140,17 @@ static int setscheduler(pid_t pid, int policy,
 	retval = 0;
 	p->policy = policy;
 	p->rt_priority = lp.sched_priority;
-	if (task_on_runqueue(p))
-		move_first_runqueue(p);
+	if (p->array) {
+		dequeue_task(p, p->array);
+		enqueue_task_head(p, rq->active);
+	}
 
 	current->need_resched = 1;
 
 out_unlock:
+	task_rq_unlock(rq, &flags);
+out_unlock_tasklist:
 	read_unlock(&tasklist_lock);
-	spin_unlock_irq(&runqueue_lock);
 
 out_nounlock:
 	return retval;
@@ -1690,12 +2225,11 @@ out_unlock:
 
 asmlinkage long sys_sched_yield(void)
 {
-	spin_lock_irq(&runqueue_lock);
-	if (current->policy == SCHED_OTHER)
-		current->policy |= SCHED_YIELD;
+	/*
+	 * schedule() moves us to the end of our priority level.
+	 */
+	current->policy |= SCHED_YIELD;
 	current->need_resched = 1;
-	move_last_runqueue(current);
-	spin_unlock_irq(&runqueue_lock);
 	return 0;
 }
 
@@ -1876,6 +2410,84 @@ void show_state(void)
 	read_unlock(&tasklist_lock);
 }
 
+/*
+ * /proc/schedstat: per-CPU run-queue length and load
+ * balancing counters.
+ */
+int get_schedstat(char *buffer)
+{
+	int i, len;
+
+	len = sprintf(buffer, "cpu  running  balance   pulled wakemoved switches\n");
+	for (i = 0; i < smp_num_cpus; i++) {
+		int cpu = cpu_logical_map(i);
+		struct runqueue *rq = cpu_rq(cpu);
+
+		len += sprintf(buffer+len, "%3d %8lu %8lu %8lu %8lu %8lu\n",
+			cpu, rq->nr_running, rq->nr_balance,
+			rq->nr_pulled, rq->nr_wake_moved, rq->nr_switches);
+	}
+	return len;
+}
+
+/*
+ * /proc/timerstat: per-CPU timer wheel operation counters.
+ */
+int get_timerstat(char *buffer)
+{
+	int i, len;
+
+	len = sprintf(buffer, "cpu      add      mod  modfast      del  cascade      run\n");
+	for (i = 0; i < smp_num_cpus; i++) {
+		int cpu = cpu_logical_map(i);
+		struct tvec_base *base = cpu_tvec(cpu);
+
+		len += sprintf(buffer+len, "%3d %8lu %8lu %8lu %8lu %8lu %8lu\n",
+			cpu, base->nr_add, base->nr_mod, base->nr_mod_fast,
+			base->nr_del, base->nr_cascade, base->nr_run);
+	}
+	return len;
+}
+
+#ifdef __SMP__
+/*
+ * Quiescent states, for data read without any lock (see __d_lookup()).
+ * Such readers never sleep, so once every CPU has been through
+ * schedule(), or is idle, after quiescent_snapshot(), none of them can
+ * still be looking at anything that was unlinked before the snapshot.
+ * The CPU doing the check counts as quiescent, as the check is made
+ * from process context outside of any such read.
+ */
+void quiescent_snapshot(unsigned long * snap)
+{
+	int i;
+
+	for (i = 0; i < smp_num_cpus; i++) {
+		int cpu = cpu_logical_map(i);
+
+		snap[cpu] = aligned_data[cpu].schedule_data.quiescent;
+	}
+}
+
+int quiescent_passed(unsigned long * snap)
+{
+	int i;
+
+	for (i = 0; i < smp_num_cpus; i++) {
+		int cpu = cpu_logical_map(i);
+
+		if (cpu == smp_processor_id())
+			continue;
+		if (aligned_data[cpu].schedule_data.quiescent != snap[cpu])
+			continue;
+		if (cpu_curr(cpu) == idle_task(cpu))
+			continue;
+		return 0;
+	}
+	return 1;
+}
+#endif
+
 /*
  *	Put all the gunge required to become a kernel thread without
  *	attached user resources in one place where it belongs.
@@ -1916,6 +2528,8 @@ void __init init_idle(void)
 			smp_processor_id(), current->pid);
 		del_from_runqueue(current);
 	}
+	/* anything beats the idle thread in preemption_goodness() */
+	current->prio = MAX_PRIO;
 	t = get_cycles();
 	sched_data->curr = current;
 	sched_data->last_schedule = t;
@@ -1932,6 +2546,32 @@ void __init sched_init(void)
 
 	init_task.processor=cpu;
 
+	for(nr = 0; nr < NR_CPUS; nr++) {
+		struct runqueue *rq = cpu_rq(nr);
+		int i, j;
+
+		spin_lock_init(&rq->lock);
+		rq->active = rq->arrays;
+		rq->expired = rq->arrays + 1;
+		for (i = 0; i < 2; i++) {
+			struct prio_array *array = rq->arrays + i;
+
+			for (j = 0; j < MAX_PRIO; j++)
+				INIT_LIST_HEAD(array->queue + j);
+		}
+	}
+
+	for(nr = 0; nr < NR_CPUS; nr++) {
+		struct tvec_base *base = cpu_tvec(nr);
+
+		spin_lock_init(&base->lock);
+		base->tvecs[0] = (struct timer_vec *)&base->tv1;
+		base->tvecs[1] = &base->tv2;
+		base->tvecs[2] = &base->tv3;
+		base->tvecs[3] = &base->tv4;
+		base->tvecs[4] = &base->tv5;
+	}
+
 	for(nr = 0; nr < PIDHASH_SZ; nr++)
 		pidhash[nr] = NULL;
 
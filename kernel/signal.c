@@ -84,24 +84,14 @@ flush_signal_handlers(struct task_struct *t)
 }
 
 /*
- * Dequeue a signal and return the element to the caller, which is 
- * expected to free it.
- *
- * All callers of must be holding current->sigmask_lock.
+ * Find the first pending signal of current not in 'mask'.
  */
-
-int
-dequeue_signal(sigset_t *mask, siginfo_t *info)
+static inline int
+next_signal(sigset_t *mask)
 {
 	unsigned long i, *s, *m, x;
 	int sig = 0;
 
-#if DEBUG_SIG
-printk("SIG dequeue (%s:%d): %d ", current->comm, current->pid,
-	signal_pending(current));
-#endif
-
-	/* Find the first desired signal that is pending.  */
 	s = current->signal.sig;
 	m = mask->sig;
 	switch (_NSIG_WORDS) {
@@ -126,7 +116,28 @@ printk("SIG dequeue (%s:%d): %d ", current->comm, current->pid,
 			sig = ffz(~x) + 1;
 		break;
 	}
+	return sig;
+}
 
+/*
+ * Dequeue a signal and return the element to the caller, which is 
+ * expected to free it.
+ *
+ * All callers of must be holding current->sigmask_lock.
+ */
+
+int
+dequeue_signal(sigset_t *mask, siginfo_t *info)
+{
+	int sig;
+
+#if DEBUG_SIG
+printk("SIG dequeue (%s:%d): %d ", current->comm, current->pid,
+	signal_pending(current));
+#endif
+
+	/* Find the first desired signal that is pending.  */
+	sig = next_signal(mask);
 	if (sig) {
 		int reset = 1;
 
@@ -206,6 +217,73 @@ printk(" %d -> %d\n", signal_pending(current), sig);
 	return sig;
 }
 
+/*
+ * Take up to 'nr' queued instances of the real-time signal 'sig' off
+ * current's queue in one pass, rather than rescanning the whole queue
+ * for each one as dequeue_signal() does. Returns how many were taken.
+ *
+ * The caller must hold current->sigmask_lock.
+ */
+static int
+dequeue_rt_signals(int sig, siginfo_t *info, int nr)
+{
+	struct signal_queue *q, **pp;
+	int n = 0, more = 0;
+
+	pp = &current->sigqueue;
+	while ((q = *pp) != NULL) {
+		if (q->info.si_signo != sig) {
+			pp = &q->next;
+			continue;
+		}
+		if (n == nr) {
+			more = 1;
+			break;
+		}
+		*pp = q->next;
+		info[n++] = q->info;
+		kmem_cache_free(signal_queue_cachep, q);
+		atomic_dec(&nr_queued_signals);
+	}
+	/* walked off the end: the last entry may have been taken */
+	if (!q)
+		current->sigqueue_tail = pp;
+
+	/* sent with the queue full: no siginfo, as in dequeue_signal() */
+	if (!n) {
+		info->si_signo = sig;
+		info->si_errno = 0;
+		info->si_code = 0;
+		info->si_pid = 0;
+		info->si_uid = 0;
+		n = 1;
+	}
+	if (!more)
+		sigdelset(&current->signal, sig);
+	recalc_sigpending(current);
+	return n;
+}
+
+/*
+ * Dequeue up to 'nr' signals not in 'mask' into 'info', lowest signal
+ * number first. Returns how many were dequeued.
+ *
+ * The caller must hold current->sigmask_lock.
+ */
+static int
+dequeue_signals(sigset_t *mask, siginfo_t *info, int nr)
+{
+	int n = 0, sig;
+
+	while (n < nr && (sig = next_signal(mask)) != 0) {
+		if (sig < SIGRTMIN)
+			n += (dequeue_signal(mask, info + n) != 0);
+		else
+			n += dequeue_rt_signals(sig, info + n, nr - n);
+	}
+	return n;
+}
+
 /*
  * Determine whether a signal should be posted or not.
  *
@@ -374,11 +452,11 @@ printk("SIG queue (%s:%d): %d ", t->comm, t->pid, sig);
 		 * note that we rely on the previous spin_lock to
 		 * lock interrupts for us! No need to set need_resched
 		 * since signal event passing goes through ->blocked.
+		 * The run-queues are per-CPU, so there is no global
+		 * lock to take here - the check is racy anyway.
 		 */
-		spin_lock(&runqueue_lock);
 		if (t->has_cpu && t->processor != smp_processor_id())
 			smp_send_reschedule(t->processor);
-		spin_unlock(&runqueue_lock);
 #endif /* __SMP__ */
 	}
 
@@ -783,6 +861,117 @@ sys_rt_sigtimedwait(const sigset_t *uthese, siginfo_t *uinfo,
 	return ret;
 }
 
+/*
+ * Like rt_sigtimedwait(), but return up to 'nr' signals at once, which
+ * is how an event loop driven by F_SETSIG readiness signals drains its
+ * queue without a system call per event. Returns the number of siginfo
+ * structures stored in 'uinfo'; signals that couldn't be stored because
+ * 'uinfo' faulted are queued again.
+ */
+
+#define SIGWAIT_BATCH	(PAGE_SIZE / sizeof(siginfo_t))
+
+asmlinkage long
+sys_rt_sigtimedwait4(const sigset_t *uthese, siginfo_t *uinfo, int nr,
+		     const struct timespec *uts, size_t sigsetsize)
+{
+	int ret, n, i;
+	unsigned long left;
+	sigset_t these;
+	struct timespec ts;
+	siginfo_t *info;
+	long timeout = 0;
+
+	/* XXX: Don't preclude handling different sized sigset_t's.  */
+	if (sigsetsize != sizeof(sigset_t))
+		return -EINVAL;
+	if (nr <= 0 || nr > INT_MAX / sizeof(siginfo_t))
+		return -EINVAL;
+	if (verify_area(VERIFY_WRITE, uinfo, nr * sizeof(siginfo_t)))
+		return -EFAULT;
+
+	if (copy_from_user(&these, uthese, sizeof(these)))
+		return -EFAULT;
+	else {
+		/* Invert the set of allowed signals to get those we
+		   want to block.  */
+		signotset(&these);
+	}
+
+	if (uts) {
+		if (copy_from_user(&ts, uts, sizeof(ts)))
+			return -EFAULT;
+		if (ts.tv_nsec >= 1000000000L || ts.tv_nsec < 0
+		    || ts.tv_sec < 0)
+			return -EINVAL;
+	}
+
+	info = (siginfo_t *) __get_free_page(GFP_KERNEL);
+	if (!info)
+		return -ENOMEM;
+
+	spin_lock_irq(&current->sigmask_lock);
+	n = dequeue_signals(&these, info, nr < SIGWAIT_BATCH ? nr : SIGWAIT_BATCH);
+	if (!n) {
+		/* None ready -- temporarily unblock those we're interested
+		   in so that we'll be awakened when they arrive.  */
+		sigset_t oldblocked = current->blocked;
+		sigandsets(&current->blocked, &current->blocked, &these);
+		recalc_sigpending(current);
+		spin_unlock_irq(&current->sigmask_lock);
+
+		timeout = MAX_SCHEDULE_TIMEOUT;
+		if (uts)
+			timeout = (timespec_to_jiffies(&ts)
+				   + (ts.tv_sec || ts.tv_nsec));
+
+		current->state = TASK_INTERRUPTIBLE;
+		timeout = schedule_timeout(timeout);
+
+		spin_lock_irq(&current->sigmask_lock);
+		n = dequeue_signals(&these, info, nr < SIGWAIT_BATCH ? nr : SIGWAIT_BATCH);
+		current->blocked = oldblocked;
+		recalc_sigpending(current);
+	}
+	spin_unlock_irq(&current->sigmask_lock);
+
+	if (!n) {
+		ret = -EAGAIN;
+		if (timeout)
+			ret = -EINTR;
+		goto out;
+	}
+
+	/* Got some: keep draining a page worth at a time, without waiting */
+	ret = 0;
+	for (;;) {
+		left = __copy_to_user(uinfo + ret, info, n * sizeof(siginfo_t));
+		if (left) {
+			/* Put back what didn't make it, and report the rest */
+			i = n - left / sizeof(siginfo_t);
+			ret += i;
+			for (; i < n; i++)
+				send_sig_info(info[i].si_signo, info + i, current);
+			if (!ret)
+				ret = -EFAULT;
+			break;
+		}
+		ret += n;
+		if (ret == nr)
+			break;
+		spin_lock_irq(&current->sigmask_lock);
+		n = dequeue_signals(&these, info,
+			nr - ret < SIGWAIT_BATCH ? nr - ret : SIGWAIT_BATCH);
+		spin_unlock_irq(&current->sigmask_lock);
+		if (!n)
+			break;
+	}
+
+out:
+	free_page((unsigned long) info);
+	return ret;
+}
+
 asmlinkage long
 sys_kill(int pid, int sig)
 {
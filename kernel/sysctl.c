@@ -25,6 +25,7 @@
 #include <linux/smp_lock.h>
 #include <linux/init.h>
 #include <linux/sysrq.h>
+#include <linux/hugetlb.h>
 
 #include <asm/uaccess.h>
 
@@ -256,6 +257,10 @@ static ctl_table vm_table[] = {
 	 &pgt_cache_water, 2*sizeof(int), 0600, NULL, &proc_dointvec},
 	{VM_PAGE_CLUSTER, "page-cluster", 
 	 &page_cluster, sizeof(int), 0600, NULL, &proc_dointvec},
+#ifdef CONFIG_HUGETLB_PAGE
+	{VM_HUGETLB_PAGES, "nr_hugepages",
+	 &htlbpage_max, sizeof(int), 0644, NULL, &hugetlb_sysctl_handler},
+#endif
 	{0}
 };
 
@@ -0,0 +1,479 @@
+/*
+ *  linux/lib/radix-tree.c
+ *
+ * A fixed fan-out radix tree with per-slot tags, used to index the
+ * page cache of an address_space by page index.
+ */
+
+#include <linux/config.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/radix-tree.h>
+
+#include <asm/bitops.h>
+
+#define RADIX_TREE_MAP_SHIFT	6
+#define RADIX_TREE_MAP_SIZE	(1UL << RADIX_TREE_MAP_SHIFT)
+#define RADIX_TREE_MAP_MASK	(RADIX_TREE_MAP_SIZE-1)
+#define RADIX_TREE_TAG_LONGS	\
+	((RADIX_TREE_MAP_SIZE + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+#define RADIX_TREE_INDEX_BITS	(8 * sizeof(unsigned long))
+#define RADIX_TREE_MAX_PATH	(RADIX_TREE_INDEX_BITS/RADIX_TREE_MAP_SHIFT + 2)
+
+/*
+ * Growing the tree by several levels and then filling in the path
+ * below the new top can take up to twice the height in new nodes.
+ */
+#define RADIX_TREE_PRELOAD_SIZE	(RADIX_TREE_MAX_PATH * 2)
+
+struct radix_tree_node {
+	unsigned int	count;		/* non-empty slots */
+	void		*slots[RADIX_TREE_MAP_SIZE];
+	unsigned long	tags[RADIX_TREE_MAX_TAGS][RADIX_TREE_TAG_LONGS];
+};
+
+struct radix_tree_path {
+	struct radix_tree_node *node;
+	int offset;
+};
+
+static kmem_cache_t *radix_tree_node_cachep;
+static unsigned long height_to_maxindex[RADIX_TREE_MAX_PATH];
+
+/*
+ * Nodes set aside by radix_tree_preload(), for insertions done
+ * under a spinlock when the slab cannot give us one atomically.
+ * Only used from process context, which cannot be preempted.
+ */
+static struct radix_tree_preload {
+	int nr;
+	struct radix_tree_node *nodes[RADIX_TREE_PRELOAD_SIZE];
+} radix_tree_preloads[NR_CPUS];
+
+static struct radix_tree_node *radix_tree_node_alloc(struct radix_tree_root *root)
+{
+	struct radix_tree_node *node;
+
+	node = kmem_cache_alloc(radix_tree_node_cachep, root->gfp_mask);
+	if (!node) {
+		struct radix_tree_preload *rtp;
+
+		rtp = radix_tree_preloads + smp_processor_id();
+		if (!rtp->nr)
+			return NULL;
+		node = rtp->nodes[--rtp->nr];
+	}
+	memset(node, 0, sizeof(*node));
+	return node;
+}
+
+static inline void radix_tree_node_free(struct radix_tree_node *node)
+{
+	kmem_cache_free(radix_tree_node_cachep, node);
+}
+
+/*
+ * Make sure the next insertion on this CPU cannot fail for lack of
+ * memory, even if it is done with a spinlock held. The caller must
+ * not sleep between this and the insertion.
+ */
+int radix_tree_preload(int gfp_mask)
+{
+	struct radix_tree_preload *rtp;
+	struct radix_tree_node *node;
+
+	rtp = radix_tree_preloads + smp_processor_id();
+	while (rtp->nr < RADIX_TREE_PRELOAD_SIZE) {
+		node = kmem_cache_alloc(radix_tree_node_cachep, gfp_mask);
+		if (!node)
+			return -ENOMEM;
+		/* We may have slept, and woken up on another CPU */
+		rtp = radix_tree_preloads + smp_processor_id();
+		if (rtp->nr < RADIX_TREE_PRELOAD_SIZE)
+			rtp->nodes[rtp->nr++] = node;
+		else
+			kmem_cache_free(radix_tree_node_cachep, node);
+	}
+	return 0;
+}
+
+static inline void tag_set(struct radix_tree_node *node, int tag, int offset)
+{
+	set_bit(offset, node->tags[tag]);
+}
+
+static inline void tag_clear(struct radix_tree_node *node, int tag, int offset)
+{
+	clear_bit(offset, node->tags[tag]);
+}
+
+static inline int tag_get(struct radix_tree_node *node, int tag, int offset)
+{
+	return test_bit(offset, node->tags[tag]);
+}
+
+static inline int any_tag_set(struct radix_tree_node *node, int tag)
+{
+	int i;
+
+	for (i = 0; i < RADIX_TREE_TAG_LONGS; i++)
+		if (node->tags[tag][i])
+			return 1;
+	return 0;
+}
+
+static inline unsigned long radix_tree_maxindex(unsigned int height)
+{
+	return height_to_maxindex[height];
+}
+
+/*
+ * Add levels on top of the tree until it can hold 'index'.
+ */
+static int radix_tree_extend(struct radix_tree_root *root, unsigned long index)
+{
+	struct radix_tree_node *node;
+	unsigned int height;
+	int tag;
+
+	height = root->height + 1;
+	while (index > radix_tree_maxindex(height))
+		height++;
+
+	if (!root->rnode) {
+		root->height = height;
+		return 0;
+	}
+
+	do {
+		node = radix_tree_node_alloc(root);
+		if (!node)
+			return -ENOMEM;
+		node->slots[0] = root->rnode;
+		node->count = 1;
+		for (tag = 0; tag < RADIX_TREE_MAX_TAGS; tag++)
+			if (any_tag_set(root->rnode, tag))
+				tag_set(node, tag, 0);
+		root->rnode = node;
+		root->height++;
+	} while (height > root->height);
+	return 0;
+}
+
+/*
+ * Insert 'item' at 'index'. Returns -EEXIST if the slot is
+ * already in use, -ENOMEM if a node could not be allocated.
+ */
+int radix_tree_insert(struct radix_tree_root *root, unsigned long index, void *item)
+{
+	struct radix_tree_node *node = NULL, *tmp;
+	unsigned int height, shift;
+	void **slot;
+	int error;
+
+	if (!root->height || index > radix_tree_maxindex(root->height)) {
+		error = radix_tree_extend(root, index);
+		if (error)
+			return error;
+	}
+
+	slot = (void **) &root->rnode;
+	height = root->height;
+	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
+	while (height > 0) {
+		if (!*slot) {
+			tmp = radix_tree_node_alloc(root);
+			if (!tmp)
+				return -ENOMEM;
+			*slot = tmp;
+			if (node)
+				node->count++;
+		}
+		node = *slot;
+		slot = node->slots + ((index >> shift) & RADIX_TREE_MAP_MASK);
+		shift -= RADIX_TREE_MAP_SHIFT;
+		height--;
+	}
+
+	if (*slot)
+		return -EEXIST;
+	*slot = item;
+	node->count++;
+	return 0;
+}
+
+void *radix_tree_lookup(struct radix_tree_root *root, unsigned long index)
+{
+	unsigned int height, shift;
+	struct radix_tree_node *node;
+
+	height = root->height;
+	if (!height || index > radix_tree_maxindex(height))
+		return NULL;
+
+	node = root->rnode;
+	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
+	while (height > 0) {
+		if (!node)
+			return NULL;
+		node = node->slots[(index >> shift) & RADIX_TREE_MAP_MASK];
+		shift -= RADIX_TREE_MAP_SHIFT;
+		height--;
+	}
+	return node;
+}
+
+/*
+ * Walk down to 'index', remembering the way. path[0] is a sentinel
+ * with a NULL node. Returns the last path element, whose slot holds
+ * the item, or NULL if there is no item at 'index'.
+ */
+static struct radix_tree_path *radix_tree_walk(struct radix_tree_root *root,
+	unsigned long index, struct radix_tree_path *path)
+{
+	struct radix_tree_path *pathp = path;
+	unsigned int height, shift;
+	struct radix_tree_node *node;
+
+	pathp->node = NULL;
+	height = root->height;
+	if (!height || index > radix_tree_maxindex(height))
+		return NULL;
+
+	node = root->rnode;
+	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
+	while (height > 0) {
+		if (!node)
+			return NULL;
+		pathp++;
+		pathp->node = node;
+		pathp->offset = (index >> shift) & RADIX_TREE_MAP_MASK;
+		node = node->slots[pathp->offset];
+		shift -= RADIX_TREE_MAP_SHIFT;
+		height--;
+	}
+	if (!node)
+		return NULL;
+	return pathp;
+}
+
+/*
+ * Clear 'tag' at the end of the path, and on the way up for as
+ * long as no other slot below carries it.
+ */
+static void radix_tree_clear_path(struct radix_tree_path *pathp, int tag)
+{
+	while (pathp->node) {
+		tag_clear(pathp->node, tag, pathp->offset);
+		if (any_tag_set(pathp->node, tag))
+			break;
+		pathp--;
+	}
+}
+
+/*
+ * Remove the item at 'index' and free the nodes that become empty.
+ * Returns the removed item, or NULL if there was none.
+ */
+void *radix_tree_delete(struct radix_tree_root *root, unsigned long index)
+{
+	struct radix_tree_path path[RADIX_TREE_MAX_PATH], *pathp;
+	struct radix_tree_node *node;
+	void *item;
+	int tag;
+
+	pathp = radix_tree_walk(root, index, path);
+	if (!pathp)
+		return NULL;
+	item = pathp->node->slots[pathp->offset];
+
+	for (tag = 0; tag < RADIX_TREE_MAX_TAGS; tag++)
+		radix_tree_clear_path(pathp, tag);
+
+	do {
+		pathp->node->slots[pathp->offset] = NULL;
+		if (--pathp->node->count)
+			goto shrink;
+		radix_tree_node_free(pathp->node);
+		pathp--;
+	} while (pathp->node);
+	root->rnode = NULL;
+	root->height = 0;
+	return item;
+
+shrink:
+	/* Drop top levels which only lead to slot 0 */
+	while (root->height > 1) {
+		node = root->rnode;
+		if (node->count != 1 || !node->slots[0])
+			break;
+		root->rnode = node->slots[0];
+		root->height--;
+		node->slots[0] = NULL;
+		radix_tree_node_free(node);
+	}
+	return item;
+}
+
+/*
+ * Set 'tag' on the item at 'index'. Returns the item, or NULL
+ * (and sets nothing) if there is no item at 'index'.
+ */
+void *radix_tree_tag_set(struct radix_tree_root *root, unsigned long index, int tag)
+{
+	struct radix_tree_path path[RADIX_TREE_MAX_PATH], *pathp;
+	void *item;
+
+	pathp = radix_tree_walk(root, index, path);
+	if (!pathp)
+		return NULL;
+	item = pathp->node->slots[pathp->offset];
+	while (pathp->node) {
+		tag_set(pathp->node, tag, pathp->offset);
+		pathp--;
+	}
+	return item;
+}
+
+/*
+ * Clear 'tag' on the item at 'index'. Returns the item, or NULL if
+ * there is no item at 'index'.
+ */
+void *radix_tree_tag_clear(struct radix_tree_root *root, unsigned long index, int tag)
+{
+	struct radix_tree_path path[RADIX_TREE_MAX_PATH], *pathp;
+
+	pathp = radix_tree_walk(root, index, path);
+	if (!pathp)
+		return NULL;
+	radix_tree_clear_path(pathp, tag);
+	return pathp->node->slots[pathp->offset];
+}
+
+static inline int slot_wanted(struct radix_tree_node *node, int offset, int tag)
+{
+	if (tag < 0)
+		return node->slots[offset] != NULL;
+	return tag_get(node, tag, offset);
+}
+
+/*
+ * Collect up to 'max_items' items at or after 'index' from the one
+ * leaf node which holds the next wanted item. A negative 'tag' means
+ * any item. '*next_index' is where the next search should start,
+ * or 0 if the end of the index space was reached.
+ */
+static unsigned int __lookup(struct radix_tree_root *root, void **results,
+	unsigned long index, unsigned int max_items, unsigned long *next_index,
+	int tag)
+{
+	unsigned int nr_found = 0;
+	unsigned int height, shift;
+	struct radix_tree_node *node;
+	unsigned long i;
+
+	height = root->height;
+	shift = (height-1) * RADIX_TREE_MAP_SHIFT;
+	node = root->rnode;
+
+	while (height > 0) {
+		i = (index >> shift) & RADIX_TREE_MAP_MASK;
+		for (; i < RADIX_TREE_MAP_SIZE; i++) {
+			if (slot_wanted(node, i, tag))
+				break;
+			index &= ~((1UL << shift) - 1);
+			index += 1UL << shift;
+			if (!index)
+				goto out;
+		}
+		if (i == RADIX_TREE_MAP_SIZE)
+			goto out;
+
+		height--;
+		if (!height) {
+			/* Bottom level: grab the items */
+			for (; i < RADIX_TREE_MAP_SIZE; i++) {
+				index++;
+				if (slot_wanted(node, i, tag)) {
+					results[nr_found++] = node->slots[i];
+					if (nr_found == max_items)
+						goto out;
+				}
+			}
+			goto out;
+		}
+		shift -= RADIX_TREE_MAP_SHIFT;
+		node = node->slots[i];
+	}
+out:
+	*next_index = index;
+	return nr_found;
+}
+
+static unsigned int radix_tree_gang(struct radix_tree_root *root,
+	void **results, unsigned long index, unsigned int max_items, int tag)
+{
+	unsigned long max_index, next_index;
+	unsigned int ret = 0;
+
+	if (!root->rnode)
+		return 0;
+	max_index = radix_tree_maxindex(root->height);
+	while (ret < max_items && index <= max_index) {
+		ret += __lookup(root, results + ret, index, max_items - ret,
+				&next_index, tag);
+		if (!next_index)
+			break;
+		index = next_index;
+	}
+	return ret;
+}
+
+/*
+ * Fill 'results' with up to 'max_items' items in ascending index
+ * order, starting at 'first_index'. Returns the number found.
+ */
+unsigned int radix_tree_gang_lookup(struct radix_tree_root *root,
+	void **results, unsigned long first_index, unsigned int max_items)
+{
+	return radix_tree_gang(root, results, first_index, max_items, -1);
+}
+
+/*
+ * Same as radix_tree_gang_lookup(), but only returns items which
+ * have 'tag' set, and does not descend into untagged subtrees.
+ */
+unsigned int radix_tree_gang_lookup_tag(struct radix_tree_root *root,
+	void **results, unsigned long first_index, unsigned int max_items,
+	int tag)
+{
+	return radix_tree_gang(root, results, first_index, max_items, tag);
+}
+
+static unsigned long __init __maxindex(unsigned int height)
+{
+	unsigned int bits = height * RADIX_TREE_MAP_SHIFT;
+
+	if (bits >= RADIX_TREE_INDEX_BITS)
+		return ~0UL;
+	return (1UL << bits) - 1;
+}
+
+void __init radix_tree_init(void)
+{
+	unsigned int i;
+
+	radix_tree_node_cachep = kmem_cache_create("radix_tree_node",
+			sizeof(struct radix_tree_node), 0,
+			SLAB_HWCACHE_ALIGN, NULL, NULL);
+	if (!radix_tree_node_cachep)
+		panic("Cannot create radix_tree_node cache");
+
+	for (i = 0; i < RADIX_TREE_MAX_PATH; i++)
+		height_to_maxindex[i] = __maxindex(i);
+}
@@ -22,6 +22,7 @@
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/mm.h>
+#include <linux/kernel_stat.h>
 
 #include <asm/pgalloc.h>
 #include <asm/uaccess.h>
@@ -41,12 +42,12 @@
  */
 
 atomic_t page_cache_size = ATOMIC_INIT(0);
-unsigned int page_hash_bits;
-struct page **page_hash_table;
 
-spinlock_t pagecache_lock = SPIN_LOCK_UNLOCKED;
 /*
- * NOTE: to avoid deadlocking you must never acquire the pagecache_lock with
+ * Each address_space indexes its pages in page_tree, under its own
+ * page_lock.
+ *
+ * NOTE: to avoid deadlocking you must never acquire a page_lock with
  *       the pagemap_lru_lock held.
  */
 spinlock_t pagemap_lru_lock = SPIN_LOCK_UNLOCKED;
@@ -54,26 +55,22 @@ spinlock_t pagemap_lru_lock = SPIN_LOCK_UNLOCKED;
 #define CLUSTER_PAGES		(1 << page_cluster)
 #define CLUSTER_OFFSET(x)	(((x) >> page_cluster) << page_cluster)
 
-void __add_page_to_hash_queue(struct page * page, struct page **p)
-{
-	atomic_inc(&page_cache_size);
-	if((page->next_hash = *p) != NULL)
-		(*p)->pprev_hash = &page->next_hash;
-	*p = page;
-	page->pprev_hash = p;
-	if (page->buffers)
-		PAGE_BUG(page);
-}
+/*
+ * How many pages the gang lookups below grab at a time.
+ */
+#define PAGEVEC_SIZE		16
 
-static void remove_page_from_hash_queue(struct page * page)
+/*
+ * Called with the mapping's page_lock held.
+ */
+static inline void __remove_inode_page(struct page *page)
 {
-	if(page->pprev_hash) {
-		if(page->next_hash)
-			page->next_hash->pprev_hash = page->pprev_hash;
-		*page->pprev_hash = page->next_hash;
-		page->pprev_hash = NULL;
-	}
+	struct address_space *mapping = page->mapping;
+
+	radix_tree_delete(&mapping->page_tree, page->index);
+	mapping->nrpages--;
 	atomic_dec(&page_cache_size);
+	page->mapping = NULL;
 }
 
 /*
@@ -83,41 +80,44 @@ static void remove_page_from_hash_queue(struct page * page)
  */
 void remove_inode_page(struct page *page)
 {
+	struct address_space *mapping = page->mapping;
+
 	if (!PageLocked(page))
 		PAGE_BUG(page);
 
-	spin_lock(&pagecache_lock);
-	remove_page_from_inode_queue(page);
-	remove_page_from_hash_queue(page);
-	page->mapping = NULL;
-	spin_unlock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
+	__remove_inode_page(page);
+	spin_unlock(&mapping->page_lock);
 }
 
 void invalidate_inode_pages(struct inode * inode)
 {
-	struct list_head *head, *curr;
-	struct page * page;
+	struct address_space *mapping = &inode->i_data;
+	struct page *pages[PAGEVEC_SIZE];
+	unsigned long index = 0;
+	int i, nr;
 
-	head = &inode->i_data.pages;
-	spin_lock(&pagecache_lock);
-	curr = head->next;
+	spin_lock(&mapping->page_lock);
+	while ((nr = radix_tree_gang_lookup(&mapping->page_tree,
+				(void **) pages, index, PAGEVEC_SIZE)) != 0) {
+		for (i = 0; i < nr; i++) {
+			struct page *page = pages[i];
 
-	while (curr != head) {
-		page = list_entry(curr, struct page, list);
-		curr = curr->next;
+			index = page->index + 1;
 
-		/* We cannot invalidate a locked page */
-		if (PageLocked(page))
-			continue;
+			/* We cannot invalidate a locked page */
+			if (PageLocked(page))
+				continue;
 
-		lru_cache_del(page);
+			lru_cache_del(page);
 
-		remove_page_from_inode_queue(page);
-		remove_page_from_hash_queue(page);
-		page->mapping = NULL;
-		page_cache_release(page);
+			__remove_inode_page(page);
+			page_cache_release(page);
+		}
+		if (!index)
+			break;
 	}
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 }
 
 /*
@@ -126,31 +126,57 @@ void invalidate_inode_pages(struct inode * inode)
  */
 void truncate_inode_pages(struct inode * inode, unsigned long start)
 {
-	struct list_head *head, *curr;
-	struct page * page;
+	struct address_space *mapping = &inode->i_data;
+	struct page *pages[PAGEVEC_SIZE];
 	unsigned partial = start & (PAGE_CACHE_SIZE - 1);
+	int i, nr;
 
 	start = (start + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
 
-repeat:
-	head = &inode->i_data.pages;
-	spin_lock(&pagecache_lock);
-	curr = head->next;
-	while (curr != head) {
-		unsigned long offset;
+	/*
+	 * Clear the end of the one partial page, the one preceeding
+	 * the first wholly truncated page.
+	 */
+	if (partial) {
+		struct page *page = find_lock_page(mapping, start - 1);
 
-		page = list_entry(curr, struct page, list);
-		curr = curr->next;
+		if (page) {
+			memclear_highpage_flush(page, partial, PAGE_CACHE_SIZE-partial);
+			if (inode->i_op->flushpage)
+				inode->i_op->flushpage(inode, page, partial);
+			UnlockPage(page);
+			page_cache_release(page);
+		}
+	}
 
-		offset = page->index;
+	/*
+	 * Only pages from 'start' on are looked at. The lock is dropped
+	 * while a batch is freed, so each batch is looked up afresh.
+	 * It's not possible to loop forever here because the pages of
+	 * the previous batch are gone.
+	 */
+	for (;;) {
+		spin_lock(&mapping->page_lock);
+		nr = radix_tree_gang_lookup(&mapping->page_tree,
+				(void **) pages, start, PAGEVEC_SIZE);
+		for (i = 0; i < nr; i++)
+			get_page(pages[i]);
+		spin_unlock(&mapping->page_lock);
+		if (!nr)
+			break;
 
-		/* page wholly truncated - free it */
-		if (offset >= start) {
-			get_page(page);
-			spin_unlock(&pagecache_lock);
+		for (i = 0; i < nr; i++) {
+			struct page *page = pages[i];
 
 			lock_page(page);
 
+			/* Raced with another truncate? */
+			if (page->mapping != mapping) {
+				UnlockPage(page);
+				page_cache_release(page);
+				continue;
+			}
+
 			if (!inode->i_op->flushpage ||
 			    inode->i_op->flushpage(inode, page, 0))
 				lru_cache_del(page);
@@ -168,74 +194,99 @@ repeat:
 			UnlockPage(page);
 			page_cache_release(page);
 			page_cache_release(page);
-
-			/*
-			 * We have done things without the pagecache lock,
-			 * so we'll have to repeat the scan.
-			 * It's not possible to deadlock here because
-			 * we are guaranteed to make progress. (ie. we have
-			 * just removed a page)
-			 */
-			goto repeat;
 		}
-		/*
-		 * there is only one partial page possible.
-		 */
-		if (!partial)
-			continue;
+	}
+}
 
-		/* and it's the one preceeding the first wholly truncated page */
-		if ((offset + 1) != start)
-			continue;
+/*
+ * Refault detection: a hashed bitmap remembers which page cache
+ * slots were reclaimed recently. A page added back to one of them
+ * before the bit is cleared again counts as a refault, which tells
+ * us that the inactive list was too short to hold the working set.
+ */
+#define EVICTED_BITS	(PAGE_SIZE * 8)
 
-		/* partial truncate, clear end of page */
-		get_page(page);
-		spin_unlock(&pagecache_lock);
+static unsigned long evicted_map[EVICTED_BITS / BITS_PER_LONG];
 
-		lock_page(page);
+static inline unsigned long evicted_hashfn(struct address_space * mapping,
+	unsigned long index)
+{
+#define i (((unsigned long) mapping)/(sizeof(struct inode) & ~ (sizeof(struct inode) - 1)))
+	return (i + index) & (EVICTED_BITS - 1);
+#undef i
+}
 
-		memclear_highpage_flush(page, partial, PAGE_CACHE_SIZE-partial);
-		if (inode->i_op->flushpage)
-			inode->i_op->flushpage(inode, page, partial);
+/*
+ * Age an active list: pages referenced since the last pass go back
+ * to its head, the others move to the inactive list. We only do
+ * this while the inactive list is the shorter one, so that each
+ * page type keeps a balanced pair of lists.
+ *
+ * Called with the pagemap_lru_lock held.
+ */
+static void refill_inactive(int type, int priority)
+{
+	struct list_head * active = &active_list[type];
+	struct list_head * page_lru;
+	struct page * page;
+	int count;
 
-		partial = 0;
+	count = nr_active_pages[type] / (priority+1);
 
-		/*
-		 * we have dropped the spinlock so we have to
-		 * restart.
-		 */
-		UnlockPage(page);
-		page_cache_release(page);
-		goto repeat;
+	while (count-- > 0 && nr_inactive_pages[type] < nr_active_pages[type] &&
+	       (page_lru = active->prev) != active) {
+		page = list_entry(page_lru, struct page, lru);
+		list_del(page_lru);
+
+		if (test_and_clear_bit(PG_referenced, &page->flags)) {
+			list_add(page_lru, active);
+			continue;
+		}
+
+		ClearPageActive(page);
+		list_add(page_lru, &inactive_list[type]);
+		nr_active_pages[type]--;
+		nr_inactive_pages[type]++;
+		kstat.pgdeactivate++;
 	}
-	spin_unlock(&pagecache_lock);
 }
 
-int shrink_mmap(int priority, int gfp_mask)
+/*
+ * Try to free one page from the tail of an inactive list.
+ *
+ * Called with the pagemap_lru_lock held, returns with it held.
+ */
+static int shrink_inactive(int type, int priority, int gfp_mask)
 {
+	struct list_head * inactive = &inactive_list[type];
 	int ret = 0, count;
 	LIST_HEAD(young);
 	LIST_HEAD(old);
-	LIST_HEAD(forget);
 	struct list_head * page_lru, * dispose;
+	struct address_space * mapping;
 	struct page * page;
 
-	count = nr_lru_pages / (priority+1);
-
-	spin_lock(&pagemap_lru_lock);
+	count = nr_inactive_pages[type] / (priority+1);
 
-	while (count > 0 && (page_lru = lru_cache.prev) != &lru_cache) {
+	while (count > 0 && (page_lru = inactive->prev) != inactive) {
 		page = list_entry(page_lru, struct page, lru);
 		list_del(page_lru);
+		ClearPageLRU(page);
+		kstat.pgscan++;
 
-		dispose = &lru_cache;
-		if (test_and_clear_bit(PG_referenced, &page->flags))
-			/* Roll the page at the top of the lru list,
-			 * we could also be more aggressive putting
-			 * the page in the young-dispose-list, so
-			 * avoiding to free young pages in each pass.
+		dispose = inactive;
+		if (test_and_clear_bit(PG_referenced, &page->flags)) {
+			/* A mapped page was found referenced through one
+			 * of its ptes: it is in use, activate it.
+			 */
+			if (page->pte_chain)
+				goto activate_continue;
+			/* Give the page another trip down the inactive
+			 * list: if it is referenced again before it gets
+			 * back here, mark_page_accessed() activates it.
 			 */
 			goto dispose_continue;
+		}
 
 		dispose = &old;
 		/* don't account passes over not DMA pages */
@@ -254,25 +305,23 @@ int shrink_mmap(int priority, int gfp_mask)
 		   queued in any lru queue since we have just locked down
 		   the page so nobody else may SMP race with us running
 		   a lru_cache_del() (lru_cache_del() always run with the
-		   page locked down ;). */
+		   page locked down ;). PG_lru is clear, so nobody will
+		   try to activate it either. */
 		spin_unlock(&pagemap_lru_lock);
 
+		/* Drop the page from the page tables mapping it */
+		if (page->pte_chain && try_to_unmap(page) != SWAP_SUCCESS)
+			goto unlock_noput_continue;
+
 		/* avoid unscalable SMP locking */
 		if (!page->buffers && page_count(page) > 1)
 			goto unlock_noput_continue;
 
-		/* Take the pagecache_lock spinlock held to avoid
-		   other tasks to notice the page while we are looking at its
-		   page count. If it's a pagecache-page we'll free it
-		   in one atomic transaction after checking its page count. */
-		spin_lock(&pagecache_lock);
-
 		/* avoid freeing the page while it's locked */
 		get_page(page);
 
 		/* Is it a buffer page? */
 		if (page->buffers) {
-			spin_unlock(&pagecache_lock);
 			if (!try_to_free_buffers(page))
 				goto unlock_continue;
 			/* page was locked, inode can't go away under us */
@@ -280,9 +329,24 @@ int shrink_mmap(int priority, int gfp_mask)
 				atomic_dec(&buffermem_pages);
 				goto made_buffer_progress;
 			}
-			spin_lock(&pagecache_lock);
 		}
 
+		/* The page is locked, so its mapping can't change */
+		mapping = page->mapping;
+		if (!mapping) {
+			if (page_count(page) == 2) {
+				printk(KERN_ERR "shrink_mmap: unknown LRU page!\n");
+				goto forget_continue;
+			}
+			goto unlock_continue;
+		}
+
+		/* Take the mapping's page_lock to avoid other tasks
+		   noticing the page while we are looking at its page
+		   count. If it's a pagecache-page we'll free it in one
+		   atomic transaction after checking its page count. */
+		spin_lock(&mapping->page_lock);
+
 		/*
 		 * We can't free pages unless there's just one user
 		 * (count == 2 because we added one ourselves above).
@@ -296,48 +360,63 @@ int shrink_mmap(int priority, int gfp_mask)
 		 * were to be marked referenced..
 		 */
 		if (PageSwapCache(page)) {
-			spin_unlock(&pagecache_lock);
+			set_bit(evicted_hashfn(mapping, page->index), evicted_map);
+			spin_unlock(&mapping->page_lock);
 			__delete_from_swap_cache(page);
 			goto made_inode_progress;
 		}	
 
-		/* is it a page-cache page? */
-		if (page->mapping) {
-			dispose = &old;
-			if (!pgcache_under_min())
-			{
-				remove_page_from_inode_queue(page);
-				remove_page_from_hash_queue(page);
-				page->mapping = NULL;
-				spin_unlock(&pagecache_lock);
-				goto made_inode_progress;
-			}
-			goto cache_unlock_continue;
+		/* it's a page-cache page */
+		dispose = &old;
+		if (!pgcache_under_min())
+		{
+			set_bit(evicted_hashfn(mapping, page->index), evicted_map);
+			__remove_inode_page(page);
+			spin_unlock(&mapping->page_lock);
+			goto made_inode_progress;
 		}
 
-		dispose = &forget;
-		printk(KERN_ERR "shrink_mmap: unknown LRU page!\n");
-
 cache_unlock_continue:
-		spin_unlock(&pagecache_lock);
+		spin_unlock(&mapping->page_lock);
 unlock_continue:
+		/* Requeue the page before unlocking it: a truncate
+		   waiting for the page lock will lru_cache_del() it
+		   right away. */
+		spin_lock(&pagemap_lru_lock);
+		list_add(page_lru, dispose);
+		SetPageLRU(page);
 		UnlockPage(page);
 		put_page(page);
-dispose_relock_continue:
-		/* even if the dispose list is local, a truncate_inode_page()
-		   may remove a page from its queue so always
-		   synchronize with the lru lock while accesing the
-		   page->lru field */
+		continue;
+
+unlock_noput_continue:
 		spin_lock(&pagemap_lru_lock);
 		list_add(page_lru, dispose);
+		SetPageLRU(page);
+		UnlockPage(page);
 		continue;
 
-unlock_noput_continue:
+forget_continue:
+		/* Nobody else knows about the page, drop it from the LRU */
+		spin_lock(&pagemap_lru_lock);
+		nr_inactive_pages[type]--;
+		nr_lru_pages--;
 		UnlockPage(page);
-		goto dispose_relock_continue;
+		put_page(page);
+		continue;
+
+activate_continue:
+		list_add(page_lru, &active_list[type]);
+		SetPageActive(page);
+		SetPageLRU(page);
+		nr_inactive_pages[type]--;
+		nr_active_pages[type]++;
+		kstat.pgactivate++;
+		continue;
 
 dispose_continue:
 		list_add(page_lru, dispose);
+		SetPageLRU(page);
 	}
 	goto out;
 
@@ -348,37 +427,84 @@ made_buffer_progress:
 	put_page(page);
 	ret = 1;
 	spin_lock(&pagemap_lru_lock);
-	/* nr_lru_pages needs the spinlock */
+	/* the LRU counts need the spinlock */
+	nr_inactive_pages[type]--;
 	nr_lru_pages--;
+	kstat.pgsteal++;
 
 out:
-	list_splice(&young, &lru_cache);
-	list_splice(&old, lru_cache.prev);
-
-	spin_unlock(&pagemap_lru_lock);
+	list_splice(&young, inactive);
+	list_splice(&old, inactive->prev);
 
 	return ret;
 }
 
-static inline struct page * __find_page_nolock(struct address_space *mapping, unsigned long offset, struct page *page)
+/*
+ * Free a page from the page cache. File pages are tried first:
+ * they don't need any swap I/O, and swap cache pages that are
+ * still mapped are only freed once swap_out() has unmapped them.
+ */
+int shrink_mmap(int priority, int gfp_mask)
 {
-	goto inside;
+	int type, ret = 0;
 
-	for (;;) {
-		page = page->next_hash;
-inside:
-		if (!page)
-			goto not_found;
-		if (page->mapping != mapping)
-			continue;
-		if (page->index == offset)
+	spin_lock(&pagemap_lru_lock);
+	for (type = 0; type < NR_LRU_TYPES; type++) {
+		refill_inactive(type, priority);
+		if (shrink_inactive(type, priority, gfp_mask)) {
+			ret = 1;
 			break;
+		}
 	}
-	set_bit(PG_referenced, &page->flags);
-not_found:
+	spin_unlock(&pagemap_lru_lock);
+
+	return ret;
+}
+
+/*
+ * Called with the mapping's page_lock held.
+ */
+static inline struct page * __find_page_nolock(struct address_space *mapping, unsigned long offset)
+{
+	struct page *page;
+
+	page = radix_tree_lookup(&mapping->page_tree, offset);
+	if (page)
+		mark_page_accessed(page);
 	return page;
 }
 
+/*
+ * A buffer of a page-cache page has been marked dirty: tag the
+ * page, so that do_buffer_fdatasync() finds it.
+ */
+void page_cache_tag_dirty(struct page *page)
+{
+	struct address_space *mapping = page->mapping;
+
+	if (!mapping)
+		return;
+	spin_lock(&mapping->page_lock);
+	if (page->mapping == mapping)
+		radix_tree_tag_set(&mapping->page_tree, page->index,
+				PAGECACHE_TAG_DIRTY);
+	spin_unlock(&mapping->page_lock);
+}
+
+static int page_buffers_test(struct page *page, int bit)
+{
+	struct buffer_head *bh, *head = page->buffers;
+
+	if (!head)
+		return 0;
+	bh = head;
+	do {
+		if (test_bit(bit, &bh->b_state))
+			return 1;
+	} while ((bh = bh->b_this_page) != head);
+	return 0;
+}
+
 /*
  * By the time this is called, the page is locked and
  * we don't have to worry about any races any more.
@@ -387,67 +513,92 @@ not_found:
  */
 static int writeout_one_page(struct page *page)
 {
+	struct address_space *mapping = page->mapping;
 	struct buffer_head *bh, *head = page->buffers;
 
 	bh = head;
-	do {
+	if (bh) do {
 		if (buffer_locked(bh) || !buffer_dirty(bh) || !buffer_uptodate(bh))
 			continue;
 
 		bh->b_flushtime = 0;
 		ll_rw_block(WRITE, 1, &bh);	
 	} while ((bh = bh->b_this_page) != head);
+
+	/*
+	 * Buffers that were locked above are still dirty. Anything in
+	 * flight, ours or not, has to be waited for in the second pass.
+	 */
+	spin_lock(&mapping->page_lock);
+	if (!page_buffers_test(page, BH_Dirty))
+		radix_tree_tag_clear(&mapping->page_tree, page->index,
+				PAGECACHE_TAG_DIRTY);
+	if (page_buffers_test(page, BH_Lock))
+		radix_tree_tag_set(&mapping->page_tree, page->index,
+				PAGECACHE_TAG_WRITEBACK);
+	spin_unlock(&mapping->page_lock);
 	return 0;
 }
 
 static int waitfor_one_page(struct page *page)
 {
+	struct address_space *mapping = page->mapping;
 	int error = 0;
 	struct buffer_head *bh, *head = page->buffers;
 
 	bh = head;
-	do {
+	if (bh) do {
 		wait_on_buffer(bh);
 		if (buffer_req(bh) && !buffer_uptodate(bh))
 			error = -EIO;
 	} while ((bh = bh->b_this_page) != head);
+
+	spin_lock(&mapping->page_lock);
+	radix_tree_tag_clear(&mapping->page_tree, page->index,
+			PAGECACHE_TAG_WRITEBACK);
+	spin_unlock(&mapping->page_lock);
 	return error;
 }
 
-static int do_buffer_fdatasync(struct inode *inode, unsigned long start, unsigned long end, int (*fn)(struct page *))
+/*
+ * Call 'fn' on the pages in [start, end) which carry 'tag'.
+ */
+static int do_buffer_fdatasync(struct inode *inode, unsigned long start, unsigned long end, int tag, int (*fn)(struct page *))
 {
-	struct list_head *head, *curr;
-	struct page *page;
+	struct address_space *mapping = &inode->i_data;
+	struct page *pages[PAGEVEC_SIZE];
 	int retval = 0;
+	int i, nr;
+
+	while (start < end) {
+		spin_lock(&mapping->page_lock);
+		nr = radix_tree_gang_lookup_tag(&mapping->page_tree,
+				(void **) pages, start, PAGEVEC_SIZE, tag);
+		for (i = 0; i < nr; i++)
+			get_page(pages[i]);
+		if (nr)
+			start = pages[nr-1]->index + 1;
+		spin_unlock(&mapping->page_lock);
+		if (!nr)
+			break;
 
-	head = &inode->i_data.pages;
-
-	spin_lock(&pagecache_lock);
-	curr = head->next;
-	while (curr != head) {
-		page = list_entry(curr, struct page, list);
-		curr = curr->next;
-		if (!page->buffers)
-			continue;
-		if (page->index >= end)
-			continue;
-		if (page->index < start)
-			continue;
+		for (i = 0; i < nr; i++) {
+			struct page *page = pages[i];
 
-		get_page(page);
-		spin_unlock(&pagecache_lock);
-		lock_page(page);
+			if (page->index < end) {
+				lock_page(page);
 
-		/* The buffers could have been free'd while we waited for the page lock */
-		if (page->buffers)
-			retval |= fn(page);
+				/* The page could have been truncated while we waited for the lock */
+				if (page->mapping == mapping)
+					retval |= fn(page);
 
-		UnlockPage(page);
-		spin_lock(&pagecache_lock);
-		curr = page->list.next;
-		page_cache_release(page);
+				UnlockPage(page);
+			}
+			page_cache_release(page);
+		}
+		if (!start)
+			break;
 	}
-	spin_unlock(&pagecache_lock);
 
 	return retval;
 }
@@ -462,58 +613,73 @@ int generic_buffer_fdatasync(struct inode *inode, unsigned long start, unsigned
 	unsigned long end_idx = (end + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
 	int retval;
 
-	retval = do_buffer_fdatasync(inode, start_idx, end_idx, writeout_one_page);
-	retval |= do_buffer_fdatasync(inode, start_idx, end_idx, waitfor_one_page);
+	retval = do_buffer_fdatasync(inode, start_idx, end_idx, PAGECACHE_TAG_DIRTY, writeout_one_page);
+	retval |= do_buffer_fdatasync(inode, start_idx, end_idx, PAGECACHE_TAG_WRITEBACK, waitfor_one_page);
 	return retval;
 }
 
 /*
  * This adds a page to the page cache, starting out as locked,
  * owned by us, referenced, but not uptodate and with no errors.
+ *
+ * Called with the mapping's page_lock held, after a successful
+ * radix_tree_preload() and a failed lookup at 'offset'.
  */
 static inline void __add_to_page_cache(struct page * page,
-	struct address_space *mapping, unsigned long offset,
-	struct page **hash)
+	struct address_space *mapping, unsigned long offset)
 {
-	struct page *alias;
 	unsigned long flags;
 
+	if (page->buffers)
+		PAGE_BUG(page);
+	if (radix_tree_insert(&mapping->page_tree, offset, page))
+		BUG();
 	flags = page->flags & ~((1 << PG_uptodate) | (1 << PG_error) | (1 << PG_referenced));
 	page->flags = flags | (1 << PG_locked);
 	get_page(page);
 	page->index = offset;
-	add_page_to_inode_queue(mapping, page);
-	__add_page_to_hash_queue(page, hash);
+	page->mapping = mapping;
+	mapping->nrpages++;
+	atomic_inc(&page_cache_size);
+	if (test_and_clear_bit(evicted_hashfn(mapping, offset), evicted_map))
+		kstat.pgrefault++;
 	lru_cache_add(page);
-	alias = __find_page_nolock(mapping, offset, *hash);
-	if (alias != page)
-		BUG();
 }
 
+/*
+ * The caller must have done a radix_tree_preload(), and not
+ * slept since.
+ */
 void add_to_page_cache(struct page * page, struct address_space * mapping, unsigned long offset)
 {
-	spin_lock(&pagecache_lock);
-	__add_to_page_cache(page, mapping, offset, page_hash(mapping, offset));
-	spin_unlock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
+	__add_to_page_cache(page, mapping, offset);
+	spin_unlock(&mapping->page_lock);
 }
 
+/*
+ * Returns 0 if the page was added, 1 if there already is a page
+ * at 'offset', and -ENOMEM if the page cache index could not grow.
+ */
 int add_to_page_cache_unique(struct page * page,
-	struct address_space *mapping, unsigned long offset,
-	struct page **hash)
+	struct address_space *mapping, unsigned long offset)
 {
 	int err;
 	struct page *alias;
 
-	spin_lock(&pagecache_lock);
-	alias = __find_page_nolock(mapping, offset, *hash);
+	if (radix_tree_preload(GFP_KERNEL))
+		return -ENOMEM;
+
+	spin_lock(&mapping->page_lock);
+	alias = __find_page_nolock(mapping, offset);
 
 	err = 1;
 	if (!alias) {
-		__add_to_page_cache(page,mapping,offset,hash);
+		__add_to_page_cache(page,mapping,offset);
 		err = 0;
 	}
 
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 	return err;
 }
 
@@ -524,21 +690,24 @@ int add_to_page_cache_unique(struct page * page,
 static inline int page_cache_read(struct file * file, unsigned long offset) 
 {
 	struct inode *inode = file->f_dentry->d_inode;
-	struct page **hash = page_hash(&inode->i_data, offset);
+	struct address_space *mapping = &inode->i_data;
 	struct page *page; 
+	int error;
 
-	spin_lock(&pagecache_lock);
-	page = __find_page_nolock(&inode->i_data, offset, *hash); 
-	spin_unlock(&pagecache_lock);
+	spin_lock(&mapping->page_lock);
+	page = __find_page_nolock(mapping, offset); 
+	spin_unlock(&mapping->page_lock);
 	if (page)
 		return 0;
 
-	page = page_cache_alloc();
+	/* The contents come from disk, the CPU cache won't help. */
+	page = page_cache_alloc_cold();
 	if (!page)
 		return -ENOMEM;
 
-	if (!add_to_page_cache_unique(page, &inode->i_data, offset, hash)) {
-		int error = inode->i_op->readpage(file, page);
+	error = add_to_page_cache_unique(page, mapping, offset);
+	if (!error) {
+		error = inode->i_op->readpage(file, page);
 		page_cache_release(page);
 		return error;
 	}
@@ -547,7 +716,7 @@ static inline int page_cache_read(struct file * file, unsigned long offset)
 	 * raced with us and added our page to the cache first.
 	 */
 	page_cache_free(page);
-	return 0;
+	return error < 0 ? error : 0;
 }
 
 /*
@@ -608,23 +777,23 @@ void lock_page(struct page *page)
 
 /*
  * a rather lightweight function, finding and getting a reference to a
- * hashed page atomically, waiting for it if it's locked.
+ * page-cache page atomically, waiting for it if it's locked.
  */
-struct page * __find_get_page (struct address_space *mapping,
-				unsigned long offset, struct page **hash)
+struct page * find_get_page (struct address_space *mapping,
+				unsigned long offset)
 {
 	struct page *page;
 
 	/*
-	 * We scan the hash list read-only. Addition to and removal from
-	 * the hash-list needs a held write-lock.
+	 * The page_lock keeps the page from being removed from the
+	 * page cache, and freed, before we hold a reference to it.
 	 */
 repeat:
-	spin_lock(&pagecache_lock);
-	page = __find_page_nolock(mapping, offset, *hash);
+	spin_lock(&mapping->page_lock);
+	page = __find_page_nolock(mapping, offset);
 	if (page)
 		get_page(page);
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 
 	/* Found the page, sleep if locked. */
 	if (page && PageLocked(page)) {
@@ -642,10 +811,10 @@ repeat:
 		remove_wait_queue(&page->wait, &wait);
 
 		/*
-		 * The page might have been unhashed meanwhile. It's
+		 * The page might have been removed meanwhile. It's
 		 * not freed though because we hold a reference to it.
 		 * If this is the case then it will be freed _here_,
-		 * and we recheck the hash anyway.
+		 * and we look it up again anyway.
 		 */
 		page_cache_release(page);
 		goto repeat;
@@ -660,21 +829,21 @@ repeat:
 /*
  * Get the lock to a page atomically.
  */
-struct page * __find_lock_page (struct address_space *mapping,
-				unsigned long offset, struct page **hash)
+struct page * find_lock_page (struct address_space *mapping,
+				unsigned long offset)
 {
 	struct page *page;
 
 	/*
-	 * We scan the hash list read-only. Addition to and removal from
-	 * the hash-list needs a held write-lock.
+	 * The page_lock keeps the page from being removed from the
+	 * page cache, and freed, before we hold a reference to it.
 	 */
 repeat:
-	spin_lock(&pagecache_lock);
-	page = __find_page_nolock(mapping, offset, *hash);
+	spin_lock(&mapping->page_lock);
+	page = __find_page_nolock(mapping, offset);
 	if (page)
 		get_page(page);
-	spin_unlock(&pagecache_lock);
+	spin_unlock(&mapping->page_lock);
 
 	/* Found the page, sleep if locked. */
 	if (page && TryLockPage(page)) {
@@ -692,10 +861,10 @@ repeat:
 		remove_wait_queue(&page->wait, &wait);
 
 		/*
-		 * The page might have been unhashed meanwhile. It's
+		 * The page might have been removed meanwhile. It's
 		 * not freed though because we hold a reference to it.
 		 * If this is the case then it will be freed _here_,
-		 * and we recheck the hash anyway.
+		 * and we look it up again anyway.
 		 */
 		page_cache_release(page);
 		goto repeat;
@@ -956,6 +1125,7 @@ void do_generic_file_read(struct file * filp, loff_t *ppos, read_descriptor_t *
 {
 	struct dentry *dentry = filp->f_dentry;
 	struct inode *inode = dentry->d_inode;
+	struct address_space *mapping = &inode->i_data;
 	unsigned long index, offset;
 	struct page *cached_page;
 	int reada_ok;
@@ -1006,7 +1176,7 @@ void do_generic_file_read(struct file * filp, loff_t *ppos, read_descriptor_t *
 	}
 
 	for (;;) {
-		struct page *page, **hash;
+		struct page *page;
 		unsigned long end_index, nr;
 
 		end_index = inode->i_size >> PAGE_CACHE_SHIFT;
@@ -1024,15 +1194,13 @@ void do_generic_file_read(struct file * filp, loff_t *ppos, read_descriptor_t *
 		/*
 		 * Try to find the data in the page cache..
 		 */
-		hash = page_hash(&inode->i_data, index);
-
-		spin_lock(&pagecache_lock);
-		page = __find_page_nolock(&inode->i_data, index, *hash);
+		spin_lock(&mapping->page_lock);
+		page = __find_page_nolock(mapping, index);
 		if (!page)
 			goto no_cached_page;
 found_page:
 		get_page(page);
-		spin_unlock(&pagecache_lock);
+		spin_unlock(&mapping->page_lock);
 
 		if (!Page_Uptodate(page))
 			goto page_not_up_to_date;
@@ -1099,32 +1267,37 @@ no_cached_page:
 		 * Ok, it wasn't cached, so we need to create a new
 		 * page..
 		 *
-		 * We get here with the page cache lock held.
+		 * We get here with the page_lock held. Drop it to
+		 * allocate the page and the index nodes for it.
 		 */
+		spin_unlock(&mapping->page_lock);
 		if (!cached_page) {
-			spin_unlock(&pagecache_lock);
 			cached_page = page_cache_alloc();
 			if (!cached_page) {
 				desc->error = -ENOMEM;
 				break;
 			}
-
-			/*
-			 * Somebody may have added the page while we
-			 * dropped the page cache lock. Check for that.
-			 */
-			spin_lock(&pagecache_lock);
-			page = __find_page_nolock(&inode->i_data, index, *hash);
-			if (page)
-				goto found_page;
+		}
+		if (radix_tree_preload(GFP_KERNEL)) {
+			desc->error = -ENOMEM;
+			break;
 		}
 
 		/*
-		 * Ok, add the new page to the hash-queues...
+		 * Somebody may have added the page while we
+		 * dropped the page_lock. Check for that.
+		 */
+		spin_lock(&mapping->page_lock);
+		page = __find_page_nolock(mapping, index);
+		if (page)
+			goto found_page;
+
+		/*
+		 * Ok, add the new page to the page cache...
 		 */
 		page = cached_page;
-		__add_to_page_cache(page, &inode->i_data, index, hash);
-		spin_unlock(&pagecache_lock);
+		__add_to_page_cache(page, mapping, index);
+		spin_unlock(&mapping->page_lock);
 		cached_page = NULL;
 
 		goto readpage;
@@ -1308,7 +1481,7 @@ static struct page * filemap_nopage(struct vm_area_struct * area,
 	struct file *file = area->vm_file;
 	struct dentry *dentry = file->f_dentry;
 	struct inode *inode = dentry->d_inode;
-	struct page *page, **hash, *old_page;
+	struct page *page, *old_page;
 	unsigned long size = (inode->i_size + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
 
 	unsigned long pgoff = ((address - area->vm_start) >> PAGE_CACHE_SHIFT) + area->vm_pgoff;
@@ -1326,9 +1499,8 @@ static struct page * filemap_nopage(struct vm_area_struct * area,
 	/*
 	 * Do we have something in the page cache already?
 	 */
-	hash = page_hash(&inode->i_data, pgoff);
 retry_find:
-	page = __find_get_page(&inode->i_data, pgoff, hash);
+	page = find_get_page(&inode->i_data, pgoff);
 	if (!page)
 		goto no_cached_page;
 
@@ -1525,6 +1697,7 @@ static inline int filemap_sync_pte(pte_t * ptep, struct vm_area_struct *vma,
 			return 0;
 		}
 		page = pte_page(pte);
+		page_remove_rmap(page, vma->vm_mm, address);
 		if (!pte_dirty(pte) || flags == MS_INVALIDATE) {
 			page_cache_free(page);
 			return 0;
@@ -1792,7 +1965,7 @@ generic_file_write(struct file *file, const char *buf,
 	struct inode	*inode = dentry->d_inode; 
 	unsigned long	limit = current->rlim[RLIMIT_FSIZE].rlim_cur;
 	loff_t		pos;
-	struct page	*page, **hash, *cached_page;
+	struct page	*page, *cached_page;
 	unsigned long	written;
 	long		status;
 	int		err;
@@ -1847,9 +2020,8 @@ generic_file_write(struct file *file, const char *buf,
 		if (bytes > count)
 			bytes = count;
 
-		hash = page_hash(&inode->i_data, index);
 repeat_find:
-		page = __find_lock_page(&inode->i_data, index, hash);
+		page = find_lock_page(&inode->i_data, index);
 		if (!page) {
 			if (!cached_page) {
 				cached_page = page_cache_alloc();
@@ -1859,7 +2031,10 @@ repeat_find:
 				break;
 			}
 			page = cached_page;
-			if (add_to_page_cache_unique(page, &inode->i_data, index, hash))
+			status = add_to_page_cache_unique(page, &inode->i_data, index);
+			if (status < 0)
+				break;
+			if (status)
 				goto repeat_find;
 
 			cached_page = NULL;
@@ -1915,30 +2090,3 @@ void put_cached_page(unsigned long addr)
 			page_count(page));
 	page_cache_release(page);
 }
-
-void __init page_cache_init(unsigned long mempages)
-{
-	unsigned long htable_size, order;
-
-	htable_size = mempages;
-	htable_size *= sizeof(struct page *);
-	for(order = 0; (PAGE_SIZE << order) < htable_size; order++)
-		;
-
-	do {
-		unsigned long tmp = (PAGE_SIZE << order) / sizeof(struct page *);
-
-		page_hash_bits = 0;
-		while((tmp >>= 1UL) != 0UL)
-			page_hash_bits++;
-
-		page_hash_table = (struct page **)
-			__get_free_pages(GFP_ATOMIC, order);
-	} while(page_hash_table == NULL && --order > 0);
-
-	printk("Page-cache hash table entries: %d (order: %ld, %ld bytes)\n",
-	       (1 << page_hash_bits), order, (PAGE_SIZE << order));
-	if (!page_hash_table)
-		panic("Failed to allocate page hash table\n");
-	memset((void *)page_hash_table, 0, PAGE_HASH_SIZE * sizeof(struct page *));
-}
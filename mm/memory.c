@@ -46,6 +46,7 @@
 #include <asm/pgalloc.h>
 #include <linux/highmem.h>
 #include <linux/pagemap.h>
+#include <linux/hugetlb.h>
 
 
 unsigned long max_mapnr = 0;
@@ -166,6 +167,9 @@ int copy_page_range(struct mm_struct *dst, struct mm_struct *src,
 	unsigned long address = vma->vm_start;
 	unsigned long end = vma->vm_end;
 	unsigned long cow = (vma->vm_flags & (VM_SHARED | VM_MAYWRITE)) == VM_MAYWRITE;
+
+	if (is_vm_hugetlb_page(vma))
+		return copy_hugetlb_page_range(dst, src, vma);
 	
 	src_pgd = pgd_offset(src, address)-1;
 	dst_pgd = pgd_offset(dst, address)-1;
@@ -247,6 +251,7 @@ skip_copy_pte_range:		address = (address + PMD_SIZE) & PMD_MASK;
 					pte = pte_mkclean(pte);
 				set_pte(dst_pte, pte_mkold(pte));
 				get_page(mem_map + page_nr);
+				page_add_rmap(mem_map + page_nr, dst, address);
 			
 cont_copy_pte_range:		address += PAGE_SIZE;
 				if (address >= end)
@@ -269,12 +274,13 @@ nomem:
 /*
  * Return indicates whether a page was freed so caller can adjust rss
  */
-static inline int free_pte(pte_t page)
+static inline int free_pte(struct mm_struct *mm, unsigned long address, pte_t page)
 {
 	if (pte_present(page)) {
 		unsigned long nr = pte_pagenr(page);
 		if (nr >= max_mapnr || PageReserved(mem_map+nr))
 			return 0;
+		page_remove_rmap(mem_map+nr, mm, address);
 		/* 
 		 * free_page() used to be able to clear swap cache
 		 * entries.  We may now have to do it manually.  
@@ -286,11 +292,11 @@ static inline int free_pte(pte_t page)
 	return 0;
 }
 
-static inline void forget_pte(pte_t page)
+static inline void forget_pte(struct mm_struct *mm, unsigned long address, pte_t page)
 {
 	if (!pte_none(page)) {
 		printk("forget_pte: old mapping existed!\n");
-		free_pte(page);
+		free_pte(mm, address, page);
 	}
 }
 
@@ -307,9 +313,8 @@ static inline int zap_pte_range(struct mm_struct *mm, pmd_t * pmd, unsigned long
 		return 0;
 	}
 	pte = pte_offset(pmd, address);
-	address &= ~PMD_MASK;
-	if (address + size > PMD_SIZE)
-		size = PMD_SIZE - address;
+	if ((address & ~PMD_MASK) + size > PMD_SIZE)
+		size = PMD_SIZE - (address & ~PMD_MASK);
 	size >>= PAGE_SHIFT;
 	freed = 0;
 	for (;;) {
@@ -320,9 +325,9 @@ static inline int zap_pte_range(struct mm_struct *mm, pmd_t * pmd, unsigned long
 		pte++;
 		size--;
 		pte_clear(pte-1);
-		if (pte_none(page))
-			continue;
-		freed += free_pte(page);
+		if (!pte_none(page))
+			freed += free_pte(mm, address, page);
+		address += PAGE_SIZE;
 	}
 	return freed;
 }
@@ -330,7 +335,7 @@ static inline int zap_pte_range(struct mm_struct *mm, pmd_t * pmd, unsigned long
 static inline int zap_pmd_range(struct mm_struct *mm, pgd_t * dir, unsigned long address, unsigned long size)
 {
 	pmd_t * pmd;
-	unsigned long end;
+	unsigned long base, end;
 	int freed;
 
 	if (pgd_none(*dir))
@@ -341,13 +346,14 @@ static inline int zap_pmd_range(struct mm_struct *mm, pgd_t * dir, unsigned long
 		return 0;
 	}
 	pmd = pmd_offset(dir, address);
+	base = address & PGDIR_MASK;
 	address &= ~PGDIR_MASK;
 	end = address + size;
 	if (end > PGDIR_SIZE)
 		end = PGDIR_SIZE;
 	freed = 0;
 	do {
-		freed += zap_pte_range(mm, pmd, address, end - address);
+		freed += zap_pte_range(mm, pmd, base + address, end - address);
 		address = (address + PMD_SIZE) & PMD_MASK; 
 		pmd++;
 	} while (address < end);
@@ -403,7 +409,11 @@ static struct page * follow_page(unsigned long address)
 	pgd = pgd_offset(current->mm, address);
 	pmd = pmd_offset(pgd, address);
 	if (pmd) {
-		pte_t * pte = pte_offset(pmd, address);
+		pte_t * pte;
+
+		if (pmd_huge(*pmd))
+			return follow_huge_pmd(current->mm, address, pmd);
+		pte = pte_offset(pmd, address);
 		if (pte && pte_present(*pte))
 			return pte_page(*pte);
 	}
@@ -572,8 +582,9 @@ void unmap_kiobuf (struct kiobuf *iobuf)
 static inline void zeromap_pte_range(pte_t * pte, unsigned long address,
                                      unsigned long size, pgprot_t prot)
 {
-	unsigned long end;
+	unsigned long base, end;
 
+	base = address & PMD_MASK;
 	address &= ~PMD_MASK;
 	end = address + size;
 	if (end > PMD_SIZE)
@@ -582,7 +593,7 @@ static inline void zeromap_pte_range(pte_t * pte, unsigned long address,
 		pte_t zero_pte = pte_wrprotect(mk_pte(ZERO_PAGE(address), prot));
 		pte_t oldpage = *pte;
 		set_pte(pte, zero_pte);
-		forget_pte(oldpage);
+		forget_pte(current->mm, base + address, oldpage);
 		address += PAGE_SIZE;
 		pte++;
 	} while (address && (address < end));
@@ -591,8 +602,9 @@ static inline void zeromap_pte_range(pte_t * pte, unsigned long address,
 static inline int zeromap_pmd_range(pmd_t * pmd, unsigned long address,
                                     unsigned long size, pgprot_t prot)
 {
-	unsigned long end;
+	unsigned long base, end;
 
+	base = address & PGDIR_MASK;
 	address &= ~PGDIR_MASK;
 	end = address + size;
 	if (end > PGDIR_SIZE)
@@ -601,7 +613,7 @@ static inline int zeromap_pmd_range(pmd_t * pmd, unsigned long address,
 		pte_t * pte = pte_alloc(pmd, address);
 		if (!pte)
 			return -ENOMEM;
-		zeromap_pte_range(pte, address, end - address, prot);
+		zeromap_pte_range(pte, base + address, end - address, prot);
 		address = (address + PMD_SIZE) & PMD_MASK;
 		pmd++;
 	} while (address && (address < end));
@@ -642,8 +654,9 @@ int zeromap_page_range(unsigned long address, unsigned long size, pgprot_t prot)
 static inline void remap_pte_range(pte_t * pte, unsigned long address, unsigned long size,
 	unsigned long phys_addr, pgprot_t prot)
 {
-	unsigned long end;
+	unsigned long base, end;
 
+	base = address & PMD_MASK;
 	address &= ~PMD_MASK;
 	end = address + size;
 	if (end > PMD_SIZE)
@@ -656,7 +669,7 @@ static inline void remap_pte_range(pte_t * pte, unsigned long address, unsigned
 		mapnr = MAP_NR(__va(phys_addr));
 		if (mapnr >= max_mapnr || PageReserved(mem_map+mapnr))
  			set_pte(pte, mk_pte_phys(phys_addr, prot));
-		forget_pte(oldpage);
+		forget_pte(current->mm, base + address, oldpage);
 		address += PAGE_SIZE;
 		phys_addr += PAGE_SIZE;
 		pte++;
@@ -666,8 +679,9 @@ static inline void remap_pte_range(pte_t * pte, unsigned long address, unsigned
 static inline int remap_pmd_range(pmd_t * pmd, unsigned long address, unsigned long size,
 	unsigned long phys_addr, pgprot_t prot)
 {
-	unsigned long end;
+	unsigned long base, end;
 
+	base = address & PGDIR_MASK;
 	address &= ~PGDIR_MASK;
 	end = address + size;
 	if (end > PGDIR_SIZE)
@@ -677,7 +691,7 @@ static inline int remap_pmd_range(pmd_t * pmd, unsigned long address, unsigned l
 		pte_t * pte = pte_alloc(pmd, address);
 		if (!pte)
 			return -ENOMEM;
-		remap_pte_range(pte, address, end - address, address + phys_addr, prot);
+		remap_pte_range(pte, base + address, end - address, address + phys_addr, prot);
 		address = (address + PMD_SIZE) & PMD_MASK;
 		pmd++;
 	} while (address && (address < end));
@@ -744,6 +758,7 @@ struct page * put_dirty_page(struct task_struct * tsk, struct page *page,
 	}
 	flush_page_to_ram(page);
 	set_pte(pte, pte_mkwrite(mk_pte(page, PAGE_COPY)));
+	page_add_rmap(page, tsk->mm, address);
 /* no need for flush_tlb */
 	return page;
 }
@@ -824,6 +839,8 @@ static int do_wp_page(struct task_struct * tsk, struct vm_area_struct * vma,
 		flush_cache_page(vma, address);
 		set_pte(page_table, pte_mkwrite(pte_mkdirty(mk_pte(new_page, vma->vm_page_prot))));
 		flush_tlb_page(vma, address);
+		page_remove_rmap(old_page, tsk->mm, address);
+		page_add_rmap(new_page, tsk->mm, address);
 
 		/* Free the old page.. */
 		new_page = old_page;
@@ -1010,7 +1027,10 @@ static int do_swap_page(struct task_struct * tsk,
 		pte = mk_pte(page, vma->vm_page_prot);
 		pte = pte_mkwrite(pte_mkdirty(pte));
 	}
+	spin_lock(&vma->vm_mm->page_table_lock);
 	set_pte(page_table, pte);
+	page_add_rmap(page, vma->vm_mm, address);
+	spin_unlock(&vma->vm_mm->page_table_lock);
 	/* No need to invalidate - it was non-present before */
 	update_mmu_cache(vma, address, pte);
 	return 1;
@@ -1036,7 +1056,11 @@ static int do_anonymous_page(struct task_struct * tsk, struct vm_area_struct * v
 		tsk->min_flt++;
 		flush_page_to_ram(page);
 	}
+	spin_lock(&vma->vm_mm->page_table_lock);
 	set_pte(page_table, entry);
+	if (page)
+		page_add_rmap(page, vma->vm_mm, addr);
+	spin_unlock(&vma->vm_mm->page_table_lock);
 	/* No need to invalidate - it was non-present before */
 	update_mmu_cache(vma, addr, entry);
 	return 1;
@@ -1091,7 +1115,10 @@ static int do_no_page(struct task_struct * tsk, struct vm_area_struct * vma,
 	} else if (page_count(new_page) > 1 &&
 		   !(vma->vm_flags & VM_SHARED))
 		entry = pte_wrprotect(entry);
+	spin_lock(&vma->vm_mm->page_table_lock);
 	set_pte(page_table, entry);
+	page_add_rmap(new_page, vma->vm_mm, address);
+	spin_unlock(&vma->vm_mm->page_table_lock);
 	/* no need to invalidate: a not-present page shouldn't be cached */
 	update_mmu_cache(vma, address, entry);
 	return 1;
@@ -1160,6 +1187,10 @@ int handle_mm_fault(struct task_struct *tsk, struct vm_area_struct * vma,
 	pgd_t *pgd;
 	pmd_t *pmd;
 
+	/* Huge pages are mapped when the area is set up */
+	if (is_vm_hugetlb_page(vma))
+		return follow_huge_addr(vma->vm_mm, address) != NULL;
+
 	pgd = pgd_offset(vma->vm_mm, address);
 	pmd = pmd_alloc(pgd, address);
 	
@@ -8,6 +8,7 @@
 #include <linux/mman.h>
 #include <linux/smp_lock.h>
 #include <linux/pagemap.h>
+#include <linux/hugetlb.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgtable.h>
@@ -111,6 +112,10 @@ static int mlock_fixup(struct vm_area_struct * vma,
 	if (newflags == vma->vm_flags)
 		return 0;
 
+	/* Huge pages are never swapped, and the area mustn't be split */
+	if (is_vm_hugetlb_page(vma))
+		return 0;
+
 	if (start == vma->vm_start) {
 		if (end == vma->vm_end)
 			retval = mlock_fixup_all(vma, newflags);
@@ -12,6 +12,7 @@
 #include <linux/smp_lock.h>
 #include <linux/init.h>
 #include <linux/file.h>
+#include <linux/hugetlb.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgalloc.h>
@@ -170,6 +171,12 @@ unsigned long do_mmap(struct file * file, unsigned long addr, unsigned long len,
 	if (file && (!file->f_op || !file->f_op->mmap))
 		return -ENODEV;
 
+	if (is_hugetlb_mmap(flags)) {
+		if (file)
+			return -EINVAL;
+		return hugetlb_mmap(addr, len, prot, flags);
+	}
+
 	if ((len = PAGE_ALIGN(len)) == 0)
 		return addr;
 
@@ -654,6 +661,18 @@ int do_munmap(unsigned long addr, size_t len)
 	    && mm->map_count >= MAX_MAP_COUNT)
 		return -ENOMEM;
 
+	/* Huge page areas can only be cut at huge page boundaries */
+	for (free = mpnt; free && free->vm_start < addr+len; free = free->vm_next) {
+		unsigned long st, end;
+
+		if (!is_vm_hugetlb_page(free))
+			continue;
+		st = addr < free->vm_start ? free->vm_start : addr;
+		end = addr+len > free->vm_end ? free->vm_end : addr+len;
+		if (!is_aligned_hugepage_range(st, end - st))
+			return -EINVAL;
+	}
+
 	/*
 	 * We may need one additional vma to fix up the mappings ... 
 	 * and this is the last chance for an easy error exit.
@@ -699,7 +718,10 @@ int do_munmap(unsigned long addr, size_t len)
 		mm->map_count--;
 
 		flush_cache_range(mm, st, end);
-		zap_page_range(mm, st, size);
+		if (is_vm_hugetlb_page(mpnt))
+			unmap_hugepage_range(mpnt, st, end);
+		else
+			zap_page_range(mm, st, size);
 		flush_tlb_range(mm, st, end);
 
 		/*
@@ -830,7 +852,6 @@ void exit_mmap(struct mm_struct * mm)
 	vmlist_modify_lock(mm);
 	mm->mmap = mm->mmap_avl = mm->mmap_cache = NULL;
 	vmlist_modify_unlock(mm);
-	mm->rss = 0;
 	mm->total_vm = 0;
 	mm->locked_vm = 0;
 	while (mpnt) {
@@ -847,12 +868,16 @@ void exit_mmap(struct mm_struct * mm)
 		}
 		mm->map_count--;
 		remove_shared_vm_struct(mpnt);
-		zap_page_range(mm, start, size);
+		if (is_vm_hugetlb_page(mpnt))
+			unmap_hugepage_range(mpnt, start, end);
+		else
+			zap_page_range(mm, start, size);
 		if (mpnt->vm_file)
 			fput(mpnt->vm_file);
 		kmem_cache_free(vm_area_cachep, mpnt);
 		mpnt = next;
 	}
+	mm->rss = 0;
 
 	/* This is just debugging */
 	if (mm->map_count)
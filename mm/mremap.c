@@ -9,6 +9,7 @@
 #include <linux/shm.h>
 #include <linux/mman.h>
 #include <linux/swap.h>
+#include <linux/hugetlb.h>
 
 #include <asm/uaccess.h>
 #include <asm/pgalloc.h>
@@ -57,7 +58,8 @@ static inline pte_t *alloc_one_pte(struct mm_struct *mm, unsigned long addr)
 	return pte;
 }
 
-static inline int copy_one_pte(struct mm_struct *mm, pte_t * src, pte_t * dst)
+static inline int copy_one_pte(struct mm_struct *mm, pte_t * src, pte_t * dst,
+	unsigned long old_addr, unsigned long new_addr)
 {
 	int error = 0;
 	pte_t pte;
@@ -69,6 +71,10 @@ static inline int copy_one_pte(struct mm_struct *mm, pte_t * src, pte_t * dst)
 		if (dst) {
 			pte_clear(src);
 			set_pte(dst, pte);
+			if (pte_present(pte)) {
+				page_remove_rmap(pte_page(pte), mm, old_addr);
+				page_add_rmap(pte_page(pte), mm, new_addr);
+			}
 			error--;
 		}
 	}
@@ -83,7 +89,8 @@ static int move_one_page(struct mm_struct *mm, unsigned long old_addr, unsigned
 
 	src = get_one_pte(mm, old_addr);
 	if (src)
-		error = copy_one_pte(mm, src, alloc_one_pte(mm, new_addr));
+		error = copy_one_pte(mm, src, alloc_one_pte(mm, new_addr),
+				     old_addr, new_addr);
 	return error;
 }
 
@@ -194,6 +201,11 @@ asmlinkage unsigned long sys_mremap(unsigned long addr,
 	vma = find_vma(current->mm, addr);
 	if (!vma || vma->vm_start > addr)
 		goto out;
+	/* Huge page areas can't grow or move */
+	ret = -EINVAL;
+	if (is_vm_hugetlb_page(vma))
+		goto out;
+	ret = -EFAULT;
 	/* We can't remap across vm area boundaries */
 	if (old_len > vma->vm_end - addr)
 		goto out;
@@ -14,19 +14,51 @@
 #include <linux/interrupt.h>
 #include <linux/pagemap.h>
 #include <linux/bootmem.h>
+#include <linux/init.h>
 
 int nr_swap_pages = 0;
 int nr_lru_pages;
-LIST_HEAD(lru_cache);
 
-static zone_t zones [MAX_NR_ZONES] =
-	{
-		{ name: "DMA" },
-		{ name: "Normal" },
-		{ name: "HighMem" }
-	};
+static char *zone_names [MAX_NR_ZONES] = { "DMA", "Normal", "HighMem" };
 
-zonelist_t zonelists [NR_GFPINDEX];
+int numnodes = 1;
+pg_data_t node_data [MAX_NR_NODES];
+unsigned char cpu_to_node_map [NR_CPUS];
+
+/*
+ * "numa=fake=N" splits memory into N nodes of equal size, so
+ * that the node code can be exercised on a single-node machine.
+ * Nothing in the tree reports real memory topology yet, so fake
+ * nodes are the only source of numnodes > 1.
+ */
+static int numa_fake = 0;
+
+/*
+ * Memory is set up before the command line options are parsed,
+ * so the architecture calls this from its early mem= parsing.
+ */
+void __init numa_setup(char *str)
+{
+	if (!strncmp(str, "fake=", 5)) {
+		numa_fake = simple_strtoul(str+5, NULL, 0);
+		if (numa_fake > MAX_NR_NODES)
+			numa_fake = MAX_NR_NODES;
+	}
+}
+
+/* Already dealt with by numa_setup(), keep it away from init. */
+static int __init numa_late_setup(char *str)
+{
+	return 1;
+}
+
+__setup("numa=", numa_late_setup);
+
+/*
+ * Fake nodes are laid out in a line, the distance between two
+ * nodes is the number of nodes between them.
+ */
+#define node_distance(a,b)	((a) > (b) ? (a)-(b) : (b)-(a))
 
 /*
  * Free_page() adds the page to the free lists. This is optimized for
@@ -57,33 +89,15 @@ zonelist_t zonelists [NR_GFPINDEX];
  * Buddy system. Hairy. You really aren't expected to understand this
  *
  * Hint: -mask = 1+~mask
+ *
+ * Called with the zone lock held.
  */
-
-void __free_pages_ok (struct page *page, unsigned long order)
+static inline void __free_one_page (zone_t *zone, struct page *page,
+	unsigned long order)
 {
-	unsigned long index, page_idx, mask, flags;
+	unsigned long index, page_idx, mask;
 	free_area_t *area;
 	struct page *base;
-	zone_t *zone;
-
-	/*
-	 * Subtle. We do not want to test this in the inlined part of
-	 * __free_page() - it's a rare condition and just increases
-	 * cache footprint unnecesserily. So we do an 'incorrect'
-	 * decrement on page->count for reserved pages, but this part
-	 * makes it safe.
-	 */
-	if (PageReserved(page))
-		return;
-
-	if (page-mem_map >= max_mapnr)
-		BUG();
-	if (PageSwapCache(page))
-		BUG();
-	if (PageLocked(page))
-		BUG();
-
-	zone = page->zone;
 
 	mask = (~0UL) << order;
 	base = mem_map + zone->offset;
@@ -94,8 +108,6 @@ void __free_pages_ok (struct page *page, unsigned long order)
 
 	area = zone->free_area + order;
 
-	spin_lock_irqsave(&zone->lock, flags);
-
 	zone->free_pages -= mask;
 
 	while (mask + (1 << (MAX_ORDER-1))) {
@@ -125,7 +137,75 @@ void __free_pages_ok (struct page *page, unsigned long order)
 		page_idx &= mask;
 	}
 	memlist_add_head(&(base + page_idx)->list, &area->free_list);
+}
 
+/*
+ * Give the 'count' coldest pages of a per-CPU list back to
+ * the buddy lists. Called with interrupts disabled.
+ */
+static void free_pages_bulk (zone_t *zone, per_cpu_pages_t *pcp, int count)
+{
+	struct page *page;
+
+	spin_lock(&zone->lock);
+	while (count-- && pcp->count) {
+		page = memlist_entry(memlist_prev(&pcp->list), struct page, list);
+		memlist_del(&page->list);
+		pcp->count--;
+		__free_one_page(zone, page, 0);
+	}
+	spin_unlock(&zone->lock);
+	pcp->drains++;
+}
+
+void __free_pages_ok (struct page *page, unsigned long order)
+{
+	unsigned long flags;
+	zone_t *zone;
+
+	/*
+	 * Subtle. We do not want to test this in the inlined part of
+	 * __free_page() - it's a rare condition and just increases
+	 * cache footprint unnecesserily. So we do an 'incorrect'
+	 * decrement on page->count for reserved pages, but this part
+	 * makes it safe.
+	 */
+	if (PageReserved(page))
+		return;
+
+	if (page-mem_map >= max_mapnr)
+		BUG();
+	if (PageSwapCache(page))
+		BUG();
+	if (PageLocked(page))
+		BUG();
+	if (PageLRU(page) || PageActive(page))
+		BUG();
+	if (page->pte_chain)
+		BUG();
+
+	zone = page->zone;
+
+	/*
+	 * A freed single page is about as cache-hot as it gets,
+	 * keep it on this CPU's hot list.
+	 */
+	if (!order) {
+		per_cpu_pages_t *pcp;
+
+		__save_flags(flags);
+		__cli();
+		pcp = &zone->pageset[smp_processor_id()].pcp[PCP_HOT];
+		if (pcp->count >= pcp->high)
+			free_pages_bulk(zone, pcp, pcp->batch);
+		memlist_add_head(&page->list, &pcp->list);
+		pcp->count++;
+		__restore_flags(flags);
+		return;
+	}
+
+	spin_lock_irqsave(&zone->lock, flags);
+	__free_one_page(zone, page, order);
 	spin_unlock_irqrestore(&zone->lock, flags);
 }
 
@@ -153,15 +233,16 @@ static inline struct page * expand (zone_t *zone, struct page *page,
 	return page;
 }
 
-static inline struct page * rmqueue (zone_t *zone, unsigned long order)
+/*
+ * Take a block off the buddy lists. Called with the zone lock held.
+ */
+static inline struct page * __rmqueue (zone_t *zone, unsigned long order)
 {
 	free_area_t * area = zone->free_area + order;
 	unsigned long curr_order = order;
 	struct list_head *head, *curr;
-	unsigned long flags;
 	struct page *page;
 
-	spin_lock_irqsave(&zone->lock, flags);
 	do {
 		head = &area->free_list;
 		curr = memlist_next(head);
@@ -178,9 +259,6 @@ static inline struct page * rmqueue (zone_t *zone, unsigned long order)
 			zone->free_pages -= 1 << order;
 
 			page = expand(zone, page, index, order, curr_order, area);
-			spin_unlock_irqrestore(&zone->lock, flags);
-
-			set_page_count(page, 1);
 			if (BAD_RANGE(zone,page))
 				BUG();
 			return page;	
@@ -188,71 +266,106 @@ static inline struct page * rmqueue (zone_t *zone, unsigned long order)
 		curr_order++;
 		area++;
 	} while (curr_order < MAX_ORDER);
-	spin_unlock_irqrestore(&zone->lock, flags);
 
 	return NULL;
 }
 
-#define ZONE_BALANCED(zone) \
-	(((zone)->free_pages > (zone)->pages_low) && (!(zone)->low_on_memory))
-
-static inline int zone_balance_memory (zone_t *zone, int gfp_mask)
+/*
+ * Refill a per-CPU list with a batch of pages from the buddy
+ * lists. Called with interrupts disabled.
+ */
+static void rmqueue_bulk (zone_t *zone, per_cpu_pages_t *pcp)
 {
-	int freed;
+	struct page *page;
+	int i;
 
-	if (zone->free_pages >= zone->pages_low) {
-		if (!zone->low_on_memory)
-			return 1;
-		/*
-		 * Simple hysteresis: exit 'low memory mode' if
-		 * the upper limit has been reached:
-		 */
-		if (zone->free_pages >= zone->pages_high) {
-			zone->low_on_memory = 0;
-			return 1;
-		}
-	} else
-		zone->low_on_memory = 1;
+	spin_lock(&zone->lock);
+	for (i = 0; i < pcp->batch; i++) {
+		page = __rmqueue(zone, 0);
+		if (!page)
+			break;
+		memlist_add_tail(&page->list, &pcp->list);
+		pcp->count++;
+	}
+	spin_unlock(&zone->lock);
+	pcp->refills++;
+}
 
-	/*
-	 * In the atomic allocation case we only 'kick' the
-	 * state machine, but do not try to free pages
-	 * ourselves.
-	 */
-	if (!(gfp_mask & __GFP_WAIT))
-		return 1;
+static inline struct page * rmqueue (zone_t *zone, unsigned long order, int cold)
+{
+	unsigned long flags;
+	struct page *page;
 
-	current->flags |= PF_MEMALLOC;
-	freed = try_to_free_pages(gfp_mask);
-	current->flags &= ~PF_MEMALLOC;
+	if (!order) {
+		per_cpu_pages_t *pcp;
+
+		__save_flags(flags);
+		__cli();
+		pcp = &zone->pageset[smp_processor_id()].pcp[cold ? PCP_COLD : PCP_HOT];
+		if (!pcp->count)
+			rmqueue_bulk(zone, pcp);
+		page = NULL;
+		if (pcp->count) {
+			page = memlist_entry(memlist_next(&pcp->list), struct page, list);
+			memlist_del(&page->list);
+			pcp->count--;
+			pcp->hits++;
+		}
+		__restore_flags(flags);
+		goto out;
+	}
 
-	if (!freed && !(gfp_mask & (__GFP_MED | __GFP_HIGH)))
-		return 0;
-	return 1;
+	spin_lock_irqsave(&zone->lock, flags);
+	page = __rmqueue(zone, order);
+	spin_unlock_irqrestore(&zone->lock, flags);
+out:
+	if (page)
+		set_page_count(page, 1);
+	return page;
 }
 
 /*
- * We are still balancing memory in a global way:
+ * Give this CPU's free-page lists back to the buddy allocator,
+ * so that they can be coalesced and count as free again.
  */
-static inline int balance_memory (int gfp_mask)
+static void drain_local_pages (void)
+{
+	unsigned long flags;
+	int nid, j, i;
+
+	__save_flags(flags);
+	__cli();
+	for (nid = 0; nid < numnodes; nid++)
+	for (j = 0; j < MAX_NR_ZONES; j++) {
+		zone_t *zone = NODE_DATA(nid)->node_zones + j;
+		per_cpu_pageset_t *pset = zone->pageset + smp_processor_id();
+
+		if (!zone->size)
+			continue;
+		for (i = 0; i < 2; i++)
+			if (pset->pcp[i].count)
+				free_pages_bulk(zone, pset->pcp + i, pset->pcp[i].count);
+	}
+	__restore_flags(flags);
+}
+
+static inline int zone_balance_memory (zone_t *zone, int gfp_mask)
 {
-	unsigned long free = nr_free_pages();
-	static int low_on_memory = 0;
 	int freed;
 
-	if (free >= freepages.low) {
-		if (!low_on_memory)
+	if (zone->free_pages >= zone->pages_low) {
+		if (!zone->low_on_memory)
 			return 1;
 		/*
 		 * Simple hysteresis: exit 'low memory mode' if
 		 * the upper limit has been reached:
 		 */
-		if (free >= freepages.high) {
-			low_on_memory = 0;
+		if (zone->free_pages >= zone->pages_high) {
+			zone->low_on_memory = 0;
 			return 1;
 		}
 	} else
-		low_on_memory = 1;
+		zone->low_on_memory = 1;
 
 	/*
 	 * In the atomic allocation case we only 'kick' the
@@ -262,6 +375,8 @@ static inline int balance_memory (int gfp_mask)
 	if (!(gfp_mask & __GFP_WAIT))
 		return 1;
 
+	drain_local_pages();
+
 	current->flags |= PF_MEMALLOC;
 	freed = try_to_free_pages(gfp_mask);
 	current->flags &= ~PF_MEMALLOC;
@@ -274,7 +389,7 @@ static inline int balance_memory (int gfp_mask)
 /*
  * This is the 'heart' of the zoned buddy allocator:
  */
-struct page * __alloc_pages (zonelist_t *zonelist, unsigned long order)
+struct page * __alloc_pages (zonelist_t *zonelist, unsigned long order, int cold)
 {
 	zone_t **zone, *z;
 	struct page *page;
@@ -284,8 +399,12 @@ struct page * __alloc_pages (zonelist_t *zonelist, unsigned long order)
 	 * (If anyone calls gfp from interrupts nonatomically then it
 	 * will sooner or later tripped up by a schedule().)
 	 *
-	 * We are falling back to lower-level zones if allocation
-	 * in a higher zone fails.
+	 * We are falling back to lower-level zones, and to zones on
+	 * other nodes, if allocation in the preferred zone fails.
+	 *
+	 * First take the nearest zone which is above its low water
+	 * mark. Memory on a remote node which has some to spare is
+	 * preferred over making the local node free some.
 	 */
 	zone = zonelist->zones;
 	gfp_mask = zonelist->gfp_mask;
@@ -295,17 +414,30 @@ struct page * __alloc_pages (zonelist_t *zonelist, unsigned long order)
 			break;
 		if (!z->size)
 			BUG();
+		if (z->free_pages > z->pages_low) {
+			page = rmqueue(z, order, cold);
+			if (page)
+				return page;
+		}
+	}
+
+	/*
+	 * All the zones are low on memory: balance them (each node
+	 * on its own, nearest first) and take what we can get.
+	 */
+	zone = zonelist->zones;
+	for (;;) {
+		z = *(zone++);
+		if (!z)
+			break;
 		/*
 		 * If this is a recursive call, we'd better
 		 * do our best to just allocate things without
 		 * further thought.
 		 */
 		if (!(current->flags & PF_MEMALLOC))
-			/*
-			 * fastpath
-			 */
-			if (!ZONE_BALANCED(z))
-				goto balance;
+			if (!zone_balance_memory(z, gfp_mask))
+				goto nopage;
 		/*
 		 * This is an optimization for the 'higher order zone
 		 * is empty' case - it can happen even in well-behaved
@@ -314,9 +446,8 @@ struct page * __alloc_pages (zonelist_t *zonelist, unsigned long order)
 		 * we do not take the spinlock and it's not exact for
 		 * the higher order case, but will do it for most things.)
 		 */
-ready:
 		if (z->free_pages) {
-			page = rmqueue(z, order);
+			page = rmqueue(z, order, cold);
 			if (page)
 				return page;
 		}
@@ -334,14 +465,6 @@ ready:
 
 nopage:
 	return NULL;
-
-/*
- * The main chunk of the balancing code is in this offline branch:
- */
-balance:
-	if (!balance_memory(gfp_mask))
-		goto nopage;
-	goto ready;
 }
 
 /*
@@ -351,10 +474,15 @@ unsigned int nr_free_pages (void)
 {
 	unsigned int sum;
 	zone_t *zone;
+	int nid;
 
 	sum = 0;
-	for (zone = zones; zone < zones + MAX_NR_ZONES; zone++)
-		sum += zone->free_pages;
+	for (nid = 0; nid < numnodes; nid++) {
+		pg_data_t *pgdat = NODE_DATA(nid);
+
+		for (zone = pgdat->node_zones; zone < pgdat->node_zones + MAX_NR_ZONES; zone++)
+			sum += zone->free_pages;
+	}
 	return sum;
 }
 
@@ -365,17 +493,28 @@ unsigned int nr_free_buffer_pages (void)
 {
 	unsigned int sum;
 	zone_t *zone;
+	int nid;
 
 	sum = nr_lru_pages;
-	for (zone = zones; zone <= zones+ZONE_NORMAL; zone++)
-		sum += zone->free_pages;
+	for (nid = 0; nid < numnodes; nid++) {
+		pg_data_t *pgdat = NODE_DATA(nid);
+
+		for (zone = pgdat->node_zones; zone <= pgdat->node_zones+ZONE_NORMAL; zone++)
+			sum += zone->free_pages;
+	}
 	return sum;
 }
 
 #if CONFIG_HIGHMEM
 unsigned int nr_free_highpages (void)
 {
-	return zones[ZONE_HIGHMEM].free_pages;
+	unsigned int sum;
+	int nid;
+
+	sum = 0;
+	for (nid = 0; nid < numnodes; nid++)
+		sum += NODE_DATA(nid)->node_zones[ZONE_HIGHMEM].free_pages;
+	return sum;
 }
 #endif
 
@@ -383,11 +522,13 @@ unsigned int nr_free_highpages (void)
  * Show free area list (used inside shift_scroll-lock stuff)
  * We also calculate the percentage fragmentation. We do this by counting the
  * memory on each free list with the exception of the first item on the list.
+ * The per-CPU page lists are shown as: pages on the list (hits refills drains).
  */
 void show_free_areas(void)
 {
  	unsigned long order;
 	unsigned type;
+	int nid, i;
 
 	printk("Free pages:      %6dkB (%6dkB HighMem)\n",
 		nr_free_pages() << (PAGE_SHIFT-10),
@@ -399,13 +540,20 @@ void show_free_areas(void)
 		freepages.min,
 		freepages.low,
 		freepages.high);
+	printk("( Active: %d/%d, inactive: %d/%d (file/anon) )\n",
+		nr_active_pages[LRU_FILE], nr_active_pages[LRU_ANON],
+		nr_inactive_pages[LRU_FILE], nr_inactive_pages[LRU_ANON]);
 
+	for (nid = 0; nid < numnodes; nid++)
 	for (type = 0; type < MAX_NR_ZONES; type++) {
 		struct list_head *head, *curr;
-		zone_t *zone = zones + type;
+		zone_t *zone = NODE_DATA(nid)->node_zones + type;
  		unsigned long nr, total, flags;
 
-		printk("  %s: ", zone->name);
+		if (numnodes > 1)
+			printk("  node %d %s: ", nid, zone->name);
+		else
+			printk("  %s: ", zone->name);
 
 		total = 0;
 		if (zone->size) {
@@ -427,6 +575,18 @@ void show_free_areas(void)
 			spin_unlock_irqrestore(&zone->lock, flags);
 		}
 		printk("= %lukB)\n", total * (PAGE_SIZE>>10));
+		if (!zone->size)
+			continue;
+		for (i = 0; i < smp_num_cpus; i++) {
+			per_cpu_pageset_t *pset = zone->pageset + cpu_logical_map(i);
+			per_cpu_pages_t *hot = pset->pcp + PCP_HOT;
+			per_cpu_pages_t *cold = pset->pcp + PCP_COLD;
+
+			printk("    cpu %d hot: %d (%lu %lu %lu) cold: %d (%lu %lu %lu)\n",
+				cpu_logical_map(i),
+				hot->count, hot->hits, hot->refills, hot->drains,
+				cold->count, cold->hits, cold->refills, cold->drains);
+		}
 	}
 
 #ifdef SWAP_CACHE_INFO
@@ -435,19 +595,19 @@ void show_free_areas(void)
 }
 
 /*
- * Builds allocation fallback zone lists. We are basically ready
- * to do NUMA-allocations, only this function has to be modified
- * and the zonelists array be made per-CPU.
+ * Builds the allocation fallback zone lists of a node: its own
+ * zones first, then the zones of the other nodes in order of
+ * distance.
  */
-static inline void build_zonelists (void)
+static inline void build_zonelists (pg_data_t *pgdat)
 {
-	int i, j, k;
+	int i, j, k, d, nid;
 
 	for (i = 0; i < NR_GFPINDEX; i++) {
 		zonelist_t *zonelist;
 		zone_t *zone;
 
-		zonelist = zonelists + i;
+		zonelist = pgdat->node_zonelists + i;
 		memset(zonelist, 0, sizeof(*zonelist));
 
 		zonelist->gfp_mask = i;
@@ -458,26 +618,35 @@ static inline void build_zonelists (void)
 		if (i & __GFP_DMA)
 			k = ZONE_DMA;
 
-		switch (k) {
-			default:
-				BUG();
-			/*
-			 * fallthrough:
-			 */
-			case ZONE_HIGHMEM:
-				zone = zones + ZONE_HIGHMEM;
-				if (zone->size) {
-#ifndef CONFIG_HIGHMEM
+		for (d = 0; d < numnodes; d++)
+		for (nid = 0; nid < numnodes; nid++) {
+			zone_t *zones = NODE_DATA(nid)->node_zones;
+
+			if (node_distance(pgdat->node_id, nid) != d)
+				continue;
+			switch (k) {
+				default:
 					BUG();
+				/*
+				 * fallthrough:
+				 */
+				case ZONE_HIGHMEM:
+					zone = zones + ZONE_HIGHMEM;
+					if (zone->size) {
+#ifndef CONFIG_HIGHMEM
+						BUG();
 #endif
-					zonelist->zones[j++] = zone;
-				}
-			case ZONE_NORMAL:
-				zone = zones + ZONE_NORMAL;
-				if (zone->size)
-					zonelist->zones[j++] = zone;
-			case ZONE_DMA:
-				zonelist->zones[j++] = zones + ZONE_DMA;
+						zonelist->zones[j++] = zone;
+					}
+				case ZONE_NORMAL:
+					zone = zones + ZONE_NORMAL;
+					if (zone->size)
+						zonelist->zones[j++] = zone;
+				case ZONE_DMA:
+					zone = zones + ZONE_DMA;
+					if (zone->size)
+						zonelist->zones[j++] = zone;
+			}
 		}
 		zonelist->zones[j++] = NULL;
 	} 
@@ -485,18 +654,93 @@ static inline void build_zonelists (void)
 
 #define LONG_ALIGN(x) (((x)+(sizeof(long))-1)&~((sizeof(long))-1))
 
+/*
+ * Set up one zone of a node, covering the mem_map entries
+ * [offset, offset+size).
+ */
+static void __init free_area_init_zone(pg_data_t *pgdat, int j,
+	unsigned long offset, unsigned long size, unsigned long reserve)
+{
+	zone_t *zone = pgdat->node_zones + j;
+	unsigned long mask = -1;
+	unsigned long i, batch;
+
+	zone->name = zone_names[j];
+	zone->zone_pgdat = pgdat;
+	spin_lock_init(&zone->lock);
+	if (numnodes > 1)
+		printk("node %d ", pgdat->node_id);
+	printk("zone(%d): %ld pages.\n", j, size);
+	zone->size = size;
+	if (!size)
+		return;
+
+	zone->offset = offset;
+	/*
+	 * It's unnecessery to balance the high memory zone
+	 */
+	if (j != ZONE_HIGHMEM) {
+		zone->pages_low = reserve * 2;
+		zone->pages_high = reserve * 3;
+	}
+	zone->low_on_memory = 0;
+
+	/*
+	 * Per-CPU page lists: move about a quarter of a
+	 * 1/1024th of the zone, at most 256kB, at a time.
+	 */
+	batch = size / 1024;
+	if (batch * PAGE_SIZE > 256*1024)
+		batch = (256*1024) / PAGE_SIZE;
+	batch /= 4;
+	if (batch < 1)
+		batch = 1;
+	for (i = 0; i < NR_CPUS; i++) {
+		per_cpu_pages_t *pcp = zone->pageset[i].pcp;
+
+		memlist_init(&pcp[PCP_HOT].list);
+		pcp[PCP_HOT].high = 6 * batch;
+		pcp[PCP_HOT].batch = batch;
+		memlist_init(&pcp[PCP_COLD].list);
+		pcp[PCP_COLD].high = 2 * batch;
+		pcp[PCP_COLD].batch = batch;
+	}
+
+	for (i = 0; i < size; i++) {
+		struct page *page = mem_map + offset + i;
+		page->zone = zone;
+		if (j != ZONE_HIGHMEM)
+			page->virtual = __page_address(page);
+	}
+
+	for (i = 0; i < MAX_ORDER; i++) {
+		unsigned long bitmap_size;
+
+		memlist_init(&zone->free_area[i].free_list);
+		mask += mask;
+		size = (size + ~mask) & mask;
+		bitmap_size = size >> i;
+		bitmap_size = (bitmap_size + 7) >> 3;
+		bitmap_size = LONG_ALIGN(bitmap_size);
+		zone->free_area[i].map = 
+			(unsigned int *) alloc_bootmem(bitmap_size);
+	}
+}
+
 /*
  * Set up the zone data structures:
  *   - mark all pages reserved
  *   - mark all memory queues empty
  *   - clear the memory bitmaps
+ *   - split memory into nodes, and give every node its zones
  */
 void __init free_area_init(unsigned int *zones_size)
 {
 	struct page * p;
 	unsigned long i, j;
 	unsigned long map_size;
-	unsigned int totalpages, offset;
+	unsigned int totalpages, span;
+	int nid;
 
 	totalpages = 0;
 	for (i = 0; i < MAX_NR_ZONES; i++) {
@@ -539,51 +783,66 @@ void __init free_area_init(unsigned int *zones_size)
 		SetPageReserved(p);
 		init_waitqueue_head(&p->wait);
 		memlist_init(&p->list);
+		p->pte_chain = NULL;
 	}
 
-	offset = 0;	
-	for (j = 0; j < MAX_NR_ZONES; j++) {
-		zone_t *zone = zones + j;
-		unsigned long mask = -1;
-		unsigned long size;
-
-		size = zones_size[j];
-
-		printk("zone(%ld): %ld pages.\n", j, size);
-		zone->size = size;
-		if (!size)
-			continue;
-
-		zone->offset = offset;
-		/*
-		 * It's unnecessery to balance the high memory zone
-		 */
-		if (j != ZONE_HIGHMEM) {
-			zone->pages_low = freepages.low;
-			zone->pages_high = freepages.high;
+	/*
+	 * Nodes start on a max-order boundary, and get at least
+	 * a few max-order blocks each.
+	 */
+	numnodes = 1;
+	if (numa_fake > 1) {
+		numnodes = numa_fake;
+		while (numnodes > 1 &&
+		       totalpages / numnodes < 4 << (MAX_ORDER-1))
+			numnodes--;
+	}
+	span = (totalpages / numnodes) & ~((1 << (MAX_ORDER-1)) - 1);
+	if (numnodes > 1)
+		printk("%d memory nodes of %u pages.\n", numnodes, span);
+
+	for (nid = 0; nid < numnodes; nid++) {
+		pg_data_t *pgdat = NODE_DATA(nid);
+		unsigned long start, end, offset, reserve;
+
+		start = nid * span;
+		end = (nid == numnodes-1) ? totalpages : start + span;
+		pgdat->node_id = nid;
+		pgdat->node_start_mapnr = start;
+		pgdat->node_size = end - start;
+
+		/* The free-page reserve, as above, for this node. */
+		reserve = pgdat->node_size >> 7;
+		if (reserve < 10)
+			reserve = 10;
+		if (reserve > 256)
+			reserve = 256;
+
+		/* Each zone of the node is its share of the global zone. */
+		offset = 0;
+		for (j = 0; j < MAX_NR_ZONES; j++) {
+			unsigned long zstart = offset, zend = offset + zones_size[j];
+
+			offset = zend;
+			if (zstart < start)
+				zstart = start;
+			if (zend > end)
+				zend = end;
+			if (zend < zstart)
+				zend = zstart;
+			free_area_init_zone(pgdat, j, zstart, zend - zstart, reserve);
 		}
-		zone->low_on_memory = 0;
+	}
 
-		for (i = 0; i < size; i++) {
-			struct page *page = mem_map + offset + i;
-			page->zone = zone;
-			if (j != ZONE_HIGHMEM)
-				page->virtual = __page_address(page);
-		}
+	/* CPUs are spread round-robin over the nodes. */
+	for (i = 0; i < NR_CPUS; i++)
+		cpu_to_node_map[i] = i % numnodes;
 
-		offset += size;
-		for (i = 0; i < MAX_ORDER; i++) {
-			unsigned long bitmap_size;
-
-			memlist_init(&zone->free_area[i].free_list);
-			mask += mask;
-			size = (size + ~mask) & mask;
-			bitmap_size = size >> i;
-			bitmap_size = (bitmap_size + 7) >> 3;
-			bitmap_size = LONG_ALIGN(bitmap_size);
-			zone->free_area[i].map = 
-				(unsigned int *) alloc_bootmem(bitmap_size);
-		}
+	for (nid = 0; nid < numnodes; nid++) {
+		pg_data_t *pgdat = NODE_DATA(nid);
+
+		pgdat->node_zonelists = (zonelist_t *)
+			alloc_bootmem(NR_GFPINDEX * sizeof(zonelist_t));
+		build_zonelists(pgdat);
 	}
-	build_zonelists();
 }
@@ -0,0 +1,238 @@
+/*
+ *  linux/mm/rmap.c
+ *
+ *  Reverse mappings: every user page table entry that maps a page is
+ *  recorded on a chain hanging off the page, so that the page can be
+ *  unmapped from all processes without scanning their page tables.
+ */
+
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/swap.h>
+#include <linux/swapctl.h>
+#include <linux/kernel_stat.h>
+#include <linux/smp_lock.h>
+#include <linux/init.h>
+
+#include <asm/pgalloc.h>
+
+/*
+ * One entry per pte mapping the page. The pte itself is found again
+ * through mm and address, under mm->page_table_lock.
+ */
+struct pte_chain {
+	struct pte_chain * next;
+	struct mm_struct * mm;
+	unsigned long address;
+};
+
+static kmem_cache_t * pte_chain_cachep;
+
+/*
+ * page->pte_chain is protected by the PG_chainlock bit of the page.
+ * It nests inside mm->page_table_lock; try_to_unmap() goes the other
+ * way round and so only ever trylocks the page tables.
+ */
+static inline void pte_chain_lock(struct page * page)
+{
+#ifdef __SMP__
+	while (test_and_set_bit(PG_chainlock, &page->flags)) {
+		while (test_bit(PG_chainlock, &page->flags))
+			barrier();
+	}
+#endif
+}
+
+static inline void pte_chain_unlock(struct page * page)
+{
+#ifdef __SMP__
+	clear_bit(PG_chainlock, &page->flags);
+#endif
+}
+
+static inline int page_is_mapped_ram(struct page * page)
+{
+	return page - mem_map < max_mapnr && !PageReserved(page);
+}
+
+/*
+ * Record that 'address' in 'mm' now maps 'page'. Called after the pte
+ * has been set, under the same hold of mm->page_table_lock (or on an mm
+ * nobody else can see yet), so that zap_page_range() can't remove the
+ * pte in between and leave a stale entry behind. If no chain entry can
+ * be allocated the mapping goes untracked: try_to_unmap() then can't
+ * drop it, and the page stays in use until swap_out() or an unmap gets
+ * rid of the pte.
+ */
+void page_add_rmap(struct page * page, struct mm_struct * mm,
+	unsigned long address)
+{
+	struct pte_chain * pc;
+
+	if (!page_is_mapped_ram(page))
+		return;
+	pc = kmem_cache_alloc(pte_chain_cachep, SLAB_ATOMIC);
+	if (!pc)
+		return;
+	pc->mm = mm;
+	pc->address = address & PAGE_MASK;
+
+	pte_chain_lock(page);
+	pc->next = page->pte_chain;
+	page->pte_chain = pc;
+	pte_chain_unlock(page);
+}
+
+/*
+ * The pte at 'address' in 'mm' no longer maps 'page'.
+ */
+void page_remove_rmap(struct page * page, struct mm_struct * mm,
+	unsigned long address)
+{
+	struct pte_chain * pc, ** pprev;
+
+	if (!page_is_mapped_ram(page))
+		return;
+	address &= PAGE_MASK;
+
+	pte_chain_lock(page);
+	for (pprev = &page->pte_chain; (pc = *pprev) != NULL; pprev = &pc->next) {
+		if (pc->mm == mm && pc->address == address) {
+			*pprev = pc->next;
+			break;
+		}
+	}
+	pte_chain_unlock(page);
+
+	if (pc)
+		kmem_cache_free(pte_chain_cachep, pc);
+}
+
+/*
+ * Try to drop one pte. Returns SWAP_SUCCESS if the entry is gone
+ * from the chain, which the caller then frees.
+ */
+static int try_to_unmap_one(struct page * page, struct pte_chain * pc)
+{
+	struct mm_struct * mm = pc->mm;
+	unsigned long address = pc->address;
+	struct vm_area_struct * vma;
+	pgd_t * pgd;
+	pmd_t * pmd;
+	pte_t * ptep, pte;
+	int ret = SWAP_SUCCESS;
+
+	if (!spin_trylock(&mm->page_table_lock))
+		return SWAP_AGAIN;
+
+	kstat.rmapscan++;
+
+	/*
+	 * A pte which doesn't map the page any more means the chain
+	 * missed an update; forget about the entry.
+	 */
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || pgd_bad(*pgd))
+		goto out_unlock;
+	pmd = pmd_offset(pgd, address);
+	if (pmd_none(*pmd) || pmd_bad(*pmd))
+		goto out_unlock;
+	ptep = pte_offset(pmd, address);
+	pte = *ptep;
+	if (!pte_present(pte) || pte_page(pte) != page)
+		goto out_unlock;
+
+	ret = SWAP_FAIL;
+	vma = find_vma(mm, address);
+	if (!vma || address < vma->vm_start || (vma->vm_flags & VM_LOCKED))
+		goto out_unlock;
+
+	/* Still in use: just age it, like swap_out() would. */
+	if (pte_young(pte)) {
+		set_pte(ptep, pte_mkold(pte));
+		set_bit(PG_referenced, &page->flags);
+		goto out_unlock;
+	}
+
+	flush_cache_page(vma, address);
+	if (PageSwapCache(page)) {
+		swp_entry_t entry;
+
+		entry.val = page->index;
+		swap_duplicate(entry);
+		set_pte(ptep, swp_entry_to_pte(entry));
+	} else if ((vma->vm_flags & VM_SHM) ||
+		   (page->mapping && !pte_dirty(pte))) {
+		/*
+		 * The page can be found again through the shm segment
+		 * or the page cache, so the pte can simply go.
+		 */
+		pte_clear(ptep);
+	} else {
+		/*
+		 * Anonymous pages need a swap entry first, and dirty
+		 * file pages need writing out: both are left to
+		 * swap_out().
+		 */
+		goto out_unlock;
+	}
+	mm->rss--;
+	flush_tlb_page(vma, address);
+	__free_page(page);
+	kstat.rmapunmap++;
+	ret = SWAP_SUCCESS;
+
+out_unlock:
+	spin_unlock(&mm->page_table_lock);
+	return ret;
+}
+
+/*
+ * Unmap a page from every page table on its chain. The caller holds
+ * a reference to the page besides the mappings, and must hold the
+ * page lock for page cache pages.
+ *
+ * Returns SWAP_SUCCESS if the page is no longer mapped, SWAP_AGAIN if
+ * some page tables were busy, and SWAP_FAIL if some pte can't be
+ * dropped from here or was referenced recently.
+ */
+int try_to_unmap(struct page * page)
+{
+	struct pte_chain * pc, ** pprev;
+	int ret = SWAP_SUCCESS;
+	int big_lock = PageSwapCache(page);
+
+	/* swap_duplicate() wants the big kernel lock */
+	if (big_lock)
+		lock_kernel();
+	pte_chain_lock(page);
+	pprev = &page->pte_chain;
+	while ((pc = *pprev) != NULL) {
+		switch (try_to_unmap_one(page, pc)) {
+		case SWAP_SUCCESS:
+			*pprev = pc->next;
+			kmem_cache_free(pte_chain_cachep, pc);
+			continue;
+		case SWAP_AGAIN:
+			if (ret == SWAP_SUCCESS)
+				ret = SWAP_AGAIN;
+			break;
+		case SWAP_FAIL:
+			ret = SWAP_FAIL;
+			break;
+		}
+		pprev = &pc->next;
+	}
+	pte_chain_unlock(page);
+	if (big_lock)
+		unlock_kernel();
+	return ret;
+}
+
+void __init pte_chain_init(void)
+{
+	pte_chain_cachep = kmem_cache_create("pte_chain",
+		sizeof(struct pte_chain), 0, 0, NULL, NULL);
+	if (!pte_chain_cachep)
+		panic("Cannot create pte_chain SLAB cache");
+}
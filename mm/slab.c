@@ -65,6 +65,18 @@
  *	Per-engine slab caches, backed by a global cache (as in Mach's Zone allocator),
  *	would allow most allocations from the same cache to execute in parallel.
  *
+ * Per-CPU object caches.
+ *	On SMP each cache has, per CPU, a small array of free objs (a "magazine"
+ *	in Bonwick's terms) in front of the slab lists.  kmem_cache_alloc() and
+ *	kmem_cache_free() normally only touch this array, under its own lock,
+ *	which is never wanted by another CPU except when the cache is shrunk,
+ *	reaped or tuned.  The slab lists, and 'c_spinlock', are only visited
+ *	to move a batch of objs in or out of an array.  Lock order is
+ *	'cc_lock' -> 'c_spinlock'.
+ *	The array limits can be changed by writing
+ *		"<cache-name> <limit> <batchcount>"
+ *	to /proc/slabinfo.  A limit of zero disables the per-CPU cache.
+ *
  *	At present, each engine can be growing a cache.  This should be blocked.
  *
  *	It is not currently 100% safe to examine the page_struct outside of a kernel
@@ -107,6 +119,8 @@
 #include	<linux/interrupt.h>
 #include	<linux/init.h>
 
+#include	<asm/uaccess.h>
+
 /* If there is a different PAGE_SIZE around, and it works with this allocator,
  * then change the following.
  */
@@ -203,6 +217,26 @@ typedef struct kmem_bufctl_s {
 #define	buf_slabp	u.buf_slabp
 #define	buf_objp	u.buf_objp
 
+#ifdef __SMP__
+/* Per-CPU cache of free objs, see the notes at the top of the file.
+ * Objs in here are still counted as active by their slab.
+ */
+typedef struct cpucache_s {
+	spinlock_t		 cc_lock;
+	unsigned int		 cc_avail;	/* num of objs in cc_entry[] */
+	unsigned int		 cc_limit;	/* size of cc_entry[] */
+	unsigned int		 cc_batch;	/* objs per refill/flush */
+	void			**cc_entry;
+	unsigned long		 cc_hits;
+	unsigned long		 cc_misses;
+	unsigned long		 cc_refills;
+	unsigned long		 cc_flushes;
+} cpucache_t;
+
+/* upper bound for a per-CPU cache limit set from /proc */
+#define	SLAB_CPUCACHE_MAX	1024
+#endif	/* __SMP__ */
+
 #if	SLAB_DEBUG_SUPPORT
 /* Magic nums for obj red zoning.
  * Placed in the first word before and the first word after an obj.
@@ -244,6 +278,9 @@ struct kmem_cache_s {
 	const char		 *c_name;
 	struct kmem_cache_s	 *c_nextp;
 	kmem_cache_t		 *c_index_cachep;
+#ifdef __SMP__
+	cpucache_t		 *c_cpucache[NR_CPUS];
+#endif
 #if	SLAB_STATS
 	unsigned long		  c_num_active;
 	unsigned long		  c_num_allocations;
@@ -293,7 +330,16 @@ struct kmem_cache_s {
 static void kmem_self_test(void);
 #endif	/* SLAB_SELFTEST */
 
-/* c_magic - used to detect 'out of slabs' in __kmem_cache_alloc() */
+#ifdef __SMP__
+static void kmem_cpucache_enable(kmem_cache_t *cachep);
+static void kmem_cpucache_drain(kmem_cache_t *cachep);
+static void kmem_cpucache_release(kmem_cache_t *cachep);
+
+/* Set once the general caches exist, and the CPUs are up. */
+static int cpucache_up = 0;
+#endif	/* __SMP__ */
+
+/* c_magic - used to detect 'out of slabs' in kmem_cache_alloc_slab() */
 #define	SLAB_C_MAGIC		0x4F17A36DUL
 
 /* maximum size of an obj (in 2^order pages) */
@@ -957,6 +1003,10 @@ printk("%s: Left_over:%d Align:%d Size:%d\n", name, left_over, offset, size);
 	cachep->c_magic = SLAB_C_MAGIC;
 	cachep->c_name = name;		/* Simply point to the name. */
 	spin_lock_init(&cachep->c_spinlock);
+#ifdef __SMP__
+	if (cpucache_up)
+		kmem_cpucache_enable(cachep);
+#endif	/* __SMP__ */
 
 	/* Need the semaphore to access the chain. */
 	down(&cache_chain_sem);
@@ -1013,6 +1063,9 @@ static int __kmem_cache_shrink(kmem_cache_t *cachep)
 	kmem_slab_t	*slabp;
 	int	ret;
 
+#ifdef __SMP__
+	kmem_cpucache_drain(cachep);
+#endif	/* __SMP__ */
 	spin_lock_irq(&cachep->c_spinlock);
 
 	/* If the cache is growing, stop shrinking. */
@@ -1108,6 +1161,9 @@ int kmem_cache_destroy(kmem_cache_t * cachep)
 		return 1;
 	}
 
+#ifdef __SMP__
+	kmem_cpucache_release(cachep);
+#endif	/* __SMP__ */
 	kmem_cache_free(&cache_cache, cachep);
 
 	return 0;
@@ -1411,13 +1467,40 @@ kmem_cache_one_free(kmem_cache_t *cachep, kmem_slab_t *slabp)
 	cachep->c_freep = slabp;
 }
 
-/* Returns a ptr to an obj in the given cache. */
+/* Take an obj from a slab which has free objs.  Called with the cache-lock
+ * held.
+ */
 static inline void *
-__kmem_cache_alloc(kmem_cache_t *cachep, int flags)
+kmem_cache_alloc_one(kmem_cache_t *cachep, kmem_slab_t *slabp)
 {
-	kmem_slab_t	*slabp;
 	kmem_bufctl_t	*bufp;
 	void		*objp;
+
+	SLAB_STATS_INC_ALLOCED(cachep);
+	SLAB_STATS_INC_ACTIVE(cachep);
+	SLAB_STATS_SET_HIGH(cachep);
+	slabp->s_inuse++;
+	bufp = slabp->s_freep;
+	slabp->s_freep = bufp->buf_nextp;
+	if (!slabp->s_freep)
+		cachep->c_freep = slabp->s_nextp;
+	if (!slabp->s_index) {
+		bufp->buf_slabp = slabp;
+		objp = ((void*)bufp) - cachep->c_offset;
+	} else {
+		/* Update index ptr. */
+		objp = ((bufp-slabp->s_index)*cachep->c_offset) + slabp->s_mem;
+		bufp->buf_objp = objp;
+	}
+	return objp;
+}
+
+/* Returns a ptr to an obj in the given cache, taken from the slab lists. */
+static inline void *
+kmem_cache_alloc_slab(kmem_cache_t *cachep, int flags)
+{
+	kmem_slab_t	*slabp;
+	void		*objp;
 	unsigned long	save_flags;
 
 	/* Sanity check. */
@@ -1435,39 +1518,20 @@ try_again:
 	if (flags & SLAB_DMA)
 		goto search_dma;
 try_again_dma:
-	SLAB_STATS_INC_ALLOCED(cachep);
-	SLAB_STATS_INC_ACTIVE(cachep);
-	SLAB_STATS_SET_HIGH(cachep);
-	slabp->s_inuse++;
-	bufp = slabp->s_freep;
-	slabp->s_freep = bufp->buf_nextp;
-	if (slabp->s_freep) {
-ret_obj:
-		if (!slabp->s_index) {
-			bufp->buf_slabp = slabp;
-			objp = ((void*)bufp) - cachep->c_offset;
-finished:
-			/* The lock is not needed by the red-zone or poison ops, and the
-			 * obj has been removed from the slab.  Should be safe to drop
-			 * the lock here.
-			 */
-			spin_unlock_irqrestore(&cachep->c_spinlock, save_flags);
+	objp = kmem_cache_alloc_one(cachep, slabp);
+	/* The lock is not needed by the red-zone or poison ops, and the
+	 * obj has been removed from the slab.  Should be safe to drop
+	 * the lock here.
+	 */
+	spin_unlock_irqrestore(&cachep->c_spinlock, save_flags);
 #if	SLAB_DEBUG_SUPPORT
-			if (cachep->c_flags & SLAB_RED_ZONE)
-				goto red_zone;
+	if (cachep->c_flags & SLAB_RED_ZONE)
+		goto red_zone;
 ret_red:
-			if ((cachep->c_flags & SLAB_POISON) && kmem_check_poison_obj(cachep, objp))
-				kmem_report_alloc_err("Bad poison", cachep);
+	if ((cachep->c_flags & SLAB_POISON) && kmem_check_poison_obj(cachep, objp))
+		kmem_report_alloc_err("Bad poison", cachep);
 #endif	/* SLAB_DEBUG_SUPPORT */
-			return objp;
-		}
-		/* Update index ptr. */
-		objp = ((bufp-slabp->s_index)*cachep->c_offset) + slabp->s_mem;
-		bufp->buf_objp = objp;
-		goto finished;
-	}
-	cachep->c_freep = slabp->s_nextp;
-	goto ret_obj;
+	return objp;
 
 #if	SLAB_DEBUG_SUPPORT
 red_zone:
@@ -1515,32 +1579,12 @@ nul_ptr:
 	goto err_exit;
 }
 
-/* Release an obj back to its cache.  If the obj has a constructed state,
- * it should be in this state _before_ it is released.
- */
+/* Return an obj to its slab.  Called with the cache-lock held. */
 static inline void
-__kmem_cache_free(kmem_cache_t *cachep, const void *objp)
+kmem_cache_free_one(kmem_cache_t *cachep, const void *objp)
 {
 	kmem_slab_t	*slabp;
 	kmem_bufctl_t	*bufp;
-	unsigned long	save_flags;
-
-	/* Basic sanity checks. */
-	if (!cachep || !objp)
-		goto null_addr;
-
-#if	SLAB_DEBUG_SUPPORT
-	/* A verify func is called without the cache-lock held. */
-	if (cachep->c_flags & SLAB_DEBUG_INITIAL)
-		goto init_state_check;
-finished_initial:
-
-	if (cachep->c_flags & SLAB_RED_ZONE)
-		goto red_zone;
-return_red:
-#endif	/* SLAB_DEBUG_SUPPORT */
-
-	spin_lock_irqsave(&cachep->c_spinlock, save_flags);
 
 	if (SLAB_BUFCTL(cachep->c_flags))
 		goto bufctl;
@@ -1583,7 +1627,6 @@ finished:
 					kmem_poison_obj(cachep, objp);
 				}
 #endif	/* SLAB_DEBUG_SUPPORT */
-				spin_unlock_irqrestore(&cachep->c_spinlock, save_flags);
 				return;
 			}
 			kmem_cache_full_free(cachep, slabp);
@@ -1594,7 +1637,6 @@ finished:
 	}
 
 	/* Don't add to freelist. */
-	spin_unlock_irqrestore(&cachep->c_spinlock, save_flags);
 	kmem_report_free_err("free with no active objs", objp, cachep);
 	return;
 bufctl:
@@ -1605,36 +1647,15 @@ bufctl:
 	bufp =	&slabp->s_index[(objp - slabp->s_mem)/cachep->c_offset];
 	if (bufp->buf_objp == objp)
 		goto check_magic;
-	spin_unlock_irqrestore(&cachep->c_spinlock, save_flags);
 	kmem_report_free_err("Either bad obj addr or double free", objp, cachep);
 	return;
 #if	SLAB_DEBUG_SUPPORT
-init_state_check:
-	/* Need to call the slab's constructor so the
-	 * caller can perform a verify of its state (debugging).
-	 */
-	cachep->c_ctor(objp, cachep, SLAB_CTOR_CONSTRUCTOR|SLAB_CTOR_VERIFY);
-	goto finished_initial;
 extra_checks:
 	if (!kmem_extra_free_checks(cachep, slabp->s_freep, bufp, objp)) {
-		spin_unlock_irqrestore(&cachep->c_spinlock, save_flags);
 		kmem_report_free_err("Double free detected during checks", objp, cachep);
 		return;
 	}
 	goto passed_extra;
-red_zone:
-	/* We do not hold the cache-lock while checking the red-zone.
-	 */
-	objp -= BYTES_PER_WORD;
-	if (xchg((unsigned long *)objp, SLAB_RED_MAGIC1) != SLAB_RED_MAGIC2) {
-		/* Either write before start of obj, or a double free. */
-		kmem_report_free_err("Bad front redzone", objp, cachep);
-	}
-	if (xchg((unsigned long *)(objp+cachep->c_org_size+BYTES_PER_WORD), SLAB_RED_MAGIC1) != SLAB_RED_MAGIC2) {
-		/* Either write past end of obj, or a double free. */
-		kmem_report_free_err("Bad rear redzone", objp, cachep);
-	}
-	goto return_red;
 #endif	/* SLAB_DEBUG_SUPPORT */
 
 bad_slab:
@@ -1644,19 +1665,313 @@ bad_slab:
 		kmem_report_free_err("free from inactive slab", objp, cachep);
 	} else
 		kmem_report_free_err("Bad obj addr", objp, cachep);
-	spin_unlock_irqrestore(&cachep->c_spinlock, save_flags);
 
 #if 1
 /* FORCE A KERNEL DUMP WHEN THIS HAPPENS. SPEAK IN ALL CAPS. GET THE CALL CHAIN. */
 	BUG();
 #endif
+}
 
+/* Release an obj back to its slab.  If the obj has a constructed state,
+ * it should be in this state _before_ it is released.
+ */
+static inline void
+kmem_cache_free_slab(kmem_cache_t *cachep, const void *objp)
+{
+	unsigned long	save_flags;
+
+	/* Basic sanity checks. */
+	if (!cachep || !objp)
+		goto null_addr;
+
+#if	SLAB_DEBUG_SUPPORT
+	/* A verify func is called without the cache-lock held. */
+	if (cachep->c_flags & SLAB_DEBUG_INITIAL)
+		goto init_state_check;
+finished_initial:
+
+	if (cachep->c_flags & SLAB_RED_ZONE)
+		goto red_zone;
+return_red:
+#endif	/* SLAB_DEBUG_SUPPORT */
+
+	spin_lock_irqsave(&cachep->c_spinlock, save_flags);
+	kmem_cache_free_one(cachep, objp);
+	spin_unlock_irqrestore(&cachep->c_spinlock, save_flags);
 	return;
+
+#if	SLAB_DEBUG_SUPPORT
+init_state_check:
+	/* Need to call the slab's constructor so the
+	 * caller can perform a verify of its state (debugging).
+	 */
+	cachep->c_ctor(objp, cachep, SLAB_CTOR_CONSTRUCTOR|SLAB_CTOR_VERIFY);
+	goto finished_initial;
+red_zone:
+	/* We do not hold the cache-lock while checking the red-zone.
+	 */
+	objp -= BYTES_PER_WORD;
+	if (xchg((unsigned long *)objp, SLAB_RED_MAGIC1) != SLAB_RED_MAGIC2) {
+		/* Either write before start of obj, or a double free. */
+		kmem_report_free_err("Bad front redzone", objp, cachep);
+	}
+	if (xchg((unsigned long *)(objp+cachep->c_org_size+BYTES_PER_WORD), SLAB_RED_MAGIC1) != SLAB_RED_MAGIC2) {
+		/* Either write past end of obj, or a double free. */
+		kmem_report_free_err("Bad rear redzone", objp, cachep);
+	}
+	goto return_red;
+#endif	/* SLAB_DEBUG_SUPPORT */
+
 null_addr:
 	kmem_report_free_err("NULL ptr", objp, cachep);
 	return;
 }
 
+#ifdef __SMP__
+/* Refill an empty per-CPU cache with up to a batch of objs from the slab
+ * lists, and return one of them.  Returns NULL if the slabs have no free
+ * objs; the caller then has to grow the cache.
+ * Called with the per-CPU cache lock held, and ints disabled.
+ */
+static void *
+kmem_cpucache_refill(kmem_cache_t *cachep, cpucache_t *cc)
+{
+	kmem_slab_t	*slabp;
+
+	spin_lock(&cachep->c_spinlock);
+	while (cc->cc_avail < cc->cc_batch) {
+		slabp = cachep->c_freep;
+		if (slabp->s_magic != SLAB_MAGIC_ALLOC)
+			break;
+		cc->cc_entry[cc->cc_avail++] = kmem_cache_alloc_one(cachep, slabp);
+	}
+	spin_unlock(&cachep->c_spinlock);
+
+	if (!cc->cc_avail)
+		return NULL;
+	cc->cc_refills++;
+	return cc->cc_entry[--cc->cc_avail];
+}
+
+/* Give the 'nr' oldest objs in a per-CPU cache back to their slabs.
+ * Called with the per-CPU cache lock held, and ints disabled.
+ */
+static void
+kmem_cpucache_flush(kmem_cache_t *cachep, cpucache_t *cc, unsigned int nr)
+{
+	unsigned int	i;
+
+	if (nr > cc->cc_avail)
+		nr = cc->cc_avail;
+	if (!nr)
+		return;
+
+	spin_lock(&cachep->c_spinlock);
+	for (i = 0; i < nr; i++)
+		kmem_cache_free_one(cachep, cc->cc_entry[i]);
+	spin_unlock(&cachep->c_spinlock);
+
+	cc->cc_avail -= nr;
+	memmove(cc->cc_entry, cc->cc_entry+nr, cc->cc_avail*sizeof(void *));
+	cc->cc_flushes++;
+}
+#endif	/* __SMP__ */
+
+/* Returns a ptr to an obj in the given cache. */
+static inline void *
+__kmem_cache_alloc(kmem_cache_t *cachep, int flags)
+{
+#ifdef __SMP__
+	cpucache_t	*cc;
+	void		*objp;
+	unsigned long	save_flags;
+
+	/* Objs in the per-CPU caches can be from any slab, so DMA
+	 * requests always go to the slab lists.
+	 */
+	if (!cachep || (flags & SLAB_DMA))
+		goto slab;
+	cc = cachep->c_cpucache[smp_processor_id()];
+	if (!cc)
+		goto slab;
+	spin_lock_irqsave(&cc->cc_lock, save_flags);
+	if (cc->cc_avail) {
+		cc->cc_hits++;
+		objp = cc->cc_entry[--cc->cc_avail];
+		spin_unlock_irqrestore(&cc->cc_lock, save_flags);
+		return objp;
+	}
+	cc->cc_misses++;
+	objp = kmem_cpucache_refill(cachep, cc);
+	spin_unlock_irqrestore(&cc->cc_lock, save_flags);
+	if (objp)
+		return objp;
+slab:
+#endif	/* __SMP__ */
+	return kmem_cache_alloc_slab(cachep, flags);
+}
+
+/* Release an obj back to its cache.  If the obj has a constructed state,
+ * it should be in this state _before_ it is released.
+ */
+static inline void
+__kmem_cache_free(kmem_cache_t *cachep, const void *objp)
+{
+#ifdef __SMP__
+	cpucache_t	*cc;
+	unsigned long	save_flags;
+
+	if (!cachep || !objp)
+		goto slab;
+	cc = cachep->c_cpucache[smp_processor_id()];
+	if (!cc)
+		goto slab;
+	spin_lock_irqsave(&cc->cc_lock, save_flags);
+	if (!cc->cc_limit)
+		goto slab_unlock;
+	if (cc->cc_avail == cc->cc_limit)
+		kmem_cpucache_flush(cachep, cc, cc->cc_batch);
+	cc->cc_entry[cc->cc_avail++] = (void *) objp;
+	spin_unlock_irqrestore(&cc->cc_lock, save_flags);
+	return;
+slab_unlock:
+	spin_unlock_irqrestore(&cc->cc_lock, save_flags);
+slab:
+#endif	/* __SMP__ */
+	kmem_cache_free_slab(cachep, objp);
+}
+
+#ifdef __SMP__
+/* Give a cache its per-CPU caches.  The limit is by obj size, so the big
+ * objs don't pin too much memory.  A CPU that doesn't get a cache (out of
+ * memory) simply uses the slab lists.
+ */
+static void
+kmem_cpucache_enable(kmem_cache_t *cachep)
+{
+	unsigned int	limit;
+	int		i;
+
+#if	SLAB_DEBUG_SUPPORT
+	/* The debug checks are done on the way in and out of the slabs. */
+	if (cachep->c_flags & (SLAB_DEBUG_FREE|SLAB_DEBUG_INITIAL|SLAB_RED_ZONE|SLAB_POISON))
+		return;
+#endif	/* SLAB_DEBUG_SUPPORT */
+
+	if (cachep->c_org_size > PAGE_SIZE)
+		limit = 8;
+	else if (cachep->c_org_size > 1024)
+		limit = 54;
+	else if (cachep->c_org_size > 256)
+		limit = 108;
+	else
+		limit = 252;
+
+	for (i = 0; i < smp_num_cpus; i++) {
+		cpucache_t *cc;
+
+		cc = (cpucache_t *) kmalloc(sizeof(cpucache_t), GFP_KERNEL);
+		if (!cc)
+			break;
+		memset(cc, 0, sizeof(cpucache_t));
+		cc->cc_entry = (void **) kmalloc(limit*sizeof(void *), GFP_KERNEL);
+		if (!cc->cc_entry) {
+			kfree(cc);
+			break;
+		}
+		spin_lock_init(&cc->cc_lock);
+		cc->cc_limit = limit;
+		cc->cc_batch = (limit+1)/2;
+		wmb();
+		cachep->c_cpucache[cpu_logical_map(i)] = cc;
+	}
+}
+
+/* Empty all the per-CPU caches of a cache.  Cannot be called within a int. */
+static void
+kmem_cpucache_drain(kmem_cache_t *cachep)
+{
+	int	i;
+
+	for (i = 0; i < NR_CPUS; i++) {
+		cpucache_t *cc = cachep->c_cpucache[i];
+
+		if (!cc || !cc->cc_avail)
+			continue;
+		spin_lock_irq(&cc->cc_lock);
+		kmem_cpucache_flush(cachep, cc, cc->cc_avail);
+		spin_unlock_irq(&cc->cc_lock);
+	}
+}
+
+/* Free the per-CPU caches of a cache that is going away.  They must be
+ * empty, ie. drained by __kmem_cache_shrink().
+ */
+static void
+kmem_cpucache_release(kmem_cache_t *cachep)
+{
+	int	i;
+
+	for (i = 0; i < NR_CPUS; i++) {
+		cpucache_t *cc = cachep->c_cpucache[i];
+
+		if (!cc)
+			continue;
+		cachep->c_cpucache[i] = NULL;
+		if (cc->cc_entry)
+			kfree(cc->cc_entry);
+		kfree(cc);
+	}
+}
+
+/* Change the limit and batch count of the per-CPU caches of a cache.
+ * Objs above the new limit are given back to the slabs.  Called with
+ * cache_chain_sem held, so the caller allocates the new entry arrays
+ * (one per online CPU) beforehand; the old ones are handed back in
+ * 'entries' for it to free.
+ */
+static void
+kmem_cpucache_tune(kmem_cache_t *cachep, unsigned int limit,
+		   unsigned int batch, void ***entries)
+{
+	int	i;
+
+	for (i = 0; i < smp_num_cpus; i++) {
+		cpucache_t *cc = cachep->c_cpucache[cpu_logical_map(i)];
+		void **old;
+
+		if (!cc)
+			continue;
+		spin_lock_irq(&cc->cc_lock);
+		if (cc->cc_avail > limit)
+			kmem_cpucache_flush(cachep, cc, cc->cc_avail-limit);
+		if (cc->cc_avail)
+			memcpy(entries[i], cc->cc_entry, cc->cc_avail*sizeof(void *));
+		old = cc->cc_entry;
+		cc->cc_entry = entries[i];
+		cc->cc_limit = limit;
+		cc->cc_batch = batch;
+		spin_unlock_irq(&cc->cc_lock);
+		entries[i] = old;
+	}
+}
+
+/* Initialisation - give all the caches created so far their per-CPU
+ * caches.  Called after smp_init(), so we know how many CPUs there are.
+ * Nothing else can create a cache this early, so the chain is walked
+ * without the semaphore (kmalloc() might end up in kmem_cache_reap()).
+ */
+void __init kmem_cpucache_init(void)
+{
+	kmem_cache_t	*cachep = &cache_cache;
+
+	do {
+		kmem_cpucache_enable(cachep);
+	} while ((cachep = cachep->c_nextp) != &cache_cache);
+	cpucache_up = 1;
+}
+#endif	/* __SMP__ */
+
 void *
 kmem_cache_alloc(kmem_cache_t *cachep, int flags)
 {
@@ -1810,6 +2125,10 @@ kmem_cache_reap(int gfp_mask)
 		/* It's safe to test this without holding the cache-lock. */
 		if (searchp->c_flags & SLAB_NO_REAP)
 			goto next;
+#ifdef __SMP__
+		/* Objs sitting in the per-CPU caches keep their slabs busy. */
+		kmem_cpucache_drain(searchp);
+#endif	/* __SMP__ */
 		spin_lock_irq(&searchp->c_spinlock);
 		if (searchp->c_growing)
 			goto next_unlock;
@@ -1939,6 +2258,8 @@ kmem_self_test(void)
 #if	defined(CONFIG_PROC_FS)
 /* /proc/slabinfo
  * cache-name num-active-objs total-objs num-active-slabs total-slabs num-pages-per-slab
+ * On SMP each line ends with the per-CPU cache figures, summed over the CPUs;
+ * : limit batchcount cached-objs hits misses refills flushes
  */
 int
 get_slabinfo(char *buf)
@@ -1960,9 +2281,9 @@ get_slabinfo(char *buf)
 	 * many complaints.
 	 */
 #if	SLAB_STATS
-	len = sprintf(buf, "slabinfo - version: 1.0 (statistics)\n");
+	len = sprintf(buf, "slabinfo - version: 1.1 (statistics)\n");
 #else
-	len = sprintf(buf, "slabinfo - version: 1.0\n");
+	len = sprintf(buf, "slabinfo - version: 1.1\n");
 #endif	/* SLAB_STATS */
 	down(&cache_chain_sem);
 	cachep = &cache_cache;
@@ -1990,18 +2311,118 @@ get_slabinfo(char *buf)
 		unsigned long allocs = cachep->c_num_allocations;
 		errors = (unsigned long) atomic_read(&cachep->c_errors);
 		spin_unlock_irqrestore(&cachep->c_spinlock, save_flags);
-		len += sprintf(buf+len, "%-16s %6lu %6lu %4lu %4lu %4lu %6lu %7lu %5lu %4lu %4lu\n",
+		len += sprintf(buf+len, "%-16s %6lu %6lu %4lu %4lu %4lu %6lu %7lu %5lu %4lu %4lu",
 				cachep->c_name, active_objs, num_objs, active_slabs, num_slabs,
 				(1<<cachep->c_gfporder)*num_slabs,
 				high, allocs, grown, reaped, errors);
 		}
 #else
 		spin_unlock_irqrestore(&cachep->c_spinlock, save_flags);
-		len += sprintf(buf+len, "%-17s %6lu %6lu\n", cachep->c_name, active_objs, num_objs);
+		len += sprintf(buf+len, "%-17s %6lu %6lu", cachep->c_name, active_objs, num_objs);
 #endif	/* SLAB_STATS */
+#ifdef __SMP__
+		{
+		unsigned long avail = 0, hits = 0, misses = 0;
+		unsigned long refills = 0, flushes = 0;
+		unsigned int limit = 0, batch = 0;
+		int i;
+
+		for (i = 0; i < NR_CPUS; i++) {
+			cpucache_t *cc = cachep->c_cpucache[i];
+			if (!cc)
+				continue;
+			spin_lock_irqsave(&cc->cc_lock, save_flags);
+			limit = cc->cc_limit;
+			batch = cc->cc_batch;
+			avail += cc->cc_avail;
+			hits += cc->cc_hits;
+			misses += cc->cc_misses;
+			refills += cc->cc_refills;
+			flushes += cc->cc_flushes;
+			spin_unlock_irqrestore(&cc->cc_lock, save_flags);
+		}
+		len += sprintf(buf+len, " : %4u %4u %5lu %8lu %7lu %6lu %6lu",
+				limit, batch, avail, hits, misses, refills, flushes);
+		}
+#endif	/* __SMP__ */
+		len += sprintf(buf+len, "\n");
 	} while ((cachep = cachep->c_nextp) != &cache_cache);
 	up(&cache_chain_sem);
 
 	return len;
 }
+
+#ifdef __SMP__
+/* Writing "<cache-name> <limit> [<batchcount>]" to /proc/slabinfo sets
+ * the per-CPU cache limits of a cache.  The batchcount defaults to half
+ * the limit.
+ */
+int
+slabinfo_write_proc(struct file *file, const char *buffer,
+		    unsigned long count, void *data)
+{
+	char		kbuf[64+1], *name, *p;
+	unsigned int	limit, batch;
+	kmem_cache_t	*cachep;
+	void		**entries[NR_CPUS];
+	int		i, res;
+
+	if (count > 64)
+		return -EINVAL;
+	if (copy_from_user(kbuf, buffer, count))
+		return -EFAULT;
+	kbuf[count] = '\0';
+
+	name = kbuf;
+	if (!(p = strchr(kbuf, ' ')))
+		return -EINVAL;
+	*p++ = '\0';
+	limit = simple_strtoul(p, &p, 10);
+	while (*p == ' ')
+		p++;
+	batch = simple_strtoul(p, &p, 10);
+
+	if (limit > SLAB_CPUCACHE_MAX || batch > limit)
+		return -EINVAL;
+	if (limit && !batch)
+		batch = (limit+1)/2;
+
+	/* kmalloc() might want cache_chain_sem for kmem_cache_reap(), so
+	 * the new per-CPU arrays are allocated before taking it.
+	 */
+	memset(entries, 0, sizeof(entries));
+	res = -ENOMEM;
+	if (limit) {
+		for (i = 0; i < smp_num_cpus; i++) {
+			entries[i] = (void **) kmalloc(limit*sizeof(void *), GFP_KERNEL);
+			if (!entries[i])
+				goto out;
+		}
+	}
+
+	/* Tune under the semaphore, so the cache can't be destroyed
+	 * from under us.
+	 */
+	res = -EINVAL;
+	down(&cache_chain_sem);
+	cachep = &cache_cache;
+	do {
+		/* The name field is constant - no lock needed. */
+		if (!strcmp(cachep->c_name, name)) {
+			kmem_cpucache_tune(cachep, limit, batch, entries);
+			res = 0;
+			break;
+		}
+	} while ((cachep = cachep->c_nextp) != &cache_cache);
+	up(&cache_chain_sem);
+out:
+	for (i = 0; i < smp_num_cpus; i++) {
+		if (entries[i])
+			kfree(entries[i]);
+	}
+	if (res)
+		return res;
+	return count;
+}
+#endif	/* __SMP__ */
 #endif	/* CONFIG_PROC_FS */
@@ -78,3 +78,94 @@ void __init swap_setup(void)
 	else
 		page_cluster = 4;
 }
+
+/*
+ * The page LRU lists, see linux/swap.h. All of them, their counts
+ * and the PG_lru/PG_active bits of the pages on them are protected
+ * by pagemap_lru_lock.
+ */
+struct list_head active_list[NR_LRU_TYPES] = {
+	LIST_HEAD_INIT(active_list[LRU_FILE]),
+	LIST_HEAD_INIT(active_list[LRU_ANON])
+};
+struct list_head inactive_list[NR_LRU_TYPES] = {
+	LIST_HEAD_INIT(inactive_list[LRU_FILE]),
+	LIST_HEAD_INIT(inactive_list[LRU_ANON])
+};
+int nr_active_pages[NR_LRU_TYPES];
+int nr_inactive_pages[NR_LRU_TYPES];
+
+/*
+ * Add a page to the head of its inactive list. A page that is
+ * only used once will leave the inactive list again without ever
+ * pushing out the pages on the active list.
+ */
+void lru_cache_add(struct page * page)
+{
+	int type = page_lru_type(page);
+
+	spin_lock(&pagemap_lru_lock);
+	if (PageLRU(page) || PageActive(page))
+		BUG();
+	list_add(&page->lru, &inactive_list[type]);
+	SetPageLRU(page);
+	nr_inactive_pages[type]++;
+	nr_lru_pages++;
+	spin_unlock(&pagemap_lru_lock);
+}
+
+/*
+ * Remove a page from the LRU. The caller holds the page lock, so
+ * shrink_mmap() can't have the page off its list right now; a page
+ * which shrink_mmap() already dropped from the LRU is left alone.
+ */
+void lru_cache_del(struct page * page)
+{
+	int type = page_lru_type(page);
+
+	spin_lock(&pagemap_lru_lock);
+	if (PageLRU(page)) {
+		list_del(&page->lru);
+		ClearPageLRU(page);
+		if (PageActive(page)) {
+			ClearPageActive(page);
+			nr_active_pages[type]--;
+		} else
+			nr_inactive_pages[type]--;
+		nr_lru_pages--;
+	}
+	spin_unlock(&pagemap_lru_lock);
+}
+
+static void activate_page(struct page * page)
+{
+	int type = page_lru_type(page);
+
+	spin_lock(&pagemap_lru_lock);
+	if (PageLRU(page) && !PageActive(page)) {
+		list_del(&page->lru);
+		list_add(&page->lru, &active_list[type]);
+		SetPageActive(page);
+		nr_inactive_pages[type]--;
+		nr_active_pages[type]++;
+		kstat.pgactivate++;
+	}
+	spin_unlock(&pagemap_lru_lock);
+}
+
+/*
+ * Called whenever a page is used: the first reference only sets
+ * PG_referenced, a second one while the page is still on the
+ * inactive list moves it to the active list.
+ *
+ * Callers may hold a mapping's page_lock or a page_table_lock,
+ * both of which nest outside pagemap_lru_lock.
+ */
+void mark_page_accessed(struct page * page)
+{
+	if (!PageActive(page) && PageReferenced(page)) {
+		activate_page(page);
+		clear_bit(PG_referenced, &page->flags);
+	} else
+		set_bit(PG_referenced, &page->flags);
+}
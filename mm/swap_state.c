@@ -18,10 +18,8 @@
 #include <asm/pgtable.h>
 
 struct address_space swapper_space = {
-	{				/* pages	*/
-		&swapper_space.pages,	/*        .next */
-		&swapper_space.pages	/*	  .prev */
-	},
+	RADIX_TREE_INIT(GFP_ATOMIC),	/* page_tree	*/
+	SPIN_LOCK_UNLOCKED,		/* page_lock	*/
 	0				/* nrpages	*/
 };
 
@@ -40,6 +38,10 @@ void show_swap_cache_info(void)
 }
 #endif
 
+/*
+ * The caller must have done a radix_tree_preload(), and not
+ * slept since.
+ */
 void add_to_swap_cache(struct page *page, swp_entry_t entry)
 {
 #ifdef SWAP_CACHE_INFO
@@ -173,10 +175,17 @@ void __delete_from_swap_cache(struct page *page)
 
 static void delete_from_swap_cache_nolock(struct page *page)
 {
-	if (block_flushpage(NULL, page, 0))
-		lru_cache_del(page);
+	int busy = !block_flushpage(NULL, page, 0);
 
+	/*
+	 * The LRU list a page is on depends on PG_swap_cache, so take
+	 * it off before clearing that. A page whose buffers are still
+	 * busy goes back as a file page for shrink_mmap() to free.
+	 */
+	lru_cache_del(page);
 	__delete_from_swap_cache(page);
+	if (busy)
+		lru_cache_add(page);
 }
 
 /*
@@ -290,6 +299,8 @@ struct page * read_swap_cache_async(swp_entry_t entry, int wait)
 	found_page = lookup_swap_cache(entry);
 	if (found_page)
 		goto out_free_page;
+	if (radix_tree_preload(GFP_USER))
+		goto out_free_page;
 	/* 
 	 * Add it to the swap cache and read its contents.
 	 */
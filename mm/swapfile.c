@@ -14,6 +14,7 @@
 #include <linux/vmalloc.h>
 #include <linux/pagemap.h>
 #include <linux/shm.h>
+#include <linux/hugetlb.h>
 
 #include <asm/pgtable.h>
 
@@ -250,6 +251,7 @@ static inline void unuse_pte(struct vm_area_struct * vma, unsigned long address,
 	if (pte_val(pte) != entry.val)
 		return;
 	set_pte(dir, pte_mkdirty(mk_pte(page, vma->vm_page_prot)));
+	page_add_rmap(page, vma->vm_mm, address);
 	swap_free(entry);
 	get_page(page);
 	++vma->vm_mm->rss;
@@ -276,7 +278,7 @@ static inline void unuse_pmd(struct vm_area_struct * vma, pmd_t *dir,
 	if (end > PMD_SIZE)
 		end = PMD_SIZE;
 	do {
-		unuse_pte(vma, offset+address-vma->vm_start, pte, entry, page);
+		unuse_pte(vma, offset+address, pte, entry, page);
 		address += PAGE_SIZE;
 		pte++;
 	} while (address && (address < end));
@@ -338,6 +340,9 @@ static void unuse_process(struct mm_struct * mm,
 		return;
 	for (vma = mm->mmap; vma; vma = vma->vm_next) {
 		pgd_t * pgd = pgd_offset(mm, vma->vm_start);
+
+		if (is_vm_hugetlb_page(vma))
+			continue;
 		unuse_vma(vma, pgd, entry, page);
 	}
 	return;
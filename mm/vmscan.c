@@ -19,6 +19,7 @@
 #include <linux/init.h>
 #include <linux/highmem.h>
 #include <linux/file.h>
+#include <linux/hugetlb.h>
 
 #include <asm/pgalloc.h>
 
@@ -46,6 +47,7 @@ static int try_to_swap_out(struct vm_area_struct* vma, unsigned long address, pt
 	page = pte_page(pte);
 	if (page-mem_map >= max_mapnr)
 		goto out_failed;
+	kstat.ptescan++;
 
 	/* Don't look at this pte if it's been accessed recently. */
 	if (pte_young(pte)) {
@@ -54,7 +56,7 @@ static int try_to_swap_out(struct vm_area_struct* vma, unsigned long address, pt
 		 * tables to the global page map.
 		 */
 		set_pte(page_table, pte_mkold(pte));
-		set_bit(PG_referenced, &page->flags);
+		mark_page_accessed(page);
 		goto out_failed;
 	}
 
@@ -77,9 +79,11 @@ static int try_to_swap_out(struct vm_area_struct* vma, unsigned long address, pt
 		swap_duplicate(entry);
 		set_pte(page_table, swp_entry_to_pte(entry));
 drop_pte:
+		page_remove_rmap(page, vma->vm_mm, address);
 		vma->vm_mm->rss--;
 		flush_tlb_page(vma, address);
 		__free_page(page);
+		kstat.pteunmap++;
 		goto out_failed;
 	}
 
@@ -134,6 +138,8 @@ drop_pte:
 		struct file *file = vma->vm_file;
 		if (file) get_file(file);
 		pte_clear(page_table);
+		page_remove_rmap(page, vma->vm_mm, address);
+		kstat.pteunmap++;
 		vma->vm_mm->rss--;
 		flush_tlb_page(vma, address);
 		vmlist_access_unlock(vma->vm_mm);
@@ -154,9 +160,18 @@ drop_pte:
 	entry = acquire_swap_entry(page);
 	if (!entry.val)
 		goto out_failed; /* No swap space left */
-		
-	if (!(page = prepare_highmem_swapout(page)))
+
+	/* Room for the page in the swap cache index */
+	if (radix_tree_preload(GFP_ATOMIC))
+		goto out_swap_free;
+
+	/* A highmem page is freed once copied: unchain it first */
+	page_remove_rmap(page, vma->vm_mm, address);
+	if (!(page = prepare_highmem_swapout(pte_page(pte)))) {
+		page_add_rmap(pte_page(pte), vma->vm_mm, address);
 		goto out_swap_free;
+	}
+	kstat.pteunmap++;
 
 	vma->vm_mm->rss--;
 	set_pte(page_table, swp_entry_to_pte(entry));
@@ -264,6 +279,17 @@ static int swap_out_vma(struct vm_area_struct * vma, unsigned long address, int
 	if (vma->vm_flags & VM_LOCKED)
 		return 0;
 
+	/*
+	 * Shared memory pages are unmapped by shm_swap() through
+	 * their pte chains, no need to walk the page tables.
+	 */
+	if (vma->vm_flags & VM_SHM)
+		return 0;
+
+	/* Huge pages are never swapped */
+	if (is_vm_hugetlb_page(vma))
+		return 0;
+
 	pgdir = pgd_offset(vma->vm_mm, address);
 
 	end = vma->vm_end;
@@ -429,6 +455,7 @@ static int do_try_to_free_pages(unsigned int gfp_mask)
 		   really plenty of memory free. */
 		count -= shrink_dcache_memory(priority, gfp_mask);
 		count -= shrink_icache_memory(priority, gfp_mask);
+		shrink_super_caches(priority);
 		if (count <= 0)
 			goto done;
 
@@ -533,12 +560,53 @@ int try_to_free_pages(unsigned int gfp_mask)
 {
 	int retval = 1;
 
+	kstat.kswapd_wakeup++;
 	wake_up_process(kswapd_process);
-	if (gfp_mask & __GFP_WAIT)
+	if (gfp_mask & __GFP_WAIT) {
+		kstat.allocstall++;
 		retval = do_try_to_free_pages(gfp_mask);
+	}
 	return retval;
 }
 
+/*
+ * /proc/vmstat: LRU list sizes and page reclaim counters.
+ */
+int get_vmstat(char *buffer)
+{
+	return sprintf(buffer,
+		"nr_active_file %d\n"
+		"nr_inactive_file %d\n"
+		"nr_active_anon %d\n"
+		"nr_inactive_anon %d\n"
+		"pgscan %u\n"
+		"pgsteal %u\n"
+		"pgactivate %u\n"
+		"pgdeactivate %u\n"
+		"pgrefault %u\n"
+		"kswapd_wakeup %u\n"
+		"allocstall %u\n"
+		"ptescan %u\n"
+		"pteunmap %u\n"
+		"rmapscan %u\n"
+		"rmapunmap %u\n",
+		nr_active_pages[LRU_FILE],
+		nr_inactive_pages[LRU_FILE],
+		nr_active_pages[LRU_ANON],
+		nr_inactive_pages[LRU_ANON],
+		kstat.pgscan,
+		kstat.pgsteal,
+		kstat.pgactivate,
+		kstat.pgdeactivate,
+		kstat.pgrefault,
+		kstat.kswapd_wakeup,
+		kstat.allocstall,
+		kstat.ptescan,
+		kstat.pteunmap,
+		kstat.rmapscan,
+		kstat.rmapunmap);
+}
+
 static int __init kswapd_init(void)
 {
 	printk("Starting kswapd v1.6\n");